@@ -392,7 +392,8 @@ static const char * const sampler_target_format[4] = {
 };
 
 
-static int column;
+/* per thread, intel-gen4disasm -j runs several disassemblers at once */
+static __thread int column;
 
 static int string (FILE *file, const char *string)
 {
@@ -410,6 +410,13 @@ void brw_uncompact_instruction(struct intel_context *intel,
 bool brw_try_compact_instruction(struct brw_compile *p,
                                  struct brw_compact_instruction *dst,
                                  struct brw_instruction *src);
+struct gen8_instruction;
+void gen8_uncompact_instruction(struct intel_context *intel,
+                                struct gen8_instruction *dst,
+                                struct brw_compact_instruction *src);
+bool gen8_try_compact_instruction(struct intel_context *intel,
+                                  struct brw_compact_instruction *dst,
+                                  struct gen8_instruction *src);
 
 void brw_debug_compact_uncompact(struct intel_context *intel,
 				 struct brw_instruction *orig,
@@ -42,6 +42,7 @@
 #include "brw_compat.h"
 #include "brw_context.h"
 #include "brw_eu.h"
+#include "gen8_instruction.h"
 
 static const uint32_t gen6_control_index_table[32] = {
    0b00000000000000000,
@@ -323,18 +324,114 @@ static const uint32_t gen7_src_index_table[32] = {
    0b010110001000
 };
 
+/* Gen8 only changed the datatype table, the others are the same as on gen7. */
+static const uint32_t gen8_datatype_table[32] = {
+   0b001000000000000000001,
+   0b001000000000001000000,
+   0b001000000000001000001,
+   0b001000000000011000001,
+   0b001000000000101011101,
+   0b001000000010111011101,
+   0b001000000011101000001,
+   0b001000000011101000101,
+   0b001000000011101011101,
+   0b001000001000001000001,
+   0b001000011000001000000,
+   0b001000011000001000001,
+   0b001000101000101000101,
+   0b001000111000101000100,
+   0b001000111000101000101,
+   0b001011100011101011101,
+   0b001011101011100011101,
+   0b001011101011101011100,
+   0b001011101011101011101,
+   0b001011111011101011100,
+   0b000000000010000001100,
+   0b001000000000001011101,
+   0b001000000000101000101,
+   0b001000001000001000000,
+   0b001000101000101000100,
+   0b001000111000100000100,
+   0b001001001001000001001,
+   0b001010111011101011101,
+   0b001011111011101011101,
+   0b001001111001101001100,
+   0b001001001001001001000,
+   0b001001011001001001000
+};
+
 static const uint32_t *control_index_table;
 static const uint32_t *datatype_table;
 static const uint32_t *subreg_table;
 static const uint32_t *src_index_table;
 
+/*
+ * The tables are searched for every instruction compacted, so each gets a
+ * small open addressing hash from uncompacted value to index. Some tables
+ * have duplicates, the lowest index is kept as the linear search did.
+ */
+#define LOOKUP_SIZE 64
+
+struct compaction_lookup {
+   const uint32_t *table;
+   uint8_t slots[LOOKUP_SIZE]; /* index + 1, 0 for empty */
+};
+
+static struct compaction_lookup control_index_lookup;
+static struct compaction_lookup datatype_lookup;
+static struct compaction_lookup subreg_lookup;
+static struct compaction_lookup src_index_lookup;
+
+static unsigned
+lookup_hash(uint32_t uncompacted)
+{
+   return (uncompacted * 0x9e3779b1u) >> 26;
+}
+
+static bool
+lookup_index(const struct compaction_lookup *lookup, uint32_t uncompacted,
+             uint32_t *compacted)
+{
+   unsigned h = lookup_hash(uncompacted);
+
+   while (lookup->slots[h]) {
+      if (lookup->table[lookup->slots[h] - 1] == uncompacted) {
+         *compacted = lookup->slots[h] - 1;
+         return true;
+      }
+      h = (h + 1) % LOOKUP_SIZE;
+   }
+
+   return false;
+}
+
+static void
+init_lookup(struct compaction_lookup *lookup, const uint32_t *table)
+{
+   uint32_t index;
+
+   memset(lookup, 0, sizeof(*lookup));
+   lookup->table = table;
+
+   for (int i = 0; i < 32; i++) {
+      unsigned h = lookup_hash(table[i]);
+
+      if (lookup_index(lookup, table[i], &index))
+         continue;
+
+      while (lookup->slots[h])
+         h = (h + 1) % LOOKUP_SIZE;
+      lookup->slots[h] = i + 1;
+   }
+}
+
 static bool
 set_control_index(struct intel_context *intel,
                   struct brw_compact_instruction *dst,
                   struct brw_instruction *src)
 {
    uint32_t *src_u32 = (uint32_t *)src;
-   uint32_t uncompacted = 0;
+   uint32_t compacted, uncompacted = 0;
 
    uncompacted |= ((src_u32[0] >> 8) & 0xffff) << 0;
    uncompacted |= ((src_u32[0] >> 31) & 0x1) << 16;
@@ -344,67 +441,51 @@ set_control_index(struct intel_context *intel,
    if (intel->gen >= 7)
       uncompacted |= ((src_u32[2] >> 25) & 0x3) << 17;
 
-   for (int i = 0; i < 32; i++) {
-      if (control_index_table[i] == uncompacted) {
-	 dst->dw0.control_index = i;
-	 return true;
-      }
-   }
+   if (!lookup_index(&control_index_lookup, uncompacted, &compacted))
+      return false;
 
-   return false;
+   dst->dw0.control_index = compacted;
+   return true;
 }
 
 static bool
 set_datatype_index(struct brw_compact_instruction *dst,
                    struct brw_instruction *src)
 {
-   uint32_t uncompacted = 0;
+   uint32_t compacted, uncompacted = 0;
 
    uncompacted |= src->bits1.ud & 0x7fff;
    uncompacted |= (src->bits1.ud >> 29) << 15;
 
-   for (int i = 0; i < 32; i++) {
-      if (datatype_table[i] == uncompacted) {
-	 dst->dw0.data_type_index = i;
-	 return true;
-      }
-   }
+   if (!lookup_index(&datatype_lookup, uncompacted, &compacted))
+      return false;
 
-   return false;
+   dst->dw0.data_type_index = compacted;
+   return true;
 }
 
 static bool
 set_subreg_index(struct brw_compact_instruction *dst,
                  struct brw_instruction *src)
 {
-   uint32_t uncompacted = 0;
+   uint32_t compacted, uncompacted = 0;
 
    uncompacted |= src->bits1.da1.dest_subreg_nr << 0;
    uncompacted |= src->bits2.da1.src0_subreg_nr << 5;
    uncompacted |= src->bits3.da1.src1_subreg_nr << 10;
 
-   for (int i = 0; i < 32; i++) {
-      if (subreg_table[i] == uncompacted) {
-	 dst->dw0.sub_reg_index = i;
-	 return true;
-      }
-   }
+   if (!lookup_index(&subreg_lookup, uncompacted, &compacted))
+      return false;
 
-   return false;
+   dst->dw0.sub_reg_index = compacted;
+   return true;
 }
 
 static bool
 get_src_index(uint32_t uncompacted,
               uint32_t *compacted)
 {
-   for (int i = 0; i < 32; i++) {
-      if (src_index_table[i] == uncompacted) {
-	 *compacted = i;
-	 return true;
-      }
-   }
-
-   return false;
+   return lookup_index(&src_index_lookup, uncompacted, compacted);
 }
 
 static bool
@@ -562,6 +643,11 @@ brw_uncompact_instruction(struct intel_context *intel,
                           struct brw_instruction *dst,
                           struct brw_compact_instruction *src)
 {
+   if (intel->gen >= 8) {
+      gen8_uncompact_instruction(intel, (struct gen8_instruction *)dst, src);
+      return;
+   }
+
    memset(dst, 0, sizeof(*dst));
 
    dst->header.opcode = src->dw0.opcode;
@@ -581,6 +667,243 @@ brw_uncompact_instruction(struct intel_context *intel,
    dst->bits3.da1.src1_reg_nr = src->dw1.src1_reg_nr;
 }
 
+/*
+ * Gen8 moved the fields of the uncompacted instruction around, so it has its
+ * own compaction working on the hardware format.
+ */
+static bool
+gen8_is_compactable_immediate(uint32_t imm)
+{
+   /* the low 12 bits are kept, bit 12 is replicated through the top 20 */
+   imm &= ~0xfff;
+   return imm == 0 || imm == 0xfffff000;
+}
+
+static bool
+gen8_is_immediate(struct gen8_instruction *insn)
+{
+   return gen8_src0_reg_file(insn) == BRW_IMMEDIATE_VALUE ||
+          gen8_src1_reg_file(insn) == BRW_IMMEDIATE_VALUE;
+}
+
+static bool
+gen8_set_control_index(struct brw_compact_instruction *dst,
+                       struct gen8_instruction *src)
+{
+   uint32_t compacted, uncompacted = 0;
+
+   uncompacted |= gen8_bits(src, 33, 32) << 17; /* flag reg and subreg */
+   uncompacted |= gen8_bits(src, 31, 31) << 16; /* saturate */
+   uncompacted |= gen8_bits(src, 23, 12) << 4;  /* exec size to qtr control */
+   uncompacted |= gen8_bits(src, 10, 9) << 2;   /* dependency control */
+   uncompacted |= gen8_bits(src, 34, 34) << 1;  /* mask control */
+   uncompacted |= gen8_bits(src, 8, 8);         /* access mode */
+
+   if (!lookup_index(&control_index_lookup, uncompacted, &compacted))
+      return false;
+
+   dst->dw0.control_index = compacted;
+   return true;
+}
+
+static bool
+gen8_set_datatype_index(struct brw_compact_instruction *dst,
+                        struct gen8_instruction *src)
+{
+   uint32_t compacted, uncompacted = 0;
+
+   uncompacted |= gen8_bits(src, 63, 61) << 18; /* dst address mode, stride */
+   uncompacted |= gen8_bits(src, 94, 89) << 12; /* src1 type and file */
+   uncompacted |= gen8_bits(src, 46, 35);       /* src0 and dst types, files */
+
+   if (!lookup_index(&datatype_lookup, uncompacted, &compacted))
+      return false;
+
+   dst->dw0.data_type_index = compacted;
+   return true;
+}
+
+static bool
+gen8_set_subreg_index(struct brw_compact_instruction *dst,
+                      struct gen8_instruction *src, bool is_immediate)
+{
+   uint32_t compacted, uncompacted = 0;
+
+   uncompacted |= gen8_bits(src, 52, 48) << 0;
+   uncompacted |= gen8_bits(src, 68, 64) << 5;
+   if (!is_immediate)
+      uncompacted |= gen8_bits(src, 100, 96) << 10;
+
+   if (!lookup_index(&subreg_lookup, uncompacted, &compacted))
+      return false;
+
+   dst->dw0.sub_reg_index = compacted;
+   return true;
+}
+
+static bool
+gen8_set_src0_index(struct brw_compact_instruction *dst,
+                    struct gen8_instruction *src)
+{
+   uint32_t compacted;
+
+   if (!get_src_index(gen8_bits(src, 88, 77), &compacted))
+      return false;
+
+   dst->dw0.src0_index = compacted & 0x3;
+   dst->dw1.src0_index = compacted >> 2;
+
+   return true;
+}
+
+static bool
+gen8_set_src1_index(struct brw_compact_instruction *dst,
+                    struct gen8_instruction *src, bool is_immediate)
+{
+   uint32_t compacted;
+
+   if (is_immediate) {
+      /* the top of the 13 bit immediate, the rest is in src1_reg_nr */
+      dst->dw1.src1_index = (gen8_src1_imm_ud(src) >> 8) & 0x1f;
+      return true;
+   }
+
+   if (!get_src_index(gen8_bits(src, 120, 109), &compacted))
+      return false;
+
+   dst->dw1.src1_index = compacted;
+
+   return true;
+}
+
+/**
+ * Tries to compact the gen8+ instruction src into dst, like
+ * brw_try_compact_instruction(). Three source instructions and messages are
+ * left alone.
+ */
+bool
+gen8_try_compact_instruction(struct intel_context *intel,
+                             struct brw_compact_instruction *dst,
+                             struct gen8_instruction *src)
+{
+   struct brw_compact_instruction temp;
+   struct gen8_instruction uncompacted;
+   bool is_immediate;
+
+   switch (gen8_opcode(src)) {
+   case BRW_OPCODE_IF:
+   case BRW_OPCODE_ELSE:
+   case BRW_OPCODE_ENDIF:
+   case BRW_OPCODE_HALT:
+   case BRW_OPCODE_DO:
+   case BRW_OPCODE_WHILE:
+   case BRW_OPCODE_SEND:
+   case BRW_OPCODE_SENDC:
+   case BRW_OPCODE_MAD:
+   case BRW_OPCODE_LRP:
+   case BRW_OPCODE_BFE:
+   case BRW_OPCODE_BFI2:
+      return false;
+   }
+
+   if (gen8_cmpt_control(src))
+      return false;
+
+   is_immediate = gen8_is_immediate(src);
+   if (is_immediate && !gen8_is_compactable_immediate(gen8_src1_imm_ud(src)))
+      return false;
+
+   memset(&temp, 0, sizeof(temp));
+
+   temp.dw0.opcode = gen8_opcode(src);
+   temp.dw0.debug_control = gen8_debug_control(src);
+   if (!gen8_set_control_index(&temp, src))
+      return false;
+   if (!gen8_set_datatype_index(&temp, src))
+      return false;
+   if (!gen8_set_subreg_index(&temp, src, is_immediate))
+      return false;
+   temp.dw0.acc_wr_control = gen8_acc_wr_control(src);
+   temp.dw0.conditionalmod = gen8_cond_modifier(src);
+   temp.dw0.cmpt_ctrl = 1;
+   if (!gen8_set_src0_index(&temp, src))
+      return false;
+   if (!gen8_set_src1_index(&temp, src, is_immediate))
+      return false;
+   temp.dw1.dst_reg_nr = gen8_dst_da_reg_nr(src);
+   temp.dw1.src0_reg_nr = gen8_src0_da_reg_nr(src);
+   if (is_immediate)
+      temp.dw1.src1_reg_nr = gen8_src1_imm_ud(src) & 0xff;
+   else
+      temp.dw1.src1_reg_nr = gen8_src1_da_reg_nr(src);
+
+   /* Bits with no place in the compacted instruction, like the nibble
+    * control, would be dropped. Only keep compactions that round trip.
+    */
+   gen8_uncompact_instruction(intel, &uncompacted, &temp);
+   if (memcmp(&uncompacted, src, sizeof(uncompacted)))
+      return false;
+
+   *dst = temp;
+
+   return true;
+}
+
+void
+gen8_uncompact_instruction(struct intel_context *intel,
+                           struct gen8_instruction *dst,
+                           struct brw_compact_instruction *src)
+{
+   uint32_t uncompacted;
+   bool is_immediate;
+
+   memset(dst, 0, sizeof(*dst));
+
+   gen8_set_opcode(dst, src->dw0.opcode);
+   gen8_set_debug_control(dst, src->dw0.debug_control);
+
+   uncompacted = control_index_table[src->dw0.control_index];
+   gen8_set_bits(dst, 33, 32, uncompacted >> 17);
+   gen8_set_bits(dst, 31, 31, uncompacted >> 16);
+   gen8_set_bits(dst, 23, 12, uncompacted >> 4);
+   gen8_set_bits(dst, 10, 9, uncompacted >> 2);
+   gen8_set_bits(dst, 34, 34, uncompacted >> 1);
+   gen8_set_bits(dst, 8, 8, uncompacted);
+
+   /* the register files, and so is_immediate, come from the datatype */
+   uncompacted = datatype_table[src->dw0.data_type_index];
+   gen8_set_bits(dst, 63, 61, uncompacted >> 18);
+   gen8_set_bits(dst, 94, 89, uncompacted >> 12);
+   gen8_set_bits(dst, 46, 35, uncompacted);
+   is_immediate = gen8_is_immediate(dst);
+
+   uncompacted = subreg_table[src->dw0.sub_reg_index];
+   gen8_set_bits(dst, 52, 48, uncompacted);
+   gen8_set_bits(dst, 68, 64, uncompacted >> 5);
+   if (!is_immediate)
+      gen8_set_bits(dst, 100, 96, uncompacted >> 10);
+
+   gen8_set_acc_wr_control(dst, src->dw0.acc_wr_control);
+   gen8_set_cond_modifier(dst, src->dw0.conditionalmod);
+
+   uncompacted = src_index_table[src->dw0.src0_index |
+                                 src->dw1.src0_index << 2];
+   gen8_set_bits(dst, 88, 77, uncompacted);
+
+   if (is_immediate) {
+      int32_t imm = src->dw1.src1_index << 8 | src->dw1.src1_reg_nr;
+
+      /* sign extend from 13 bits */
+      dst->data[3] = imm & 0x1000 ? imm | 0xfffff000 : imm;
+   } else {
+      gen8_set_bits(dst, 120, 109, src_index_table[src->dw1.src1_index]);
+      gen8_set_src1_da_reg_nr(dst, src->dw1.src1_reg_nr);
+   }
+
+   gen8_set_dst_da_reg_nr(dst, src->dw1.dst_reg_nr);
+   gen8_set_src0_da_reg_nr(dst, src->dw1.src0_reg_nr);
+}
+
 void brw_debug_compact_uncompact(struct intel_context *intel,
                                  struct brw_instruction *orig,
                                  struct brw_instruction *uncompacted)
@@ -645,8 +968,16 @@ brw_init_compaction_tables(struct intel_context *intel)
    assert(gen7_datatype_table[ARRAY_SIZE(gen6_datatype_table) - 1] != 0);
    assert(gen7_subreg_table[ARRAY_SIZE(gen6_subreg_table) - 1] != 0);
    assert(gen7_src_index_table[ARRAY_SIZE(gen6_src_index_table) - 1] != 0);
+   assert(gen8_datatype_table[ARRAY_SIZE(gen8_datatype_table) - 1] != 0);
 
    switch (intel->gen) {
+   case 9:
+   case 8:
+      control_index_table = gen7_control_index_table;
+      datatype_table = gen8_datatype_table;
+      subreg_table = gen7_subreg_table;
+      src_index_table = gen7_src_index_table;
+      break;
    case 7:
       control_index_table = gen7_control_index_table;
       datatype_table = gen7_datatype_table;
@@ -662,6 +993,11 @@ brw_init_compaction_tables(struct intel_context *intel)
    default:
       return;
    }
+
+   init_lookup(&control_index_lookup, control_index_table);
+   init_lookup(&datatype_lookup, datatype_table);
+   init_lookup(&subreg_lookup, subreg_table);
+   init_lookup(&src_index_lookup, src_index_table);
 }
 
 void
@@ -20,11 +20,15 @@
  * OF THIS SOFTWARE.
  */
 
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <getopt.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "gen4asm.h"
 #include "brw_eu.h"
@@ -34,95 +38,375 @@ static const struct option longopts[] = {
 	{ NULL, 0, NULL, 0 }
 };
 
-static struct brw_program *
-read_program (FILE *input)
+enum input_format {
+    INPUT_DWORDS,	/* 0x%08x text, as output by intel-gen4asm */
+    INPUT_BYTES,	/* 0x%02x text, as output by intel-gen4asm -b */
+    INPUT_RAW,		/* binary */
+};
+
+/* The input, mapped when it is a file, read into memory otherwise. */
+struct input {
+    const char	*data;
+    size_t	size;
+    bool	mapped;
+};
+
+/*
+ * A flat array of instructions pointing into the program, which is either
+ * the raw input or the words parsed from text input.
+ */
+struct program {
+    const uint32_t	*words;
+    size_t		nwords;
+    uint32_t		*parsed;
+    const uint32_t	**insns;
+    size_t		ninsns;
+};
+
+static struct brw_context brw;
+static int gen = 4;
+
+static int
+map_input (struct input *input, FILE *file)
 {
-    uint32_t			    inst[4];
-    struct brw_program		    *program;
-    struct brw_program_instruction  *entry, **prev;
-    int			c;
-    int			n = 0;
-
-    program = malloc (sizeof (struct brw_program));
-    program->first = NULL;
-    prev = &program->first;
-    while ((c = getc (input)) != EOF) {
-	if (c == '0') {
-	    if (fscanf (input, "x%x", &inst[n]) == 1) {
-		++n;
-		if (n == 4) {
-		    entry = malloc (sizeof (struct brw_program_instruction));
-		    memcpy (&entry->insn, inst, 4 * sizeof (uint32_t));
-		    entry->next = NULL;
-		    *prev = entry;
-		    prev = &entry->next;
-		    n = 0;
-		}
-	    }
+    struct stat st;
+    size_t alloc = 0;
+    char *buf = NULL;
+    size_t n;
+
+    if (fstat (fileno (file), &st) == 0 && S_ISREG (st.st_mode)) {
+	input->size = st.st_size;
+	input->mapped = true;
+	if (!input->size) {
+	    input->data = "";
+	    return 0;
 	}
+
+	input->data = mmap (NULL, input->size, PROT_READ, MAP_PRIVATE,
+			    fileno (file), 0);
+	if (input->data == MAP_FAILED)
+	    return -1;
+	madvise ((void *)input->data, input->size, MADV_SEQUENTIAL);
+	return 0;
     }
-    return program;
+
+    /* pipes and terminals */
+    input->size = 0;
+    input->mapped = false;
+    do {
+	if (input->size == alloc) {
+	    alloc = alloc ? 2 * alloc : 1 << 20;
+	    buf = realloc (buf, alloc);
+	    if (!buf)
+		return -1;
+	}
+	n = fread (buf + input->size, 1, alloc - input->size, file);
+	input->size += n;
+    } while (n);
+
+    input->data = buf;
+    return ferror (file) ? -1 : 0;
 }
 
-static struct brw_program *
-read_program_binary (FILE *input)
+static void
+unmap_input (struct input *input)
 {
-    uint32_t			    temp;
-    uint8_t			    inst[16];
-    struct brw_program		    *program;
-    struct brw_program_instruction  *entry, **prev;
-    int			c;
-    int			n = 0;
-
-    program = malloc (sizeof (struct brw_program));
-    program->first = NULL;
-    prev = &program->first;
-    while ((c = getc (input)) != EOF) {
-	if (c == '0') {
-	    if (fscanf (input, "x%2x", &temp) == 1) {
-		inst[n++] = (uint8_t)temp;
-		if (n == 16) {
-		    entry = malloc (sizeof (struct brw_program_instruction));
-		    memcpy (&entry->insn, inst, 16 * sizeof (uint8_t));
-		    entry->next = NULL;
-		    *prev = entry;
-		    prev = &entry->next;
-		    n = 0;
-		}
-	    }
+    if (input->mapped && input->size)
+	munmap ((void *)input->data, input->size);
+    else if (!input->mapped)
+	free ((void *)input->data);
+}
+
+static int
+hex_digit (char c)
+{
+    if (c >= '0' && c <= '9')
+	return c - '0';
+    if (c >= 'a' && c <= 'f')
+	return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+	return c - 'A' + 10;
+    return -1;
+}
+
+/*
+ * Pick the "0x" numbers out of the text, ignoring everything else, with at
+ * most max_digits digits each. Longer numbers keep their low 32 bits, as
+ * fscanf("x%x") did.
+ */
+static size_t
+parse_hex (const char *p, const char *end, int max_digits,
+	   void (*store) (void *dst, size_t i, uint32_t v), void *dst)
+{
+    size_t count = 0;
+
+    while ((p = memchr (p, '0', end - p))) {
+	uint32_t v = 0;
+	int digits = 0, d;
+
+	if (++p == end)
+	    break;
+	if (*p != 'x' && *p != 'X')
+	    continue;
+
+	for (p++; p < end && digits < max_digits &&
+	     (d = hex_digit (*p)) >= 0; p++, digits++)
+	    v = v << 4 | d;
+
+	if (digits)
+	    store (dst, count++, v);
+    }
+
+    return count;
+}
+
+static void
+store_dword (void *dst, size_t i, uint32_t v)
+{
+    if (dst)
+	((uint32_t *)dst)[i] = v;
+}
+
+static void
+store_byte (void *dst, size_t i, uint32_t v)
+{
+    if (dst)
+	((uint8_t *)dst)[i] = v;
+}
+
+static bool
+is_compacted (const uint32_t *insn)
+{
+    return gen >= 6 && (insn[0] & (1 << 29));
+}
+
+static int
+read_program (struct program *program, const struct input *input,
+	      enum input_format format)
+{
+    const char *end = input->data + input->size;
+    size_t i, n;
+
+    memset (program, 0, sizeof (*program));
+
+    switch (format) {
+    case INPUT_RAW:
+	program->words = (const uint32_t *)input->data;
+	program->nwords = input->size / 4;
+	break;
+    case INPUT_DWORDS:
+	/* count first, so that the words can go in one flat array */
+	n = parse_hex (input->data, end, INT_MAX, store_dword, NULL);
+	program->parsed = malloc (n * 4 + 1);
+	if (!program->parsed)
+	    return -1;
+	program->nwords = parse_hex (input->data, end, INT_MAX, store_dword,
+				     program->parsed);
+	program->words = program->parsed;
+	break;
+    case INPUT_BYTES:
+	n = parse_hex (input->data, end, 2, store_byte, NULL);
+	program->parsed = calloc (n / 4 + 1, 4);
+	if (!program->parsed)
+	    return -1;
+	program->nwords = parse_hex (input->data, end, 2, store_byte,
+				     program->parsed) / 4;
+	program->words = program->parsed;
+	break;
+    }
+
+    /* compacted instructions are two words, the others four */
+    program->insns = malloc ((program->nwords / 2 + 1) *
+			     sizeof (*program->insns));
+    if (!program->insns)
+	return -1;
+
+    for (i = 0; i < program->nwords; ) {
+	const uint32_t *insn = &program->words[i];
+	size_t len = is_compacted (insn) ? 2 : 4;
+
+	if (i + len > program->nwords)
+	    break;
+
+	program->insns[program->ninsns++] = insn;
+	i += len;
+    }
+
+    return 0;
+}
+
+static void
+free_program (struct program *program)
+{
+    free (program->insns);
+    free (program->parsed);
+}
+
+static void
+disassemble (FILE *output, const uint32_t *insn)
+{
+    struct brw_instruction full;
+
+    if (is_compacted (insn)) {
+	brw_uncompact_instruction (&brw.intel, &full,
+				   (struct brw_compact_instruction *)insn);
+    } else {
+	memcpy (&full, insn, sizeof (full));
+    }
+
+    if (gen >= 8)
+	gen8_disassemble (output, (struct gen8_instruction *)&full, gen);
+    else
+	brw_disasm (output, &full, gen);
+}
+
+/*
+ * With several threads, the instructions are disassembled in chunks to
+ * memory, and the chunks written out in order as they complete.
+ */
+struct chunk {
+    size_t	first, count;
+    char	*text;
+    size_t	len;
+    bool	done;
+};
+
+static struct {
+    pthread_mutex_t	lock;
+    pthread_cond_t	cond;
+    const struct program *program;
+    struct chunk	*chunks;
+    size_t		nchunks;
+    size_t		next;
+} work = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static void *
+worker (void *arg)
+{
+    for (;;) {
+	struct chunk *chunk;
+	FILE *f;
+	size_t i;
+
+	pthread_mutex_lock (&work.lock);
+	chunk = work.next < work.nchunks ? &work.chunks[work.next++] : NULL;
+	pthread_mutex_unlock (&work.lock);
+	if (!chunk)
+	    break;
+
+	f = open_memstream (&chunk->text, &chunk->len);
+	if (f) {
+	    for (i = 0; i < chunk->count; i++)
+		disassemble (f, work.program->insns[chunk->first + i]);
+	    fclose (f);
 	}
+
+	pthread_mutex_lock (&work.lock);
+	chunk->done = true;
+	pthread_cond_broadcast (&work.cond);
+	pthread_mutex_unlock (&work.lock);
     }
-    return program;
+
+    return NULL;
+}
+
+static int
+disassemble_parallel (FILE *output, const struct program *program,
+		      int threads)
+{
+    size_t chunk_size, i;
+    pthread_t *tids;
+    int started;
+
+    /* enough chunks to keep the threads busy, big enough to be worth it */
+    chunk_size = program->ninsns / (threads * 8) + 1;
+    if (chunk_size < 256)
+	chunk_size = 256;
+
+    work.program = program;
+    work.nchunks = (program->ninsns + chunk_size - 1) / chunk_size;
+    work.chunks = calloc (work.nchunks + 1, sizeof (*work.chunks));
+    tids = calloc (threads, sizeof (*tids));
+    if (!work.chunks || !tids)
+	return -1;
+
+    for (i = 0; i < work.nchunks; i++) {
+	work.chunks[i].first = i * chunk_size;
+	work.chunks[i].count = program->ninsns - i * chunk_size;
+	if (work.chunks[i].count > chunk_size)
+	    work.chunks[i].count = chunk_size;
+    }
+
+    for (started = 0; started < threads; started++)
+	if (pthread_create (&tids[started], NULL, worker, NULL))
+	    break;
+
+    /* the main thread helps out if no thread could be started */
+    if (!started)
+	worker (NULL);
+
+    for (i = 0; i < work.nchunks; i++) {
+	struct chunk *chunk = &work.chunks[i];
+
+	pthread_mutex_lock (&work.lock);
+	while (!chunk->done)
+	    pthread_cond_wait (&work.cond, &work.lock);
+	pthread_mutex_unlock (&work.lock);
+
+	if (chunk->text)
+	    fwrite (chunk->text, 1, chunk->len, output);
+	else
+	    fprintf (stderr, "Out of memory disassembling instructions "
+		     "%zu to %zu\n", chunk->first,
+		     chunk->first + chunk->count - 1);
+	free (chunk->text);
+    }
+
+    while (started--)
+	pthread_join (tids[started], NULL);
+
+    free (tids);
+    free (work.chunks);
+    return 0;
 }
 
 static void usage(void)
 {
     fprintf(stderr, "usage: intel-gen4disasm [options] inputfile\n");
-    fprintf(stderr, "\t-b, --binary                         C style binary output\n");
+    fprintf(stderr, "\t-b, --binary                         C style binary input\n");
+    fprintf(stderr, "\t-r, --raw                            Raw binary input\n");
     fprintf(stderr, "\t-o, --output {outputfile}            Specify output file\n");
     fprintf(stderr, "\t-g, --gen <4|5|6|7|8|9>              Specify GPU generation\n");
+    fprintf(stderr, "\t-j, --threads <n>                    Disassemble with n threads\n");
 }
 
 int main(int argc, char **argv)
 {
-    struct brw_program	*program;
-    FILE		*input = stdin;
+    struct program	program;
+    struct input	input;
+    FILE		*file = stdin;
     FILE		*output = stdout;
     char		*input_filename = NULL;
     char		*output_file = NULL;
-    int			byte_array_input = 0;
+    enum input_format	format = INPUT_DWORDS;
+    int			threads = 1;
     int			o;
-    int			gen = 4;
-    struct brw_program_instruction  *inst;
+    size_t		i;
 
-    while ((o = getopt_long(argc, argv, "o:bg:", longopts, NULL)) != -1) {
+    while ((o = getopt_long(argc, argv, "o:brg:j:", longopts, NULL)) != -1) {
 	switch (o) {
 	case 'o':
 	    if (strcmp(optarg, "-") != 0)
 		output_file = optarg;
 	    break;
 	case 'b':
-	    byte_array_input = 1;
+	    format = INPUT_BYTES;
+	    break;
+	case 'r':
+	    format = INPUT_RAW;
 	    break;
 	case 'g':
 	    gen = strtol(optarg, NULL, 10);
@@ -132,6 +416,13 @@ int main(int argc, char **argv)
 		    exit(1);
 	    }
 
+	    break;
+	case 'j':
+	    threads = strtol(optarg, NULL, 10);
+	    if (threads < 1) {
+		usage();
+		exit(1);
+	    }
 	    break;
 	default:
 	    usage();
@@ -147,18 +438,20 @@ int main(int argc, char **argv)
 
     if (strcmp(argv[0], "-") != 0) {
 	input_filename = argv[0];
-	input = fopen(input_filename, "r");
-	if (input == NULL) {
+	file = fopen(input_filename, "r");
+	if (file == NULL) {
 	    perror("Couldn't open input file");
 	    exit(1);
 	}
     }
-    if (byte_array_input)
-	program = read_program_binary (input);
-    else
-	program = read_program (input);
-    if (!program)
+    if (map_input (&input, file)) {
+	perror("Couldn't read input file");
+	exit(1);
+    }
+    if (read_program (&program, &input, format)) {
+	perror("Couldn't read program");
 	exit (1);
+    }
     if (output_file) {
 	output = fopen (output_file, "w");
 	if (output == NULL) {
@@ -167,11 +460,21 @@ int main(int argc, char **argv)
 	}
     }
 
-    for (inst = program->first; inst; inst = inst->next)
-	if (gen >= 8)
-	    gen8_disassemble(output, &inst->insn.gen8, gen);
-	else
-	    brw_disasm (output, &inst->insn.gen, gen);
+    brw_init_context (&brw, gen * 10);
+    brw_init_compaction_tables (&brw.intel);
+
+    if (threads > 1 && program.ninsns > 256) {
+	if (disassemble_parallel (output, &program, threads)) {
+	    perror("Couldn't disassemble");
+	    exit (1);
+	}
+    } else {
+	for (i = 0; i < program.ninsns; i++)
+	    disassemble (output, program.insns[i]);
+    }
+
+    free_program (&program);
+    unmap_input (&input);
 
     exit (0);
 }
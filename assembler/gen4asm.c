@@ -0,0 +1,633 @@
+/* -*- c-basic-offset: 8 -*- */
+/*
+ * Copyright © 2006 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *    Eric Anholt <eric@anholt.net>
+ *
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+
+#include "ralloc.h"
+#include "gen4asm.h"
+#include "brw_eu.h"
+#include "intel_gen4asm.h"
+
+/*
+ * The assembler proper, driving the parser over a source buffer and
+ * resolving the labels. Used by intel-gen4asm and as libintel-gen4asm.
+ */
+
+extern FILE *yyin;
+extern int yycolumn;
+extern void set_branch_two_offsets(struct brw_program_instruction *insn, int jip_offset, int uip_offset);
+extern void set_branch_one_offset(struct brw_program_instruction *insn, int jip_offset);
+
+long int gen_level = 40;
+int advanced_flag = 0; /* 0: in unit of byte, 1: in unit of data element size */
+int compact_flag = 0; /* instructions compacted, offsets in 64 bit units */
+unsigned int warning_flags = WARN_ALWAYS;
+int need_export = 0;
+char *input_filename = "<stdin>";
+int errors;
+
+struct brw_context genasm_brw_context;
+struct brw_compile genasm_compile;
+
+struct brw_program compiled_program;
+struct program_defaults program_defaults = {.register_type = BRW_REGISTER_TYPE_F};
+
+/*
+ * Open addressing hash table with linear probing, for the declared registers
+ * and the labels. Kernels may have tens of thousands of both.
+ */
+struct hash_item {
+	char *key;
+	void *value;
+};
+
+struct hash_table {
+	struct hash_item *items;
+	unsigned size; /* power of two */
+	unsigned count;
+	int (*compare)(const char *a, const char *b);
+	bool owns_items; /* keys and values are malloc'ed, freed with the table */
+};
+
+/* register names are case insensitive */
+static struct hash_table declared_register_table = {
+	.compare = strcasecmp,
+	.owns_items = true,
+};
+
+/* all the addresses of a label in ascending order, labels may be duplicated */
+struct label_item {
+	int *addr;
+	int count;
+	int size;
+};
+static struct hash_table label_table = { .compare = strcmp };
+
+/* labels to align to 4 instructions, the value is unused */
+static struct hash_table entry_point_table = { .compare = strcmp };
+
+/* FNV-1a of the lowercase key, so it works for either comparison */
+static unsigned hash(const char *key)
+{
+    unsigned ret = 2166136261u;
+
+    while (*key)
+        ret = (ret ^ (unsigned char)tolower(*key++)) * 16777619u;
+    return ret;
+}
+
+static struct hash_item *lookup_hash_item(struct hash_table *t, const char *key)
+{
+    unsigned mask = t->size - 1;
+    unsigned i;
+
+    for (i = hash(key) & mask; t->items[i].key; i = (i + 1) & mask)
+	if (t->compare(t->items[i].key, key) == 0)
+	    break;
+    return &t->items[i];
+}
+
+static void *find_hash_item(struct hash_table *t, const char *key)
+{
+    if (!t->count)
+	return NULL;
+    return lookup_hash_item(t, key)->value;
+}
+
+static void insert_hash_item(struct hash_table *t, char *key, void *v)
+{
+    struct hash_item *p;
+
+    /* keep the load factor at or below 1/2 */
+    if ((t->count + 1) * 2 > t->size) {
+	struct hash_table old = *t;
+	unsigned i;
+
+	t->size = old.size ? old.size * 2 : 64;
+	t->items = calloc(t->size, sizeof(*t->items));
+	if (!t->items) {
+	    fprintf(stderr, "Out of memory\n");
+	    exit(1);
+	}
+	for (i = 0; i < old.size; i++)
+	    if (old.items[i].key)
+		*lookup_hash_item(t, old.items[i].key) = old.items[i];
+	free(old.items);
+    }
+
+    p = lookup_hash_item(t, key);
+    if (!p->key) {
+	t->count++;
+    } else if (t->owns_items) {
+	/* replacing a duplicate key */
+	if (p->key != key)
+	    free(p->key);
+	if (p->value != v)
+	    free(p->value);
+    }
+    p->key = key;
+    p->value = v;
+}
+
+static void free_hash_table(struct hash_table *t)
+{
+    unsigned i;
+
+    for (i = 0; t->owns_items && i < t->size; i++) {
+	if (t->items[i].key) {
+	    free(t->items[i].key);
+	    free(t->items[i].value);
+	}
+    }
+    free(t->items);
+    t->items = NULL;
+    t->size = t->count = 0;
+}
+
+struct declared_register *find_register(char *name)
+{
+    return find_hash_item(&declared_register_table, name);
+}
+
+void insert_register(struct declared_register *reg)
+{
+    insert_hash_item(&declared_register_table, reg->name, reg);
+}
+
+/* Instructions are carved out of larger blocks, freed with the program. */
+static struct brw_program_instruction *instruction_pool;
+static unsigned instruction_pool_left;
+
+struct brw_program_instruction *brw_program_alloc_instruction(void)
+{
+    if (!instruction_pool_left) {
+	instruction_pool_left = 1024;
+	instruction_pool = rzalloc_array(genasm_compile.mem_ctx,
+					 struct brw_program_instruction,
+					 instruction_pool_left);
+	if (!instruction_pool) {
+	    fprintf(stderr, "Out of memory\n");
+	    exit(1);
+	}
+    }
+
+    instruction_pool_left--;
+    return instruction_pool++;
+}
+
+static void add_label(struct brw_program_instruction *i)
+{
+    struct label_item *p;
+
+    assert(is_label(i));
+
+    p = find_hash_item(&label_table, label_name(i));
+    if (!p) {
+	p = rzalloc(genasm_compile.mem_ctx, struct label_item);
+	insert_hash_item(&label_table, label_name(i), p);
+    }
+
+    /* labels are added in program order, so this stays sorted */
+    if (p->count == p->size) {
+	p->size = p->size ? p->size * 2 : 1;
+	p->addr = reralloc(genasm_compile.mem_ctx, p->addr, int, p->size);
+    }
+    assert(p->count == 0 || p->addr[p->count - 1] <= (int)i->inst_offset);
+    p->addr[p->count++] = i->inst_offset;
+}
+
+/* Some assembly code have duplicated labels.
+   Start from start_addr. Search as a loop. Return the first label found. */
+static int label_to_addr(char *name, int start_addr)
+{
+    /* return the first label just after start_addr, or the first label from the head */
+    struct label_item *p = find_hash_item(&label_table, name);
+    int lo = 0, hi;
+
+    if (!p) {
+        fprintf(stderr, "%s: Can't find label %s\n", input_filename, name);
+        return -1;
+    }
+
+    hi = p->count;
+    while (lo < hi) {
+	int mid = (lo + hi) / 2;
+
+	if (p->addr[mid] >= start_addr)
+	    hi = mid;
+	else
+	    lo = mid + 1;
+    }
+
+    return lo < p->count ? p->addr[lo] : p->addr[0];
+}
+
+static int is_entry_point(struct brw_program_instruction *i)
+{
+	assert(i->type == GEN4ASM_INSTRUCTION_LABEL);
+
+	return find_hash_item(&entry_point_table, i->insn.label.name) != NULL;
+}
+
+/* in instructions, or in 64 bit units when compacting */
+static int instruction_size(struct brw_program_instruction *entry)
+{
+	if (is_label(entry))
+		return 0;
+	if (!compact_flag)
+		return 1;
+
+	return entry->insn.gen.header.cmpt_control ? 1 : 2;
+}
+
+static bool is_end_of_thread(struct brw_program_instruction *entry)
+{
+	unsigned opcode = entry->insn.gen.header.opcode;
+
+	if (opcode != BRW_OPCODE_SEND && opcode != BRW_OPCODE_SENDC)
+		return false;
+
+	if (IS_GENp(8))
+		return gen8_eot(&entry->insn.gen8);
+
+	return entry->insn.gen.bits3.generic.end_of_thread;
+}
+
+/*
+ * Jumps given as numbers, or through a register for JMPI, are distances in
+ * the hardware units of the uncompacted program. Compaction would silently
+ * move their targets.
+ */
+static bool has_literal_jump(struct brw_program_instruction *entry)
+{
+	struct relocation *reloc = &entry->reloc;
+
+	if (!is_relocatable(entry))
+		return false;
+
+	if (entry->insn.gen.header.opcode == BRW_OPCODE_JMPI)
+		return !reloc->first_reloc_target;
+
+	return (!reloc->first_reloc_target && reloc->first_reloc_offset) ||
+	       (!reloc->second_reloc_target && reloc->second_reloc_offset);
+}
+
+/*
+ * Compact what can be before laying the program out, so that labels and
+ * branches resolve to the final offsets. Branches to labels stay full size.
+ */
+static int compact_program(void)
+{
+	struct brw_program_instruction *entry;
+	struct brw_compact_instruction compacted;
+	bool ok;
+
+	for (entry = compiled_program.first; entry; entry = entry->next) {
+		if (has_literal_jump(entry)) {
+			fprintf(stderr, "%s: jumps must be to labels to compact "
+				"the program\n", input_filename);
+			return -EINVAL;
+		}
+	}
+
+	for (entry = compiled_program.first; entry; entry = entry->next) {
+		if (is_label(entry) || is_relocatable(entry) ||
+		    entry->insn.gen.header.cmpt_control)
+			continue;
+
+		if (IS_GENp(8))
+			ok = gen8_try_compact_instruction(&genasm_brw_context.intel,
+							  &compacted,
+							  &entry->insn.gen8);
+		else
+			ok = brw_try_compact_instruction(&genasm_compile,
+							 &compacted,
+							 &entry->insn.gen);
+		if (ok) {
+			memset(&entry->insn.gen, 0, sizeof(entry->insn.gen));
+			memcpy(&entry->insn.gen, &compacted, sizeof(compacted));
+		}
+	}
+
+	return 0;
+}
+
+static struct brw_program_instruction *
+insert_compacted_nop(struct brw_program_instruction *prev,
+		     struct brw_program_instruction *next)
+{
+	struct brw_program_instruction *nop = brw_program_alloc_instruction();
+	struct brw_compact_instruction *compacted = (void *)&nop->insn.gen;
+
+	compacted->dw0.opcode = BRW_OPCODE_NOP;
+	compacted->dw0.cmpt_ctrl = 1;
+
+	nop->next = next;
+	if (prev)
+		prev->next = nop;
+	else
+		compiled_program.first = nop;
+	if (!next)
+		compiled_program.last = nop;
+
+	return nop;
+}
+
+/* offsets in instructions, entry points aligned to 4 of them with NOPs */
+static void layout(void)
+{
+	struct brw_program_instruction *entry, *entry1, *tmp_entry;
+	int inst_offset;
+
+	inst_offset = 0 ;
+	for (entry = compiled_program.first;
+		entry != NULL; entry = entry->next) {
+	    entry->inst_offset = inst_offset;
+	    entry1 = entry->next;
+	    if (entry1 && is_label(entry1) && is_entry_point(entry1)) {
+		// insert NOP instructions until (inst_offset+1) % 4 == 0
+		while (((inst_offset+1) % 4) != 0) {
+		    tmp_entry = brw_program_alloc_instruction();
+		    tmp_entry->insn.gen.header.opcode = BRW_OPCODE_NOP;
+		    entry->next = tmp_entry;
+		    tmp_entry->next = entry1;
+		    entry = tmp_entry;
+		    tmp_entry->inst_offset = ++inst_offset;
+		}
+	    }
+	    if (!is_label(entry))
+              inst_offset++;
+	}
+}
+
+/*
+ * The compacted layout pads with compacted NOPs to keep entry points on 64
+ * bytes, as without compaction, and to keep end of thread SENDs, which hang
+ * the GPU otherwise, and the end of the program on 128 bits.
+ */
+static void layout_compacted(void)
+{
+	struct brw_program_instruction *entry, *prev = NULL;
+	int inst_offset = 0, align;
+
+	for (entry = compiled_program.first; entry;
+	     prev = entry, entry = entry->next) {
+		if (is_label(entry))
+			align = is_entry_point(entry) ? 8 : 1;
+		else
+			align = is_end_of_thread(entry) ? 2 : 1;
+
+		while (inst_offset % align) {
+			prev = insert_compacted_nop(prev, entry);
+			prev->inst_offset = inst_offset++;
+		}
+
+		entry->inst_offset = inst_offset;
+		inst_offset += instruction_size(entry);
+	}
+
+	if (inst_offset % 2)
+		insert_compacted_nop(prev, NULL)->inst_offset = inst_offset;
+}
+
+/* Lay the kernel out as a single block: header, code, labels, names. */
+struct gen4asm_kernel *kernel_alloc(size_t size, unsigned int num_labels,
+				    size_t names_size)
+{
+	struct gen4asm_kernel *kernel;
+	size_t code_offset = (sizeof(*kernel) + 15) & ~15;
+	size_t labels_offset = code_offset + ((size + 15) & ~15);
+	size_t names_offset = labels_offset +
+		num_labels * sizeof(struct gen4asm_label);
+	char *p;
+
+	p = calloc(1, names_offset + names_size);
+	if (!p)
+		return NULL;
+
+	kernel = (struct gen4asm_kernel *)p;
+	kernel->code = p + code_offset;
+	kernel->size = size;
+	kernel->labels = (struct gen4asm_label *)(p + labels_offset);
+	kernel->num_labels = num_labels;
+
+	return kernel;
+}
+
+void gen4asm_kernel_free(struct gen4asm_kernel *kernel)
+{
+	free(kernel);
+}
+
+static struct gen4asm_kernel *build_kernel(void)
+{
+	struct brw_program_instruction *entry;
+	struct gen4asm_kernel *kernel;
+	struct gen4asm_label *label;
+	unsigned int num_labels = 0;
+	size_t size = 0, names_size = 0, unit;
+	char *code, *names;
+
+	unit = compact_flag ? 8 : sizeof(struct brw_instruction);
+
+	for (entry = compiled_program.first; entry; entry = entry->next) {
+		if (is_label(entry)) {
+			num_labels++;
+			names_size += strlen(label_name(entry)) + 1;
+		} else {
+			size += instruction_size(entry) * unit;
+		}
+	}
+
+	kernel = kernel_alloc(size, num_labels, names_size);
+	if (!kernel)
+		return NULL;
+
+	code = (char *)kernel->code;
+	label = (struct gen4asm_label *)kernel->labels;
+	names = (char *)&kernel->labels[num_labels];
+
+	for (entry = compiled_program.first; entry; entry = entry->next) {
+		if (is_label(entry)) {
+			label->name = strcpy(names, label_name(entry));
+			label->ip = (IS_GENx(5) ? 2 : 1) * entry->inst_offset;
+			names += strlen(names) + 1;
+			label++;
+		} else {
+			memcpy(code, &entry->insn.gen,
+			       instruction_size(entry) * unit);
+			code += instruction_size(entry) * unit;
+		}
+	}
+
+	return kernel;
+}
+
+static int assemble(const struct gen4asm_options *options)
+{
+	struct brw_program_instruction *entry;
+	int err;
+
+	err = yyparse();
+	yylex_destroy();
+	if (err || errors)
+		return -EINVAL;
+
+	if (options->entry_points) {
+		const char * const *name;
+
+		for (name = options->entry_points; *name; name++)
+			insert_hash_item(&entry_point_table, (char *)*name,
+					 (void *)*name);
+	}
+
+	if (compact_flag) {
+		err = compact_program();
+		if (err)
+			return err;
+		layout_compacted();
+	} else {
+		layout();
+	}
+
+	for (entry = compiled_program.first; entry; entry = entry->next)
+	    if (is_label(entry))
+		add_label(entry);
+
+	for (entry = compiled_program.first; entry; entry = entry->next) {
+	    struct relocation *reloc = &entry->reloc;
+	    int addr;
+
+	    if (!is_relocatable(entry))
+		continue;
+
+	    if (reloc->first_reloc_target) {
+		addr = label_to_addr(reloc->first_reloc_target, entry->inst_offset);
+		if (addr < 0)
+		    return -ENOENT;
+		reloc->first_reloc_offset = addr - entry->inst_offset;
+	    }
+
+	    if (reloc->second_reloc_target) {
+		addr = label_to_addr(reloc->second_reloc_target, entry->inst_offset);
+		if (addr < 0)
+		    return -ENOENT;
+		reloc->second_reloc_offset = addr - entry->inst_offset;
+	    }
+
+	    if (reloc->second_reloc_offset) { // this is a branch instruction with two offset arguments
+                set_branch_two_offsets(entry, reloc->first_reloc_offset, reloc->second_reloc_offset);
+	    } else if (reloc->first_reloc_offset) {
+                set_branch_one_offset(entry, reloc->first_reloc_offset);
+	    }
+	}
+
+	return 0;
+}
+
+/**
+ * Assemble size bytes of source for options->gen into a new kernel, to be
+ * freed with gen4asm_kernel_free(). Diagnostics go to stderr.
+ *
+ * Returns 0 on success, -EINVAL if the source does not assemble, -ENOENT for
+ * undefined labels, or another negative error code.
+ */
+int gen4asm_assemble(const struct gen4asm_options *options,
+		     const char *source, size_t size,
+		     struct gen4asm_kernel **kernel)
+{
+	static const struct program_defaults defaults = {
+		.register_type = BRW_REGISTER_TYPE_F
+	};
+	struct brw_program_instruction *entry;
+	void *mem_ctx;
+	int err;
+
+	*kernel = NULL;
+
+	if (options->gen < 40 || options->gen > 90)
+		return -EINVAL;
+
+	/* there is no valid empty program, and fmemopen() wants a size */
+	if (!size)
+		return -EINVAL;
+
+	yyin = fmemopen((void *)source, size, "r");
+	if (!yyin)
+		return -errno;
+
+	gen_level = options->gen;
+	advanced_flag = options->advanced;
+	compact_flag = options->compact && gen_level >= 60;
+	warning_flags = WARN_ALWAYS | (options->warnings ? WARN_ALL : 0);
+	input_filename = (char *)(options->filename ?: "<memory>");
+	errors = 0;
+	yycolumn = 1;
+
+	memset(&compiled_program, 0, sizeof(compiled_program));
+	program_defaults = defaults;
+	instruction_pool = NULL;
+	instruction_pool_left = 0;
+
+	brw_init_context(&genasm_brw_context, gen_level);
+	mem_ctx = ralloc_context(NULL);
+	brw_init_compile(&genasm_brw_context, &genasm_compile, mem_ctx);
+
+	err = assemble(options);
+	fclose(yyin);
+	yyin = NULL;
+
+	if (!err) {
+		*kernel = build_kernel();
+		if (!*kernel)
+			err = -ENOMEM;
+	}
+
+	for (entry = compiled_program.first; entry; entry = entry->next) {
+		if (is_relocatable(entry)) {
+			free(entry->reloc.first_reloc_target);
+			free(entry->reloc.second_reloc_target);
+		}
+	}
+
+	free_hash_table(&entry_point_table);
+	free_hash_table(&declared_register_table);
+	free_hash_table(&label_table);
+	ralloc_free(mem_ctx);
+	memset(&compiled_program, 0, sizeof(compiled_program));
+	instruction_pool = NULL;
+	instruction_pool_left = 0;
+
+	return err;
+}
@@ -30,6 +30,7 @@
 #define __GEN4ASM_H__
 
 #include <inttypes.h>
+#include <stddef.h>
 #include <stdbool.h>
 #include <assert.h>
 
@@ -40,6 +41,7 @@
 
 extern long int gen_level;
 extern int advanced_flag;
+extern int compact_flag;
 extern int errors;
 
 #define WARN_ALWAYS	(1 << 0)
@@ -189,6 +191,13 @@ struct brw_program {
 
 extern struct brw_program compiled_program;
 
+/* zeroed, from genasm_compile.mem_ctx like the label names */
+struct brw_program_instruction *brw_program_alloc_instruction(void);
+
+struct gen4asm_kernel;
+struct gen4asm_kernel *kernel_alloc(size_t size, unsigned int num_labels,
+				    size_t names_size);
+
 #define TYPE_B_INDEX            0
 #define TYPE_UB_INDEX           1
 #define TYPE_W_INDEX            2
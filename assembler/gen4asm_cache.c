@@ -0,0 +1,475 @@
+/* -*- c-basic-offset: 8 -*- */
+/*
+ * Copyright © 2017 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * On-disk cache of assembled kernels. Each kernel is stored in a file named
+ * after a hash of the source and of the options that affect the output. The
+ * file also holds the complete source and options, which are compared on
+ * lookup, so hash collisions and stale or corrupt files are just misses.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <link.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "gen4asm.h"
+#include "intel_gen4asm.h"
+
+#define CACHE_MAGIC	"G4ACACHE"
+#define CACHE_VERSION	3
+
+#ifndef PACKAGE_VERSION
+#define PACKAGE_VERSION	"unknown"
+#endif
+
+struct cache_header {
+	char magic[8];
+	uint32_t version;
+	char build[64];		/* of the assembler which stored the kernel */
+	uint32_t gen;
+	uint32_t advanced;
+	uint32_t compact;
+	uint32_t num_labels;
+	uint32_t reserved;
+	uint64_t key_size;	/* entry points and source */
+	uint64_t code_size;
+	uint64_t names_size;
+};
+
+/* followed by the key, the code, then num_labels of these, then the names */
+struct cache_label {
+	uint32_t ip;
+	uint32_t name;		/* offset in the names */
+};
+
+struct cache_key {
+	char build[64];
+	char *data;
+	size_t size;
+};
+
+/* The GNU build id note of the object containing the assembler */
+static int find_build_id(struct dl_phdr_info *info, size_t size, void *data)
+{
+	uintptr_t addr = (uintptr_t)&gen4asm_assemble;
+	const ElfW(Nhdr) **id = data;
+	bool found = false;
+	int i;
+
+	for (i = 0; i < info->dlpi_phnum; i++) {
+		const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+		uintptr_t start = info->dlpi_addr + phdr->p_vaddr;
+
+		if (phdr->p_type == PT_LOAD &&
+		    addr >= start && addr < start + phdr->p_memsz)
+			found = true;
+	}
+	if (!found)
+		return 0;
+
+	for (i = 0; i < info->dlpi_phnum; i++) {
+		const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+		const char *p, *end;
+
+		if (phdr->p_type != PT_NOTE)
+			continue;
+
+		p = (const char *)(info->dlpi_addr + phdr->p_vaddr);
+		end = p + phdr->p_memsz;
+		while (p + sizeof(**id) <= end) {
+			const ElfW(Nhdr) *note = (const void *)p;
+
+			if (note->n_type == NT_GNU_BUILD_ID &&
+			    note->n_namesz == 4 &&
+			    memcmp(note + 1, "GNU", 4) == 0) {
+				*id = note;
+				return 1;
+			}
+
+			p += sizeof(*note) + ((note->n_namesz + 3) & ~3) +
+			     ((note->n_descsz + 3) & ~3);
+		}
+	}
+
+	return 1;
+}
+
+/*
+ * Kernels stored by another build of the assembler, which may encode some
+ * instructions differently, must not be used. Tell builds apart by their
+ * build id, when the linker gave them one, and by the package version.
+ */
+static void cache_build_init(char *build, size_t size)
+{
+	const ElfW(Nhdr) *id = NULL;
+	const unsigned char *desc;
+	int len;
+	size_t i;
+
+	len = snprintf(build, size, "%s", PACKAGE_VERSION);
+
+	dl_iterate_phdr(find_build_id, &id);
+	if (!id)
+		return;
+
+	desc = (const unsigned char *)(id + 1) + 4;
+	for (i = 0; i < id->n_descsz && len + 3 < size; i++)
+		len += snprintf(build + len, size - len, "%s%02x",
+				i ? "" : "-", desc[i]);
+}
+
+/*
+ * The entry points change the output, the warnings and the file name used in
+ * diagnostics do not.
+ */
+static int cache_key_init(struct cache_key *key,
+			  const struct gen4asm_options *options,
+			  const char *source, size_t size)
+{
+	const char * const *name;
+	char *p;
+
+	memset(key->build, 0, sizeof(key->build));
+	cache_build_init(key->build, sizeof(key->build));
+
+	key->size = 1 + size;
+	for (name = options->entry_points; name && *name; name++)
+		key->size += strlen(*name) + 1;
+
+	key->data = p = malloc(key->size);
+	if (!key->data)
+		return -ENOMEM;
+
+	for (name = options->entry_points; name && *name; name++)
+		p = stpcpy(p, *name) + 1;
+	*p++ = '\0';
+	memcpy(p, source, size);
+
+	return 0;
+}
+
+static uint64_t cache_hash(const struct gen4asm_options *options,
+			   const struct cache_key *key)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+	uint32_t params[4] = {
+		CACHE_VERSION, options->gen, options->advanced, options->compact
+	};
+	const unsigned char *p;
+	size_t i;
+
+	for (p = (const void *)params, i = 0; i < sizeof(params); i++)
+		hash = (hash ^ p[i]) * 0x100000001b3ull;
+	for (p = (const void *)key->build, i = 0; i < sizeof(key->build); i++)
+		hash = (hash ^ p[i]) * 0x100000001b3ull;
+	for (p = (const void *)key->data, i = 0; i < key->size; i++)
+		hash = (hash ^ p[i]) * 0x100000001b3ull;
+
+	return hash;
+}
+
+static int mkdir_parents(const char *dir)
+{
+	char path[PATH_MAX];
+	char *p;
+
+	if (snprintf(path, sizeof(path), "%s", dir) >= sizeof(path))
+		return -ENAMETOOLONG;
+
+	for (p = path + 1; *p; p++) {
+		if (*p != '/')
+			continue;
+
+		*p = '\0';
+		if (mkdir(path, 0755) && errno != EEXIST)
+			return -errno;
+		*p = '/';
+	}
+
+	if (mkdir(path, 0755) && errno != EEXIST)
+		return -errno;
+
+	return 0;
+}
+
+static int read_all(int fd, void *buf, size_t size)
+{
+	char *p = buf;
+
+	while (size) {
+		ssize_t n = read(fd, p, size);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -EIO;
+
+		p += n;
+		size -= n;
+	}
+
+	return 0;
+}
+
+static int write_all(int fd, const void *buf, size_t size)
+{
+	const char *p = buf;
+
+	while (size) {
+		ssize_t n = write(fd, p, size);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -EIO;
+
+		p += n;
+		size -= n;
+	}
+
+	return 0;
+}
+
+static struct gen4asm_kernel *cache_load(const char *path,
+					 const struct gen4asm_options *options,
+					 const struct cache_key *key)
+{
+	struct gen4asm_kernel *kernel = NULL;
+	struct gen4asm_label *labels;
+	struct cache_header header;
+	struct cache_label *cached = NULL;
+	char *data = NULL, *names;
+	struct stat st;
+	uint32_t i;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) ||
+	    read_all(fd, &header, sizeof(header)) ||
+	    memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) ||
+	    header.version != CACHE_VERSION ||
+	    memcmp(header.build, key->build, sizeof(header.build)) ||
+	    header.gen != options->gen ||
+	    header.advanced != options->advanced ||
+	    header.compact != options->compact ||
+	    header.key_size != key->size ||
+	    header.code_size % 16 ||
+	    header.code_size > st.st_size ||
+	    header.names_size > st.st_size ||
+	    header.num_labels > st.st_size / sizeof(*cached) ||
+	    st.st_size != sizeof(header) + header.key_size +
+			  header.code_size +
+			  header.num_labels * sizeof(*cached) +
+			  header.names_size)
+		goto out;
+
+	data = malloc(key->size);
+	cached = malloc(header.num_labels * sizeof(*cached) + 1);
+	kernel = kernel_alloc(header.code_size, header.num_labels,
+			      header.names_size + 1);
+	if (!data || !cached || !kernel)
+		goto err;
+
+	labels = (struct gen4asm_label *)kernel->labels;
+	names = (char *)&labels[header.num_labels];
+
+	if (read_all(fd, data, key->size) ||
+	    memcmp(data, key->data, key->size) ||
+	    read_all(fd, (void *)kernel->code, header.code_size) ||
+	    read_all(fd, cached, header.num_labels * sizeof(*cached)) ||
+	    read_all(fd, names, header.names_size))
+		goto err;
+
+	/* the names were zero-terminated when stored, keep them so */
+	names[header.names_size] = '\0';
+	for (i = 0; i < header.num_labels; i++) {
+		if (cached[i].name >= header.names_size)
+			goto err;
+
+		labels[i].name = names + cached[i].name;
+		labels[i].ip = cached[i].ip;
+	}
+
+	goto out;
+
+err:
+	gen4asm_kernel_free(kernel);
+	kernel = NULL;
+out:
+	free(cached);
+	free(data);
+	close(fd);
+
+	return kernel;
+}
+
+static int cache_store(const char *dir, const char *path,
+		       const struct gen4asm_options *options,
+		       const struct cache_key *key,
+		       const struct gen4asm_kernel *kernel)
+{
+	struct cache_header header = {
+		.magic = CACHE_MAGIC,
+		.version = CACHE_VERSION,
+		.gen = options->gen,
+		.advanced = options->advanced,
+		.compact = options->compact,
+		.num_labels = kernel->num_labels,
+		.key_size = key->size,
+		.code_size = kernel->size,
+	};
+	struct cache_label *cached;
+	char tmp[PATH_MAX];
+	char *names;
+	uint32_t i;
+	int fd, err;
+
+	memcpy(header.build, key->build, sizeof(header.build));
+
+	cached = calloc(kernel->num_labels + 1, sizeof(*cached));
+	if (!cached)
+		return -ENOMEM;
+
+	/* the names are stored right after the labels, in order */
+	names = (char *)&kernel->labels[kernel->num_labels];
+	for (i = 0; i < kernel->num_labels; i++) {
+		cached[i].ip = kernel->labels[i].ip;
+		cached[i].name = kernel->labels[i].name - names;
+		header.names_size += strlen(kernel->labels[i].name) + 1;
+	}
+
+	err = mkdir_parents(dir);
+	if (err)
+		goto out;
+
+	/* write to a temporary file first so that readers never see half */
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= sizeof(tmp)) {
+		err = -ENAMETOOLONG;
+		goto out;
+	}
+
+	fd = mkstemp(tmp);
+	if (fd < 0) {
+		err = -errno;
+		goto out;
+	}
+
+	err = write_all(fd, &header, sizeof(header));
+	if (!err)
+		err = write_all(fd, key->data, key->size);
+	if (!err)
+		err = write_all(fd, kernel->code, kernel->size);
+	if (!err)
+		err = write_all(fd, cached,
+				kernel->num_labels * sizeof(*cached));
+	if (!err)
+		err = write_all(fd, names, header.names_size);
+	if (close(fd) && !err)
+		err = -errno;
+	if (!err && rename(tmp, path))
+		err = -errno;
+	if (err)
+		unlink(tmp);
+
+out:
+	free(cached);
+
+	return err;
+}
+
+static const char *default_cache_dir(char *buf, size_t size)
+{
+	const char *dir;
+
+	dir = getenv("XDG_CACHE_HOME");
+	if (dir && *dir) {
+		snprintf(buf, size, "%s/intel-gen4asm", dir);
+		return buf;
+	}
+
+	dir = getenv("HOME");
+	if (dir && *dir) {
+		snprintf(buf, size, "%s/.cache/intel-gen4asm", dir);
+		return buf;
+	}
+
+	return NULL;
+}
+
+/**
+ * Like gen4asm_assemble(), but look the kernel up in cache_dir first, and
+ * store it there once assembled. With a NULL cache_dir, the intel-gen4asm
+ * directory in $XDG_CACHE_HOME or ~/.cache is used. Failing to use the cache
+ * is not an error, the source is just assembled.
+ *
+ * Returns 1 if the kernel came from the cache, otherwise as gen4asm_assemble().
+ */
+int gen4asm_assemble_cached(const char *cache_dir,
+			    const struct gen4asm_options *options,
+			    const char *source, size_t size,
+			    struct gen4asm_kernel **kernel)
+{
+	char dir[PATH_MAX], path[PATH_MAX];
+	struct cache_key key;
+	int err;
+
+	if (!cache_dir)
+		cache_dir = default_cache_dir(dir, sizeof(dir));
+
+	if (!cache_dir || cache_key_init(&key, options, source, size))
+		return gen4asm_assemble(options, source, size, kernel);
+
+	snprintf(path, sizeof(path), "%s/%016llx", cache_dir,
+		 (unsigned long long)cache_hash(options, &key));
+
+	*kernel = cache_load(path, options, &key);
+	if (*kernel) {
+		free(key.data);
+		return 1;
+	}
+
+	err = gen4asm_assemble(options, source, size, kernel);
+	if (!err)
+		cache_store(cache_dir, path, options, &key, *kernel);
+
+	free(key.data);
+
+	return err;
+}
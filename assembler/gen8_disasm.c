@@ -261,7 +261,8 @@ static const char *const m_urb_opcode[16] = {
 
 static const char *const m_urb_interleave[2] = { "", "interleaved" };
 
-static int column;
+/* thread local, like in brw_disasm.c */
+static __thread int column;
 
 static int
 string(FILE *file, const char *string)
@@ -32,6 +32,7 @@
 #include <stdbool.h>
 #include <stdarg.h>
 #include <assert.h>
+#include "ralloc.h"
 #include "gen4asm.h"
 #include "brw_eu.h"
 #include "gen8_instruction.h"
@@ -214,7 +215,7 @@ brw_program_add_instruction(struct brw_program *p,
 {
     struct brw_program_instruction *list_entry;
 
-    list_entry = calloc(sizeof(struct brw_program_instruction), 1);
+    list_entry = brw_program_alloc_instruction();
     list_entry->type = GEN4ASM_INSTRUCTION_GEN;
     list_entry->insn.gen = instruction->insn.gen;
     brw_program_append_entry(p, list_entry);
@@ -226,7 +227,7 @@ brw_program_add_relocatable(struct brw_program *p,
 {
     struct brw_program_instruction *list_entry;
 
-    list_entry = calloc(sizeof(struct brw_program_instruction), 1);
+    list_entry = brw_program_alloc_instruction();
     list_entry->type = GEN4ASM_INSTRUCTION_GEN_RELOCATABLE;
     list_entry->insn.gen = instruction->insn.gen;
     list_entry->reloc = instruction->reloc;
@@ -237,9 +238,9 @@ static void brw_program_add_label(struct brw_program *p, const char *label)
 {
     struct brw_program_instruction *list_entry;
 
-    list_entry = calloc(sizeof(struct brw_program_instruction), 1);
+    list_entry = brw_program_alloc_instruction();
     list_entry->type = GEN4ASM_INSTRUCTION_LABEL;
-    list_entry->insn.label.name = strdup(label);
+    list_entry->insn.label.name = ralloc_strdup(genasm_compile.mem_ctx, label);
     brw_program_append_entry(p, list_entry);
 }
 
@@ -3331,21 +3332,23 @@ static inline int branch_offset(struct brw_program_instruction *insn, int offset
     /*
      * bspec: Unlike other flow control instructions, the offset used by JMPI
      * is relative to the incremented instruction pointer rather than the IP
-     * value for the instruction itself.
+     * value for the instruction itself. A JMPI to a label is never compacted.
      */
     if (instruction_opcode(insn) == BRW_OPCODE_JMPI)
-        offset--;
+        offset -= compact_flag ? 2 : 1;
 
     /*
      * Gen4- bspec: the jump distance is in number of sixteen-byte units
      * Gen5+ bspec: the jump distance is in number of eight-byte units
      * Gen7.5+: the offset is in unit of 8bits for JMPI, 64bits for other flow
      * control instructions
+     *
+     * When compacting, the offsets are already in 64 bit units.
      */
     if (gen_level >= 75 &&
         (instruction_opcode(insn) == BRW_OPCODE_JMPI))
-        offset *= 16;
-    else if (gen_level >= 50)
+        offset *= compact_flag ? 8 : 16;
+    else if (gen_level >= 50 && !compact_flag)
         offset *= 2;
 
     return offset;
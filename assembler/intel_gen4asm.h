@@ -0,0 +1,88 @@
+/* -*- c-basic-offset: 8 -*- */
+/*
+ * Copyright © 2017 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __INTEL_GEN4ASM_H__
+#define __INTEL_GEN4ASM_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * libintel-gen4asm: the intel-gen4asm assembler as a library, assembling
+ * from memory instead of files. The assembler keeps its state in globals, so
+ * calls must not be made from several threads at once.
+ */
+
+/**
+ * Assembler options, the equivalents of the intel-gen4asm command line
+ * options.
+ */
+struct gen4asm_options {
+	/* GPU generation times ten, e.g. 75 for Haswell, as with -g */
+	int gen;
+	/* subregister numbers in units of the data type, as with -a */
+	bool advanced;
+	/* enable all warnings, as with -W */
+	bool warnings;
+	/* NULL terminated list of labels to align to 4 instructions, as with -l */
+	const char * const *entry_points;
+	/* name used in diagnostics, "<memory>" if NULL */
+	const char *filename;
+	/*
+	 * compact the instructions that can be on gen6 and later, as with -c,
+	 * all jumps must then be to labels
+	 */
+	bool compact;
+};
+
+/**
+ * A label of the assembled kernel, the same as in the -e export file.
+ */
+struct gen4asm_label {
+	const char *name;
+	/* offset in instructions, or in 64 bit units on gen5 and when compacted */
+	unsigned int ip;
+};
+
+/**
+ * An assembled kernel, allocated as a single block. Labels are in program
+ * order and may repeat.
+ */
+struct gen4asm_kernel {
+	const void *code;
+	size_t size;
+	const struct gen4asm_label *labels;
+	unsigned int num_labels;
+};
+
+int gen4asm_assemble(const struct gen4asm_options *options,
+		     const char *source, size_t size,
+		     struct gen4asm_kernel **kernel);
+int gen4asm_assemble_cached(const char *cache_dir,
+			    const struct gen4asm_options *options,
+			    const char *source, size_t size,
+			    struct gen4asm_kernel **kernel);
+void gen4asm_kernel_free(struct gen4asm_kernel *kernel);
+
+#endif /* __INTEL_GEN4ASM_H__ */
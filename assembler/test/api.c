@@ -0,0 +1,344 @@
+/*
+ * Copyright © 2017 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Assemble the script tests from memory through libintel-gen4asm, and check
+ * the label exports and the kernel cache.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "brw_eu.h"
+#include "intel_gen4asm.h"
+
+#ifdef NDEBUG
+#error "the checks need their asserts"
+#endif
+
+static const char *tests[] = {
+	"mov", "frc", "rndd", "rndu", "rnde", "rndz", "lzd", "not", "immediate",
+};
+
+static char *read_file(const char *name, size_t *size)
+{
+	const char *srcdir = getenv("srcdir");
+	char path[1024];
+	char *buf;
+	FILE *f;
+	long len;
+
+	snprintf(path, sizeof(path), "%s/test/%s", srcdir ?: ".", name);
+	f = fopen(path, "r");
+	if (!f) {
+		perror(path);
+		exit(1);
+	}
+
+	fseek(f, 0, SEEK_END);
+	len = ftell(f);
+	rewind(f);
+
+	buf = calloc(1, len + 1);
+	if (!buf || fread(buf, 1, len, f) != len) {
+		perror(path);
+		exit(1);
+	}
+	fclose(f);
+
+	*size = len;
+	return buf;
+}
+
+/* the format of intel-gen4asm without -b */
+static char *format_kernel(const struct gen4asm_kernel *kernel)
+{
+	char *text = calloc(1, kernel->size / 16 * 64 + 1);
+	char *p = text;
+	size_t i;
+
+	for (i = 0; i < kernel->size; i += 16) {
+		const unsigned int *dw =
+			(const unsigned int *)((const char *)kernel->code + i);
+
+		p += sprintf(p, "   { 0x%08x, 0x%08x, 0x%08x, 0x%08x },\n",
+			     dw[0], dw[1], dw[2], dw[3]);
+	}
+
+	return text;
+}
+
+static void test_expected(void)
+{
+	struct gen4asm_options options = { .gen = 40 };
+	struct gen4asm_kernel *kernel;
+	char name[64], *source, *expected, *text;
+	size_t size, expected_size;
+	int i;
+
+	for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+		snprintf(name, sizeof(name), "%s.g4a", tests[i]);
+		source = read_file(name, &size);
+		snprintf(name, sizeof(name), "%s.expected", tests[i]);
+		expected = read_file(name, &expected_size);
+
+		options.filename = tests[i];
+		assert(gen4asm_assemble(&options, source, size, &kernel) == 0);
+		text = format_kernel(kernel);
+		assert(strcmp(text, expected) == 0);
+		free(text);
+		gen4asm_kernel_free(kernel);
+
+		free(expected);
+		free(source);
+	}
+}
+
+static const char labels_source[] =
+	"start:\n"
+	"mov (1) g0<1>UD g1<0,1,0>UD { align1 };\n"
+	"main:\n"
+	"mov (1) g0<1>UD g1<0,1,0>UD { align1 };\n"
+	"mov (1) g0<1>UD g1<0,1,0>UD { align1 };\n";
+
+static void test_labels(void)
+{
+	static const char * const entry_points[] = { "main", NULL };
+	struct gen4asm_options options = { .gen = 40 };
+	struct gen4asm_kernel *kernel;
+
+	assert(gen4asm_assemble(&options, labels_source,
+				strlen(labels_source), &kernel) == 0);
+	assert(kernel->size == 3 * 16);
+	assert(kernel->num_labels == 2);
+	assert(strcmp(kernel->labels[0].name, "start") == 0);
+	assert(kernel->labels[0].ip == 0);
+	assert(strcmp(kernel->labels[1].name, "main") == 0);
+	assert(kernel->labels[1].ip == 1);
+	gen4asm_kernel_free(kernel);
+
+	/* entry points are padded with nops to 4 instructions */
+	options.entry_points = entry_points;
+	assert(gen4asm_assemble(&options, labels_source,
+				strlen(labels_source), &kernel) == 0);
+	assert(kernel->size == 6 * 16);
+	assert(kernel->labels[1].ip == 4);
+	gen4asm_kernel_free(kernel);
+
+	/* gen5 exports in 64 bit units */
+	options.gen = 50;
+	options.entry_points = NULL;
+	assert(gen4asm_assemble(&options, labels_source,
+				strlen(labels_source), &kernel) == 0);
+	assert(kernel->labels[1].ip == 2);
+	gen4asm_kernel_free(kernel);
+}
+
+/* compactable on gen6 and later, but for the last on gen7 and later */
+static const char compact_source[] =
+	"mov (8) g2<1>UD g1<8,8,1>UD { align1 };\n"
+	"add (8) g2<1>F g3<8,8,1>F g4<8,8,1>F { align1 };\n"
+	"main:\n"
+	"mov (8) g2<1>UD g1<8,8,1>UD { align1 };\n"
+	"mov (1) g0<1>UD g1<0,1,0>UD { align1 };\n";
+
+/* expand the compacted kernel and check it against the full one */
+static void check_uncompacted(int gen, const struct gen4asm_kernel *kernel,
+			      const struct gen4asm_kernel *full)
+{
+	static struct brw_context brw;
+	struct brw_instruction insn;
+	const char *p = kernel->code, *end = p + kernel->size;
+	size_t offset = 0;
+
+	brw_init_context(&brw, gen);
+	brw_init_compaction_tables(&brw.intel);
+
+	while (p < end) {
+		const unsigned int *dw = (const unsigned int *)p;
+
+		if (dw[0] & (1 << 29)) {
+			struct brw_compact_instruction compacted;
+
+			memcpy(&compacted, p, sizeof(compacted));
+			brw_uncompact_instruction(&brw.intel, &insn,
+						  &compacted);
+			p += sizeof(compacted);
+		} else {
+			memcpy(&insn, p, sizeof(insn));
+			p += sizeof(insn);
+		}
+
+		/* the compacted NOP padding the end */
+		if (offset == full->size) {
+			assert(insn.header.opcode == BRW_OPCODE_NOP);
+			continue;
+		}
+
+		assert(offset < full->size &&
+		       memcmp(&insn, (const char *)full->code + offset,
+			      sizeof(insn)) == 0);
+		offset += sizeof(insn);
+	}
+
+	assert(offset == full->size);
+}
+
+static void test_compact(void)
+{
+	static const char * const entry_points[] = { "main", NULL };
+	static const int gens[] = { 70, 80 };
+	struct gen4asm_options options = { .compact = true };
+	struct gen4asm_kernel *kernel, *full;
+	int i;
+
+	/* three compacted instructions, one full and a compacted NOP */
+	for (i = 0; i < sizeof(gens) / sizeof(gens[0]); i++) {
+		options.gen = gens[i];
+		options.compact = true;
+		assert(gen4asm_assemble(&options, compact_source,
+					strlen(compact_source), &kernel) == 0);
+		options.compact = false;
+		assert(gen4asm_assemble(&options, compact_source,
+					strlen(compact_source), &full) == 0);
+
+		assert(kernel->size == 3 * 8 + 16 + 8);
+		assert(full->size == 4 * 16);
+		assert(kernel->labels[0].ip == 2);
+		check_uncompacted(gens[i], kernel, full);
+
+		gen4asm_kernel_free(full);
+		gen4asm_kernel_free(kernel);
+	}
+
+	/* labels are in 64 bit units, entry points still on 64 bytes */
+	options.gen = 80;
+	options.compact = true;
+	options.entry_points = entry_points;
+	assert(gen4asm_assemble(&options, labels_source,
+				strlen(labels_source), &kernel) == 0);
+	assert(kernel->size == 6 * 16);
+	assert(kernel->labels[0].ip == 0);
+	assert(kernel->labels[1].ip == 8);
+	gen4asm_kernel_free(kernel);
+
+	/* there is no compaction before gen6 */
+	options.gen = 40;
+	assert(gen4asm_assemble(&options, labels_source,
+				strlen(labels_source), &kernel) == 0);
+	options.compact = false;
+	assert(gen4asm_assemble(&options, labels_source,
+				strlen(labels_source), &full) == 0);
+	assert(kernel->size == full->size);
+	assert(memcmp(kernel->code, full->code, full->size) == 0);
+	assert(kernel->labels[1].ip == full->labels[1].ip);
+	gen4asm_kernel_free(full);
+	gen4asm_kernel_free(kernel);
+
+	/* jump distances given as numbers would be off once compacted */
+	options.gen = 70;
+	options.compact = true;
+	options.entry_points = NULL;
+	assert(gen4asm_assemble(&options, "jmpi 2;\n", 8, &kernel) == -EINVAL);
+	assert(kernel == NULL);
+}
+
+static void test_errors(void)
+{
+	static const char bad[] = "mov (1) g0<1>UD;\n";
+	static const char undefined[] = "jmpi nowhere;\n";
+	struct gen4asm_options options = { .gen = 40 };
+	struct gen4asm_kernel *kernel;
+
+	assert(gen4asm_assemble(&options, bad, strlen(bad), &kernel) == -EINVAL);
+	assert(kernel == NULL);
+	assert(gen4asm_assemble(&options, undefined, strlen(undefined),
+				&kernel) == -ENOENT);
+	assert(gen4asm_assemble(&options, "", 0, &kernel) == -EINVAL);
+
+	options.gen = 30;
+	assert(gen4asm_assemble(&options, labels_source,
+				strlen(labels_source), &kernel) == -EINVAL);
+
+	/* the parser state does not leak into the next call */
+	options.gen = 40;
+	assert(gen4asm_assemble(&options, labels_source,
+				strlen(labels_source), &kernel) == 0);
+	gen4asm_kernel_free(kernel);
+}
+
+static void test_cache(void)
+{
+	struct gen4asm_options options = { .gen = 40 };
+	struct gen4asm_kernel *kernel, *cached;
+	char dir[] = "/tmp/gen4asm-cache.XXXXXX";
+	char cmd[64];
+
+	assert(mkdtemp(dir) != NULL);
+
+	assert(gen4asm_assemble_cached(dir, &options, labels_source,
+				       strlen(labels_source), &kernel) == 0);
+	assert(gen4asm_assemble_cached(dir, &options, labels_source,
+				       strlen(labels_source), &cached) == 1);
+	assert(kernel->size == cached->size);
+	assert(memcmp(kernel->code, cached->code, kernel->size) == 0);
+	assert(kernel->num_labels == cached->num_labels);
+	assert(strcmp(cached->labels[1].name, "main") == 0);
+	assert(cached->labels[1].ip == kernel->labels[1].ip);
+	gen4asm_kernel_free(cached);
+	gen4asm_kernel_free(kernel);
+
+	/* options that change the output miss */
+	options.gen = 50;
+	assert(gen4asm_assemble_cached(dir, &options, labels_source,
+				       strlen(labels_source), &kernel) == 0);
+	gen4asm_kernel_free(kernel);
+	options.compact = true;
+	assert(gen4asm_assemble_cached(dir, &options, labels_source,
+				       strlen(labels_source), &kernel) == 0);
+	gen4asm_kernel_free(kernel);
+
+	/* failures are not cached */
+	assert(gen4asm_assemble_cached(dir, &options, "jmpi nowhere;\n", 14,
+				       &kernel) == -ENOENT);
+	assert(gen4asm_assemble_cached(dir, &options, "jmpi nowhere;\n", 14,
+				       &kernel) == -ENOENT);
+
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+	assert(system(cmd) == 0);
+}
+
+int main(int argc, char **argv)
+{
+	test_expected();
+	test_labels();
+	test_compact();
+	test_errors();
+	test_cache();
+
+	return 0;
+}
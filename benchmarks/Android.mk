@@ -27,7 +27,8 @@ define add_benchmark
 
     LOCAL_SHARED_LIBRARIES := libpciaccess  \
                               libdrm        \
-                              libdrm_intel
+                              libdrm_intel  \
+                              libz
 
     include $(BUILD_EXECUTABLE)
 endef
@@ -38,126 +38,362 @@
 #include <sys/time.h>
 #include <time.h>
 #include <assert.h>
+#include <pthread.h>
+#include <zlib.h>
 
 #include "drm.h"
 #include "ioctl_wrappers.h"
 #include "drmtest.h"
 #include "intel_io.h"
+#include "igt_aux.h"
+#include "igt_calibration.h"
+#include "igt_rand.h"
 #include "igt_stats.h"
 
-enum {
-	ADD_BO = 0,
-	DEL_BO,
-	ADD_CTX,
-	DEL_CTX,
-	EXEC,
-	WAIT,
+#include "gem_exec_trace.h"
+
+struct trace_reader {
+	const char *filename;
+	uint8_t *map;
+	size_t size;
+	uint32_t version;
+
+	/* v2: the chunks, either from the index or found by walking the file */
+	const struct trace_index_entry *index;
+	unsigned int index_count, next_chunk;
+	uint8_t *pos;
+
+	uint8_t *buf;
+	size_t buf_size;
+
+	/* the records of the current chunk */
+	uint8_t *ptr, *end;
+
+	bool corrupt;
 };
 
-struct trace_add_bo {
-	uint32_t handle;
-	uint64_t size;
-} __attribute__((packed));
+static int trace_reader_open(struct trace_reader *r, const char *filename)
+{
+	const struct trace_version *tv;
+	struct stat st;
+	int fd;
+
+	memset(r, 0, sizeof(*r));
+	r->filename = filename;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return -errno;
 
-struct trace_del_bo {
-	uint32_t handle;
-} __attribute__((packed));
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -errno;
+	}
+
+	if (st.st_size < (off_t)sizeof(*tv)) {
+		fprintf(stderr, "%s: truncated\n", filename);
+		close(fd);
+		return -EINVAL;
+	}
+
+	/* Private and writable, replay patches the relocations in place */
+	r->map = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (r->map == MAP_FAILED)
+		return -errno;
+
+	r->size = st.st_size;
+	madvise(r->map, r->size, MADV_SEQUENTIAL);
+
+	tv = (struct trace_version *)r->map;
+	if (tv->magic != TRACE_MAGIC) {
+		fprintf(stderr, "%s: invalid magic\n", filename);
+		goto err;
+	}
 
-struct trace_add_ctx {
-	uint32_t handle;
-} __attribute__((packed));
+	r->version = tv->version;
+	switch (r->version) {
+	case 1:
+		r->ptr = (void *)(tv + 1);
+		r->end = r->map + r->size;
+		break;
+
+	case 2:
+		r->pos = (void *)(tv + 1);
+		if (r->size >= sizeof(*tv) + sizeof(struct trace_index)) {
+			const struct trace_index *idx =
+				(void *)(r->map + r->size - sizeof(*idx));
+
+			if (idx->magic == TRACE_INDEX_MAGIC &&
+			    idx->offset + idx->count * sizeof(*r->index) ==
+			    r->size - sizeof(*idx)) {
+				r->index = (void *)(r->map + idx->offset);
+				r->index_count = idx->count;
+			}
+		}
+		break;
 
-struct trace_del_ctx {
-	uint32_t handle;
-} __attribute__((packed));
+	default:
+		fprintf(stderr, "%s: unhandled version %d\n",
+			filename, r->version);
+		goto err;
+	}
 
-struct trace_exec {
-	uint32_t object_count;
-	uint64_t flags;
-	uint32_t context;
-}__attribute__((packed));
+	return 0;
 
-struct trace_exec_object {
-	uint32_t handle;
-	uint32_t relocation_count;
-	uint64_t alignment;
-	uint64_t offset;
-	uint64_t flags;
-	uint64_t rsvd1;
-	uint64_t rsvd2;
-}__attribute__((packed));
+err:
+	munmap(r->map, r->size);
+	r->map = NULL;
+	return -EINVAL;
+}
 
-struct trace_wait {
-	uint32_t handle;
-} __attribute__((packed));
+static void trace_reader_close(struct trace_reader *r)
+{
+	if (r->map)
+		munmap(r->map, r->size);
+	free(r->buf);
+	memset(r, 0, sizeof(*r));
+}
 
-static uint32_t hars_petruska_f54_1_random(void)
+/* Make the next chunk's records current, returns false after the last one */
+static bool trace_reader_next_chunk(struct trace_reader *r)
 {
-	static uint32_t state = 0x12345678;
+	const struct trace_chunk *c;
+	uint8_t *data;
+
+	if (r->version != 2)
+		return false;
+
+	if (r->index) {
+		if (r->next_chunk == r->index_count)
+			return false;
+
+		r->pos = r->map + r->index[r->next_chunk++].offset;
+	}
+
+	if (r->pos + sizeof(*c) > r->map + r->size)
+		return false;
+
+	c = (void *)r->pos;
+	if (c->magic != TRACE_CHUNK_MAGIC) {
+		if (c->magic != TRACE_INDEX_MAGIC || r->index) {
+			fprintf(stderr, "%s: corrupt chunk at offset %zd\n",
+				r->filename, r->pos - r->map);
+			r->corrupt = true;
+		}
+		return false;
+	}
+
+	data = (void *)(c + 1);
+	if (data + c->size > r->map + r->size) {
+		/* An unindexed trace may have been cut short by a crash */
+		fprintf(stderr, "%s: truncated chunk at offset %zd\n",
+			r->filename, r->pos - r->map);
+		r->corrupt = r->index != NULL;
+		return false;
+	}
+	r->pos = data + c->size;
+
+	if (c->flags & TRACE_CHUNK_DEFLATE) {
+		uLongf len = c->raw_size;
+
+		if (c->raw_size > r->buf_size) {
+			free(r->buf);
+			r->buf_size = c->raw_size;
+			r->buf = malloc(r->buf_size);
+			if (!r->buf) {
+				r->buf_size = 0;
+				return false;
+			}
+		}
+
+		if (uncompress(r->buf, &len, data, c->size) != Z_OK ||
+		    len != c->raw_size) {
+			fprintf(stderr, "%s: failed to inflate chunk\n",
+				r->filename);
+			r->corrupt = true;
+			return false;
+		}
+
+		data = r->buf;
+	}
+
+	r->ptr = data;
+	r->end = data + c->raw_size;
+	return true;
+}
 
-#define rol(x,k) ((x << k) | (x >> (32-k)))
-	return state = (state ^ rol (state, 5) ^ rol (state, 24)) + 0x37798849;
-#undef rol
+static size_t trace_payload_size(const struct trace_reader *r,
+				 uint8_t cmd, const uint8_t *ptr)
+{
+	switch (cmd) {
+	case ADD_BO: return sizeof(struct trace_add_bo);
+	case DEL_BO: return sizeof(struct trace_del_bo);
+	case ADD_CTX: return sizeof(struct trace_add_ctx);
+	case DEL_CTX: return sizeof(struct trace_del_ctx);
+	case WAIT: return sizeof(struct trace_wait);
+	case FENCE_OUT: return r->version > 1 ? sizeof(struct trace_fence) : 0;
+	case EXEC: {
+		const struct trace_exec *t = (const void *)ptr;
+		size_t len = sizeof(*t);
+
+		if (ptr + len > r->end)
+			return 0;
+
+		if (r->version > 1 && t->flags & I915_EXEC_FENCE_IN)
+			len += sizeof(struct trace_fence);
+
+		for (uint32_t i = 0; i < t->object_count; i++) {
+			const struct trace_exec_object *to =
+				(const void *)(ptr + len);
+
+			if (ptr + len + sizeof(*to) > r->end)
+				return 0;
+
+			len += sizeof(*to);
+			len += sizeof(struct drm_i915_gem_relocation_entry) *
+				(size_t)to->relocation_count;
+		}
+		return len;
+	}
+	default: return 0;
+	}
 }
 
-static double elapsed(const struct timespec *start, const struct timespec *end)
+/*
+ * Fetch the next record, returning its cmd (or -1 at the end of the trace)
+ * and pointing @payload at its contents. Payloads are only valid until the
+ * following chunk is read.
+ */
+static int trace_reader_next(struct trace_reader *r,
+			     uint64_t *timestamp, void **payload)
 {
-	return 1e3*(end->tv_sec - start->tv_sec) + 1e-6*(end->tv_nsec - start->tv_nsec);
+	size_t len;
+	uint8_t cmd = 0;
+
+	while (r->ptr >= r->end) {
+		if (!trace_reader_next_chunk(r))
+			return -1;
+	}
+
+	if (r->version > 1) {
+		const struct trace_record *rec = (void *)r->ptr;
+
+		if (r->ptr + sizeof(*rec) > r->end)
+			goto corrupt;
+
+		cmd = rec->cmd;
+		*timestamp = rec->timestamp;
+		r->ptr = (void *)(rec + 1);
+	} else {
+		cmd = *r->ptr++;
+		*timestamp = 0;
+	}
+
+	len = trace_payload_size(r, cmd, r->ptr);
+	if (!len || r->ptr + len > r->end)
+		goto corrupt;
+
+	*payload = r->ptr;
+	r->ptr += len;
+	return cmd;
+
+corrupt:
+	fprintf(stderr, "%s: unknown or truncated cmd: %x\n",
+		r->filename, cmd);
+	r->ptr = r->end;
+	r->version = 0; /* stop reading chunks */
+	r->corrupt = true;
+	return -1;
 }
 
+static uint32_t prng = 0x12345678;
+
 static uint32_t __gem_context_create(int fd)
 {
 	struct drm_i915_gem_context_create arg = {};
-	drmIoctl(fd, DRM_IOCTL_I915_GEM_CONTEXT_CREATE, &arg);
+	igt_ioctl(fd, DRM_IOCTL_I915_GEM_CONTEXT_CREATE, &arg);
 	return arg.ctx_id;
 }
 
-static double replay(const char *filename, long nop, long range)
+static uint64_t gettime_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void sleep_until_ns(uint64_t deadline)
+{
+	struct timespec ts = {
+		.tv_sec = deadline / 1000000000,
+		.tv_nsec = deadline % 1000000000,
+	};
+
+	/* Avoid the syscall when already late, e.g. catching up on a burst */
+	if (gettime_ns() >= deadline)
+		return;
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+/* How execs are spread out over time during replay */
+struct pacing {
+	enum {
+		PACE_NONE = 0, /* back to back */
+		PACE_RECORDED, /* the recorded gaps, multiplied by scale */
+		PACE_RATE, /* open-loop, rate execs per second */
+	} mode;
+	double scale;
+	double rate;
+};
+
+struct replay_result {
+	double elapsed; /* ms, or -1 on failure */
+	struct {
+		double mean, median, p99, max; /* us */
+	} latency;
+};
+
+/*
+ * Replay the trace, each exec being submitted as soon as the previous one
+ * returns or, when paced, at the time it is due. The submission latency of
+ * each exec is measured from when it was due (or issued, if not paced) to
+ * the return of the execbuf.
+ */
+static void replay(const char *filename, long nop, long range,
+		   const struct pacing *pace, struct replay_result *result)
 {
 	struct timespec t_start, t_end;
 	struct drm_i915_gem_execbuffer2 eb = {};
-	const struct trace_version {
-		uint32_t magic;
-		uint32_t version;
-	} *tv;
 	const uint32_t bbe = 0xa << 23;
 	struct drm_i915_gem_exec_object2 *exec_objects = NULL;
+	struct trace_reader r;
 	uint32_t *bo, *ctx;
 	int num_bo, num_ctx;
 	int max_objects = 0;
-	struct stat st;
-	uint8_t *ptr, *end;
-	int fd;
-
-	fd = open(filename, O_RDONLY);
-	if (fd < 0)
-		return -1;
-
-	if (fstat(fd, &st) < 0) {
-		close(fd);
-		return -1;
+	uint64_t timestamp, first_timestamp = 0, start;
+	unsigned long execs = 0;
+	igt_stats_t latency;
+	void *payload;
+	bool corrupt;
+	int cmd, fd;
+
+	result->elapsed = -1;
+
+	if (trace_reader_open(&r, filename))
+		return;
+
+	if (pace->mode == PACE_RECORDED && r.version < 2) {
+		fprintf(stderr, "%s: no timestamps recorded to pace by\n",
+			filename);
+		trace_reader_close(&r);
+		return;
 	}
 
-	ptr = mmap(0, st.st_size, PROT_WRITE, MAP_PRIVATE, fd, 0);
-	close(fd);
-
-	if (ptr == MAP_FAILED)
-		return -1;
-
-	madvise(ptr, st.st_size, MADV_SEQUENTIAL);
-	end = ptr + st.st_size;
-
-	tv = (struct trace_version *)ptr;
-	if (tv->magic != 0xdeadbeef) {
-		fprintf(stderr, "%s: invalid magic\n", filename);
-		return -1;
-	}
-	if (tv->version != 1) {
-		fprintf(stderr, "%s: unhandled version %d\n",
-			filename, tv->version);
-		return -1;
-	}
-	ptr = (void *)(tv + 1);
+	igt_stats_init_sketch(&latency, IGT_STATS_SKETCH_DEFAULT_PRECISION);
 
 	ctx = calloc(1024, sizeof(*ctx));
 	num_ctx = 1024;
@@ -178,14 +414,14 @@ static double replay(const char *filename, long nop, long range)
 	}
 
 	clock_gettime(CLOCK_MONOTONIC, &t_start);
-	do switch (*ptr++) {
+	start = gettime_ns();
+	while ((cmd = trace_reader_next(&r, &timestamp, &payload)) != -1) switch (cmd) {
 	case ADD_BO:
 		{
-			struct trace_add_bo *t = (void *)ptr;
-			ptr = (void *)(t + 1);
+			struct trace_add_bo *t = payload;
 
 			if (t->handle >= num_bo) {
-				int new_bo = ALIGN(t->handle, 4096);
+				int new_bo = ALIGN(t->handle + 1, 4096);
 				bo = realloc(bo, sizeof(*bo)*new_bo);
 				memset(bo + num_bo, 0, sizeof(*bo)*(new_bo - num_bo));
 				num_bo = new_bo;
@@ -196,8 +432,7 @@ static double replay(const char *filename, long nop, long range)
 		}
 	case DEL_BO:
 		{
-			struct trace_del_bo *t = (void *)ptr;
-			ptr = (void *)(t + 1);
+			struct trace_del_bo *t = payload;
 
 			assert(t->handle && t->handle < num_bo && bo[t->handle]);
 			gem_close(fd, bo[t->handle]);
@@ -206,11 +441,10 @@ static double replay(const char *filename, long nop, long range)
 		}
 	case ADD_CTX:
 		{
-			struct trace_add_ctx *t = (void *)ptr;
-			ptr = (void *)(t + 1);
+			struct trace_add_ctx *t = payload;
 
 			if (t->handle >= num_ctx) {
-				int new_ctx = ALIGN(t->handle, 1024);
+				int new_ctx = ALIGN(t->handle + 1, 1024);
 				ctx = realloc(ctx, sizeof(*ctx)*new_ctx);
 				memset(ctx + num_ctx, 0, sizeof(*ctx)*(new_ctx - num_ctx));
 				num_ctx = new_ctx;
@@ -221,8 +455,7 @@ static double replay(const char *filename, long nop, long range)
 		}
 	case DEL_CTX:
 		{
-			struct trace_del_ctx *t = (void *)ptr;
-			ptr = (void *)(t + 1);
+			struct trace_del_ctx *t = payload;
 
 			assert(t->handle < num_ctx && ctx[t->handle]);
 			gem_context_destroy(fd, ctx[t->handle]);
@@ -231,11 +464,16 @@ static double replay(const char *filename, long nop, long range)
 		}
 	case EXEC:
 		{
-			struct trace_exec *t = (void *)ptr;
-			ptr = (void *)(t + 1);
+			struct trace_exec *t = payload;
+			uint8_t *ptr = (void *)(t + 1);
+			uint64_t due = 0;
+
+			/* Fences are not replayed, only the ordering they imply */
+			if (r.version > 1 && t->flags & I915_EXEC_FENCE_IN)
+				ptr += sizeof(struct trace_fence);
 
 			eb.buffer_count = t->object_count;
-			eb.flags = t->flags;
+			eb.flags = t->flags & ~(I915_EXEC_FENCE_IN | I915_EXEC_FENCE_OUT);
 			eb.rsvd1 = ctx[t->context];
 
 			if (eb.buffer_count >= max_objects) {
@@ -276,145 +514,1270 @@ static double replay(const char *filename, long nop, long range)
 				sizeof(*exec_objects)))->handle = bo[0];
 
 			if (nop > 0) {
-				eb.batch_start_offset = hars_petruska_f54_1_random();
+				eb.batch_start_offset = hars_petruska_f54_1_random(&prng);
 				eb.batch_start_offset =
 					((uint64_t)eb.batch_start_offset * range) >> 32;
 				eb.batch_start_offset = ALIGN(eb.batch_start_offset, 64);
 			}
+
+			switch (pace->mode) {
+			case PACE_NONE:
+				due = gettime_ns();
+				break;
+			case PACE_RECORDED:
+				if (!execs)
+					first_timestamp = timestamp;
+				due = start + (timestamp - first_timestamp) * pace->scale;
+				sleep_until_ns(due);
+				break;
+			case PACE_RATE:
+				due = start + execs * 1e9 / pace->rate;
+				sleep_until_ns(due);
+				break;
+			}
+
 			gem_execbuf(fd, &eb);
+			igt_stats_push(&latency, gettime_ns() - due);
+			execs++;
 			break;
 		}
 
 	case WAIT:
 		{
-			struct trace_wait *t = (void *)ptr;
-			ptr = (void *)(t + 1);
+			struct trace_wait *t = payload;
 
 			assert(t->handle && t->handle < num_bo && bo[t->handle]);
 			gem_wait(fd, bo[t->handle], NULL);
 			break;
 		}
 
-	default:
-		fprintf(stderr, "Unknown cmd: %x\n", *ptr);
-		return -1;
-	} while (ptr < end);
+	case FENCE_OUT:
+		break;
+	}
 	clock_gettime(CLOCK_MONOTONIC, &t_end);
 
-	return elapsed(&t_start, &t_end);
+	free(exec_objects);
+	corrupt = r.corrupt;
+	trace_reader_close(&r);
+
+	if (!corrupt) {
+		result->elapsed = 1e3 * igt_elapsed(&t_start, &t_end);
+		if (execs) {
+			result->latency.mean = 1e-3 * igt_stats_get_mean(&latency);
+			result->latency.median = 1e-3 * igt_stats_get_median(&latency);
+			result->latency.p99 = 1e-3 * igt_stats_get_percentile(&latency, 99);
+			result->latency.max = 1e-3 * igt_stats_get_max(&latency);
+		}
+	}
+	igt_stats_fini(&latency);
 }
 
-static long calibrate_nop(int usecs)
+#define LOCAL_I915_EXEC_BSD_SHIFT      (13)
+#define LOCAL_I915_EXEC_BSD_MASK       (3 << LOCAL_I915_EXEC_BSD_SHIFT)
+
+#define ANALYSIS_SAMPLES 32
+#define ANALYSIS_HOT 10
+
+static const char *engine_names[] = {
+	"default", "render", "bsd", "blt", "vebox", "bsd1", "bsd2", "other"
+};
+
+struct analysis {
+	/* ns since the start of the trace for v2, number of execs for v1 */
+	uint64_t now;
+
+	struct analysis_bo {
+		uint64_t size;
+		uint64_t created;
+		unsigned long uses;
+		bool live;
+	} *bo;
+	uint32_t num_bo;
+
+	uint8_t *ctx_used;
+	uint32_t num_ctx;
+
+	/* working set, bucketed over time, rebucketed as the trace grows */
+	struct {
+		uint64_t bytes;
+		unsigned int count;
+	} ws[ANALYSIS_SAMPLES];
+	uint64_t ws_width;
+	unsigned int ws_last;
+
+	struct {
+		uint32_t handle;
+		unsigned long uses;
+		uint64_t size;
+	} hot[ANALYSIS_HOT];
+
+	igt_stats_t objects, relocs, lifetime;
+
+	uint64_t live_bytes, peak_bytes;
+	unsigned long live_bo, peak_bo;
+	unsigned long num_created, num_still_open;
+	unsigned long ctx_created, ctx_live, ctx_peak, ctx_executed;
+	unsigned long execs, waits, fences;
+	unsigned long engines[ARRAY_SIZE(engine_names)];
+};
+
+static void analysis_ws_update(struct analysis *a)
 {
-	const uint32_t bbe = 0xa << 23;
-	int fd = drm_open_driver(DRIVER_INTEL);
-	struct drm_i915_gem_exec_object2 obj = {};
-	struct drm_i915_gem_execbuffer2 eb = { .buffer_count = 1, .buffers_ptr = (uintptr_t)&obj};
-	unsigned long size, last_size;
-
-	size = 256*1024;
-	do {
-		struct timespec t_start, t_end;
-
-		obj.handle = gem_create(fd, size);
-		gem_write(fd, obj.handle, size - sizeof(bbe), &bbe, sizeof(bbe));
-		gem_execbuf(fd, &eb);
-		gem_sync(fd, obj.handle);
-
-		clock_gettime(CLOCK_MONOTONIC, &t_start);
-		for (int loop = 0; loop < 9; loop++)
-			gem_execbuf(fd, &eb);
-		gem_sync(fd, obj.handle);
-		clock_gettime(CLOCK_MONOTONIC, &t_end);
+	uint64_t idx = a->now / a->ws_width;
 
-		gem_close(fd, obj.handle);
+	while (idx >= ANALYSIS_SAMPLES) {
+		for (int i = 0; i < ANALYSIS_SAMPLES / 2; i++) {
+			a->ws[i].bytes = max(a->ws[2*i].bytes, a->ws[2*i+1].bytes);
+			a->ws[i].count = max(a->ws[2*i].count, a->ws[2*i+1].count);
+		}
+		memset(&a->ws[ANALYSIS_SAMPLES / 2], 0,
+		       sizeof(a->ws) / 2);
 
-		last_size = size;
-		size = 9e-3*usecs / elapsed(&t_start, &t_end) * size;
-		size = ALIGN(size, 4096);
-	} while (size != last_size);
+		a->ws_last /= 2;
+		a->ws_width *= 2;
+		idx = a->now / a->ws_width;
+	}
 
-	close(fd);
-	return size;
+	/* Carry the current working set over the idle buckets */
+	for (unsigned int i = a->ws_last; i <= idx; i++) {
+		a->ws[i].bytes = max(a->ws[i].bytes, a->live_bytes);
+		a->ws[i].count = max(a->ws[i].count, (unsigned int)a->live_bo);
+	}
+	a->ws_last = idx;
+}
+
+static struct analysis_bo *analysis_bo(struct analysis *a, uint32_t handle)
+{
+	if (handle >= a->num_bo) {
+		uint32_t new_bo = ALIGN(handle + 1, 4096);
+
+		a->bo = realloc(a->bo, sizeof(*a->bo) * new_bo);
+		igt_assert(a->bo);
+		memset(a->bo + a->num_bo, 0,
+		       sizeof(*a->bo) * (new_bo - a->num_bo));
+		a->num_bo = new_bo;
+	}
+
+	return &a->bo[handle];
+}
+
+static void analysis_retire(struct analysis *a, uint32_t handle)
+{
+	struct analysis_bo *bo = &a->bo[handle];
+	int i;
+
+	igt_stats_push(&a->lifetime, a->now - bo->created);
+
+	i = ANALYSIS_HOT;
+	while (i && a->hot[i - 1].uses < bo->uses) {
+		if (i < ANALYSIS_HOT)
+			a->hot[i] = a->hot[i - 1];
+		i--;
+	}
+	if (i < ANALYSIS_HOT) {
+		a->hot[i].handle = handle;
+		a->hot[i].uses = bo->uses;
+		a->hot[i].size = bo->size;
+	}
+
+	a->live_bytes -= bo->size;
+	a->live_bo--;
+	bo->live = false;
+}
+
+static void analysis_report(const char *filename, struct analysis *a,
+			    bool timed)
+{
+	const char *unit = timed ? "ms" : "execs";
+	double scale = timed ? 1e-6 : 1;
+
+	printf("%s:\n", filename);
+	if (timed)
+		printf("  duration: %.3fms, %lu execs, %lu waits, %lu fences\n",
+		       a->now * 1e-6, a->execs, a->waits, a->fences);
+	else
+		printf("  %lu execs, %lu waits\n", a->execs, a->waits);
+
+	printf("  contexts: %lu created, %lu peak, %lu used by execbuf\n",
+	       a->ctx_created, a->ctx_peak, a->ctx_executed);
+
+	if (a->execs) {
+		printf("  objects per exec: mean %.1f, median %.0f, p99 %.0f, max %"PRIu64"\n",
+		       igt_stats_get_mean(&a->objects),
+		       igt_stats_get_median(&a->objects),
+		       igt_stats_get_percentile(&a->objects, 99),
+		       igt_stats_get_max(&a->objects));
+		printf("  relocations per exec: mean %.1f, median %.0f, p99 %.0f, max %"PRIu64"\n",
+		       igt_stats_get_mean(&a->relocs),
+		       igt_stats_get_median(&a->relocs),
+		       igt_stats_get_percentile(&a->relocs, 99),
+		       igt_stats_get_max(&a->relocs));
+
+		printf("  engines:");
+		for (unsigned int i = 0; i < ARRAY_SIZE(engine_names); i++) {
+			if (!a->engines[i])
+				continue;
+			printf(" %s %lu (%.1f%%)", engine_names[i],
+			       a->engines[i], 100. * a->engines[i] / a->execs);
+		}
+		printf("\n");
+	}
+
+	printf("  buffers: %lu created, peak working set %.2fMiB in %lu objects\n",
+	       a->num_created, a->peak_bytes / (1024. * 1024.), a->peak_bo);
+
+	if (a->lifetime.n_values)
+		printf("  lifetime (%s): median %.3f, p90 %.3f, p99 %.3f, max %.3f; %lu still open at the end\n",
+		       unit,
+		       scale * igt_stats_get_median(&a->lifetime),
+		       scale * igt_stats_get_percentile(&a->lifetime, 90),
+		       scale * igt_stats_get_percentile(&a->lifetime, 99),
+		       scale * igt_stats_get_max(&a->lifetime),
+		       a->num_still_open);
+
+	printf("  working set over time (%s):\n", unit);
+	for (unsigned int i = 0; i <= a->ws_last; i++)
+		printf("    %12.3f - %12.3f: %8u objects, %10.2fMiB\n",
+		       scale * i * a->ws_width,
+		       scale * (i + 1) * a->ws_width,
+		       a->ws[i].count, a->ws[i].bytes / (1024. * 1024.));
+
+	printf("  hot handles:\n");
+	for (int i = 0; i < ANALYSIS_HOT && a->hot[i].uses; i++)
+		printf("    %8u: %lu uses, %"PRIu64" bytes\n",
+		       a->hot[i].handle, a->hot[i].uses, a->hot[i].size);
+}
+
+/*
+ * Walk through the trace without touching the GPU, and summarise what the
+ * workload asked of it.
+ */
+static int analyze(const char *filename)
+{
+	struct trace_reader r;
+	struct analysis a = {};
+	uint64_t timestamp;
+	void *payload;
+	int cmd, ret;
+
+	if (trace_reader_open(&r, filename))
+		return -1;
+
+	a.ws_width = 1;
+	igt_stats_init_sketch(&a.objects, IGT_STATS_SKETCH_DEFAULT_PRECISION);
+	igt_stats_init_sketch(&a.relocs, IGT_STATS_SKETCH_DEFAULT_PRECISION);
+	igt_stats_init_sketch(&a.lifetime, IGT_STATS_SKETCH_DEFAULT_PRECISION);
+
+	while ((cmd = trace_reader_next(&r, &timestamp, &payload)) != -1) {
+		if (r.version > 1)
+			a.now = timestamp;
+		analysis_ws_update(&a);
+
+		switch (cmd) {
+		case ADD_BO: {
+			struct trace_add_bo *t = payload;
+			struct analysis_bo *bo = analysis_bo(&a, t->handle);
+
+			if (bo->live)
+				analysis_retire(&a, t->handle);
+
+			bo->size = t->size;
+			bo->created = a.now;
+			bo->uses = 0;
+			bo->live = true;
+
+			a.num_created++;
+			a.live_bytes += t->size;
+			if (++a.live_bo > a.peak_bo)
+				a.peak_bo = a.live_bo;
+			if (a.live_bytes > a.peak_bytes)
+				a.peak_bytes = a.live_bytes;
+			break;
+		}
+
+		case DEL_BO: {
+			struct trace_del_bo *t = payload;
+
+			if (t->handle < a.num_bo && a.bo[t->handle].live)
+				analysis_retire(&a, t->handle);
+			break;
+		}
+
+		case ADD_CTX:
+			a.ctx_created++;
+			if (++a.ctx_live > a.ctx_peak)
+				a.ctx_peak = a.ctx_live;
+			break;
+
+		case DEL_CTX:
+			if (a.ctx_live)
+				a.ctx_live--;
+			break;
+
+		case EXEC: {
+			struct trace_exec *t = payload;
+			uint8_t *ptr = (void *)(t + 1);
+			unsigned int engine, relocs = 0;
+
+			if (r.version > 1 && t->flags & I915_EXEC_FENCE_IN)
+				ptr += sizeof(struct trace_fence);
+
+			for (uint32_t i = 0; i < t->object_count; i++) {
+				struct trace_exec_object *to = (void *)ptr;
+
+				analysis_bo(&a, to->handle)->uses++;
+				relocs += to->relocation_count;
+
+				ptr = (void *)(to + 1);
+				ptr += sizeof(struct drm_i915_gem_relocation_entry) * to->relocation_count;
+			}
+
+			igt_stats_push(&a.objects, t->object_count);
+			igt_stats_push(&a.relocs, relocs);
+
+			engine = t->flags & I915_EXEC_RING_MASK;
+			if (engine == I915_EXEC_BSD) {
+				switch (t->flags & LOCAL_I915_EXEC_BSD_MASK) {
+				case 1 << LOCAL_I915_EXEC_BSD_SHIFT: engine = 5; break;
+				case 2 << LOCAL_I915_EXEC_BSD_SHIFT: engine = 6; break;
+				}
+			}
+			if (engine >= ARRAY_SIZE(engine_names))
+				engine = ARRAY_SIZE(engine_names) - 1;
+			a.engines[engine]++;
+
+			if (t->context >= a.num_ctx) {
+				uint32_t new_ctx = ALIGN(t->context + 1, 1024);
+
+				a.ctx_used = realloc(a.ctx_used, new_ctx);
+				igt_assert(a.ctx_used);
+				memset(a.ctx_used + a.num_ctx, 0,
+				       new_ctx - a.num_ctx);
+				a.num_ctx = new_ctx;
+			}
+			a.ctx_used[t->context] = 1;
+
+			a.execs++;
+			if (r.version == 1)
+				a.now++;
+			break;
+		}
+
+		case WAIT:
+			a.waits++;
+			break;
+
+		case FENCE_OUT:
+			a.fences++;
+			break;
+		}
+
+		analysis_ws_update(&a);
+	}
+
+	for (uint32_t i = 0; i < a.num_bo; i++) {
+		if (a.bo[i].live) {
+			analysis_retire(&a, i);
+			a.num_still_open++;
+		}
+	}
+
+	for (uint32_t i = 0; i < a.num_ctx; i++)
+		a.ctx_executed += a.ctx_used[i];
+
+	ret = r.corrupt ? -1 : 0;
+	if (ret == 0)
+		analysis_report(filename, &a, r.version > 1);
+
+	igt_stats_fini(&a.objects);
+	igt_stats_fini(&a.relocs);
+	igt_stats_fini(&a.lifetime);
+	free(a.ctx_used);
+	free(a.bo);
+	trace_reader_close(&r);
+
+	return ret;
+}
+
+/*
+ * Parallel replay: the trace is decoded up front into one queue per
+ * context for the execs, plus a control queue (0) keeping the context
+ * lifetimes, the waits and the lifetimes of shared buffers in trace
+ * order. The queues are spread over a pool of threads, and an op only
+ * waits for ops of other queues that it depends upon: the creation of the
+ * buffers and context it uses, the last write to a buffer it reads, the
+ * last accesses to a buffer it writes, and the last wait on the control
+ * queue. The trace does not tell which thread waited, so a wait orders
+ * all later execs.
+ *
+ * Buffers and contexts are renumbered by incarnation so that handles
+ * reused by the traced process map onto separate slots, and the handle
+ * tables never need to grow while the workers are running.
+ */
+#define LOCAL_EXEC_OBJECT_WRITE (1<<2)
+
+struct par_dep {
+	uint32_t queue;
+	uint32_t pos; /* satisfied once the queue has completed pos ops */
+};
+
+struct par_dep_set {
+	struct par_dep *deps;
+	unsigned int count, size;
+};
+
+struct par_op {
+	uint8_t cmd;
+	uint32_t queue, pos;
+	uint32_t num_deps;
+	struct par_dep *deps;
+	union {
+		struct {
+			uint32_t bo;
+			uint64_t size;
+		} add_bo;
+		struct {
+			uint32_t bo;
+		} del_bo, wait;
+		struct {
+			uint32_t ctx;
+		} add_ctx, del_ctx;
+		struct {
+			struct drm_i915_gem_execbuffer2 eb;
+			uint32_t ctx;
+			uint64_t due; /* ns since the start of replay */
+		} exec;
+	};
+};
+
+struct par_queue {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	uint32_t completed;
+	uint32_t length;
+};
+
+/* What the decoder needs to know about each incarnation of a buffer */
+struct par_bo {
+	uint64_t size;
+	bool created;
+	struct par_dep add;
+	struct par_dep last_write;
+	struct par_dep_set readers; /* since the last write */
+	struct par_dep_set users;
+	bool written;
+};
+
+struct par_replay {
+	int fd;
+	const struct pacing *pace;
+	uint64_t start;
+
+	struct par_op *ops;
+	unsigned long num_ops, max_ops;
+
+	struct par_queue *queues;
+	uint32_t num_queues, max_queues;
+
+	/* indexed by incarnation, 0 being the nop batch / default context */
+	uint32_t *bo_handles, *ctx_handles;
+	struct par_bo *bo;
+	uint32_t num_bo, max_bo;
+	struct par_ctx {
+		uint32_t queue;
+		struct par_dep add;
+	} *ctx;
+	uint32_t num_ctx, max_ctx;
+
+	/* trace handle to its live incarnation */
+	uint32_t *bo_map, *ctx_map;
+	uint32_t bo_map_size, ctx_map_size;
+};
+
+struct par_worker {
+	pthread_t thread;
+	struct par_replay *p;
+	struct par_op **ops;
+	unsigned long count, size;
+	igt_stats_t latency;
+};
+
+static void *grow(void *ptr, uint32_t *size, uint32_t want, size_t elem)
+{
+	uint32_t old = *size;
+
+	if (want < old)
+		return ptr;
+
+	*size = ALIGN(want + 1, 1024);
+	ptr = realloc(ptr, *size * elem);
+	igt_assert(ptr);
+	memset((char *)ptr + old * elem, 0, (*size - old) * elem);
+	return ptr;
+}
+
+static void dep_set_add(struct par_dep_set *set, struct par_dep dep)
+{
+	if (!dep.pos)
+		return;
+
+	/* Queues complete in order, only the latest op of each matters */
+	for (unsigned int i = 0; i < set->count; i++) {
+		if (set->deps[i].queue == dep.queue) {
+			if (set->deps[i].pos < dep.pos)
+				set->deps[i].pos = dep.pos;
+			return;
+		}
+	}
+
+	if (set->count == set->size) {
+		set->size = set->size ? 2 * set->size : 4;
+		set->deps = realloc(set->deps, set->size * sizeof(*set->deps));
+		igt_assert(set->deps);
+	}
+	set->deps[set->count++] = dep;
+}
+
+static void dep_set_merge(struct par_dep_set *set,
+			  const struct par_dep_set *other)
+{
+	for (unsigned int i = 0; i < other->count; i++)
+		dep_set_add(set, other->deps[i]);
+}
+
+static uint32_t par_new_queue(struct par_replay *p)
+{
+	if (p->num_queues == p->max_queues) {
+		p->max_queues = p->max_queues ? 2 * p->max_queues : 64;
+		p->queues = realloc(p->queues,
+				    p->max_queues * sizeof(*p->queues));
+		igt_assert(p->queues);
+	}
+
+	memset(&p->queues[p->num_queues], 0, sizeof(*p->queues));
+	return p->num_queues++;
+}
+
+static uint32_t par_new_ctx(struct par_replay *p, uint32_t handle)
+{
+	uint32_t ctx = p->num_ctx++;
+
+	p->ctx = grow(p->ctx, &p->max_ctx, ctx, sizeof(*p->ctx));
+	p->ctx[ctx].queue = par_new_queue(p);
+
+	p->ctx_map = grow(p->ctx_map, &p->ctx_map_size, handle, sizeof(uint32_t));
+	p->ctx_map[handle] = ctx;
+
+	return ctx;
+}
+
+static struct par_op *par_new_op(struct par_replay *p, uint8_t cmd,
+				 uint32_t queue, struct par_dep_set *deps)
+{
+	struct par_op *op;
+
+	if (p->num_ops == p->max_ops) {
+		p->max_ops = p->max_ops ? 2 * p->max_ops : 4096;
+		p->ops = realloc(p->ops, p->max_ops * sizeof(*p->ops));
+		igt_assert(p->ops);
+	}
+
+	op = memset(&p->ops[p->num_ops++], 0, sizeof(*op));
+	op->cmd = cmd;
+	op->queue = queue;
+	op->pos = ++p->queues[queue].length;
+
+	if (deps && deps->count) {
+		op->num_deps = deps->count;
+		op->deps = malloc(deps->count * sizeof(*op->deps));
+		igt_assert(op->deps);
+		memcpy(op->deps, deps->deps, deps->count * sizeof(*op->deps));
+	}
+
+	return op;
+}
+
+static struct par_dep par_op_dep(const struct par_op *op)
+{
+	return (struct par_dep){ op->queue, op->pos };
+}
+
+static uint32_t par_lookup_bo(struct par_replay *p, uint32_t handle)
+{
+	uint32_t bo = handle < p->bo_map_size ? p->bo_map[handle] : 0;
+
+	igt_assert_f(bo, "exec on unknown handle %u\n", handle);
+	return bo;
+}
+
+/*
+ * Buffers are created on the queue of their first user, and closed on the
+ * queue of their last if they were only ever used from one, so that a
+ * context working on its own buffers does not have to wait on another
+ * thread.
+ */
+static void par_use_bo(struct par_replay *p, uint32_t bo, uint32_t queue)
+{
+	struct par_op *op;
+
+	if (p->bo[bo].created)
+		return;
+
+	op = par_new_op(p, ADD_BO, queue, NULL);
+	op->add_bo.bo = bo;
+	op->add_bo.size = p->bo[bo].size;
+	p->bo[bo].add = par_op_dep(op);
+	p->bo[bo].created = true;
+}
+
+static void par_decode_exec(struct par_replay *p, struct trace_exec *t,
+			    bool fence_in, struct par_dep barrier,
+			    uint64_t due, uint64_t batch_offset)
+{
+	struct drm_i915_gem_exec_object2 *objects;
+	struct par_dep_set deps = {};
+	uint32_t *inc;
+	uint8_t *ptr = (void *)(t + 1);
+	uint32_t ctx, queue;
+	struct par_op *op;
+
+	if (fence_in)
+		ptr += sizeof(struct trace_fence);
+
+	/* The default context, or one created before tracing started */
+	if (t->context >= p->ctx_map_size || !p->ctx_map[t->context])
+		par_new_ctx(p, t->context);
+	ctx = p->ctx_map[t->context];
+	queue = p->ctx[ctx].queue;
+
+	objects = calloc(t->object_count + 1, sizeof(*objects));
+	inc = calloc(t->object_count + 1, sizeof(*inc));
+	igt_assert(objects && inc);
+
+	for (uint32_t i = 0; i < t->object_count; i++) {
+		struct trace_exec_object *to = (void *)ptr;
+		struct drm_i915_gem_relocation_entry *relocs;
+		size_t len;
+
+		ptr = (void *)(to + 1);
+		len = sizeof(*relocs) * to->relocation_count;
+
+		inc[i] = par_lookup_bo(p, to->handle);
+		par_use_bo(p, inc[i], queue);
+		p->bo[inc[i]].written = to->flags & LOCAL_EXEC_OBJECT_WRITE;
+
+		objects[i].handle = inc[i];
+		objects[i].alignment = to->alignment;
+		objects[i].offset = to->offset;
+		objects[i].flags = to->flags;
+		objects[i].rsvd1 = to->rsvd1;
+		objects[i].rsvd2 = to->rsvd2;
+		objects[i].relocation_count = to->relocation_count;
+
+		relocs = NULL;
+		if (len) {
+			relocs = malloc(len);
+			igt_assert(relocs);
+			memcpy(relocs, ptr, len);
+		}
+		objects[i].relocs_ptr = (uintptr_t)relocs;
+		ptr += len;
+	}
+
+	/* Relocations with a write domain mark their target as written */
+	for (uint32_t i = 0; i < t->object_count; i++) {
+		struct drm_i915_gem_relocation_entry *relocs =
+			from_user_pointer(objects[i].relocs_ptr);
+
+		for (uint32_t j = 0; j < objects[i].relocation_count; j++) {
+			uint32_t target = relocs[j].target_handle;
+
+			if (t->flags & I915_EXEC_HANDLE_LUT) {
+				if (target < t->object_count &&
+				    relocs[j].write_domain)
+					p->bo[inc[target]].written = true;
+				continue;
+			}
+
+			relocs[j].target_handle = par_lookup_bo(p, target);
+			par_use_bo(p, relocs[j].target_handle, queue);
+			if (relocs[j].write_domain)
+				p->bo[relocs[j].target_handle].written = true;
+		}
+	}
+
+	dep_set_add(&deps, barrier);
+	dep_set_add(&deps, p->ctx[ctx].add);
+	for (uint32_t i = 0; i < t->object_count; i++) {
+		struct par_bo *bo = &p->bo[inc[i]];
+
+		dep_set_add(&deps, bo->add);
+		dep_set_add(&deps, bo->last_write);
+		if (bo->written)
+			dep_set_merge(&deps, &bo->readers);
+	}
+
+	op = par_new_op(p, EXEC, queue, &deps);
+	op->exec.ctx = ctx;
+	op->exec.due = due;
+	op->exec.eb.buffers_ptr = (uintptr_t)objects;
+	op->exec.eb.buffer_count = t->object_count + 1; /* + nop batch */
+	op->exec.eb.flags = t->flags & ~(I915_EXEC_FENCE_IN | I915_EXEC_FENCE_OUT);
+	op->exec.eb.batch_start_offset = batch_offset;
+
+	for (uint32_t i = 0; i < t->object_count; i++) {
+		struct par_bo *bo = &p->bo[inc[i]];
+
+		if (bo->written) {
+			bo->last_write = par_op_dep(op);
+			bo->readers.count = 0;
+			bo->written = false;
+		} else {
+			dep_set_add(&bo->readers, par_op_dep(op));
+		}
+		dep_set_add(&bo->users, par_op_dep(op));
+	}
+
+	free(deps.deps);
+	free(inc);
+}
+
+static int par_decode(struct par_replay *p, const char *filename,
+		      long nop, long range)
+{
+	struct trace_reader r;
+	struct par_dep barrier = {};
+	uint64_t timestamp, first_timestamp = 0;
+	unsigned long execs = 0;
+	void *payload;
+	bool corrupt;
+	int cmd;
+
+	if (trace_reader_open(&r, filename))
+		return -1;
+
+	if (p->pace->mode == PACE_RECORDED && r.version < 2) {
+		fprintf(stderr, "%s: no timestamps recorded to pace by\n",
+			filename);
+		trace_reader_close(&r);
+		return -1;
+	}
+
+	par_new_queue(p); /* control */
+	p->num_ctx = 1; /* unused, 0 marks an unmapped context */
+	p->num_bo = 1; /* the nop batch */
+	p->bo = grow(p->bo, &p->max_bo, 0, sizeof(*p->bo));
+
+	while ((cmd = trace_reader_next(&r, &timestamp, &payload)) != -1) {
+		switch (cmd) {
+		case ADD_BO: {
+			struct trace_add_bo *t = payload;
+			uint32_t bo = p->num_bo++;
+
+			p->bo = grow(p->bo, &p->max_bo, bo, sizeof(*p->bo));
+			p->bo_map = grow(p->bo_map, &p->bo_map_size,
+					 t->handle, sizeof(uint32_t));
+			p->bo_map[t->handle] = bo;
+			p->bo[bo].size = t->size;
+			break;
+		}
+
+		case DEL_BO: {
+			struct trace_del_bo *t = payload;
+			uint32_t bo = par_lookup_bo(p, t->handle);
+			struct par_dep_set *users = &p->bo[bo].users;
+			struct par_op *op;
+
+			par_use_bo(p, bo, 0);
+			if (users->count == 1)
+				op = par_new_op(p, DEL_BO, users->deps[0].queue, NULL);
+			else
+				op = par_new_op(p, DEL_BO, 0, users);
+			op->del_bo.bo = bo;
+
+			p->bo_map[t->handle] = 0;
+			free(p->bo[bo].readers.deps);
+			free(p->bo[bo].users.deps);
+			memset(&p->bo[bo].readers, 0, sizeof(p->bo[bo].readers));
+			memset(&p->bo[bo].users, 0, sizeof(p->bo[bo].users));
+			break;
+		}
+
+		case ADD_CTX: {
+			struct trace_add_ctx *t = payload;
+			uint32_t ctx = par_new_ctx(p, t->handle);
+			struct par_op *op;
+
+			op = par_new_op(p, ADD_CTX, 0, NULL);
+			op->add_ctx.ctx = ctx;
+			p->ctx[ctx].add = par_op_dep(op);
+			break;
+		}
+
+		case DEL_CTX: {
+			struct trace_del_ctx *t = payload;
+			struct par_dep_set deps = {};
+			struct par_op *op;
+			uint32_t ctx;
+
+			if (t->handle >= p->ctx_map_size || !p->ctx_map[t->handle])
+				break;
+
+			ctx = p->ctx_map[t->handle];
+			dep_set_add(&deps, (struct par_dep){
+				    p->ctx[ctx].queue,
+				    p->queues[p->ctx[ctx].queue].length });
+
+			op = par_new_op(p, DEL_CTX, 0, &deps);
+			op->del_ctx.ctx = ctx;
+			p->ctx_map[t->handle] = 0;
+			free(deps.deps);
+			break;
+		}
+
+		case EXEC: {
+			struct trace_exec *t = payload;
+			uint64_t due = 0, offset = 0;
+
+			switch (p->pace->mode) {
+			case PACE_NONE:
+				break;
+			case PACE_RECORDED:
+				if (!execs)
+					first_timestamp = timestamp;
+				due = (timestamp - first_timestamp) * p->pace->scale;
+				break;
+			case PACE_RATE:
+				due = execs * 1e9 / p->pace->rate;
+				break;
+			}
+
+			if (nop > 0) {
+				offset = hars_petruska_f54_1_random(&prng);
+				offset = ALIGN((offset * range) >> 32, 64);
+			}
+
+			par_decode_exec(p, t,
+					r.version > 1 && t->flags & I915_EXEC_FENCE_IN,
+					barrier, due, offset);
+			execs++;
+			break;
+		}
+
+		case WAIT: {
+			struct trace_wait *t = payload;
+			uint32_t bo = par_lookup_bo(p, t->handle);
+			struct par_op *op;
+
+			par_use_bo(p, bo, 0);
+			op = par_new_op(p, WAIT, 0, &p->bo[bo].users);
+			op->wait.bo = bo;
+			barrier = par_op_dep(op);
+
+			/* and the close must not overtake the wait */
+			dep_set_add(&p->bo[bo].users, barrier);
+			break;
+		}
+		}
+	}
+
+	corrupt = r.corrupt;
+	trace_reader_close(&r);
+
+	for (uint32_t i = 0; i < p->num_bo; i++) {
+		free(p->bo[i].readers.deps);
+		free(p->bo[i].users.deps);
+	}
+	free(p->bo);
+	free(p->bo_map);
+	free(p->ctx_map);
+	free(p->ctx);
+	p->bo = NULL;
+	p->bo_map = p->ctx_map = NULL;
+	p->ctx = NULL;
+
+	return corrupt ? -1 : 0;
+}
+
+static void par_fini(struct par_replay *p)
+{
+	for (unsigned long i = 0; i < p->num_ops; i++) {
+		struct par_op *op = &p->ops[i];
+
+		if (op->cmd == EXEC) {
+			struct drm_i915_gem_exec_object2 *objects =
+				from_user_pointer(op->exec.eb.buffers_ptr);
+
+			for (uint32_t j = 0; j < op->exec.eb.buffer_count; j++)
+				free(from_user_pointer(objects[j].relocs_ptr));
+			free(objects);
+		}
+		free(op->deps);
+	}
+	free(p->ops);
+	free(p->queues);
+}
+
+static void par_wait(struct par_replay *p, const struct par_op *op)
+{
+	for (uint32_t i = 0; i < op->num_deps; i++) {
+		struct par_queue *q = &p->queues[op->deps[i].queue];
+
+		if (__atomic_load_n(&q->completed, __ATOMIC_ACQUIRE) >= op->deps[i].pos)
+			continue;
+
+		pthread_mutex_lock(&q->lock);
+		while (q->completed < op->deps[i].pos)
+			pthread_cond_wait(&q->cond, &q->lock);
+		pthread_mutex_unlock(&q->lock);
+	}
+}
+
+static void par_complete(struct par_replay *p, const struct par_op *op)
+{
+	struct par_queue *q = &p->queues[op->queue];
+
+	pthread_mutex_lock(&q->lock);
+	__atomic_store_n(&q->completed, op->pos, __ATOMIC_RELEASE);
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+}
+
+static void par_execute(struct par_worker *w, struct par_op *op)
+{
+	struct par_replay *p = w->p;
+
+	switch (op->cmd) {
+	case ADD_BO:
+		p->bo_handles[op->add_bo.bo] = gem_create(p->fd, op->add_bo.size);
+		break;
+
+	case DEL_BO:
+		gem_close(p->fd, p->bo_handles[op->del_bo.bo]);
+		break;
+
+	case ADD_CTX:
+		p->ctx_handles[op->add_ctx.ctx] = __gem_context_create(p->fd);
+		break;
+
+	case DEL_CTX:
+		gem_context_destroy(p->fd, p->ctx_handles[op->del_ctx.ctx]);
+		break;
+
+	case WAIT:
+		gem_wait(p->fd, p->bo_handles[op->wait.bo], NULL);
+		break;
+
+	case EXEC: {
+		struct drm_i915_gem_execbuffer2 *eb = &op->exec.eb;
+		struct drm_i915_gem_exec_object2 *objects =
+			from_user_pointer(eb->buffers_ptr);
+		uint64_t due;
+
+		/* Each op runs once, resolve the handles in place */
+		for (uint32_t i = 0; i < eb->buffer_count; i++) {
+			struct drm_i915_gem_relocation_entry *relocs =
+				from_user_pointer(objects[i].relocs_ptr);
+
+			objects[i].handle = p->bo_handles[objects[i].handle];
+			if (eb->flags & I915_EXEC_HANDLE_LUT)
+				continue;
+
+			for (uint32_t j = 0; j < objects[i].relocation_count; j++)
+				relocs[j].target_handle =
+					p->bo_handles[relocs[j].target_handle];
+		}
+		eb->rsvd1 = p->ctx_handles[op->exec.ctx];
+
+		if (p->pace->mode == PACE_NONE) {
+			due = gettime_ns();
+		} else {
+			due = p->start + op->exec.due;
+			sleep_until_ns(due);
+		}
+
+		gem_execbuf(p->fd, eb);
+		igt_stats_push(&w->latency, gettime_ns() - due);
+		break;
+	}
+	}
+}
+
+static void *par_worker(void *data)
+{
+	struct par_worker *w = data;
+
+	for (unsigned long i = 0; i < w->count; i++) {
+		par_wait(w->p, w->ops[i]);
+		par_execute(w, w->ops[i]);
+		par_complete(w->p, w->ops[i]);
+	}
+
+	return NULL;
 }
 
-static int measure_nop(long nop)
+static void replay_parallel(const char *filename, long nop, long range,
+			    const struct pacing *pace, unsigned int threads,
+			    struct replay_result *result)
 {
 	const uint32_t bbe = 0xa << 23;
-	int fd = drm_open_driver(DRIVER_INTEL);
-	struct drm_i915_gem_exec_object2 obj = {};
-	struct drm_i915_gem_execbuffer2 eb = { .buffer_count = 1, .buffers_ptr = (uintptr_t)&obj};
+	struct par_replay p = { .pace = pace };
+	struct par_worker *workers;
 	struct timespec t_start, t_end;
+	igt_stats_t latency;
+
+	result->elapsed = -1;
+
+	/* The same spread of batch offsets as replay() */
+	if (par_decode(&p, filename, nop, nop > 0 ? 2 * range - 64 : 0))
+		goto out;
+
+	/*
+	 * Queues are distributed round-robin, each worker running its ops in
+	 * trace order. As dependencies only ever point to earlier ops, the
+	 * oldest incomplete op is always runnable.
+	 */
+	workers = calloc(threads, sizeof(*workers));
+	igt_assert(workers);
+	for (unsigned long i = 0; i < p.num_ops; i++) {
+		struct par_worker *w = &workers[p.ops[i].queue % threads];
+
+		if (w->count == w->size) {
+			w->size = w->size ? 2 * w->size : 1024;
+			w->ops = realloc(w->ops, w->size * sizeof(*w->ops));
+			igt_assert(w->ops);
+		}
+		w->ops[w->count++] = &p.ops[i];
+	}
 
-	obj.handle = gem_create(fd, nop);
-	gem_write(fd, obj.handle, nop - sizeof(bbe), &bbe, sizeof(bbe));
-	gem_execbuf(fd, &eb);
-	gem_sync(fd, obj.handle);
+	for (uint32_t i = 0; i < p.num_queues; i++) {
+		pthread_mutex_init(&p.queues[i].lock, NULL);
+		pthread_cond_init(&p.queues[i].cond, NULL);
+	}
+
+	p.bo_handles = calloc(p.num_bo, sizeof(*p.bo_handles));
+	p.ctx_handles = calloc(p.num_ctx, sizeof(*p.ctx_handles));
+	igt_assert(p.bo_handles && p.ctx_handles);
+
+	p.fd = drm_open_driver(DRIVER_INTEL);
+	if (nop > 0) {
+		p.bo_handles[0] = gem_create(p.fd, nop + range);
+		gem_write(p.fd, p.bo_handles[0], nop + range - sizeof(bbe),
+			  &bbe, sizeof(bbe));
+	} else {
+		p.bo_handles[0] = gem_create(p.fd, 4096);
+		gem_write(p.fd, p.bo_handles[0], 0, &bbe, sizeof(bbe));
+	}
 
 	clock_gettime(CLOCK_MONOTONIC, &t_start);
-	for (int loop = 0; loop < 9; loop++)
-		gem_execbuf(fd, &eb);
-	gem_sync(fd, obj.handle);
+	p.start = gettime_ns();
+	for (unsigned int i = 0; i < threads; i++) {
+		workers[i].p = &p;
+		igt_stats_init_sketch(&workers[i].latency,
+				      IGT_STATS_SKETCH_DEFAULT_PRECISION);
+		pthread_create(&workers[i].thread, NULL,
+			       par_worker, &workers[i]);
+	}
+
+	igt_stats_init_sketch(&latency, IGT_STATS_SKETCH_DEFAULT_PRECISION);
+	for (unsigned int i = 0; i < threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		igt_stats_merge(&latency, &workers[i].latency);
+		igt_stats_fini(&workers[i].latency);
+		free(workers[i].ops);
+	}
 	clock_gettime(CLOCK_MONOTONIC, &t_end);
 
-	gem_close(fd, obj.handle);
+	result->elapsed = 1e3 * igt_elapsed(&t_start, &t_end);
+	if (latency.n_values) {
+		result->latency.mean = 1e-3 * igt_stats_get_mean(&latency);
+		result->latency.median = 1e-3 * igt_stats_get_median(&latency);
+		result->latency.p99 = 1e-3 * igt_stats_get_percentile(&latency, 99);
+		result->latency.max = 1e-3 * igt_stats_get_max(&latency);
+	}
+	igt_stats_fini(&latency);
+
+	close(p.fd);
+	free(workers);
+	free(p.bo_handles);
+	free(p.ctx_handles);
+out:
+	par_fini(&p);
+}
 
-	close(fd);
-	return 1e3*elapsed(&t_start, &t_end) / 9;
+/*
+ * Print the schedule replay_parallel() would run, one op per line as
+ * "queue.pos op argument", followed by the ops of other queues it waits
+ * for.
+ */
+static int print_schedule(const char *filename, const struct pacing *pace)
+{
+	static const char *names[] = {
+		[ADD_BO] = "add_bo",
+		[DEL_BO] = "del_bo",
+		[ADD_CTX] = "add_ctx",
+		[DEL_CTX] = "del_ctx",
+		[EXEC] = "exec",
+		[WAIT] = "wait",
+	};
+	struct par_replay p = { .pace = pace };
+	int ret;
+
+	ret = par_decode(&p, filename, 0, 0);
+	if (ret == 0) {
+		printf("%s:\n", filename);
+		for (unsigned long i = 0; i < p.num_ops; i++) {
+			const struct par_op *op = &p.ops[i];
+			uint32_t arg = 0;
+
+			switch (op->cmd) {
+			case ADD_BO: arg = op->add_bo.bo; break;
+			case DEL_BO: arg = op->del_bo.bo; break;
+			case ADD_CTX: arg = op->add_ctx.ctx; break;
+			case DEL_CTX: arg = op->del_ctx.ctx; break;
+			case EXEC: arg = op->exec.ctx; break;
+			case WAIT: arg = op->wait.bo; break;
+			}
+
+			printf("  %u.%u %s %u", op->queue, op->pos,
+			       names[op->cmd], arg);
+			for (uint32_t j = 0; j < op->num_deps; j++)
+				printf(" %s%u.%u", j ? "" : "after ",
+				       op->deps[j].queue, op->deps[j].pos);
+			printf("\n");
+		}
+	}
+
+	par_fini(&p);
+	return ret;
 }
 
 int main(int argc, char **argv)
 {
+	struct pacing pace = {};
+	unsigned int threads = 1;
+	bool analyze_only = false;
+	bool schedule_only = false;
 	int delay = 1000;
-	double *results;
+	struct replay_result *results;
 	long nop = 0;
 	long range = 0;
 	int i, c;
 
-	results = mmap(NULL, ALIGN(argc*sizeof(double), 4096),
+	results = mmap(NULL, ALIGN(argc*sizeof(*results), 4096),
 		       PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
 
-	while ((c = getopt(argc, argv, "d:n:r:")) != -1) {
+	while ((c = getopt(argc, argv, "ad:j:n:pr:s:t:")) != -1) {
 		switch (c) {
+		case 'a':
+			analyze_only = true;
+			break;
 		case 'd':
 			delay = atoi(optarg);
 			break;
+		case 'j':
+			threads = max(atoi(optarg), 1);
+			break;
 		case 'n':
 			nop = strtol(optarg, NULL, 0);
 			if (nop > 0)
 				nop = ALIGN(nop, 4096);
 			break;
+		case 'p':
+			schedule_only = true;
+			break;
 		case 'r':
 			range = strtol(optarg, NULL, 0);
 			if (range > 0)
 				range = ALIGN(range, 4096);
 			break;
+		case 's':
+			pace.mode = PACE_RECORDED;
+			pace.scale = atof(optarg);
+			if (pace.scale < 0) {
+				fprintf(stderr, "Invalid pacing scale '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 't':
+			pace.mode = PACE_RATE;
+			pace.rate = atof(optarg);
+			if (pace.rate <= 0) {
+				fprintf(stderr, "Invalid target rate '%s'\n", optarg);
+				return 1;
+			}
+			break;
 		default:
 			break;
 		}
 	}
 
-	if (!nop)
-		nop = calibrate_nop(delay);
+	if (analyze_only) {
+		int ret = 0;
+
+		for (i = optind; i < argc; i++) {
+			if (analyze(argv[i])) {
+				printf("%s: failed\n", argv[i]);
+				ret = 1;
+			}
+		}
+
+		return ret;
+	}
+
+	if (schedule_only) {
+		int ret = 0;
+
+		for (i = optind; i < argc; i++) {
+			if (print_schedule(argv[i], &pace)) {
+				printf("%s: failed\n", argv[i]);
+				ret = 1;
+			}
+		}
+
+		return ret;
+	}
+
+	if (nop >= 0) {
+		int fd = drm_open_driver(DRIVER_INTEL);
+
+		if (!nop)
+			nop = igt_calibrate_nop_cached(fd, 0, delay, 0, NULL);
+		delay = igt_measure_nop(fd, 0, nop, 9);
+		close(fd);
+	}
 	if (!range)
 		range = nop / 2;
 	if (nop > 0) {
-		delay = measure_nop(nop);
 		printf("Using %lu nop batch for ~%dus delay, range %lu [%dus]\n",
 		       nop, delay,
 		       range, (int)(delay * range / nop));
 	}
 
-	igt_fork(child, argc-optind)
-		results[child] = replay(argv[child + optind], nop, range);
+	igt_fork(child, argc-optind) {
+		if (threads > 1)
+			replay_parallel(argv[child + optind], nop, range,
+					&pace, threads, &results[child]);
+		else
+			replay(argv[child + optind], nop, range,
+			       &pace, &results[child]);
+	}
 	igt_waitchildren();
 
 	for (i = 0; i < argc - optind; i++) {
-		double t = results[i];
-		if (t < 0)
+		const struct replay_result *r = &results[i];
+
+		if (r->elapsed < 0) {
 			printf("%s: failed\n", argv[optind + i]);
-		else
-			printf("%s: %.3f\n", argv[optind + i], t);
+			continue;
+		}
+
+		printf("%s: %.3f\n", argv[optind + i], r->elapsed);
+		if (pace.mode != PACE_NONE)
+			printf("%s: submission latency mean %.1fus, median %.1fus, p99 %.1fus, max %.1fus\n",
+			       argv[optind + i],
+			       r->latency.mean, r->latency.median,
+			       r->latency.p99, r->latency.max);
 	}
 
 	return 0;
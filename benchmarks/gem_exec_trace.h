@@ -0,0 +1,156 @@
+/*
+ * Copyright © 2017 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef GEM_EXEC_TRACE_H
+#define GEM_EXEC_TRACE_H
+
+#include <stdint.h>
+
+/*
+ * Trace format shared by gem_exec_tracer (the LD_PRELOAD recorder) and
+ * gem_exec_trace (the replayer).
+ *
+ * A trace starts with a struct trace_version. In version 1 it is directly
+ * followed by the records, each being a cmd byte and the matching payload
+ * below.
+ *
+ * Version 2 groups the records into chunks, each a struct trace_chunk header
+ * followed by chunk.size bytes of records, deflated (zlib) if
+ * TRACE_CHUNK_DEFLATE is set. Every record starts with a struct trace_record
+ * giving its cmd and a timestamp, then the payload. Records never straddle
+ * chunks. A cleanly closed trace ends with an array of struct
+ * trace_index_entry, one per chunk, and a struct trace_index pointing at it;
+ * without an index the chunks can still be walked from the start.
+ */
+
+#define TRACE_MAGIC 0xdeadbeef
+#define TRACE_VERSION 2
+
+enum {
+	ADD_BO = 0,
+	DEL_BO,
+	ADD_CTX,
+	DEL_CTX,
+	EXEC,
+	WAIT,
+	FENCE_OUT, /* v2 */
+};
+
+struct trace_version {
+	uint32_t magic;
+	uint32_t version;
+};
+
+#define TRACE_CHUNK_MAGIC 0x6b6e6863 /* "chnk" */
+#define TRACE_CHUNK_DEFLATE (1 << 0)
+
+struct trace_chunk {
+	uint32_t magic;
+	uint32_t flags;
+	uint32_t size; /* bytes following this header in the file */
+	uint32_t raw_size; /* bytes of records once inflated */
+	uint32_t count; /* number of records */
+	uint32_t reserved;
+	uint64_t first_timestamp;
+	uint64_t last_timestamp;
+};
+
+#define TRACE_INDEX_MAGIC 0x78646e69 /* "indx" */
+
+struct trace_index_entry {
+	uint64_t offset; /* of the struct trace_chunk from the start of file */
+	uint64_t first_timestamp;
+	uint64_t last_timestamp;
+	uint32_t count;
+	uint32_t reserved;
+};
+
+/* The very last bytes of the file */
+struct trace_index {
+	uint32_t magic;
+	uint32_t count;
+	uint64_t offset; /* of the first struct trace_index_entry */
+};
+
+struct trace_record {
+	uint8_t cmd;
+	uint64_t timestamp; /* ns since the trace was started, CLOCK_MONOTONIC */
+} __attribute__((packed));
+
+struct trace_add_bo {
+	uint32_t handle;
+	uint64_t size;
+} __attribute__((packed));
+
+struct trace_del_bo {
+	uint32_t handle;
+} __attribute__((packed));
+
+struct trace_add_ctx {
+	uint32_t handle;
+} __attribute__((packed));
+
+struct trace_del_ctx {
+	uint32_t handle;
+} __attribute__((packed));
+
+/*
+ * Followed, in v2 and only if flags has I915_EXEC_FENCE_IN, by a struct
+ * trace_fence, then by object_count struct trace_exec_object, each directly
+ * followed by its relocation_count struct drm_i915_gem_relocation_entry.
+ */
+struct trace_exec {
+	uint32_t object_count;
+	uint64_t flags;
+	uint32_t context;
+} __attribute__((packed));
+
+struct trace_exec_object {
+	uint32_t handle;
+	uint32_t relocation_count;
+	uint64_t alignment;
+	uint64_t offset;
+	uint64_t flags;
+	uint64_t rsvd1;
+	uint64_t rsvd2;
+} __attribute__((packed));
+
+struct trace_exec_relocation {
+	uint32_t target_handle;
+	uint32_t delta;
+	uint64_t offset;
+	uint64_t presumed_offset;
+	uint32_t read_domains;
+	uint32_t write_domain;
+} __attribute__((packed));
+
+struct trace_wait {
+	uint32_t handle;
+} __attribute__((packed));
+
+/* The fd of a sync_file, as seen by the traced process */
+struct trace_fence {
+	int32_t fd;
+} __attribute__((packed));
+
+#endif /* GEM_EXEC_TRACE_H */
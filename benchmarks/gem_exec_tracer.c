@@ -39,90 +39,65 @@
 #include <dlfcn.h>
 #include <i915_drm.h>
 #include <pthread.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <zlib.h>
 
 #include "intel_aub.h"
 #include "intel_chipset.h"
 
+#include "gem_exec_trace.h"
+
 static int (*libc_close)(int fd);
 static int (*libc_ioctl)(int fd, unsigned long request, void *argp);
 
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static bool compress_chunks;
+
+/*
+ * Records are appended to an in-memory chunk under a short per-trace lock;
+ * full chunks (and partial ones once FLUSH_INTERVAL has passed) are handed
+ * over to a per-trace thread that compresses and writes them out, so the
+ * traced ioctl never waits on the disk.
+ */
+#define CHUNK_SIZE (1 << 20)
+#define FLUSH_INTERVAL_NS (100 * 1000 * 1000)
+
+struct chunk {
+	struct chunk *next;
+	struct trace_chunk hdr;
+	size_t alloc;
+	uint8_t data[];
+};
 
 struct trace {
 	int fd;
-	FILE *file;
+	int out;
+	pid_t pid;
+	struct timespec epoch;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t flusher;
+	struct chunk *current;
+	struct chunk *queue, **queue_tail;
+	bool closing;
+
+	/* only touched by the flusher until it is joined */
+	struct trace_index_entry *index;
+	unsigned int index_count, index_size;
+	uint64_t offset;
+
 	struct trace *next;
 } *traces;
 
 #define DRM_MAJOR 226
 
-enum {
-	ADD_BO = 0,
-	DEL_BO,
-	ADD_CTX,
-	DEL_CTX,
-	EXEC,
-	WAIT,
+static const struct trace_version version = {
+	.magic = TRACE_MAGIC,
+	.version = TRACE_VERSION
 };
 
-static struct trace_verion {
-	uint32_t magic;
-	uint32_t version;
-} version = {
-	.magic = 0xdeadbeef,
-	.version = 1
-};
-
-struct trace_add_bo {
-	uint8_t cmd;
-	uint32_t handle;
-	uint64_t size;
-} __attribute__((packed));
-struct trace_del_bo {
-	uint8_t cmd;
-	uint32_t handle;
-}__attribute__((packed));
-
-struct trace_add_ctx {
-	uint8_t cmd;
-	uint32_t handle;
-} __attribute__((packed));
-struct trace_del_ctx {
-	uint8_t cmd;
-	uint32_t handle;
-}__attribute__((packed));
-
-struct trace_exec {
-	uint8_t cmd;
-	uint32_t object_count;
-	uint64_t flags;
-	uint32_t context;
-}__attribute__((packed));
-
-struct trace_exec_object {
-	uint32_t handle;
-	uint32_t relocation_count;
-	uint64_t alignment;
-	uint64_t offset;
-	uint64_t flags;
-	uint64_t rsvd1;
-	uint64_t rsvd2;
-}__attribute__((packed));
-
-struct trace_exec_relocation {
-	uint32_t target_handle;
-	uint32_t delta;
-	uint64_t offset;
-	uint64_t presumed_offset;
-	uint32_t read_domains;
-	uint32_t write_domain;
-}__attribute__((packed));
-
-struct trace_wait {
-	uint8_t cmd;
-	uint32_t handle;
-} __attribute__((packed));
-
 static void __attribute__ ((format(__printf__, 2, 3)))
 fail_if(int cond, const char *format, ...)
 {
@@ -138,6 +113,185 @@ fail_if(int cond, const char *format, ...)
 	abort();
 }
 
+static void write_all(int fd, struct iovec *iov, int count)
+{
+	while (count) {
+		ssize_t len = writev(fd, iov, count);
+
+		if (len < 0) {
+			fail_if(errno != EINTR && errno != EAGAIN,
+				"failed to write trace: %s\n", strerror(errno));
+			continue;
+		}
+
+		while (count && len >= iov->iov_len) {
+			len -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if (count) {
+			iov->iov_base = (uint8_t *)iov->iov_base + len;
+			iov->iov_len -= len;
+		}
+	}
+}
+
+static void write_chunk(struct trace *t, struct chunk *c)
+{
+	struct trace_index_entry *e;
+	struct iovec iov[2];
+	uint8_t *deflated = NULL;
+
+	c->hdr.magic = TRACE_CHUNK_MAGIC;
+	c->hdr.size = c->hdr.raw_size;
+	iov[1].iov_base = c->data;
+
+	if (compress_chunks) {
+		uLongf len = compressBound(c->hdr.raw_size);
+
+		deflated = malloc(len);
+		if (deflated &&
+		    compress2(deflated, &len,
+			      c->data, c->hdr.raw_size, 1) == Z_OK &&
+		    len < c->hdr.raw_size) {
+			c->hdr.flags |= TRACE_CHUNK_DEFLATE;
+			c->hdr.size = len;
+			iov[1].iov_base = deflated;
+		}
+	}
+
+	iov[0].iov_base = &c->hdr;
+	iov[0].iov_len = sizeof(c->hdr);
+	iov[1].iov_len = c->hdr.size;
+	write_all(t->out, iov, 2);
+	free(deflated);
+
+	if (t->index_count == t->index_size) {
+		t->index_size = t->index_size ? 2 * t->index_size : 256;
+		t->index = realloc(t->index,
+				   t->index_size * sizeof(*t->index));
+		fail_if(!t->index, "out of memory for the trace index\n");
+	}
+
+	e = &t->index[t->index_count++];
+	e->offset = t->offset;
+	e->first_timestamp = c->hdr.first_timestamp;
+	e->last_timestamp = c->hdr.last_timestamp;
+	e->count = c->hdr.count;
+	e->reserved = 0;
+
+	t->offset += sizeof(c->hdr) + c->hdr.size;
+}
+
+/* Called with t->lock held */
+static void seal_chunk(struct trace *t)
+{
+	struct chunk *c = t->current;
+
+	if (!c || !c->hdr.count)
+		return;
+
+	t->current = NULL;
+	c->next = NULL;
+	*t->queue_tail = c;
+	t->queue_tail = &c->next;
+	pthread_cond_signal(&t->cond);
+}
+
+static void *flush_thread(void *data)
+{
+	struct trace *t = data;
+
+	pthread_mutex_lock(&t->lock);
+	for (;;) {
+		struct chunk *list;
+
+		while (!t->queue && !t->closing) {
+			struct timespec ts;
+
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += FLUSH_INTERVAL_NS;
+			if (ts.tv_nsec >= 1000000000) {
+				ts.tv_nsec -= 1000000000;
+				ts.tv_sec++;
+			}
+
+			if (pthread_cond_timedwait(&t->cond, &t->lock,
+						   &ts) == ETIMEDOUT)
+				seal_chunk(t);
+		}
+
+		list = t->queue;
+		t->queue = NULL;
+		t->queue_tail = &t->queue;
+		if (!list)
+			break;
+
+		pthread_mutex_unlock(&t->lock);
+		while (list) {
+			struct chunk *next = list->next;
+
+			write_chunk(t, list);
+			free(list);
+			list = next;
+		}
+		pthread_mutex_lock(&t->lock);
+	}
+	pthread_mutex_unlock(&t->lock);
+
+	return NULL;
+}
+
+/*
+ * Reserve space for a record of @len bytes of payload in the current chunk.
+ * Returns with t->lock held, to be released by trace_commit() once the
+ * payload has been filled in.
+ */
+static void *trace_reserve(struct trace *t, uint8_t cmd, size_t len)
+{
+	struct trace_record *r;
+	struct timespec now;
+	struct chunk *c;
+	uint64_t ts;
+
+	len += sizeof(*r);
+
+	pthread_mutex_lock(&t->lock);
+
+	c = t->current;
+	if (!c || c->hdr.raw_size + len > c->alloc) {
+		size_t alloc = len > CHUNK_SIZE ? len : CHUNK_SIZE;
+
+		seal_chunk(t);
+
+		c = malloc(sizeof(*c) + alloc);
+		fail_if(!c, "out of memory for the trace\n");
+		memset(c, 0, sizeof(*c));
+		c->alloc = alloc;
+		t->current = c;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ts = (now.tv_sec - t->epoch.tv_sec) * 1000000000ull;
+	ts += now.tv_nsec - t->epoch.tv_nsec;
+
+	if (!c->hdr.count++)
+		c->hdr.first_timestamp = ts;
+	c->hdr.last_timestamp = ts;
+
+	r = (struct trace_record *)(c->data + c->hdr.raw_size);
+	c->hdr.raw_size += len;
+
+	r->cmd = cmd;
+	r->timestamp = ts;
+	return r + 1;
+}
+
+static void trace_commit(struct trace *t)
+{
+	pthread_mutex_unlock(&t->lock);
+}
+
 static void
 trace_exec(struct trace *trace,
 	   const struct drm_i915_gem_execbuffer2 *execbuffer2)
@@ -145,19 +299,32 @@ trace_exec(struct trace *trace,
 #define to_ptr(T, x) ((T *)(uintptr_t)(x))
 	const struct drm_i915_gem_exec_object2 *exec_objects =
 		to_ptr(typeof(*exec_objects), execbuffer2->buffers_ptr);
+	size_t len;
+	uint8_t *ptr;
+
+	len = sizeof(struct trace_exec);
+	if (execbuffer2->flags & I915_EXEC_FENCE_IN)
+		len += sizeof(struct trace_fence);
+	for (uint32_t i = 0; i < execbuffer2->buffer_count; i++)
+		len += sizeof(struct trace_exec_object) +
+			sizeof(struct drm_i915_gem_relocation_entry) *
+			exec_objects[i].relocation_count;
+
+	ptr = trace_reserve(trace, EXEC, len);
+	{
+		struct trace_exec *t = (void *)ptr;
 
-	fail_if(execbuffer2->flags & (I915_EXEC_FENCE_IN | I915_EXEC_FENCE_OUT),
-		"fences not supported yet\n");
+		t->object_count = execbuffer2->buffer_count;
+		t->flags = execbuffer2->flags;
+		t->context = execbuffer2->rsvd1;
+		ptr = (void *)(t + 1);
+	}
 
-	flockfile(trace->file);
-	{
-		struct trace_exec t = {
-			EXEC,
-			execbuffer2->buffer_count,
-			execbuffer2->flags,
-			execbuffer2->rsvd1,
-		};
-		fwrite(&t, sizeof(t), 1, trace->file);
+	if (execbuffer2->flags & I915_EXEC_FENCE_IN) {
+		struct trace_fence *t = (void *)ptr;
+
+		t->fd = execbuffer2->rsvd2 & 0xffffffff;
+		ptr = (void *)(t + 1);
 	}
 
 	for (uint32_t i = 0; i < execbuffer2->buffer_count; i++) {
@@ -165,59 +332,163 @@ trace_exec(struct trace *trace,
 		const struct drm_i915_gem_relocation_entry *relocs =
 			to_ptr(typeof(*relocs), obj->relocs_ptr);
 		{
-			struct trace_exec_object t = {
-				obj->handle,
-				obj->relocation_count,
-				obj->alignment,
-				obj->offset,
-				obj->flags,
-				obj->rsvd1,
-				obj->rsvd2
-			};
-			fwrite(&t, sizeof(t), 1, trace->file);
+			struct trace_exec_object *t = (void *)ptr;
+
+			t->handle = obj->handle;
+			t->relocation_count = obj->relocation_count;
+			t->alignment = obj->alignment;
+			t->offset = obj->offset;
+			t->flags = obj->flags;
+			t->rsvd1 = obj->rsvd1;
+			t->rsvd2 = obj->rsvd2;
+			ptr = (void *)(t + 1);
 		}
-		fwrite(relocs, sizeof(*relocs), obj->relocation_count,
-		       trace->file);
+
+		len = sizeof(*relocs) * obj->relocation_count;
+		memcpy(ptr, relocs, len);
+		ptr += len;
 	}
 
-	fflush(trace->file);
-	funlockfile(trace->file);
+	trace_commit(trace);
 #undef to_ptr
 }
 
+static void
+trace_fence_out(struct trace *trace, int fence)
+{
+	struct trace_fence *t = trace_reserve(trace, FENCE_OUT, sizeof(*t));
+	t->fd = fence;
+	trace_commit(trace);
+}
+
 static void
 trace_wait(struct trace *trace, uint32_t handle)
 {
-	struct trace_wait t = { WAIT, handle };
-	fwrite(&t, sizeof(t), 1, trace->file);
+	struct trace_wait *t = trace_reserve(trace, WAIT, sizeof(*t));
+	t->handle = handle;
+	trace_commit(trace);
 }
 
 static void
 trace_add(struct trace *trace, uint32_t handle, uint64_t size)
 {
-	struct trace_add_bo t = { ADD_BO, handle, size };
-	fwrite(&t, sizeof(t), 1, trace->file);
+	struct trace_add_bo *t = trace_reserve(trace, ADD_BO, sizeof(*t));
+	t->handle = handle;
+	t->size = size;
+	trace_commit(trace);
 }
 
 static void
 trace_del(struct trace *trace, uint32_t handle)
 {
-	struct trace_del_bo t = { DEL_BO, handle };
-	fwrite(&t, sizeof(t), 1, trace->file);
+	struct trace_del_bo *t = trace_reserve(trace, DEL_BO, sizeof(*t));
+	t->handle = handle;
+	trace_commit(trace);
 }
 
 static void
 trace_add_context(struct trace *trace, uint32_t handle)
 {
-	struct trace_add_ctx t = { ADD_CTX, handle };
-	fwrite(&t, sizeof(t), 1, trace->file);
+	struct trace_add_ctx *t = trace_reserve(trace, ADD_CTX, sizeof(*t));
+	t->handle = handle;
+	trace_commit(trace);
 }
 
 static void
 trace_del_context(struct trace *trace, uint32_t handle)
 {
-	struct trace_del_ctx t = { DEL_CTX, handle };
-	fwrite(&t, sizeof(t), 1, trace->file);
+	struct trace_del_ctx *t = trace_reserve(trace, DEL_CTX, sizeof(*t));
+	t->handle = handle;
+	trace_commit(trace);
+}
+
+static struct trace *trace_open(int fd)
+{
+	struct iovec iov = {
+		.iov_base = (void *)&version,
+		.iov_len = sizeof(version),
+	};
+	char filename[80];
+	struct trace *t;
+
+	t = calloc(1, sizeof(*t));
+	if (!t)
+		return NULL;
+
+	sprintf(filename, "/tmp/trace-%d.%d", getpid(), fd);
+	t->out = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (t->out < 0)
+		goto err_free;
+
+	write_all(t->out, &iov, 1);
+	t->offset = sizeof(version);
+
+	t->fd = fd;
+	t->pid = getpid();
+	clock_gettime(CLOCK_MONOTONIC, &t->epoch);
+
+	pthread_mutex_init(&t->lock, NULL);
+	pthread_cond_init(&t->cond, NULL);
+	t->queue_tail = &t->queue;
+
+	if (pthread_create(&t->flusher, NULL, flush_thread, t))
+		goto err_sync;
+
+	return t;
+
+err_sync:
+	pthread_cond_destroy(&t->cond);
+	pthread_mutex_destroy(&t->lock);
+	libc_close(t->out);
+	unlink(filename);
+err_free:
+	free(t);
+	return NULL;
+}
+
+static void trace_close(struct trace *t)
+{
+	struct trace_index tail;
+	struct iovec iov[2];
+
+	/*
+	 * Inherited across fork(), the flusher belongs to the parent. Only
+	 * release our copies of the chunks, the index and the output fd.
+	 */
+	if (t->pid != getpid()) {
+		while (t->queue) {
+			struct chunk *next = t->queue->next;
+
+			free(t->queue);
+			t->queue = next;
+		}
+		free(t->current);
+		free(t->index);
+		libc_close(t->out);
+		free(t);
+		return;
+	}
+
+	pthread_mutex_lock(&t->lock);
+	seal_chunk(t);
+	t->closing = true;
+	pthread_cond_signal(&t->cond);
+	pthread_mutex_unlock(&t->lock);
+	pthread_join(t->flusher, NULL);
+
+	tail.magic = TRACE_INDEX_MAGIC;
+	tail.count = t->index_count;
+	tail.offset = t->offset;
+
+	iov[0].iov_base = t->index;
+	iov[0].iov_len = t->index_count * sizeof(*t->index);
+	iov[1].iov_base = &tail;
+	iov[1].iov_len = sizeof(tail);
+	write_all(t->out, iov, 2);
+
+	libc_close(t->out);
+	free(t->index);
+	free(t);
 }
 
 int
@@ -229,8 +500,7 @@ close(int fd)
 	for (p = &traces; (t = *p); p = &t->next) {
 		if (t->fd == fd) {
 			*p = t->next;
-			fclose(t->file);
-			free(t);
+			trace_close(t);
 			break;
 		}
 	}
@@ -294,31 +564,24 @@ ioctl(int fd, unsigned long request, ...)
 			break;
 		}
 	}
+	if (t && t->pid != getpid()) {
+		/* A child starts its own trace for the inherited fd */
+		*p = t->next;
+		free(t);
+		t = NULL;
+	}
 	if (!t) {
-		char filename[80];
-
 		if (!is_i915(fd)) {
 			pthread_mutex_unlock(&mutex);
 			goto untraced;
 		}
 
-		t = malloc(sizeof(*t));
+		t = trace_open(fd);
 		if (!t) {
 			pthread_mutex_unlock(&mutex);
 			return -ENOMEM;
 		}
 
-		sprintf(filename, "/tmp/trace-%d.%d", getpid(), fd);
-		t->file = fopen(filename, "w+");
-		t->fd = fd;
-
-		if (!fwrite(&version, sizeof(version), 1, t->file)) {
-			pthread_mutex_unlock(&mutex);
-			fclose(t->file);
-			free(t);
-			return -ENOMEM;
-		}
-
 		t->next = traces;
 		traces = t;
 	}
@@ -397,6 +660,13 @@ ioctl(int fd, unsigned long request, ...)
 		trace_add_context(t, create->ctx_id);
 		break;
 	}
+
+	case DRM_IOCTL_I915_GEM_EXECBUFFER2_WR: {
+		struct drm_i915_gem_execbuffer2 *eb = argp;
+		if (eb->flags & I915_EXEC_FENCE_OUT)
+			trace_fence_out(t, eb->rsvd2 >> 32);
+		break;
+	}
 	}
 
 	return 0;
@@ -412,4 +682,19 @@ init(void)
 	libc_ioctl = dlsym(RTLD_NEXT, "ioctl");
 	fail_if(libc_close == NULL || libc_ioctl == NULL,
 		"failed to get libc ioctl or close\n");
+
+	compress_chunks = getenv("GEM_EXEC_TRACE_COMPRESS") != NULL;
+}
+
+static void __attribute__ ((destructor))
+fini(void)
+{
+	struct trace *t;
+
+	pthread_mutex_lock(&mutex);
+	while ((t = traces)) {
+		traces = t->next;
+		trace_close(t);
+	}
+	pthread_mutex_unlock(&mutex);
 }
@@ -117,14 +117,18 @@ static void gem_execbuf_wr(int _fd, struct drm_i915_gem_execbuffer2 *execbuf)
 	igt_assert_eq(__gem_execbuf_wr(_fd, execbuf), 0);
 }
 
+/* Keep each thread's accumulators on their own cachelines */
+#define CACHELINE 64
+
 struct consumer {
 	pthread_t thread;
 
 	int go;
 
 	struct igt_mean latency;
+	igt_stats_t samples;
 	struct producer *producer;
-};
+} __attribute__((aligned(CACHELINE)));
 
 struct producer {
 	pthread_t thread;
@@ -150,11 +154,12 @@ struct producer {
 	int complete;
 	int done;
 	struct igt_mean latency, dispatch;
+	igt_stats_t samples;
 
 	int nop;
 	int nconsumers;
 	struct consumer *consumers;
-};
+} __attribute__((aligned(CACHELINE)));
 
 #define LOCAL_EXEC_NO_RELOC (1<<11)
 #define COPY_BLT_CMD		(2<<29|0x53<<22|0x6)
@@ -326,13 +331,18 @@ static void fence_wait(int fence)
 	poll(&pfd, 1, -1);
 }
 
-static void measure_latency(struct producer *p, struct igt_mean *mean)
+static void measure_latency(struct producer *p,
+			    struct igt_mean *mean, igt_stats_t *samples)
 {
+	uint32_t cycles;
+
 	if (!(p->latency_dispatch.execbuf.flags & LOCAL_I915_EXEC_FENCE_OUT))
 		gem_sync(fd, p->latency_dispatch.exec[0].handle);
 	else
 		fence_wait(p->latency_dispatch.execbuf.rsvd2 >> 32);
-	igt_mean_add(mean, read_timestamp() - *p->last_timestamp);
+	cycles = read_timestamp() - *p->last_timestamp;
+	igt_mean_add(mean, cycles);
+	igt_stats_push(samples, cycles);
 }
 
 static void *producer(void *arg)
@@ -379,7 +389,7 @@ static void *producer(void *arg)
 		 * and how long it took for the batch to be submitted
 		 * (including the nop delays).
 		 */
-		measure_latency(p, &p->latency);
+		measure_latency(p, &p->latency, &p->samples);
 		igt_mean_add(&p->dispatch, *p->last_timestamp - start);
 
 		/* Tidy up all the extra threads before we submit again. */
@@ -425,7 +435,7 @@ static void *consumer(void *arg)
 		if (p->done)
 			return NULL;
 
-		measure_latency(p, &c->latency);
+		measure_latency(p, &c->latency, &c->samples);
 	} while (1);
 }
 
@@ -439,6 +449,16 @@ static double l_estimate(igt_stats_t *stats)
 		return igt_stats_get_mean(stats);
 }
 
+static void *calloc_aligned(size_t nmemb, size_t size)
+{
+	void *ptr;
+
+	if (posix_memalign(&ptr, CACHELINE, nmemb * size))
+		return NULL;
+
+	return memset(ptr, 0, nmemb * size);
+}
+
 static double cpu_time(const struct rusage *r)
 {
 	return 10e6*(r->ru_utime.tv_sec + r->ru_stime.tv_sec) +
@@ -454,7 +474,7 @@ static int run(int seconds,
 {
 	pthread_attr_t attr;
 	struct producer *p;
-	igt_stats_t platency, latency, dispatch;
+	igt_stats_t platency, latency, dispatch, samples;
 	struct rusage rused;
 	uint32_t nop_batch;
 	uint32_t workload_batch;
@@ -492,7 +512,7 @@ static int run(int seconds,
 	nop_batch = create_nop();
 	workload_batch = create_workload(gen, workload);
 
-	p = calloc(nproducers, sizeof(*p));
+	p = calloc_aligned(nproducers, sizeof(*p));
 	for (n = 0; n < nproducers; n++) {
 		if (flags & CONTEXT)
 			p[n].ctx = gem_context_create(fd);
@@ -507,13 +527,18 @@ static int run(int seconds,
 
 		igt_mean_init(&p[n].latency);
 		igt_mean_init(&p[n].dispatch);
+		igt_stats_init_sketch(&p[n].samples,
+				      IGT_STATS_SKETCH_DEFAULT_PRECISION);
 		p[n].wait = nconsumers;
 		p[n].nop = nop;
 		p[n].nconsumers = nconsumers;
-		p[n].consumers = calloc(nconsumers, sizeof(struct consumer));
+		p[n].consumers = calloc_aligned(nconsumers,
+						sizeof(struct consumer));
 		for (m = 0; m < nconsumers; m++) {
 			p[n].consumers[m].producer = &p[n];
 			igt_mean_init(&p[n].consumers[m].latency);
+			igt_stats_init_sketch(&p[n].consumers[m].samples,
+					      IGT_STATS_SKETCH_DEFAULT_PRECISION);
 			pthread_create(&p[n].consumers[m].thread, NULL,
 				       consumer, &p[n].consumers[m]);
 		}
@@ -544,6 +569,7 @@ static int run(int seconds,
 	igt_stats_init_with_size(&dispatch, nproducers);
 	igt_stats_init_with_size(&platency, nproducers);
 	igt_stats_init_with_size(&latency, nconsumers*nproducers);
+	igt_stats_init_sketch(&samples, IGT_STATS_SKETCH_DEFAULT_PRECISION);
 	for (n = 0; n < nproducers; n++) {
 		pthread_join(p[n].thread, NULL);
 
@@ -555,11 +581,13 @@ static int run(int seconds,
 		igt_stats_push_float(&latency, p[n].latency.mean);
 		igt_stats_push_float(&platency, p[n].latency.mean);
 		igt_stats_push_float(&dispatch, p[n].dispatch.mean);
+		igt_stats_merge(&samples, &p[n].samples);
 
 		for (m = 0; m < nconsumers; m++) {
 			pthread_join(p[n].consumers[m].thread, NULL);
 			igt_stats_push_float(&latency,
 					     p[n].consumers[m].latency.mean);
+			igt_stats_merge(&samples, &p[n].consumers[m].samples);
 		}
 	}
 
@@ -589,6 +617,14 @@ static int run(int seconds,
 	case 5:
 		printf("%d\n", complete);
 		break;
+	case 6:
+		printf("%f\n",
+		       CYCLES_TO_US(igt_stats_get_percentile(&samples, 50)));
+		break;
+	case 7:
+		printf("%f\n",
+		       CYCLES_TO_US(igt_stats_get_percentile(&samples, 99)));
+		break;
 	}
 
 	return 0;
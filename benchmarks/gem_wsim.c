@@ -30,23 +30,30 @@
 #include <fcntl.h>
 #include <inttypes.h>
 #include <errno.h>
+#include <ctype.h>
+#include <stdarg.h>
 #include <poll.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
 #include <sys/time.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
 #include <time.h>
 #include <assert.h>
 #include <limits.h>
-
+#include <pthread.h>
 
 #include "intel_chipset.h"
 #include "drm.h"
 #include "ioctl_wrappers.h"
 #include "drmtest.h"
 #include "intel_io.h"
+#include "igt_aux.h"
+#include "igt_calibration.h"
+#include "igt_fake_i915.h"
 #include "igt_rand.h"
+#include "igt_stats.h"
 
 enum intel_engine_id {
 	RCS,
@@ -69,9 +76,13 @@ enum w_type
 	DELAY,
 	PERIOD,
 	THROTTLE,
-	QD_THROTTLE
+	QD_THROTTLE,
+	PRIORITY,
+	BRANCH
 };
 
+#define MAX_DEPS 8
+
 struct w_step
 {
 	/* Workload step metadata */
@@ -79,14 +90,20 @@ struct w_step
 	unsigned int context;
 	unsigned int engine;
 	struct duration duration;
-	int dependency;
+	unsigned int nr_deps;
+	int deps[MAX_DEPS];
 	int wait;
+	unsigned int probability; /* of taking a branch, in percent */
+	unsigned int group; /* context group, 0 for none */
+	const char *name; /* NULL if unnamed */
+	unsigned int line; /* in the workload descriptor */
 
 	/* Implementation details */
 	unsigned int idx;
+	uint64_t sim_end; /* completion of the last submission, simulator only */
 
 	struct drm_i915_gem_execbuffer2 eb;
-	struct drm_i915_gem_exec_object2 obj[4];
+	struct drm_i915_gem_exec_object2 obj[3 + MAX_DEPS];
 	struct drm_i915_gem_relocation_entry reloc[3];
 	unsigned long bb_sz;
 	uint32_t bb_handle;
@@ -103,6 +120,7 @@ struct workload
 {
 	unsigned int nr_steps;
 	struct w_step *steps;
+	char *desc; /* parsed descriptor holding the step names, if not a clone */
 
 	struct timespec repeat_start;
 
@@ -114,7 +132,16 @@ struct workload
 	uint32_t seqno[NUM_ENGINES];
 	uint32_t status_page_handle;
 	uint32_t *status_page;
-	unsigned int vcs_rr;
+	unsigned int rr[NUM_ENGINES];
+	int load_qd[NUM_ENGINES]; /* last published to engine_load */
+
+	uint32_t prng;
+
+	/* Engine picked for each context group in the current iteration */
+	unsigned int nr_groups;
+	int *group_engine;
+
+	struct telemetry *tm;
 
 	unsigned long qd_sum[NUM_ENGINES];
 	unsigned long nr_bb[NUM_ENGINES];
@@ -135,13 +162,25 @@ static unsigned long nop_calibration;
 static bool quiet;
 static int fd;
 
+static bool stop_background; /* set when the master of threaded clients ends */
+
+static int telemetry_fd = -1;
+static uint64_t telemetry_period; /* ns, 0 for the final report only */
+
+#define LOCAL_CONTEXT_PARAM_PRIORITY 0x6
+
 #define SWAPVCS	(1<<0)
 #define SEQNO	(1<<1)
 #define BALANCE	(1<<2)
 #define RT	(1<<3)
 
-#define VCS_SEQNO_IDX(engine) (((engine) - VCS1) * 16)
-#define VCS_SEQNO_OFFSET(engine) (VCS_SEQNO_IDX(engine) * sizeof(uint32_t))
+/*
+ * Balanced engines write their seqno and, with RT, the submit and
+ * completion timestamps to their own 16 dword slot of the status page.
+ */
+#define SEQNO_IDX(engine) ((engine) * 16)
+#define SEQNO_OFFSET(engine) (SEQNO_IDX(engine) * sizeof(uint32_t))
+#define STATUS_PAGE_SIZE (NUM_ENGINES * 16 * sizeof(uint32_t))
 
 #define RCS_TIMESTAMP (0x2000 + 0x358)
 #define REG(x) (volatile uint32_t *)((volatile char *)igt_global_mmio + x)
@@ -166,235 +205,656 @@ static const char *ring_str_map[NUM_ENGINES] = {
 	[VECS] = "VECS",
 };
 
-static struct workload *parse_workload(char *_desc)
+/*
+ * Engines which a workload can name as a class, letting the balancer pick
+ * one of the instances for every batch.
+ */
+struct engine_class {
+	enum intel_engine_id engine;
+	unsigned int count;
+	enum intel_engine_id instances[NUM_ENGINES];
+};
+
+static const struct engine_class engine_classes[] = {
+	{ VCS, 2, { VCS1, VCS2 } },
+};
+
+static const struct engine_class *get_engine_class(enum intel_engine_id engine)
 {
-	struct workload *wrk;
-	unsigned int nr_steps = 0;
-	char *desc = strdup(_desc);
-	char *_token, *token, *tctx = NULL, *tstart = desc;
-	char *field, *fctx = NULL, *fstart;
-	struct w_step step, *steps = NULL;
-	unsigned int valid;
+	for (unsigned int i = 0; i < ARRAY_SIZE(engine_classes); i++) {
+		if (engine_classes[i].engine == engine)
+			return &engine_classes[i];
+	}
+
+	return NULL;
+}
+
+static bool is_balanced_instance(enum intel_engine_id engine)
+{
+	for (unsigned int i = 0; i < ARRAY_SIZE(engine_classes); i++) {
+		for (unsigned int j = 0; j < engine_classes[i].count; j++) {
+			if (engine_classes[i].instances[j] == engine)
+				return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Steps are parsed into this intermediate form which remembers the names
+ * used as references, so they can be resolved once all loops have been
+ * unrolled. Every copy of a loop body then refers to the nearest step of
+ * that name.
+ */
+struct parse_loc {
+	const char *token;
+	unsigned int line;
+	unsigned int step;
+};
+
+struct parse_step {
+	struct w_step step;
+	struct parse_loc loc;
+	const char *name;
+	const char *refs[MAX_DEPS]; /* dependency, sync or branch target names */
+};
+
+#define MAX_LOOP_DEPTH 8
+
+struct parser {
+	struct parse_loc loc;
+
+	struct parse_step *steps;
+	unsigned int nr_steps, max_steps;
+
+	struct {
+		struct parse_loc loc;
+		unsigned int start;
+		unsigned int count;
+	} loops[MAX_LOOP_DEPTH];
+	unsigned int depth;
+
+	unsigned int *ctx_group;
+	unsigned int nr_ctx_groups;
+	unsigned int nr_groups;
+};
+
+static void __attribute__((format(printf, 2, 3)))
+parse_error(const struct parse_loc *loc, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (quiet)
+		return;
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+
+	fprintf(stderr, " at step %u (line %u: '%s')!\n",
+		loc->step, loc->line, loc->token);
+}
+
+static bool parse_int(const char *str, long min, long max, int *out)
+{
+	char *end;
+	long val;
+
+	errno = 0;
+	val = strtol(str, &end, 10);
+	if (!*str || *end || errno || val < min || val > max)
+		return false;
+
+	*out = val;
+	return true;
+}
+
+static bool is_name(const char *str)
+{
+	if (!isalpha((unsigned char)*str) && *str != '_')
+		return false;
+
+	while (*++str) {
+		if (!isalnum((unsigned char)*str) && *str != '_')
+			return false;
+	}
+
+	return true;
+}
+
+static char *strip(char *str)
+{
+	char *end;
+
+	while (isspace((unsigned char)*str))
+		str++;
+
+	end = str + strlen(str);
+	while (end > str && isspace((unsigned char)end[-1]))
+		*--end = 0;
+
+	return str;
+}
+
+static struct parse_step *new_step(struct parser *p)
+{
+	struct parse_step *ps;
+
+	if (p->nr_steps == p->max_steps) {
+		p->max_steps = p->max_steps ? 2 * p->max_steps : 64;
+		p->steps = realloc(p->steps, p->max_steps * sizeof(*p->steps));
+		igt_assert(p->steps);
+	}
+
+	ps = &p->steps[p->nr_steps++];
+	memset(ps, 0, sizeof(*ps));
+	ps->loc = p->loc;
+
+	return ps;
+}
+
+/* <int < 0>|<name>, or <int > 0>|<name> for forward references */
+static bool parse_ref(struct parse_step *ps, unsigned int i, const char *field,
+		      bool forward, int *out)
+{
+	if (is_name(field)) {
+		ps->refs[i] = field;
+		*out = 0;
+		return true;
+	}
+
+	if (forward)
+		return parse_int(field, 1, INT_MAX, out);
+	else
+		return parse_int(field, INT_MIN, -1, out);
+}
+
+static bool parse_deps(struct parse_step *ps, char *field)
+{
+	struct w_step *step = &ps->step;
+	char *dep, *ctx = NULL;
+
+	if (!strcmp(field, "0"))
+		return true;
+
+	for (; (dep = strtok_r(field, "/", &ctx)); field = NULL) {
+		if (step->nr_deps == MAX_DEPS) {
+			parse_error(&ps->loc, "Too many dependencies (max %u)",
+				    MAX_DEPS);
+			return false;
+		}
+
+		if (!parse_ref(ps, step->nr_deps, dep, false,
+			       &step->deps[step->nr_deps])) {
+			parse_error(&ps->loc, "Invalid dependency '%s'", dep);
+			return false;
+		}
+
+		step->nr_deps++;
+	}
+
+	return true;
+}
+
+static bool parse_duration(struct duration *dur, char *field)
+{
+	char *sep = strchr(field, '-');
+	int min = 0, max = 0;
+
+	bool ok;
+
+	if (sep)
+		*sep = 0;
+
+	ok = parse_int(field, 1, INT_MAX, &min);
+	if (ok && sep)
+		ok = parse_int(sep + 1, min, INT_MAX, &max);
+	else
+		max = min;
+
+	if (sep)
+		*sep = '-';
+
+	dur->min = min;
+	dur->max = max;
+
+	return ok;
+}
+
+/* ctx.engine.duration_us.dependencies.wait */
+static bool parse_batch(struct parser *p, struct parse_step *ps,
+			char **fields, unsigned int nr_fields)
+{
+	struct w_step *step = &ps->step;
 	int tmp;
 
-	while ((_token = strtok_r(tstart, ",", &tctx)) != NULL) {
-		tstart = NULL;
-		token = strdup(_token);
-		fstart = token;
-		valid = 0;
-		memset(&step, 0, sizeof(step));
-
-		if ((field = strtok_r(fstart, ".", &fctx)) != NULL) {
-			fstart = NULL;
-
-			if (!strcasecmp(field, "d")) {
-				if ((field = strtok_r(fstart, ".", &fctx)) !=
-				    NULL) {
-					tmp = atoi(field);
-					if (tmp <= 0) {
-						if (!quiet)
-							fprintf(stderr,
-								"Invalid delay at step %u!\n",
-								nr_steps);
-						return NULL;
-					}
-
-					step.type = DELAY;
-					step.wait = tmp;
-					goto add_step;
-				}
-			} else if (!strcasecmp(field, "p")) {
-				if ((field = strtok_r(fstart, ".", &fctx)) !=
-				    NULL) {
-					tmp = atoi(field);
-					if (tmp <= 0) {
-						if (!quiet)
-							fprintf(stderr,
-								"Invalid period at step %u!\n",
-								nr_steps);
-						return NULL;
-					}
-
-					step.type = PERIOD;
-					step.wait = tmp;
-					goto add_step;
-				}
-			} else if (!strcasecmp(field, "s")) {
-				if ((field = strtok_r(fstart, ".", &fctx)) !=
-				    NULL) {
-					tmp = atoi(field);
-					if (tmp >= 0) {
-						if (!quiet)
-							fprintf(stderr,
-								"Invalid sync target at step %u!\n",
-								nr_steps);
-						return NULL;
-					}
-
-					step.type = SYNC;
-					step.wait = tmp;
-					goto add_step;
-				}
-			} else if (!strcasecmp(field, "t")) {
-				if ((field = strtok_r(fstart, ".", &fctx)) !=
-				    NULL) {
-					tmp = atoi(field);
-					if (tmp < 0) {
-						if (!quiet)
-							fprintf(stderr,
-								"Invalid throttle at step %u!\n",
-								nr_steps);
-						return NULL;
-					}
-
-					step.type = THROTTLE;
-					step.wait = tmp;
-					goto add_step;
-				}
-			} else if (!strcasecmp(field, "q")) {
-				if ((field = strtok_r(fstart, ".", &fctx)) !=
-				    NULL) {
-					tmp = atoi(field);
-					if (tmp < 0) {
-						if (!quiet)
-							fprintf(stderr,
-								"Invalid qd throttle at step %u!\n",
-								nr_steps);
-						return NULL;
-					}
-
-					step.type = QD_THROTTLE;
-					step.wait = tmp;
-					goto add_step;
-				}
-			}
+	if (nr_fields != 5) {
+		parse_error(&p->loc, "Invalid record");
+		return false;
+	}
 
-			tmp = atoi(field);
-			if (tmp < 0) {
-				if (!quiet)
-					fprintf(stderr,
-						"Invalid ctx id at step %u!\n",
-						nr_steps);
-				return NULL;
-			}
-			step.context = tmp;
+	step->type = BATCH;
+
+	if (!parse_int(fields[0], 0, INT_MAX, &tmp)) {
+		parse_error(&p->loc, "Invalid ctx id '%s'", fields[0]);
+		return false;
+	}
+	step->context = tmp;
 
-			valid++;
+	for (tmp = 0; tmp < ARRAY_SIZE(ring_str_map); tmp++) {
+		if (!strcasecmp(fields[1], ring_str_map[tmp]))
+			break;
+	}
+	if (tmp == ARRAY_SIZE(ring_str_map)) {
+		parse_error(&p->loc, "Invalid engine id '%s'", fields[1]);
+		return false;
+	}
+	step->engine = tmp;
+
+	if (!parse_duration(&step->duration, fields[2])) {
+		parse_error(&p->loc, "Invalid duration '%s'", fields[2]);
+		return false;
+	}
+
+	if (!parse_deps(ps, fields[3]))
+		return false;
+
+	if (!parse_int(fields[4], 0, 1, &step->wait)) {
+		parse_error(&p->loc, "Invalid wait boolean '%s'", fields[4]);
+		return false;
+	}
+
+	return true;
+}
+
+static bool parse_group(struct parser *p, char *field)
+{
+	char *ctx_str, *ctx = NULL;
+	unsigned int group = ++p->nr_groups;
+	int tmp;
+
+	for (; (ctx_str = strtok_r(field, "/", &ctx)); field = NULL) {
+		if (!parse_int(ctx_str, 0, INT_MAX, &tmp)) {
+			parse_error(&p->loc, "Invalid ctx id '%s'", ctx_str);
+			return false;
 		}
 
-		if ((field = strtok_r(fstart, ".", &fctx)) != NULL) {
-			unsigned int i, old_valid = valid;
+		if (tmp >= p->nr_ctx_groups) {
+			unsigned int n = tmp + 1;
 
-			fstart = NULL;
+			p->ctx_group = realloc(p->ctx_group,
+					       n * sizeof(*p->ctx_group));
+			igt_assert(p->ctx_group);
+			memset(&p->ctx_group[p->nr_ctx_groups], 0,
+			       (n - p->nr_ctx_groups) * sizeof(*p->ctx_group));
+			p->nr_ctx_groups = n;
+		}
 
-			for (i = 0; i < ARRAY_SIZE(ring_str_map); i++) {
-				if (!strcasecmp(field, ring_str_map[i])) {
-					step.engine = i;
-					valid++;
-					break;
-				}
-			}
+		if (p->ctx_group[tmp]) {
+			parse_error(&p->loc, "Context %d already in a group",
+				    tmp);
+			return false;
+		}
 
-			if (old_valid == valid) {
-				if (!quiet)
-					fprintf(stderr,
-						"Invalid engine id at step %u!\n",
-						nr_steps);
-				return NULL;
-			}
+		p->ctx_group[tmp] = group;
+	}
+
+	return true;
+}
+
+static bool parse_loop_end(struct parser *p)
+{
+	unsigned int start, len, count;
+
+	if (!p->depth) {
+		parse_error(&p->loc, "Loop end without a loop");
+		return false;
+	}
+
+	p->depth--;
+	start = p->loops[p->depth].start;
+	count = p->loops[p->depth].count;
+	len = p->nr_steps - start;
+
+	while (--count) {
+		for (unsigned int i = 0; i < len; i++) {
+			struct parse_step *ps = new_step(p);
+
+			/* new_step() may have moved the array */
+			*ps = p->steps[start + i];
 		}
+	}
 
-		if ((field = strtok_r(fstart, ".", &fctx)) != NULL) {
-			char *sep = NULL;
-			long int tmpl;
+	return true;
+}
 
-			fstart = NULL;
+#define MAX_FIELDS 8
 
-			tmpl = strtol(field, &sep, 10);
-			if (tmpl == LONG_MIN || tmpl == LONG_MAX) {
-				if (!quiet)
-					fprintf(stderr,
-						"Invalid duration at step %u!\n",
-						nr_steps);
-				return NULL;
-			}
-			step.duration.min = tmpl;
+static bool parse_token(struct parser *p, char *token)
+{
+	char *fields[MAX_FIELDS];
+	unsigned int nr_fields = 0;
+	struct parse_step *ps;
+	struct w_step *step;
+	const char *name = NULL;
+	char *sep, *field, *ctx = NULL;
+
+	sep = strchr(token, ':');
+	if (sep) {
+		*sep = 0;
+		name = strip(token);
+		token = strip(sep + 1);
+
+		if (!is_name(name)) {
+			parse_error(&p->loc, "Invalid step name '%s'", name);
+			return false;
+		}
+	}
 
-			if (sep && *sep == '-') {
-				tmpl = strtol(sep + 1, NULL, 10);
-				if (tmpl == LONG_MIN || tmpl == LONG_MAX) {
-					if (!quiet)
-						fprintf(stderr,
-							"Invalid duration range at step %u!\n",
-							nr_steps);
-					return NULL;
-				}
-				step.duration.max = tmpl;
-			} else {
-				step.duration.max = step.duration.min;
+	for (; (field = strtok_r(token, ".", &ctx)); token = NULL) {
+		if (nr_fields == MAX_FIELDS) {
+			parse_error(&p->loc, "Invalid record");
+			return false;
+		}
+		fields[nr_fields++] = field;
+	}
+
+	if (!nr_fields) {
+		parse_error(&p->loc, "Empty step");
+		return false;
+	}
+
+	/* Directives which do not add a step */
+	if (!strcasecmp(fields[0], "group") || !strcasecmp(fields[0], "loop") ||
+	    !strcasecmp(fields[0], "end")) {
+		int count;
+
+		if (name) {
+			parse_error(&p->loc, "Unexpected step name '%s'", name);
+			return false;
+		}
+
+		if (!strcasecmp(fields[0], "end")) {
+			if (nr_fields != 1) {
+				parse_error(&p->loc, "Invalid loop end");
+				return false;
 			}
 
-			valid++;
+			return parse_loop_end(p);
+		}
+
+		if (nr_fields != 2) {
+			parse_error(&p->loc, "Invalid %s", fields[0]);
+			return false;
 		}
 
-		if ((field = strtok_r(fstart, ".", &fctx)) != NULL) {
-			fstart = NULL;
+		if (!strcasecmp(fields[0], "group"))
+			return parse_group(p, fields[1]);
 
-			tmp = atoi(field);
-			if (tmp > 0) {
-				if (!quiet)
-					fprintf(stderr,
-						"Invalid forward dependency at step %u!\n",
-						nr_steps);
-				return NULL;
-			}
-			step.dependency = tmp;
+		if (p->depth == MAX_LOOP_DEPTH) {
+			parse_error(&p->loc, "Loops nested too deep (max %u)",
+				    MAX_LOOP_DEPTH);
+			return false;
+		}
 
-			valid++;
+		if (!parse_int(fields[1], 1, INT_MAX, &count)) {
+			parse_error(&p->loc, "Invalid loop count '%s'",
+				    fields[1]);
+			return false;
 		}
 
-		if ((field = strtok_r(fstart, ".", &fctx)) != NULL) {
-			fstart = NULL;
+		p->loops[p->depth].loc = p->loc;
+		p->loops[p->depth].start = p->nr_steps;
+		p->loops[p->depth].count = count;
+		p->depth++;
 
-			tmp = atoi(field);
-			if (tmp != 0 && tmp != 1) {
-				if (!quiet)
-					fprintf(stderr,
-						"Invalid wait boolean at step %u!\n",
-						nr_steps);
-				return NULL;
-			}
-			step.wait = tmp;
+		return true;
+	}
 
-			valid++;
+	ps = new_step(p);
+	ps->name = name;
+	step = &ps->step;
+
+	if (!strcasecmp(fields[0], "d") || !strcasecmp(fields[0], "p") ||
+	    !strcasecmp(fields[0], "t") || !strcasecmp(fields[0], "q")) {
+		static const struct {
+			const char *id;
+			enum w_type type;
+			int min;
+			const char *desc;
+		} simple[] = {
+			{ "d", DELAY, 1, "delay" },
+			{ "p", PERIOD, 1, "period" },
+			{ "t", THROTTLE, 0, "throttle" },
+			{ "q", QD_THROTTLE, 0, "qd throttle" },
+		};
+		unsigned int i;
+
+		for (i = 0; strcasecmp(fields[0], simple[i].id); i++)
+			;
+
+		if (nr_fields != 2 ||
+		    !parse_int(fields[1], simple[i].min, INT_MAX, &step->wait)) {
+			parse_error(&p->loc, "Invalid %s", simple[i].desc);
+			return false;
 		}
 
-		if (valid != 5) {
-			if (!quiet)
-				fprintf(stderr, "Invalid record at step %u!\n",
-					nr_steps);
-			return NULL;
+		step->type = simple[i].type;
+	} else if (!strcasecmp(fields[0], "s")) {
+		if (nr_fields != 2 ||
+		    !parse_ref(ps, 0, fields[1], false, &step->wait)) {
+			parse_error(&p->loc, "Invalid sync target");
+			return false;
+		}
+
+		step->type = SYNC;
+	} else if (!strcasecmp(fields[0], "prio")) {
+		int tmp;
+
+		if (nr_fields != 3 || !parse_int(fields[1], 0, INT_MAX, &tmp)) {
+			parse_error(&p->loc, "Invalid priority context");
+			return false;
+		}
+		step->context = tmp;
+
+		if (!parse_int(fields[2], -1023, 1023, &step->wait)) {
+			parse_error(&p->loc, "Invalid priority '%s'",
+				    fields[2]);
+			return false;
 		}
 
-		step.type = BATCH;
+		step->type = PRIORITY;
+	} else if (!strcasecmp(fields[0], "branch")) {
+		int tmp;
 
-add_step:
-		step.idx = nr_steps++;
-		steps = realloc(steps, sizeof(step) * nr_steps);
-		igt_assert(steps);
+		if (nr_fields != 3 || !parse_int(fields[1], 0, 100, &tmp)) {
+			parse_error(&p->loc, "Invalid branch probability");
+			return false;
+		}
+		step->probability = tmp;
 
-		memcpy(&steps[nr_steps - 1], &step, sizeof(step));
+		if (!parse_ref(ps, 0, fields[2], true, &step->wait)) {
+			parse_error(&p->loc, "Invalid branch target '%s'",
+				    fields[2]);
+			return false;
+		}
 
-		free(token);
+		step->type = BRANCH;
+	} else {
+		return parse_batch(p, ps, fields, nr_fields);
 	}
 
-	wrk = malloc(sizeof(*wrk));
-	igt_assert(wrk);
+	return true;
+}
+
+static int find_step(struct parser *p, unsigned int from, const char *name,
+		     bool forward)
+{
+	int i;
+
+	if (forward) {
+		for (i = from + 1; i < p->nr_steps; i++) {
+			if (p->steps[i].name && !strcmp(p->steps[i].name, name))
+				return i;
+		}
+	} else {
+		for (i = from - 1; i >= 0; i--) {
+			if (p->steps[i].name && !strcmp(p->steps[i].name, name))
+				return i;
+		}
+	}
+
+	return -1;
+}
+
+/* Resolve names to step offsets and check that references are sane */
+static bool resolve_refs(struct parser *p, unsigned int idx)
+{
+	struct parse_step *ps = &p->steps[idx];
+	struct w_step *step = &ps->step;
+	unsigned int nr_refs = 0;
+	int *refs = NULL;
+	bool forward = false;
+
+	switch (step->type) {
+	case BATCH:
+		refs = step->deps;
+		nr_refs = step->nr_deps;
+		break;
+	case SYNC:
+		refs = &step->wait;
+		nr_refs = 1;
+		break;
+	case BRANCH:
+		refs = &step->wait;
+		nr_refs = 1;
+		forward = true;
+		break;
+	default:
+		break;
+	}
+
+	for (unsigned int i = 0; i < nr_refs; i++) {
+		int target;
+
+		if (ps->refs[i]) {
+			target = find_step(p, idx, ps->refs[i], forward);
+			if (target < 0) {
+				parse_error(&ps->loc, "Unknown %s step '%s'",
+					    forward ? "following" : "preceding",
+					    ps->refs[i]);
+				return false;
+			}
+			refs[i] = target - (int)idx;
+		}
+
+		target = idx + refs[i];
+		if (forward) {
+			/* Branching to the end skips the rest of the workload */
+			if (target > p->nr_steps) {
+				parse_error(&ps->loc,
+					    "Branch beyond the end of the workload");
+				return false;
+			}
+		} else if (target < 0) {
+			parse_error(&ps->loc,
+				    "Reference before the start of the workload");
+			return false;
+		} else if (p->steps[target].step.type != BATCH) {
+			parse_error(&ps->loc, "Reference to a non-batch step");
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * See benchmarks/wsim/README for the grammar. Steps are separated by commas
+ * or new lines, and '#' starts a comment running to the end of the line.
+ */
+static struct workload *parse_workload(char *_desc)
+{
+	struct parser p = { };
+	struct workload *wrk = NULL;
+	char *desc = strdup(_desc);
+	char *orig = strdup(_desc); /* unmodified steps for error messages */
+	char *line, *next;
+	bool ok = true;
+
+	igt_assert(desc && orig);
+
+	for (line = desc; ok && line; line = next) {
+		char *token, *c, *ctx = NULL;
+
+		p.loc.line++;
+
+		next = strchr(line, '\n');
+		if (next)
+			*next++ = 0;
+
+		c = strchr(line, '#');
+		if (c)
+			*c = 0;
+
+		for (; ok && (token = strtok_r(line, ",", &ctx)); line = NULL) {
+			token = strip(token);
+			if (!*token)
+				continue;
+
+			p.loc.token = orig + (token - desc);
+			orig[token - desc + strlen(token)] = 0;
+			p.loc.step++;
+
+			ok = parse_token(&p, token);
+		}
+	}
+
+	if (ok && p.depth) {
+		parse_error(&p.loops[p.depth - 1].loc, "Unterminated loop");
+		ok = false;
+	}
+
+	if (ok && !p.nr_steps) {
+		if (!quiet)
+			fprintf(stderr, "Empty workload!\n");
+		ok = false;
+	}
+
+	for (unsigned int i = 0; ok && i < p.nr_steps; i++)
+		ok = resolve_refs(&p, i);
+
+	if (ok) {
+		wrk = calloc(1, sizeof(*wrk));
+		igt_assert(wrk);
+
+		wrk->nr_steps = p.nr_steps;
+		wrk->steps = calloc(p.nr_steps, sizeof(struct w_step));
+		igt_assert(wrk->steps);
+		wrk->nr_groups = p.nr_groups;
+
+		for (unsigned int i = 0; i < p.nr_steps; i++) {
+			struct w_step *w = &wrk->steps[i];
 
-	wrk->nr_steps = nr_steps;
-	wrk->steps = steps;
+			*w = p.steps[i].step;
+			w->idx = i;
+			w->name = p.steps[i].name;
+			w->line = p.steps[i].loc.line;
 
-	free(desc);
+			if (w->type == BATCH && w->context < p.nr_ctx_groups)
+				w->group = p.ctx_group[w->context];
+		}
+	}
+
+	free(p.ctx_group);
+	free(p.steps);
+	free(orig);
+
+	if (wrk)
+		wrk->desc = desc;
+	else
+		free(desc);
 
 	return wrk;
 }
@@ -414,6 +874,10 @@ clone_workload(struct workload *_wrk)
 
 	memcpy(wrk->steps, _wrk->steps, sizeof(struct w_step) * wrk->nr_steps);
 
+	wrk->nr_groups = _wrk->nr_groups;
+	wrk->group_engine = calloc(wrk->nr_groups + 1, sizeof(int));
+	igt_assert(wrk->group_engine);
+
 	return wrk;
 }
 
@@ -422,12 +886,12 @@ clone_workload(struct workload *_wrk)
 #define PAGE_SIZE (4096)
 #endif
 
-static unsigned int get_duration(struct duration *dur)
+static unsigned int get_duration(struct workload *wrk, struct duration *dur)
 {
 	if (dur->min == dur->max)
 		return dur->min;
 	else
-		return dur->min + hars_petruska_f54_1_random_unsafe() %
+		return dur->min + hars_petruska_f54_1_random(&wrk->prng) %
 		       (dur->max + 1 - dur->min);
 }
 
@@ -530,17 +994,16 @@ alloc_step_batch(struct workload *wrk, struct w_step *w, unsigned int flags)
 	w->bb_handle = w->obj[bb_i].handle = gem_create(fd, w->bb_sz);
 	terminate_bb(w, flags);
 
-	igt_assert(w->dependency <= 0);
-	if (w->dependency) {
-		int dep_idx = w->idx + w->dependency;
+	for (unsigned int i = 0; i < w->nr_deps; i++) {
+		int dep_idx = w->idx + w->deps[i];
 
+		igt_assert(w->deps[i] < 0);
 		igt_assert(dep_idx >= 0 && dep_idx < wrk->nr_steps);
 		igt_assert(wrk->steps[dep_idx].type == BATCH);
 
 		w->obj[j].handle = w->obj[bb_i].handle;
-		bb_i = j;
-		w->obj[j - 1].handle = wrk->steps[dep_idx].obj[0].handle;
-		j++;
+		w->obj[bb_i].handle = wrk->steps[dep_idx].obj[0].handle;
+		bb_i = j++;
 	}
 
 	if (flags & SEQNO) {
@@ -579,7 +1042,7 @@ prepare_workload(struct workload *wrk, unsigned int flags)
 	int i;
 
 	if (flags & SEQNO) {
-		const unsigned int status_sz = sizeof(uint32_t);
+		const unsigned int status_sz = STATUS_PAGE_SIZE;
 		uint32_t handle = gem_create(fd, status_sz);
 
 		gem_set_caching(fd, handle, I915_CACHING_CACHED);
@@ -604,7 +1067,7 @@ prepare_workload(struct workload *wrk, unsigned int flags)
 		if (!wrk->ctx_id[w->context]) {
 			struct drm_i915_gem_context_create arg = {};
 
-			drmIoctl(fd, DRM_IOCTL_I915_GEM_CONTEXT_CREATE, &arg);
+			igt_ioctl(fd, DRM_IOCTL_I915_GEM_CONTEXT_CREATE, &arg);
 			igt_assert(arg.ctx_id);
 
 			wrk->ctx_id[w->context] = arg.ctx_id;
@@ -618,37 +1081,34 @@ prepare_workload(struct workload *wrk, unsigned int flags)
 		if (w->type != BATCH)
 			continue;
 
-		if (engine != VCS && engine != VCS1 && engine != VCS2)
+		if (!get_engine_class(engine) && !is_balanced_instance(engine))
 			_flags &= ~(SEQNO | RT);
 
-		if (engine == VCS)
+		if (get_engine_class(engine))
 			_flags &= ~SWAPVCS;
 
 		alloc_step_batch(wrk, w, _flags);
 	}
 }
 
-static double elapsed(const struct timespec *start, const struct timespec *end)
-{
-	return (end->tv_sec - start->tv_sec) +
-	       (end->tv_nsec - start->tv_nsec) / 1e9;
-}
-
 static int elapsed_us(const struct timespec *start, const struct timespec *end)
 {
-	return elapsed(start, end) * 1e6;
-}
-
-static enum intel_engine_id get_vcs_engine(unsigned int n)
-{
-	const enum intel_engine_id vcs_engines[2] = { VCS1, VCS2 };
-
-	igt_assert(n < ARRAY_SIZE(vcs_engines));
-
-	return vcs_engines[n];
+	return igt_elapsed(start, end) * 1e6;
 }
 
+/*
+ * Balancers pick an instance of the engine class a batch was submitted to.
+ * They only look at the workload state (seqnos, status page), which is
+ * written either by the GPU or by the simulator, so the same code is used
+ * for both.
+ */
 struct workload_balancer {
+	unsigned int id;
+	const char *name;
+	const char *desc;
+	unsigned int flags;
+	unsigned int min_gen;
+
 	unsigned int (*get_qd)(const struct workload_balancer *balancer,
 			       struct workload *wrk,
 			       enum intel_engine_id engine);
@@ -660,75 +1120,138 @@ static enum intel_engine_id
 rr_balance(const struct workload_balancer *balancer,
 	   struct workload *wrk, struct w_step *w)
 {
-	unsigned int engine;
+	const struct engine_class *class = get_engine_class(w->engine);
+	unsigned int n;
 
-	engine = get_vcs_engine(wrk->vcs_rr);
-	wrk->vcs_rr ^= 1;
+	n = wrk->rr[w->engine] % class->count;
+	wrk->rr[w->engine] = n + 1;
 
-	return engine;
+	return class->instances[n];
 }
 
-static const struct workload_balancer rr_balancer = {
-	.balance = rr_balance,
-};
-
 static unsigned int
 get_qd_depth(const struct workload_balancer *balancer,
 	     struct workload *wrk, enum intel_engine_id engine)
 {
 	return wrk->seqno[engine] -
-	       wrk->status_page[VCS_SEQNO_IDX(engine)];
+	       wrk->status_page[SEQNO_IDX(engine)];
 }
 
-static enum intel_engine_id
+/*
+ * Pick the instance with the lowest estimate, ties going to the next one
+ * in round-robin order.
+ */
+static enum intel_engine_id
+select_lowest(struct workload *wrk, const struct engine_class *class,
+	      const long *estimate)
+{
+	unsigned int first = wrk->rr[class->engine] % class->count;
+	unsigned int n = first;
+
+	for (unsigned int i = 1; i < class->count; i++) {
+		unsigned int k = (first + i) % class->count;
+
+		if (estimate[k] < estimate[n])
+			n = k;
+	}
+
+	wrk->rr[class->engine] = n + 1;
+
+	return class->instances[n];
+}
+
+static enum intel_engine_id
 qd_balance(const struct workload_balancer *balancer,
 	   struct workload *wrk, struct w_step *w)
 {
-	enum intel_engine_id engine;
+	const struct engine_class *class = get_engine_class(w->engine);
 	long qd[NUM_ENGINES];
-	unsigned int n;
-
-	igt_assert(w->engine == VCS);
 
-	qd[VCS1] = balancer->get_qd(balancer, wrk, VCS1);
-	wrk->qd_sum[VCS1] += qd[VCS1];
+	igt_assert(class);
 
-	qd[VCS2] = balancer->get_qd(balancer, wrk, VCS2);
-	wrk->qd_sum[VCS2] += qd[VCS2];
+	for (unsigned int i = 0; i < class->count; i++) {
+		enum intel_engine_id engine = class->instances[i];
 
-	if (qd[VCS1] < qd[VCS2])
-		n = 0;
-	else if (qd[VCS2] < qd[VCS1])
-		n = 1;
-	else
-		n = wrk->vcs_rr;
-
-	engine = get_vcs_engine(n);
-	wrk->vcs_rr = n ^ 1;
+		qd[i] = balancer->get_qd(balancer, wrk, engine);
+		wrk->qd_sum[engine] += qd[i];
+	}
 
 #ifdef DEBUG
-	printf("qd_balance: 1:%ld 2:%ld rr:%u = %u\t(%lu - %u) (%lu - %u)\n",
-	       qd[VCS1], qd[VCS2], wrk->vcs_rr, engine,
-	       wrk->seqno[VCS1], wrk->status_page[VCS_SEQNO_IDX(VCS1)],
-	       wrk->seqno[VCS2], wrk->status_page[VCS_SEQNO_IDX(VCS2)]);
+	for (unsigned int i = 0; i < class->count; i++)
+		printf("qd_balance: %s %ld (%u - %u)\n",
+		       ring_str_map[class->instances[i]], qd[i],
+		       wrk->seqno[class->instances[i]],
+		       wrk->status_page[SEQNO_IDX(class->instances[i])]);
 #endif
-	return engine;
+	return select_lowest(wrk, class, qd);
 }
 
-static const struct workload_balancer qd_balancer = {
-	.get_qd = get_qd_depth,
-	.balance = qd_balance,
+/*
+ * Load of the balanced engines as seen by all the clients, the sum of the
+ * queue depths each of them last published. It lives in shared memory so
+ * forked clients see it as well as threaded ones, and is only updated with
+ * atomic adds, so reading it is lock-free if possibly a little stale.
+ */
+struct engine_load {
+	int qd[NUM_ENGINES];
 };
 
+static struct engine_load *engine_load;
+
+static void publish_load(struct workload *wrk, enum intel_engine_id engine)
+{
+	int qd;
+
+	if (!engine_load || !wrk->status_page)
+		return;
+
+	qd = get_qd_depth(NULL, wrk, engine);
+	if (qd != wrk->load_qd[engine]) {
+		__atomic_add_fetch(&engine_load->qd[engine],
+				   qd - wrk->load_qd[engine], __ATOMIC_RELAXED);
+		wrk->load_qd[engine] = qd;
+	}
+}
+
+static void publish_all_loads(struct workload *wrk)
+{
+	for (unsigned int i = 0; i < ARRAY_SIZE(engine_classes); i++) {
+		const struct engine_class *class = &engine_classes[i];
+
+		for (unsigned int j = 0; j < class->count; j++)
+			publish_load(wrk, class->instances[j]);
+	}
+}
+
+static enum intel_engine_id
+gqd_balance(const struct workload_balancer *balancer,
+	    struct workload *wrk, struct w_step *w)
+{
+	const struct engine_class *class = get_engine_class(w->engine);
+	long qd[NUM_ENGINES];
+
+	igt_assert(class && engine_load);
+
+	for (unsigned int i = 0; i < class->count; i++) {
+		enum intel_engine_id engine = class->instances[i];
+
+		publish_load(wrk, engine);
+		wrk->qd_sum[engine] += balancer->get_qd(balancer, wrk, engine);
+		qd[i] = __atomic_load_n(&engine_load->qd[engine],
+					__ATOMIC_RELAXED);
+	}
+
+	return select_lowest(wrk, class, qd);
+}
+
 static enum intel_engine_id
 rt_balance(const struct workload_balancer *balancer,
 	   struct workload *wrk, struct w_step *w)
 {
-	enum intel_engine_id engine;
+	const struct engine_class *class = get_engine_class(w->engine);
 	long qd[NUM_ENGINES];
-	unsigned int n;
 
-	igt_assert(w->engine == VCS);
+	igt_assert(class);
 
 	/* Estimate the "speed" of the most recent batch
 	 *    (finish time - submit time)
@@ -736,57 +1259,85 @@ rt_balance(const struct workload_balancer *balancer,
 	 * all batches on that engine. We try to keep the total remaining
 	 * balanced between the engines.
 	 */
-	qd[VCS1] = balancer->get_qd(balancer, wrk, VCS1);
-	wrk->qd_sum[VCS1] += qd[VCS1];
-	qd[VCS1] *= wrk->status_page[2] - wrk->status_page[1];
-#ifdef DEBUG
-	printf("qd[0] = %d (%d - %d) x %d (%d - %d) = %ld\n",
-	       wrk->seqno[VCS1] - wrk->status_page[0],
-	       wrk->seqno[VCS1], wrk->status_page[0],
-	       wrk->status_page[2] - wrk->status_page[1],
-	       wrk->status_page[2], wrk->status_page[1],
-	       qd[VCS1]);
-#endif
+	for (unsigned int i = 0; i < class->count; i++) {
+		enum intel_engine_id engine = class->instances[i];
+		const uint32_t *rt = &wrk->status_page[SEQNO_IDX(engine)];
 
-	qd[VCS2] = balancer->get_qd(balancer, wrk, VCS2);
-	wrk->qd_sum[VCS2] += qd[VCS2];
-	qd[VCS2] *= wrk->status_page[2 + 16] - wrk->status_page[1 + 16];
+		qd[i] = balancer->get_qd(balancer, wrk, engine);
+		wrk->qd_sum[engine] += qd[i];
+		qd[i] *= rt[2] - rt[1];
 #ifdef DEBUG
-	printf("qd[1] = %d (%d - %d) x %d (%d - %d) = %ld\n",
-	       wrk->seqno[VCS2] - wrk->status_page[16],
-	       wrk->seqno[VCS2], wrk->status_page[16],
-	       wrk->status_page[18] - wrk->status_page[17],
-	       wrk->status_page[18], wrk->status_page[17],
-	       qd[VCS2]);
+		printf("qd[%s] = %d (%d - %d) x %d (%d - %d) = %ld\n",
+		       ring_str_map[engine],
+		       wrk->seqno[engine] - rt[0],
+		       wrk->seqno[engine], rt[0],
+		       rt[2] - rt[1], rt[2], rt[1],
+		       qd[i]);
 #endif
+	}
 
-	if (qd[VCS1] < qd[VCS2])
-		n = 0;
-	else if (qd[VCS2] < qd[VCS1])
-		n = 1;
-	else
-		n = wrk->vcs_rr;
-
-	engine = get_vcs_engine(n);
-	wrk->vcs_rr = n ^ 1;
-
-	return engine;
+	return select_lowest(wrk, class, qd);
 }
 
-static const struct workload_balancer rt_balancer = {
-	.get_qd = get_qd_depth,
-	.balance = rt_balance,
+static const struct workload_balancer all_balancers[] = {
+	{
+		.id = 0,
+		.name = "rr",
+		.desc = "Simple round-robin.",
+		.balance = rr_balance,
+	},
+	{
+		.id = 1,
+		.name = "qd",
+		.desc = "Queue depth estimation with round-robin on equal depth.",
+		.flags = SEQNO,
+		.min_gen = 8,
+		.get_qd = get_qd_depth,
+		.balance = qd_balance,
+	},
+	{
+		.id = 2,
+		.name = "rt",
+		.desc = "Queue depth plus last runtime estimation.",
+		.flags = SEQNO | RT,
+		.min_gen = 8,
+		.get_qd = get_qd_depth,
+		.balance = rt_balance,
+	},
+	{
+		.id = 3,
+		.name = "gqd",
+		.desc = "Queue depth across all clients.",
+		.flags = SEQNO,
+		.min_gen = 8,
+		.get_qd = get_qd_depth,
+		.balance = gqd_balance,
+	},
 };
 
+static const struct workload_balancer *find_balancer(const char *arg)
+{
+	char *end;
+	long id = strtol(arg, &end, 0);
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(all_balancers); i++) {
+		if (*end == '\0' ? all_balancers[i].id == id :
+		    !strcasecmp(arg, all_balancers[i].name))
+			return &all_balancers[i];
+	}
+
+	return NULL;
+}
+
 static void
 update_bb_seqno(struct w_step *w, enum intel_engine_id engine, uint32_t seqno)
 {
-	igt_assert(engine == VCS1 || engine == VCS2);
+	igt_assert(is_balanced_instance(engine));
 
 	gem_set_domain(fd, w->bb_handle,
 		       I915_GEM_DOMAIN_WC, I915_GEM_DOMAIN_WC);
 
-	w->reloc[0].delta = VCS_SEQNO_OFFSET(engine);
+	w->reloc[0].delta = SEQNO_OFFSET(engine);
 
 	*w->seqno_value = seqno;
 	*w->seqno_address = w->reloc[0].presumed_offset + w->reloc[0].delta;
@@ -799,13 +1350,13 @@ update_bb_seqno(struct w_step *w, enum intel_engine_id engine, uint32_t seqno)
 static void
 update_bb_rt(struct w_step *w, enum intel_engine_id engine)
 {
-	igt_assert(engine == VCS1 || engine == VCS2);
+	igt_assert(is_balanced_instance(engine));
 
 	gem_set_domain(fd, w->bb_handle,
 		       I915_GEM_DOMAIN_WC, I915_GEM_DOMAIN_WC);
 
-	w->reloc[1].delta = VCS_SEQNO_OFFSET(engine) + sizeof(uint32_t);
-	w->reloc[2].delta = VCS_SEQNO_OFFSET(engine) + 2 * sizeof(uint32_t);
+	w->reloc[1].delta = SEQNO_OFFSET(engine) + sizeof(uint32_t);
+	w->reloc[2].delta = SEQNO_OFFSET(engine) + 2 * sizeof(uint32_t);
 
 	*w->rt0_value = *REG(RCS_TIMESTAMP);
 	*w->rt0_address = w->reloc[1].presumed_offset + w->reloc[1].delta;
@@ -818,7 +1369,8 @@ update_bb_rt(struct w_step *w, enum intel_engine_id engine)
 	}
 }
 
-static void w_sync_to(struct workload *wrk, struct w_step *w, int target)
+/* The batch at or before step target, wrapping around the workload */
+static struct w_step *sync_target(struct workload *wrk, int target)
 {
 	if (target < 0)
 		target = wrk->nr_steps + target;
@@ -833,7 +1385,373 @@ static void w_sync_to(struct workload *wrk, struct w_step *w, int target)
 	igt_assert(target < wrk->nr_steps);
 	igt_assert(wrk->steps[target].type == BATCH);
 
-	gem_sync(fd, wrk->steps[target].obj[0].handle);
+	return &wrk->steps[target];
+}
+
+static void w_sync_to(struct workload *wrk, struct w_step *w, int target)
+{
+	gem_sync(fd, sync_target(wrk, target)->obj[0].handle);
+}
+
+/*
+ * Batches from contexts in the same group follow the balancing decision
+ * made for the first of them in every iteration of the workload.
+ */
+static enum intel_engine_id
+balance_step(const struct workload_balancer *balancer,
+	     struct workload *wrk, struct w_step *w)
+{
+	int *group = w->group ? &wrk->group_engine[w->group] : NULL;
+	enum intel_engine_id engine;
+
+	if (group && *group >= 0)
+		return *group;
+
+	engine = balancer->balance(balancer, wrk, w);
+	if (group)
+		*group = engine;
+
+	return engine;
+}
+
+static void reset_groups(struct workload *wrk)
+{
+	for (unsigned int i = 0; i <= wrk->nr_groups; i++)
+		wrk->group_engine[i] = -1;
+}
+
+static bool take_branch(struct workload *wrk, struct w_step *w)
+{
+	return hars_petruska_f54_1_random(&wrk->prng) % 100 < w->probability;
+}
+
+static void set_priority(struct workload *wrk, unsigned int ctx, int prio)
+{
+	struct local_i915_gem_context_param param = {
+		.context = wrk->ctx_id[ctx],
+		.param = LOCAL_CONTEXT_PARAM_PRIORITY,
+		.value = prio,
+	};
+
+	gem_context_set_param(fd, &param);
+}
+
+static uint64_t gettime_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * Telemetry (-T): per step submit to completion latency, time spent
+ * throttling before a submission and dropped periods, times in us. Values
+ * are collected for the current interval and folded into the totals every
+ * time a sample is emitted. Samples and the final report are JSON lines,
+ * each written with a single write() so forked clients can share a file.
+ */
+struct telemetry {
+	igt_stats_t *latency, *latency_total;
+	igt_stats_t throttle, throttle_total;
+	unsigned long dropped, dropped_total;
+	uint64_t start, next_sample;
+
+	/* Submitted batches not yet seen completing, real GPU only */
+	struct pending_batch {
+		unsigned int step;
+		uint64_t submit;
+	} *pending;
+	unsigned int nr_pending, max_pending;
+};
+
+static void telemetry_start(struct workload *wrk, uint64_t now)
+{
+	struct telemetry *tm;
+
+	if (telemetry_fd < 0)
+		return;
+
+	tm = calloc(1, sizeof(*tm));
+	igt_assert(tm);
+
+	tm->latency = calloc(wrk->nr_steps, sizeof(*tm->latency));
+	tm->latency_total = calloc(wrk->nr_steps, sizeof(*tm->latency_total));
+	igt_assert(tm->latency && tm->latency_total);
+
+	for (unsigned int i = 0; i < wrk->nr_steps; i++) {
+		if (wrk->steps[i].type != BATCH)
+			continue;
+
+		igt_stats_init(&tm->latency[i]);
+		igt_stats_init_sketch(&tm->latency_total[i],
+				      IGT_STATS_SKETCH_DEFAULT_PRECISION);
+	}
+
+	igt_stats_init(&tm->throttle);
+	igt_stats_init_sketch(&tm->throttle_total,
+			      IGT_STATS_SKETCH_DEFAULT_PRECISION);
+
+	tm->start = now;
+	tm->next_sample = now + telemetry_period;
+
+	wrk->tm = tm;
+}
+
+static void telemetry_fini(struct workload *wrk)
+{
+	struct telemetry *tm = wrk->tm;
+
+	if (!tm)
+		return;
+
+	for (unsigned int i = 0; i < wrk->nr_steps; i++) {
+		if (wrk->steps[i].type != BATCH)
+			continue;
+
+		igt_stats_fini(&tm->latency[i]);
+		igt_stats_fini(&tm->latency_total[i]);
+	}
+	igt_stats_fini(&tm->throttle);
+	igt_stats_fini(&tm->throttle_total);
+
+	free(tm->latency);
+	free(tm->latency_total);
+	free(tm->pending);
+	free(tm);
+
+	wrk->tm = NULL;
+}
+
+static void telemetry_latency(struct workload *wrk, unsigned int step,
+			      uint64_t ns)
+{
+	if (wrk->tm)
+		igt_stats_push(&wrk->tm->latency[step], ns / 1000);
+}
+
+static void telemetry_throttle(struct workload *wrk, uint64_t ns)
+{
+	if (wrk->tm)
+		igt_stats_push(&wrk->tm->throttle, ns / 1000);
+}
+
+static void telemetry_dropped(struct workload *wrk)
+{
+	if (wrk->tm)
+		wrk->tm->dropped++;
+}
+
+static void json_stats(FILE *f, igt_stats_t *stats)
+{
+	fprintf(f, "\"count\":%"PRIu64, stats->n_values);
+	if (!stats->n_values)
+		return;
+
+	fprintf(f, ",\"mean\":%.1f,\"p50\":%.1f,\"p99\":%.1f,\"max\":%"PRIu64,
+		igt_stats_get_mean(stats),
+		igt_stats_get_percentile(stats, 50),
+		igt_stats_get_percentile(stats, 99),
+		igt_stats_get_max(stats));
+}
+
+static void telemetry_emit(struct workload *wrk, unsigned int id,
+			   uint64_t now, bool summary)
+{
+	struct telemetry *tm = wrk->tm;
+	const char *sep = "";
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *f;
+
+	f = open_memstream(&buf, &len);
+	igt_assert(f);
+
+	fprintf(f, "{\"type\":\"%s\",\"client\":%u,\"time\":%.6f",
+		summary ? "summary" : "sample", id, (now - tm->start) / 1e9);
+	fprintf(f, ",\"dropped\":%lu,\"throttle\":{",
+		summary ? tm->dropped_total : tm->dropped);
+	json_stats(f, summary ? &tm->throttle_total : &tm->throttle);
+	fprintf(f, "},\"steps\":[");
+
+	for (unsigned int i = 0; i < wrk->nr_steps; i++) {
+		igt_stats_t *stats =
+			summary ? &tm->latency_total[i] : &tm->latency[i];
+
+		if (wrk->steps[i].type != BATCH || !stats->n_values)
+			continue;
+
+		fprintf(f, "%s{\"step\":%u,", sep, i);
+		if (wrk->steps[i].name)
+			fprintf(f, "\"name\":\"%s\",", wrk->steps[i].name);
+		fprintf(f, "\"line\":%u,\"engine\":\"%s\",",
+			wrk->steps[i].line,
+			ring_str_map[wrk->steps[i].engine]);
+		json_stats(f, stats);
+		fprintf(f, "}");
+		sep = ",";
+	}
+	fprintf(f, "]}\n");
+	fclose(f);
+
+	igt_assert(write(telemetry_fd, buf, len) == (ssize_t)len);
+	free(buf);
+}
+
+static void telemetry_fold(struct workload *wrk)
+{
+	struct telemetry *tm = wrk->tm;
+
+	for (unsigned int i = 0; i < wrk->nr_steps; i++) {
+		if (wrk->steps[i].type != BATCH)
+			continue;
+
+		igt_stats_merge(&tm->latency_total[i], &tm->latency[i]);
+		igt_stats_fini(&tm->latency[i]);
+		igt_stats_init(&tm->latency[i]);
+	}
+
+	igt_stats_merge(&tm->throttle_total, &tm->throttle);
+	igt_stats_fini(&tm->throttle);
+	igt_stats_init(&tm->throttle);
+
+	tm->dropped_total += tm->dropped;
+	tm->dropped = 0;
+}
+
+static void telemetry_sample(struct workload *wrk, unsigned int id,
+			     uint64_t now)
+{
+	struct telemetry *tm = wrk->tm;
+
+	if (!tm || !telemetry_period || now < tm->next_sample)
+		return;
+
+	telemetry_emit(wrk, id, now, false);
+	telemetry_fold(wrk);
+
+	while (tm->next_sample <= now)
+		tm->next_sample += telemetry_period;
+}
+
+static void telemetry_summary(struct workload *wrk, unsigned int id,
+			      uint64_t now)
+{
+	if (!wrk->tm)
+		return;
+
+	telemetry_fold(wrk);
+	telemetry_emit(wrk, id, now, true);
+}
+
+static void telemetry_submit(struct workload *wrk, struct w_step *w)
+{
+	struct telemetry *tm = wrk->tm;
+
+	if (!tm)
+		return;
+
+	if (tm->nr_pending == tm->max_pending) {
+		tm->max_pending = tm->max_pending ? 2 * tm->max_pending : 64;
+		tm->pending = realloc(tm->pending,
+				      tm->max_pending * sizeof(*tm->pending));
+		igt_assert(tm->pending);
+	}
+
+	tm->pending[tm->nr_pending].step = w->idx;
+	tm->pending[tm->nr_pending].submit = gettime_ns();
+	tm->nr_pending++;
+}
+
+/*
+ * Records the batches which have completed since the last call. A step
+ * resubmitted before its previous batch was seen completing shares the
+ * output object with it, so both are accounted when the later completes.
+ */
+static void telemetry_reap(struct workload *wrk)
+{
+	struct telemetry *tm = wrk->tm;
+	uint64_t now;
+	unsigned int i, j;
+
+	if (!tm || !tm->nr_pending)
+		return;
+
+	now = gettime_ns();
+	for (i = j = 0; i < tm->nr_pending; i++) {
+		struct pending_batch *b = &tm->pending[i];
+
+		if (gem_bo_busy(fd, wrk->steps[b->step].obj[0].handle))
+			tm->pending[j++] = *b;
+		else
+			telemetry_latency(wrk, b->step, now - b->submit);
+	}
+	tm->nr_pending = j;
+}
+
+/* Sleeps, noting batch completions as they happen when collecting telemetry */
+static void w_sleep(struct workload *wrk, unsigned int us)
+{
+	struct telemetry *tm = wrk->tm;
+	uint64_t deadline = gettime_ns() + us * 1000ull;
+	uint64_t now;
+
+	while (tm && tm->nr_pending && (now = gettime_ns()) < deadline) {
+		int64_t timeout = deadline - now;
+
+		if (gem_wait(fd, wrk->steps[tm->pending[0].step].obj[0].handle,
+			     &timeout))
+			break;
+
+		telemetry_reap(wrk);
+	}
+
+	now = gettime_ns();
+	if (now < deadline)
+		usleep((deadline - now) / 1000);
+}
+
+/* Waits for every outstanding batch, at the end of the run */
+static void telemetry_drain(struct workload *wrk)
+{
+	struct telemetry *tm = wrk->tm;
+
+	while (tm && tm->nr_pending) {
+		gem_sync(fd, wrk->steps[tm->pending[0].step].obj[0].handle);
+		telemetry_reap(wrk);
+	}
+}
+
+static void
+print_client_stats(unsigned int id, struct workload *wrk, bool background,
+		   const struct workload_balancer *balancer,
+		   unsigned int repeat, double t)
+{
+	printf("%c%u: %.3fs elapsed (%.3f workloads/s)",
+	       background ? ' ' : '*', id, t, repeat / t);
+
+	for (unsigned int i = 0; balancer && i < ARRAY_SIZE(engine_classes); i++) {
+		const struct engine_class *class = &engine_classes[i];
+		unsigned long nr = wrk->nr_bb[class->engine];
+
+		if (!nr)
+			continue;
+
+		printf(". %lu (", nr);
+		for (unsigned int j = 0; j < class->count; j++)
+			printf("%s%lu", j ? " + " : "",
+			       wrk->nr_bb[class->instances[j]]);
+		printf(") total %s batches", ring_str_map[class->engine]);
+
+		if (!balancer->get_qd)
+			continue;
+
+		printf(". Average queue depths");
+		for (unsigned int j = 0; j < class->count; j++)
+			printf("%s %.3f", j ? "," : "",
+			       (double)wrk->qd_sum[class->instances[j]] / nr);
+	}
+	printf(balancer ? ".\n" : "\n");
 }
 
 static void
@@ -853,16 +1771,24 @@ run_workload(unsigned int id, struct workload *wrk,
 
 	clock_gettime(CLOCK_MONOTONIC, &t_start);
 
-	hars_petruska_f54_1_random_seed(0);
+	wrk->prng = 0;
+	telemetry_start(wrk, gettime_ns());
 
 	for (j = 0; run && (background || j < repeat); j++) {
 		clock_gettime(CLOCK_MONOTONIC, &wrk->repeat_start);
+		reset_groups(wrk);
 
 		for (i = 0, w = wrk->steps; run && (i < wrk->nr_steps);
 		     i++, w++) {
 			enum intel_engine_id engine = w->engine;
+			uint64_t throttle_start = 0;
 			int do_sleep = 0;
 
+			if (wrk->tm) {
+				telemetry_reap(wrk);
+				telemetry_sample(wrk, id, gettime_ns());
+			}
+
 			if (w->type == DELAY) {
 				do_sleep = w->wait;
 			} else if (w->type == PERIOD) {
@@ -872,11 +1798,11 @@ run_workload(unsigned int id, struct workload *wrk,
 				do_sleep = w->wait -
 					   elapsed_us(&wrk->repeat_start, &now);
 				if (do_sleep < 0) {
-					if (!quiet) {
+					telemetry_dropped(wrk);
+					if (!quiet)
 						printf("%u: Dropped period @ %u/%u (%dus late)!\n",
 						       id, j, i, do_sleep);
-						continue;
-					}
+					continue;
 				}
 			} else if (w->type == SYNC) {
 				unsigned int s_idx = i + w->wait;
@@ -891,17 +1817,26 @@ run_workload(unsigned int id, struct workload *wrk,
 			} else if (w->type == QD_THROTTLE) {
 				qd_throttle = w->wait;
 				continue;
+			} else if (w->type == PRIORITY) {
+				set_priority(wrk, w->context, w->wait);
+				continue;
+			} else if (w->type == BRANCH) {
+				if (take_branch(wrk, w)) {
+					i += w->wait - 1;
+					w += w->wait - 1;
+				}
+				continue;
 			}
 
 			if (do_sleep) {
-				usleep(do_sleep);
+				w_sleep(wrk, do_sleep);
 				continue;
 			}
 
 			wrk->nr_bb[engine]++;
 
-			if (engine == VCS && balancer) {
-				engine = balancer->balance(balancer, wrk, w);
+			if (balancer && get_engine_class(engine)) {
+				engine = balance_step(balancer, wrk, w);
 				wrk->nr_bb[engine]++;
 
 				eb_update_flags(w, engine, flags);
@@ -914,7 +1849,7 @@ run_workload(unsigned int id, struct workload *wrk,
 			}
 
 			if (w->duration.min != w->duration.max) {
-				unsigned int d = get_duration(&w->duration);
+				unsigned int d = get_duration(wrk, &w->duration);
 				unsigned long offset;
 
 				offset = ALIGN(w->bb_sz - get_bb_sz(d),
@@ -928,6 +1863,9 @@ run_workload(unsigned int id, struct workload *wrk,
 			    !(balancer && balancer->get_qd))
 				throttle = qd_throttle;
 
+			if (wrk->tm && (throttle > 0 || qd_throttle > 0))
+				throttle_start = gettime_ns();
+
 			if (throttle > 0)
 				w_sync_to(wrk, w, i - throttle);
 
@@ -944,7 +1882,15 @@ run_workload(unsigned int id, struct workload *wrk,
 				}
 			}
 
+			if (throttle_start)
+				telemetry_throttle(wrk,
+						   gettime_ns() - throttle_start);
+
 			gem_execbuf(fd, &w->eb);
+			telemetry_submit(wrk, w);
+
+			if (engine != w->engine && flags & SEQNO)
+				publish_load(wrk, engine);
 
 			if (pipe_fd >= 0) {
 				struct pollfd fds;
@@ -957,76 +1903,519 @@ run_workload(unsigned int id, struct workload *wrk,
 				}
 			}
 
+			if (background &&
+			    __atomic_load_n(&stop_background, __ATOMIC_RELAXED)) {
+				run = false;
+				break;
+			}
+
 			if (w->wait)
 				gem_sync(fd, w->obj[0].handle);
 		}
 	}
 
 	if (run)
-		gem_sync(fd, wrk->steps[wrk->nr_steps - 1].obj[0].handle);
+		w_sync_to(wrk, NULL, wrk->nr_steps - 1);
+	telemetry_drain(wrk);
+	publish_all_loads(wrk);
 
 	clock_gettime(CLOCK_MONOTONIC, &t_end);
 
-	t = elapsed(&t_start, &t_end);
-	if (!quiet && !balancer)
-		printf("%c%u: %.3fs elapsed (%.3f workloads/s)\n",
-		       background ? ' ' : '*', id, t, repeat / t);
-	else if (!quiet && !balancer->get_qd)
-		printf("%c%u: %.3fs elapsed (%.3f workloads/s). %lu (%lu + %lu) total VCS batches.\n",
-		       background ? ' ' : '*', id, t, repeat / t,
-		       wrk->nr_bb[VCS], wrk->nr_bb[VCS1], wrk->nr_bb[VCS2]);
-	else if (!quiet && balancer)
-		printf("%c%u: %.3fs elapsed (%.3f workloads/s). %lu (%lu + %lu) total VCS batches. Average queue depths %.3f, %.3f.\n",
-		       background ? ' ' : '*', id, t, repeat / t,
-		       wrk->nr_bb[VCS], wrk->nr_bb[VCS1], wrk->nr_bb[VCS2],
-		       (double)wrk->qd_sum[VCS1] / wrk->nr_bb[VCS],
-		       (double)wrk->qd_sum[VCS2] / wrk->nr_bb[VCS]);
+	t = igt_elapsed(&t_start, &t_end);
+	if (!quiet)
+		print_client_stats(id, wrk, background, balancer, repeat, t);
+
+	telemetry_summary(wrk, id, gettime_ns());
+	telemetry_fini(wrk);
+}
+
+/*
+ * Discrete-event simulation of the workloads, for developing balancers
+ * without a GPU. Batches take exactly their (random within range) duration
+ * and every engine executes them in submission order, a batch starting
+ * once the engine is idle and its dependency and its own previous
+ * submission have completed. Completions write the seqno and timestamps
+ * (in us) to the client's status page just like the batches do on the
+ * GPU, so the balancers see the same state as on real hardware.
+ */
+struct sim_batch {
+	uint64_t submit, start, end;
+	struct workload *wrk;
+	unsigned int step;
+	uint32_t seqno; /* 0 when not balanced */
+};
+
+static struct sim_engine {
+	uint64_t busy_until;
+	uint64_t busy;
+	struct sim_batch *pending;
+	unsigned int head, count, size;
+} sim_engines[NUM_ENGINES];
+
+static uint64_t sim_now;
+
+struct sim_client {
+	struct workload *wrk;
+	unsigned int id;
+	bool background, swap, done;
+	unsigned int i, j;
+	bool submitting; /* balanced and throttled, waiting to submit */
+	enum intel_engine_id engine;
+	bool balanced;
+	int throttle, qd_throttle;
+	uint64_t ready, start, end, repeat_start;
+	bool throttled;
+	uint64_t throttle_start;
+};
+
+static void sim_push(struct sim_engine *e, const struct sim_batch *b)
+{
+	if (e->count == e->size) {
+		unsigned int size = e->size ? 2 * e->size : 64;
+		struct sim_batch *pending = malloc(size * sizeof(*pending));
+
+		igt_assert(pending);
+		for (unsigned int i = 0; i < e->count; i++)
+			pending[i] = e->pending[(e->head + i) % e->size];
+
+		free(e->pending);
+		e->pending = pending;
+		e->size = size;
+		e->head = 0;
+	}
+
+	e->pending[(e->head + e->count++) % e->size] = *b;
+}
+
+static void sim_retire(void)
+{
+	for (unsigned int engine = 0; engine < NUM_ENGINES; engine++) {
+		struct sim_engine *e = &sim_engines[engine];
+
+		while (e->count && e->pending[e->head].end <= sim_now) {
+			const struct sim_batch *b = &e->pending[e->head];
+
+			telemetry_latency(b->wrk, b->step, b->end - b->submit);
+
+			if (b->seqno) {
+				uint32_t *rt =
+					&b->wrk->status_page[SEQNO_IDX(engine)];
+
+				rt[0] = b->seqno;
+				rt[1] = b->start / 1000;
+				rt[2] = b->end / 1000;
+			}
+
+			e->head = (e->head + 1) % e->size;
+			e->count--;
+		}
+	}
+}
+
+/*
+ * Like execbuf blocking once the ring is full, a client can only have so
+ * many batches queued on an engine before it has to wait for one of them.
+ */
+#define SIM_QUEUE_LIMIT 64
+
+static unsigned int sim_queued(struct workload *wrk,
+			       enum intel_engine_id engine)
+{
+	struct sim_engine *e = &sim_engines[engine];
+	unsigned int count = 0;
+
+	for (unsigned int i = 0; i < e->count; i++)
+		count += e->pending[(e->head + i) % e->size].wrk == wrk;
+
+	return count;
+}
+
+/* When the client's oldest batch still executing on the engine completes */
+static uint64_t sim_next_completion(struct workload *wrk,
+				    enum intel_engine_id engine)
+{
+	struct sim_engine *e = &sim_engines[engine];
+
+	for (unsigned int i = 0; i < e->count; i++) {
+		const struct sim_batch *b = &e->pending[(e->head + i) % e->size];
+
+		if (b->wrk == wrk)
+			return b->end;
+	}
+
+	return sim_now;
+}
+
+static void sim_submit(struct sim_client *c, struct w_step *w)
+{
+	struct workload *wrk = c->wrk;
+	struct sim_engine *e = &sim_engines[c->engine];
+	struct sim_batch b = { .submit = sim_now, .wrk = wrk, .step = w->idx };
+	uint64_t start, duration;
+
+	start = max(sim_now, e->busy_until);
+	start = max(start, w->sim_end);
+	for (unsigned int i = 0; i < w->nr_deps; i++)
+		start = max(start, wrk->steps[w->idx + w->deps[i]].sim_end);
+
+	duration = get_duration(wrk, &w->duration) * 1000ull;
+	b.start = start;
+	b.end = start + duration;
+	if (c->balanced)
+		b.seqno = ++wrk->seqno[c->engine];
+
+	e->busy_until = b.end;
+	e->busy += duration;
+	w->sim_end = b.end;
+
+	sim_push(e, &b);
+
+	if (c->balanced)
+		publish_load(wrk, c->engine);
+}
+
+/* Run the client until it has to wait, setting when it can resume */
+static void sim_client_run(struct sim_client *c,
+			   const struct workload_balancer *balancer,
+			   unsigned int repeat)
+{
+	struct workload *wrk = c->wrk;
+
+	for (;;) {
+		struct w_step *w;
+
+		telemetry_sample(wrk, c->id, sim_now);
+
+		if (c->i == wrk->nr_steps) {
+			c->i = 0;
+			if (!c->background && ++c->j >= repeat) {
+				c->end = sim_now;
+				for (unsigned int i = 0; i < wrk->nr_steps; i++)
+					c->end = max(c->end, wrk->steps[i].sim_end);
+				c->done = true;
+				publish_all_loads(wrk);
+				return;
+			}
+		}
+
+		if (c->i == 0 && !c->submitting) {
+			c->repeat_start = sim_now;
+			reset_groups(wrk);
+		}
+
+		w = &wrk->steps[c->i];
+		switch (w->type) {
+		case DELAY:
+			c->i++;
+			c->ready = sim_now + w->wait * 1000ull;
+			return;
+
+		case PERIOD:
+			c->i++;
+			c->ready = c->repeat_start + w->wait * 1000ull;
+			if (c->ready >= sim_now)
+				return;
+
+			telemetry_dropped(wrk);
+			if (!quiet)
+				printf("%u: Dropped period @ %u/%u (%dus late)!\n",
+				       c->id, c->j, c->i - 1,
+				       (int)(((int64_t)c->ready -
+					      (int64_t)sim_now) / 1000));
+			continue;
+
+		case SYNC:
+			c->i++;
+			c->ready = wrk->steps[c->i - 1 + w->wait].sim_end;
+			if (c->ready > sim_now)
+				return;
+			continue;
+
+		case THROTTLE:
+			c->throttle = w->wait;
+			c->i++;
+			continue;
+
+		case QD_THROTTLE:
+			c->qd_throttle = w->wait;
+			c->i++;
+			continue;
+
+		case PRIORITY:
+			/* Engines are simulated as FIFOs */
+			c->i++;
+			continue;
+
+		case BRANCH:
+			c->i += take_branch(wrk, w) ? w->wait : 1;
+			continue;
+
+		case BATCH:
+			break;
+		}
+
+		if (!c->submitting) {
+			const struct engine_class *class;
+
+			c->engine = w->engine;
+			if (c->swap && c->engine == VCS1)
+				c->engine = VCS2;
+			else if (c->swap && c->engine == VCS2)
+				c->engine = VCS1;
+			c->balanced = false;
+			wrk->nr_bb[c->engine]++;
+
+			class = get_engine_class(c->engine);
+			if (class && balancer) {
+				c->engine = balance_step(balancer, wrk, w);
+				c->balanced = true;
+				wrk->nr_bb[c->engine]++;
+			} else if (class) {
+				/* i915 picks the instance for the fd */
+				c->engine = class->instances[0];
+			}
+
+			if (c->qd_throttle > 0 && c->throttle < 0 &&
+			    !(balancer && balancer->get_qd))
+				c->throttle = c->qd_throttle;
+
+			c->submitting = true;
+			if (c->throttle > 0 || c->qd_throttle > 0) {
+				c->throttled = true;
+				c->throttle_start = sim_now;
+			}
+
+			if (c->throttle > 0) {
+				struct w_step *t =
+					sync_target(wrk, c->i - c->throttle);
+
+				if (t->sim_end > sim_now) {
+					c->ready = t->sim_end;
+					return;
+				}
+			}
+		}
+
+		if (sim_queued(wrk, c->engine) >= SIM_QUEUE_LIMIT) {
+			c->ready = sim_next_completion(wrk, c->engine);
+			return;
+		}
+
+		if (c->qd_throttle > 0 && balancer && balancer->get_qd &&
+		    balancer->get_qd(balancer, wrk, c->engine) >= c->qd_throttle) {
+			c->ready = sim_next_completion(wrk, c->engine);
+			if (c->ready > sim_now)
+				return;
+		}
+
+		if (c->throttled) {
+			telemetry_throttle(wrk, sim_now - c->throttle_start);
+			c->throttled = false;
+		}
+
+		sim_submit(c, w);
+		c->submitting = false;
+		c->i++;
+
+		if (w->wait && w->sim_end > sim_now) {
+			c->ready = w->sim_end;
+			return;
+		}
+	}
+}
+
+static void
+simulate(struct workload **w, unsigned int clients, int master_workload,
+	 const struct workload_balancer *balancer, unsigned int repeat,
+	 unsigned int flags)
+{
+	struct sim_client *c;
+	uint64_t end = 0;
+
+	c = calloc(clients, sizeof(*c));
+	igt_assert(c);
+
+	for (unsigned int i = 0; i < clients; i++) {
+		c[i].wrk = w[i];
+		c[i].id = i;
+		c[i].background = master_workload >= 0 && i != master_workload;
+		c[i].swap = flags & SWAPVCS && !(i & 1);
+		c[i].throttle = -1;
+		c[i].qd_throttle = -1;
+
+		w[i]->status_page = calloc(1, STATUS_PAGE_SIZE);
+		igt_assert(w[i]->status_page);
+
+		telemetry_start(w[i], 0);
+	}
+
+	for (;;) {
+		struct sim_client *next = NULL;
+
+		for (unsigned int i = 0; i < clients; i++) {
+			if (!c[i].done && (!next || c[i].ready < next->ready))
+				next = &c[i];
+		}
+		if (!next)
+			break;
+
+		sim_now = max(sim_now, next->ready);
+		sim_retire();
+		sim_client_run(next, balancer, repeat);
+
+		/* Background clients run for as long as the master */
+		if (next->done && !next->background && master_workload >= 0) {
+			for (unsigned int i = 0; i < clients; i++) {
+				if (!c[i].done) {
+					c[i].done = true;
+					c[i].end = sim_now;
+				}
+			}
+		}
+	}
+
+	/* Let the outstanding batches complete, for their telemetry */
+	for (unsigned int i = 0; i < NUM_ENGINES; i++)
+		sim_now = max(sim_now, sim_engines[i].busy_until);
+	sim_retire();
+
+	for (unsigned int i = 0; i < clients; i++) {
+		end = max(end, c[i].end);
+		if (!quiet)
+			print_client_stats(i, w[i], c[i].background, balancer,
+					   repeat, c[i].end / 1e9);
+		telemetry_summary(w[i], i, c[i].end);
+		telemetry_fini(w[i]);
+		free(w[i]->status_page);
+		w[i]->status_page = NULL;
+	}
+
+	if (!quiet) {
+		printf("%.3fs simulated (%.3f workloads/s)\n",
+		       end / 1e9, clients * repeat / (end / 1e9));
+
+		/* Background batches may still be executing */
+		for (unsigned int i = 0; i < NUM_ENGINES; i++)
+			end = max(end, sim_engines[i].busy_until);
+		for (unsigned int i = 0; i < NUM_ENGINES; i++) {
+			if (sim_engines[i].busy)
+				printf("%s: %.1f%% busy\n", ring_str_map[i],
+				       100. * sim_engines[i].busy / end);
+		}
+	}
+
+	for (unsigned int i = 0; i < NUM_ENGINES; i++)
+		free(sim_engines[i].pending);
+	free(c);
 }
 
 static void fini_workload(struct workload *wrk)
 {
+	free(wrk->desc);
+	free(wrk->group_engine);
 	free(wrk->steps);
 	free(wrk);
 }
 
-static unsigned long calibrate_nop(unsigned int tolerance_pct)
+static void
+run_processes(struct workload **w, unsigned int clients, int master_workload,
+	      const struct workload_balancer *balancer, unsigned int repeat,
+	      unsigned int flags)
 {
-	const uint32_t bbe = 0xa << 23;
-	unsigned int loops = 17;
-	unsigned int usecs = nop_calibration_us;
-	struct drm_i915_gem_exec_object2 obj = {};
-	struct drm_i915_gem_execbuffer2 eb =
-		{ .buffer_count = 1, .buffers_ptr = (uintptr_t)&obj};
-	long size, last_size;
-	struct timespec t_0, t_end;
+	igt_fork(child, clients) {
+		int pipe_fd = -1;
+		bool background = false;
 
-	clock_gettime(CLOCK_MONOTONIC, &t_0);
+		if (master_workload >= 0) {
+			close(w[child]->pipe[0]);
+			if (child != master_workload) {
+				pipe_fd = w[child]->pipe[1];
+				background = true;
+			} else {
+				close(w[child]->pipe[1]);
+			}
+		}
 
-	size = 256 * 1024;
-	do {
-		struct timespec t_start;
+		run_workload(child, w[child], background, pipe_fd, balancer,
+			     repeat, flags);
+	}
 
-		obj.handle = gem_create(fd, size);
-		gem_write(fd, obj.handle, size - sizeof(bbe), &bbe,
-			  sizeof(bbe));
-		gem_execbuf(fd, &eb);
-		gem_sync(fd, obj.handle);
+	if (master_workload >= 0) {
+		int status = -1;
+		pid_t pid;
 
-		clock_gettime(CLOCK_MONOTONIC, &t_start);
-		for (int loop = 0; loop < loops; loop++)
-			gem_execbuf(fd, &eb);
-		gem_sync(fd, obj.handle);
-		clock_gettime(CLOCK_MONOTONIC, &t_end);
+		for (unsigned int i = 0; i < clients; i++)
+			close(w[i]->pipe[1]);
 
-		gem_close(fd, obj.handle);
+		pid = wait(&status);
+		if (pid >= 0)
+			igt_child_done(pid);
 
-		last_size = size;
-		size = loops * size / elapsed(&t_start, &t_end) / 1e6 * usecs;
-		size = ALIGN(size, sizeof(uint32_t));
-	} while (elapsed(&t_0, &t_end) < 5 ||
-		 abs(size - last_size) > (size * tolerance_pct / 100));
+		for (unsigned int i = 0; i < clients; i++)
+			close(w[i]->pipe[0]);
+	}
 
-	return size / sizeof(uint32_t);
+	igt_waitchildren();
+}
+
+struct client_thread {
+	pthread_t thread;
+	unsigned int id;
+	struct workload *wrk;
+	bool background;
+	const struct workload_balancer *balancer;
+	unsigned int repeat;
+	unsigned int flags;
+};
+
+static void *client_thread(void *data)
+{
+	struct client_thread *ct = data;
+
+	run_workload(ct->id, ct->wrk, ct->background, -1, ct->balancer,
+		     ct->repeat, ct->flags);
+
+	return NULL;
+}
+
+/*
+ * Threaded clients share the device fd, just as forked ones do, and keep
+ * all their state in their struct workload. Background clients stop at
+ * their next submission once the master has finished.
+ */
+static void
+run_threads(struct workload **w, unsigned int clients, int master_workload,
+	    const struct workload_balancer *balancer, unsigned int repeat,
+	    unsigned int flags)
+{
+	struct client_thread *ct;
+
+	ct = calloc(clients, sizeof(*ct));
+	igt_assert(ct);
+
+	for (unsigned int i = 0; i < clients; i++) {
+		ct[i].id = i;
+		ct[i].wrk = w[i];
+		ct[i].background = master_workload >= 0 && i != master_workload;
+		ct[i].balancer = balancer;
+		ct[i].repeat = repeat;
+		ct[i].flags = flags;
+
+		igt_assert_eq(pthread_create(&ct[i].thread, NULL,
+					     client_thread, &ct[i]), 0);
+	}
+
+	if (master_workload >= 0) {
+		pthread_join(ct[master_workload].thread, NULL);
+		__atomic_store_n(&stop_background, true, __ATOMIC_RELAXED);
+	}
+
+	for (unsigned int i = 0; i < clients; i++) {
+		if ((int)i != master_workload)
+			pthread_join(ct[i].thread, NULL);
+	}
+
+	free(ct);
 }
 
 static void print_help(void)
@@ -1035,8 +2424,9 @@ static void print_help(void)
 "Usage: gem_wsim [OPTIONS]\n"
 "\n"
 "Runs a simulated workload on the GPU.\n"
-"When ran without arguments performs a GPU calibration result of which needs\n"
-"to be provided when running the simulation in subsequent invocations.\n"
+"When ran without arguments performs a GPU calibration, which is cached per\n"
+"device, kernel and engine and reused, after a quick check, by subsequent\n"
+"invocations unless one is given with -n.\n"
 "\n"
 "Options:\n"
 "	-h		This text.\n"
@@ -1054,15 +2444,29 @@ static void print_help(void)
 "	-r <n>		How many times to emit the workload.\n"
 "	-c <n>		Fork N clients emitting the workload simultaneously.\n"
 "	-x		Swap VCS1 and VCS2 engines in every other client.\n"
-"	-b <n>		Load balancing to use. (0: rr, 1: qd, 2: rt)\n"
+"	-b <n|name>	Load balancing to use, by number or name.\n"
+"	-S		Simulate the workloads instead of running them on the\n"
+"			GPU. Useful for developing balancers, no device or\n"
+"			calibration is required.\n"
+"	-P		Run the clients as threads of a single process rather\n"
+"			than forking one process per client. Not with -S.\n"
+"	-T <ms>		Collect per step latency, throttling and dropped\n"
+"			period telemetry, output as JSON lines every <ms>\n"
+"			(0: only a final summary) per client.\n"
+"	-J <path>	Write the telemetry to a file instead of stdout.\n"
 	);
+
+	printf("\nBalancers:\n");
+	for (unsigned int i = 0; i < ARRAY_SIZE(all_balancers); i++)
+		printf("	%u: %-8s%s\n", all_balancers[i].id,
+		       all_balancers[i].name, all_balancers[i].desc);
 }
 
 static char *load_workload_descriptor(char *filename)
 {
 	struct stat sbuf;
 	char *buf;
-	int infd, ret, i;
+	int infd, ret;
 	ssize_t len;
 
 	ret = stat(filename, &sbuf);
@@ -1070,7 +2474,7 @@ static char *load_workload_descriptor(char *filename)
 		return filename;
 
 	igt_assert(sbuf.st_size < 1024 * 1024); /* Just so. */
-	buf = malloc(sbuf.st_size);
+	buf = malloc(sbuf.st_size + 1);
 	igt_assert(buf);
 
 	infd = open(filename, O_RDONLY);
@@ -1079,14 +2483,7 @@ static char *load_workload_descriptor(char *filename)
 	igt_assert(len == sbuf.st_size);
 	close(infd);
 
-	for (i = 0; i < len; i++) {
-		if (buf[i] == '\n')
-			buf[i] = ',';
-	}
-
-	len--;
-	while (buf[len] == ',')
-		buf[len--] = 0;
+	buf[len] = 0;
 
 	return buf;
 }
@@ -1113,13 +2510,14 @@ int main(int argc, char **argv)
 	char **w_args = NULL;
 	unsigned int tolerance_pct = 1;
 	const struct workload_balancer *balancer = NULL;
+	bool simulation = false;
+	bool threads = false;
+	bool telemetry = false;
+	const char *telemetry_path = NULL;
 	double t;
 	int i, c;
 
-	fd = drm_open_driver(DRIVER_INTEL);
-	intel_register_access_init(intel_get_pci_device(), false, fd);
-
-	while ((c = getopt(argc, argv, "qc:n:r:xw:W:t:b:h")) != -1) {
+	while ((c = getopt(argc, argv, "qc:n:r:xw:W:t:b:SPT:J:h")) != -1) {
 		switch (c) {
 		case 'W':
 			if (master_workload >= 0) {
@@ -1152,30 +2550,28 @@ int main(int argc, char **argv)
 			flags |= SWAPVCS;
 			break;
 		case 'b':
-			switch (strtol(optarg, NULL, 0)) {
-			case 0:
-				balancer = &rr_balancer;
-				flags |= BALANCE;
-				break;
-			case 1:
-				igt_assert(intel_gen(intel_get_drm_devid(fd)) >=
-					   8);
-				balancer = &qd_balancer;
-				flags |= SEQNO | BALANCE;
-				break;
-			case 2:
-				igt_assert(intel_gen(intel_get_drm_devid(fd)) >=
-					   8);
-				balancer = &rt_balancer;
-				flags |= SEQNO | BALANCE | RT;
-				break;
-			default:
+			balancer = find_balancer(optarg);
+			if (!balancer) {
 				if (!quiet)
 					fprintf(stderr,
 						"Unknown balancing mode '%s'!\n",
 						optarg);
 				return 1;
 			}
+			flags |= BALANCE | balancer->flags;
+			break;
+		case 'S':
+			simulation = true;
+			break;
+		case 'P':
+			threads = true;
+			break;
+		case 'T':
+			telemetry = true;
+			telemetry_period = strtoull(optarg, NULL, 0) * 1000000;
+			break;
+		case 'J':
+			telemetry_path = optarg;
 			break;
 		case 'h':
 			print_help();
@@ -1185,16 +2581,55 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (!nop_calibration) {
+	if (!simulation) {
+		fd = drm_open_driver(DRIVER_INTEL);
+
+		/*
+		 * A fake device has no registers and never writes the seqnos
+		 * or timestamps, so only balancers which track their own
+		 * submissions make sense on it.
+		 */
+		if (igt_is_fake_i915(fd)) {
+			if (balancer && balancer->flags & (SEQNO | RT)) {
+				if (!quiet)
+					fprintf(stderr,
+						"Balancer '%s' needs a real GPU!\n",
+						balancer->name);
+				return 1;
+			}
+		} else {
+			intel_register_access_init(intel_get_pci_device(),
+						   false, fd);
+		}
+
+		if (balancer &&
+		    intel_gen(intel_get_drm_devid(fd)) < balancer->min_gen) {
+			if (!quiet)
+				fprintf(stderr,
+					"Balancer '%s' needs gen%u+!\n",
+					balancer->name, balancer->min_gen);
+			return 1;
+		}
+	}
+
+	if (!nop_calibration && !simulation) {
+		bool cached;
+
 		if (!quiet)
 			printf("Calibrating nop delay with %u%% tolerance...\n",
 				tolerance_pct);
-		nop_calibration = calibrate_nop(tolerance_pct);
+		nop_calibration = igt_calibrate_nop_cached(fd, 0,
+							   nop_calibration_us,
+							   tolerance_pct,
+							   &cached);
+		nop_calibration /= sizeof(uint32_t);
 		if (!quiet)
-			printf("Nop calibration for %uus delay is %lu.\n",
-			       nop_calibration_us, nop_calibration);
+			printf("Nop calibration for %uus delay is %lu%s.\n",
+			       nop_calibration_us, nop_calibration,
+			       cached ? " (cached)" : "");
 
-		return 0;
+		if (!nr_w_args)
+			return 0;
 	}
 
 	if (!nr_w_args) {
@@ -1203,6 +2638,27 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
+	if (telemetry && telemetry_path) {
+		telemetry_fd = open(telemetry_path,
+				    O_WRONLY | O_CREAT | O_TRUNC | O_APPEND,
+				    0644);
+		if (telemetry_fd < 0) {
+			if (!quiet)
+				fprintf(stderr, "Failed to open '%s'!\n",
+					telemetry_path);
+			return 1;
+		}
+	} else if (telemetry) {
+		telemetry_fd = STDOUT_FILENO;
+	}
+
+	if (simulation && threads) {
+		if (!quiet)
+			fprintf(stderr,
+				"Threaded clients cannot be simulated!\n");
+		return 1;
+	}
+
 	if (nr_w_args > 1 && clients > 1) {
 		if (!quiet)
 			fprintf(stderr,
@@ -1233,8 +2689,13 @@ int main(int argc, char **argv)
 	}
 
 	if (!quiet) {
-		printf("Using %lu nop calibration for %uus delay.\n",
-		       nop_calibration, nop_calibration_us);
+		if (simulation)
+			printf("Simulating the workloads.\n");
+		else
+			printf("Using %lu nop calibration for %uus delay.\n",
+			       nop_calibration, nop_calibration_us);
+		if (threads)
+			printf("Running clients as threads.\n");
 		if (nr_w_args > 1)
 			clients = nr_w_args;
 		printf("%u client%s.\n", clients, clients > 1 ? "s" : "");
@@ -1248,12 +2709,24 @@ int main(int argc, char **argv)
 	w = calloc(clients, sizeof(struct workload *));
 	igt_assert(w);
 
+	engine_load = mmap(NULL, sizeof(*engine_load), PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	igt_assert(engine_load != MAP_FAILED);
+
+	if (simulation) {
+		for (i = 0; i < clients; i++)
+			w[i] = clone_workload(wrk[nr_w_args > 1 ? i : 0]);
+
+		simulate(w, clients, master_workload, balancer, repeat, flags);
+		goto out;
+	}
+
 	for (i = 0; i < clients; i++) {
 		unsigned int flags_ = flags;
 
 		w[i] = clone_workload(wrk[nr_w_args > 1 ? i : 0]);
 
-		if (master_workload >= 0) {
+		if (master_workload >= 0 && !threads) {
 			int ret = pipe(w[i]->pipe);
 
 			igt_assert(ret == 0);
@@ -1267,48 +2740,21 @@ int main(int argc, char **argv)
 
 	clock_gettime(CLOCK_MONOTONIC, &t_start);
 
-	igt_fork(child, clients) {
-		int pipe_fd = -1;
-		bool background = false;
-
-		if (master_workload >= 0) {
-			close(w[child]->pipe[0]);
-			if (child != master_workload) {
-				pipe_fd = w[child]->pipe[1];
-				background = true;
-			} else {
-				close(w[child]->pipe[1]);
-			}
-		}
-
-		run_workload(child, w[child], background, pipe_fd, balancer,
-			     repeat, flags);
-	}
-
-	if (master_workload >= 0) {
-		int status = -1;
-		pid_t pid;
-
-		for (i = 0; i < clients; i++)
-			close(w[i]->pipe[1]);
-
-		pid = wait(&status);
-		if (pid >= 0)
-			igt_child_done(pid);
-
-		for (i = 0; i < clients; i++)
-			close(w[i]->pipe[0]);
-	}
-
-	igt_waitchildren();
+	if (threads)
+		run_threads(w, clients, master_workload, balancer, repeat,
+			    flags);
+	else
+		run_processes(w, clients, master_workload, balancer, repeat,
+			      flags);
 
 	clock_gettime(CLOCK_MONOTONIC, &t_end);
 
-	t = elapsed(&t_start, &t_end);
+	t = igt_elapsed(&t_start, &t_end);
 	if (!quiet)
 		printf("%.3fs elapsed (%.3f workloads/s)\n",
 		       t, clients * repeat / t);
 
+out:
 	for (i = 0; i < clients; i++)
 		fini_workload(w[i]);
 	free(w);
@@ -1316,5 +2762,8 @@ int main(int argc, char **argv)
 		fini_workload(wrk[i]);
 	free(w_args);
 
+	if (telemetry_fd > STDOUT_FILENO)
+		close(telemetry_fd);
+
 	return 0;
 }
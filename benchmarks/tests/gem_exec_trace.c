@@ -0,0 +1,296 @@
+/*
+ * Copyright © 2017 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Write small synthetic traces and check what gem_exec_trace makes of them
+ * without a GPU: the analysis, and the schedule decoded for the parallel
+ * replay.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "igt.h"
+#include "gem_exec_trace.h"
+
+#define LOCAL_EXEC_OBJECT_WRITE (1<<2)
+#define LOCAL_I915_EXEC_FENCE_IN (1<<16)
+
+/* The records of a v2 trace, written out as a single plain chunk */
+struct trace {
+	uint8_t *data;
+	size_t len, size;
+	uint32_t count;
+	uint64_t now;
+};
+
+static void *trace_add(struct trace *t, uint8_t cmd, size_t len)
+{
+	struct trace_record *rec;
+
+	while (t->len + sizeof(*rec) + len > t->size) {
+		t->size = t->size ? 2 * t->size : 4096;
+		t->data = realloc(t->data, t->size);
+		igt_assert(t->data);
+	}
+
+	rec = (void *)(t->data + t->len);
+	rec->cmd = cmd;
+	rec->timestamp = t->now += 1000;
+	t->len += sizeof(*rec) + len;
+	t->count++;
+
+	return memset(rec + 1, 0, len);
+}
+
+static void trace_handle(struct trace *t, uint8_t cmd, uint32_t handle)
+{
+	/* all the single handle payloads share the same layout */
+	struct trace_del_bo *p = trace_add(t, cmd, sizeof(*p));
+
+	p->handle = handle;
+}
+
+static void trace_add_bo(struct trace *t, uint32_t handle, uint64_t size)
+{
+	struct trace_add_bo *p = trace_add(t, ADD_BO, sizeof(*p));
+
+	p->handle = handle;
+	p->size = size;
+}
+
+/* One object, @flags taking the object write and exec fence in flags */
+static void trace_exec(struct trace *t, uint32_t ctx, uint32_t handle,
+		       uint64_t flags)
+{
+	struct trace_exec *p;
+	struct trace_exec_object *obj;
+	size_t fence = 0;
+
+	if (flags & LOCAL_I915_EXEC_FENCE_IN)
+		fence = sizeof(struct trace_fence);
+
+	p = trace_add(t, EXEC, sizeof(*p) + fence + sizeof(*obj));
+	p->object_count = 1;
+	p->flags = flags & LOCAL_I915_EXEC_FENCE_IN;
+	p->context = ctx;
+
+	obj = (void *)((uint8_t *)(p + 1) + fence);
+	obj->handle = handle;
+	obj->flags = flags & LOCAL_EXEC_OBJECT_WRITE;
+}
+
+static void trace_fence_out(struct trace *t, int32_t fd)
+{
+	struct trace_fence *p = trace_add(t, FENCE_OUT, sizeof(*p));
+
+	p->fd = fd;
+}
+
+static char *trace_write(struct trace *t)
+{
+	struct trace_version version = { TRACE_MAGIC, TRACE_VERSION };
+	struct trace_chunk chunk = {
+		.magic = TRACE_CHUNK_MAGIC,
+		.size = t->len,
+		.raw_size = t->len,
+		.count = t->count,
+		.first_timestamp = 1000,
+		.last_timestamp = t->now,
+	};
+	struct trace_index_entry entry = {
+		.offset = sizeof(version),
+		.first_timestamp = chunk.first_timestamp,
+		.last_timestamp = chunk.last_timestamp,
+		.count = chunk.count,
+	};
+	struct trace_index index = {
+		.magic = TRACE_INDEX_MAGIC,
+		.count = 1,
+		.offset = sizeof(version) + sizeof(chunk) + t->len,
+	};
+	char *path = strdup("/tmp/gem_exec_trace.XXXXXX");
+	FILE *f;
+	int fd;
+
+	fd = mkstemp(path);
+	igt_assert_lte(0, fd);
+	f = fdopen(fd, "w");
+	igt_assert(f);
+
+	fwrite(&version, sizeof(version), 1, f);
+	fwrite(&chunk, sizeof(chunk), 1, f);
+	fwrite(t->data, t->len, 1, f);
+	fwrite(&entry, sizeof(entry), 1, f);
+	fwrite(&index, sizeof(index), 1, f);
+	fclose(f);
+
+	free(t->data);
+	memset(t, 0, sizeof(*t));
+
+	return path;
+}
+
+/* Run gem_exec_trace over the trace, and return what it printed */
+static char *run(const char *args, char *path)
+{
+	char *out = igt_capture_output("./gem_exec_trace %s %s", args, path);
+
+	unlink(path);
+	free(path);
+
+	igt_assert_f(out, "gem_exec_trace %s failed\n", args);
+	return out;
+}
+
+struct sched_op {
+	unsigned int queue, pos, arg;
+	char name[16];
+	unsigned int num_deps;
+	struct { unsigned int queue, pos; } deps[16];
+};
+
+static int parse_schedule(char *out, struct sched_op *ops, int max)
+{
+	char *line, *save;
+	int n = 0;
+
+	for (line = strtok_r(out, "\n", &save); line && n < max;
+	     line = strtok_r(NULL, "\n", &save)) {
+		struct sched_op *op = &ops[n];
+		char *dep;
+		int len;
+
+		if (sscanf(line, " %u.%u %15s %u%n", &op->queue, &op->pos,
+			   op->name, &op->arg, &len) != 4)
+			continue;
+
+		op->num_deps = 0;
+		dep = strstr(line + len, "after ");
+		while (dep && op->num_deps < 16) {
+			dep = strchr(dep, ' ');
+			if (!dep ||
+			    sscanf(dep, " %u.%u",
+				   &op->deps[op->num_deps].queue,
+				   &op->deps[op->num_deps].pos) != 2)
+				break;
+			op->num_deps++;
+			dep++;
+		}
+		n++;
+	}
+
+	return n;
+}
+
+static const struct sched_op *
+find_op(const struct sched_op *ops, int count, const char *name)
+{
+	for (int i = 0; i < count; i++)
+		if (!strcmp(ops[i].name, name))
+			return &ops[i];
+
+	return NULL;
+}
+
+/* Whether @op cannot start before @before has completed */
+static int ordered(const struct sched_op *op, const struct sched_op *before)
+{
+	if (op->queue == before->queue)
+		return op->pos > before->pos;
+
+	for (unsigned int i = 0; i < op->num_deps; i++)
+		if (op->deps[i].queue == before->queue &&
+		    op->deps[i].pos >= before->pos)
+			return 1;
+
+	return 0;
+}
+
+static void test_analyze(void)
+{
+	struct trace t = {};
+	char *out;
+
+	trace_handle(&t, ADD_CTX, 1);
+	trace_add_bo(&t, 1, 4096);
+	trace_add_bo(&t, 2, 8192);
+	trace_exec(&t, 1, 1, LOCAL_EXEC_OBJECT_WRITE);
+	trace_fence_out(&t, 10);
+	trace_exec(&t, 0, 2, LOCAL_I915_EXEC_FENCE_IN);
+	trace_handle(&t, WAIT, 1);
+	trace_exec(&t, 1, 1, 0);
+	trace_handle(&t, WAIT, 2);
+	trace_handle(&t, DEL_BO, 1);
+
+	out = run("-a", trace_write(&t));
+
+	igt_assert(strstr(out, "  duration: 0.010ms, 3 execs, 2 waits, 1 fences\n"));
+	igt_assert(strstr(out, "  contexts: 1 created, 1 peak, 2 used by execbuf\n"));
+	igt_assert(strstr(out, "  buffers: 2 created, peak working set 0.01MiB in 2 objects\n"));
+	igt_assert(strstr(out, "; 1 still open at the end\n"));
+	igt_assert(strstr(out, "         1: 2 uses, 4096 bytes\n"));
+
+	free(out);
+}
+
+static void test_exec_wait_close(void)
+{
+	const struct sched_op *exec, *wait, *close;
+	struct sched_op ops[32];
+	struct trace t = {};
+	char *out;
+	int count;
+
+	trace_handle(&t, ADD_CTX, 1);
+	trace_add_bo(&t, 1, 4096);
+	trace_exec(&t, 1, 1, LOCAL_EXEC_OBJECT_WRITE);
+	trace_handle(&t, WAIT, 1);
+	trace_handle(&t, DEL_BO, 1);
+
+	out = run("-p", trace_write(&t));
+
+	count = parse_schedule(out, ops, 32);
+	exec = find_op(ops, count, "exec");
+	wait = find_op(ops, count, "wait");
+	close = find_op(ops, count, "del_bo");
+	igt_assert(exec && wait && close);
+
+	igt_assert_neq(exec->queue, 0);
+	igt_assert_eq(wait->queue, 0);
+	igt_assert(ordered(wait, exec));
+	igt_assert(ordered(close, exec));
+	igt_assert(ordered(close, wait));
+
+	free(out);
+}
+
+igt_main
+{
+	igt_subtest("analyze")
+		test_analyze();
+
+	igt_subtest("exec-wait-close")
+		test_exec_wait_close();
+}
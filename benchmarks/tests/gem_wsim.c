@@ -0,0 +1,103 @@
+/*
+ * Copyright © 2017 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Simulate small workloads with gem_wsim -S, which needs no GPU.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "igt.h"
+
+static char *write_workload(const char *desc)
+{
+	char *path = strdup("/tmp/gem_wsim.XXXXXX");
+	FILE *f;
+	int fd;
+
+	fd = mkstemp(path);
+	igt_assert_lte(0, fd);
+	f = fdopen(fd, "w");
+	igt_assert(f);
+
+	fputs(desc, f);
+	fclose(f);
+
+	return path;
+}
+
+/*
+ * A background client which never waits keeps submitting at the same
+ * simulated time unless its queue is limited like on the GPU.
+ */
+static void test_background_no_wait(void)
+{
+	char *master = write_workload("1.RCS.1000.0.1\n");
+	char *bg = write_workload("1.VCS.1000.0.0\n");
+	char *out;
+
+	out = igt_capture_output("./gem_wsim -S -W %s -w %s -r 3", master, bg);
+	unlink(master);
+	unlink(bg);
+	free(master);
+	free(bg);
+
+	igt_assert_f(out, "gem_wsim failed\n");
+	igt_assert(strstr(out, "2 clients.\n"));
+	igt_assert(strstr(out, "simulated"));
+
+	free(out);
+}
+
+/* Unrolled loops report every copy of a step against the descriptor */
+static void test_telemetry_names(void)
+{
+	char *wrk = write_workload("loop.2\n"
+				   "dec: 1.VCS.1000.0.0\n"
+				   "1.RCS.500.-1.1\n"
+				   "end\n");
+	char *out;
+
+	out = igt_capture_output("./gem_wsim -q -S -w %s -r 2 -T 0", wrk);
+	unlink(wrk);
+	free(wrk);
+
+	igt_assert_f(out, "gem_wsim failed\n");
+	igt_assert(strstr(out, "{\"step\":0,\"name\":\"dec\",\"line\":2,"));
+	igt_assert(strstr(out, "{\"step\":1,\"line\":3,"));
+	igt_assert(strstr(out, "{\"step\":2,\"name\":\"dec\",\"line\":2,"));
+	igt_assert(strstr(out, "{\"step\":3,\"line\":3,"));
+
+	free(out);
+}
+
+igt_main
+{
+	igt_subtest("background-no-wait")
+		test_background_no_wait();
+
+	igt_subtest("telemetry-names")
+		test_telemetry_names();
+}
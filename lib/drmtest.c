@@ -59,6 +59,7 @@
 #include "intel_reg.h"
 #include "ioctl_wrappers.h"
 #include "igt_dummyload.h"
+#include "igt_fake_i915.h"
 
 /**
  * SECTION:drmtest
@@ -85,7 +86,7 @@ static int __get_drm_device_name(int fd, char *name)
 	version.name_len = 4;
 	version.name = name;
 
-	if (!drmIoctl(fd, DRM_IOCTL_VERSION, &version)){
+	if (!igt_ioctl(fd, DRM_IOCTL_VERSION, &version)){
 		return 0;
 	}
 
@@ -136,7 +137,7 @@ static bool has_known_intel_chipset(int fd)
 	gp.param = I915_PARAM_CHIPSET_ID;
 	gp.value = &devid;
 
-	if (ioctl(fd, DRM_IOCTL_I915_GETPARAM, &gp, sizeof(gp)))
+	if (igt_ioctl(fd, DRM_IOCTL_I915_GETPARAM, &gp))
 		return false;
 
 	if (!intel_gen(devid))
@@ -237,17 +238,34 @@ static int modprobe(const char *driver)
 	return igt_kmod_load(driver, "");
 }
 
+static int __drm_open_fake_i915(void)
+{
+	int fd = igt_fake_i915_open();
+
+	if (fd >= 0 && !has_known_intel_chipset(fd)) {
+		close(fd);
+		fd = -1;
+	}
+
+	return fd;
+}
+
 /**
  * __drm_open_driver:
  * @chipset: OR'd flags for each chipset to search, eg. #DRIVER_INTEL
  *
- * Open the first DRM device we can find, searching up to 16 device nodes
+ * Open the first DRM device we can find, searching up to 16 device nodes.
+ * If the IGT_FAKE_I915 environment variable is set, requests for #DRIVER_INTEL
+ * get a fake device instead, see igt_fake_i915_open().
  *
  * Returns:
  * An open DRM fd or -1 on error
  */
 int __drm_open_driver(int chipset)
 {
+	if (chipset & DRIVER_INTEL && igt_fake_i915_enabled())
+		return __drm_open_fake_i915();
+
 	if (chipset & DRIVER_VGEM)
 		modprobe("vgem");
 
@@ -294,6 +312,9 @@ static int __drm_open_driver_render(int chipset)
 	char *name;
 	int i, fd;
 
+	if (chipset & DRIVER_INTEL && igt_fake_i915_enabled())
+		return __drm_open_fake_i915();
+
 	for (i = 128; i < (128 + 16); i++) {
 		int ret;
 
@@ -360,9 +381,9 @@ int drm_open_driver(int chipset)
 
 	/* For i915, at least, we ensure that the driver is idle before
 	 * starting a test and we install an exit handler to wait until
-	 * idle before quitting.
+	 * idle before quitting. There is nothing to wait for on a fake device.
 	 */
-	if (is_i915_device(fd)) {
+	if (is_i915_device(fd) && !igt_is_fake_i915(fd)) {
 		if (__sync_fetch_and_add(&open_count, 1) == 0) {
 			gem_quiescent_gpu(fd);
 
@@ -411,7 +432,7 @@ int drm_open_driver_render(int chipset)
 	if (fd == -1)
 		return drm_open_driver(chipset);
 
-	if (__sync_fetch_and_add(&open_count, 1))
+	if (igt_is_fake_i915(fd) || __sync_fetch_and_add(&open_count, 1))
 		return fd;
 
 	at_exit_drm_render_fd = __drm_open_driver(chipset);
@@ -31,6 +31,7 @@
 #else
 #include <libgen.h>
 #endif
+#include <stdarg.h>
 #include <stdio.h>
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -85,6 +86,7 @@ static struct __igt_sigiter_global {
 	pid_t tid;
 	timer_t timer;
 	struct timespec offset;
+	int (*ioctl)(int fd, unsigned long request, void *arg);
 	struct {
 		long hit, miss;
 		long ioctls, signals;
@@ -102,9 +104,17 @@ static void sigiter(int sig, siginfo_t *info, void *arg)
 #define SIG_ASSERT(expr)
 #endif
 
+static int raw_ioctl(int fd, unsigned long request, void *arg)
+{
+	return ioctl(fd, request, arg);
+}
+
 static int
 sig_ioctl(int fd, unsigned long request, void *arg)
 {
+	/* Chain to whatever we replaced, but without drmIoctl's restarts */
+	int (*next)(int fd, unsigned long request, void *arg) =
+		__igt_sigiter.ioctl == drmIoctl ? raw_ioctl : __igt_sigiter.ioctl;
 	struct itimerspec its;
 	int ret;
 
@@ -114,8 +124,8 @@ sig_ioctl(int fd, unsigned long request, void *arg)
 	memset(&its, 0, sizeof(its));
 	if (timer_settime(__igt_sigiter.timer, 0, &its, NULL)) {
 		/* oops, we didn't undo the interrupter (i.e. !unwound abort) */
-		igt_ioctl = drmIoctl;
-		return drmIoctl(fd, request, arg);
+		igt_ioctl = __igt_sigiter.ioctl;
+		return igt_ioctl(fd, request, arg);
 	}
 
 	its.it_value = __igt_sigiter.offset;
@@ -127,7 +137,7 @@ sig_ioctl(int fd, unsigned long request, void *arg)
 		ret = 0;
 		serial = __igt_sigiter.stat.signals;
 		igt_assert(timer_settime(__igt_sigiter.timer, 0, &its, NULL) == 0);
-		if (ioctl(fd, request, arg))
+		if (next(fd, request, arg))
 			ret = errno;
 		if (__igt_sigiter.stat.signals == serial)
 			__igt_sigiter.stat.miss++;
@@ -161,8 +171,9 @@ static bool igt_sigiter_start(struct __igt_sigiter *iter, bool enable)
 	/* Note that until we can automatically clean up on failed/skipped
 	 * tests, we cannot assume the state of the igt_ioctl indirection.
 	 */
-	SIG_ASSERT(igt_ioctl == drmIoctl);
-	igt_ioctl = drmIoctl;
+	if (igt_ioctl != sig_ioctl)
+		__igt_sigiter.ioctl = igt_ioctl;
+	igt_ioctl = __igt_sigiter.ioctl;
 
 	if (enable) {
 		struct timespec start, end;
@@ -222,7 +233,7 @@ static bool igt_sigiter_stop(struct __igt_sigiter *iter, bool enable)
 
 		SIG_ASSERT(igt_ioctl == sig_ioctl);
 		SIG_ASSERT(__igt_sigiter.tid == gettid());
-		igt_ioctl = drmIoctl;
+		igt_ioctl = __igt_sigiter.ioctl;
 
 		timer_delete(__igt_sigiter.timer);
 
@@ -1533,6 +1544,49 @@ igt_lsof(const char *dpath)
 	free(sanitized);
 }
 
+/**
+ * igt_capture_output:
+ * @fmt: printf style format string for the shell command to run
+ * @...: optional arguments used in the format string
+ *
+ * Runs a command through the shell and collects everything it writes to its
+ * standard output, for checking the output of the tools.
+ *
+ * Returns: The output, to be freed by the caller, or NULL when the command
+ * could not be run or did not exit successfully.
+ */
+char *igt_capture_output(const char *fmt, ...)
+{
+	size_t size = 0;
+	char *out = NULL;
+	char *cmd;
+	va_list ap;
+	FILE *f;
+	int ret;
+
+	va_start(ap, fmt);
+	ret = vasprintf(&cmd, fmt, ap);
+	va_end(ap);
+	igt_assert(ret != -1);
+
+	f = popen(cmd, "r");
+	free(cmd);
+	if (!f)
+		return NULL;
+
+	if (getdelim(&out, &size, '\0', f) < 0) {
+		free(out);
+		out = strdup("");
+	}
+
+	if (pclose(f)) {
+		free(out);
+		out = NULL;
+	}
+
+	return out;
+}
+
 static struct igt_siglatency {
 	timer_t timer;
 	struct timespec target;
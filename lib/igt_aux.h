@@ -281,6 +281,8 @@ void igt_set_module_param_int(const char *name, int val);
 
 int igt_terminate_process(int sig, const char *comm);
 void igt_lsof(const char *dpath);
+__attribute__((format(printf, 1, 2)))
+char *igt_capture_output(const char *fmt, ...);
 
 /*
  * This list data structure is a verbatim copy from wayland-util.h from the
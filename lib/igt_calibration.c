@@ -0,0 +1,399 @@
+/*
+ * Copyright © 2017 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+
+#include "drmtest.h"
+#include "igt_aux.h"
+#include "igt_calibration.h"
+#include "igt_fake_i915.h"
+#include "intel_chipset.h"
+#include "intel_reg.h"
+#include "ioctl_wrappers.h"
+
+/**
+ * SECTION:igt_calibration
+ * @short_description: Nop batch calibration for benchmarks
+ * @title: Calibration
+ * @include: igt_calibration.h
+ *
+ * Benchmarks emulating GPU load usually do so with batches of MI_NOOPs, sized
+ * so that each batch keeps an engine busy for a given time. This library
+ * finds that size and remembers it across runs.
+ *
+ * Results of igt_calibrate_nop_cached() are stored in a small text file keyed
+ * by PCI device id, kernel release and build, engine and target duration. A
+ * cached size is checked with a short measurement before being used, and
+ * calibrated again if the device no longer agrees with it, so a run on a warm
+ * cache costs a handful of batches instead of several seconds.
+ *
+ * The cache lives in $XDG_CACHE_HOME/igt-nop-calibration, or
+ * ~/.cache/igt-nop-calibration, unless IGT_CALIBRATION_CACHE names another
+ * file. Setting IGT_CALIBRATION_CACHE to an empty string disables caching.
+ */
+
+#define CALIBRATION_LOOPS 17
+#define CALIBRATION_MIN_TIME 5 /* seconds, lets the GPU reach its clocks */
+#define REVALIDATE_LOOPS 5
+#define REVALIDATE_MIN_TOLERANCE 5 /* % */
+#define MAX_ENTRIES 256
+
+struct calibration_entry {
+	uint32_t devid;
+	char kernel[128];
+	uint32_t build;
+	unsigned int engine;
+	unsigned int usecs;
+	unsigned long size;
+};
+
+/**
+ * igt_elapsed:
+ * @start: the earlier time
+ * @end: the later time
+ *
+ * Returns:
+ * The time from @start to @end in seconds.
+ */
+double igt_elapsed(const struct timespec *start, const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) +
+	       (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static uint32_t nop_batch(int fd, unsigned long size)
+{
+	const uint32_t bbe = MI_BATCH_BUFFER_END;
+	uint32_t handle;
+
+	handle = gem_create(fd, size);
+	gem_write(fd, handle, size - sizeof(bbe), &bbe, sizeof(bbe));
+
+	return handle;
+}
+
+static double time_nops(int fd, unsigned int engine, uint32_t handle,
+			unsigned int loops)
+{
+	struct drm_i915_gem_exec_object2 obj = { .handle = handle };
+	struct drm_i915_gem_execbuffer2 eb = {
+		.buffers_ptr = to_user_pointer(&obj),
+		.buffer_count = 1,
+		.flags = engine,
+	};
+	struct timespec t_start, t_end;
+
+	gem_execbuf(fd, &eb);
+	gem_sync(fd, handle);
+
+	clock_gettime(CLOCK_MONOTONIC, &t_start);
+	for (unsigned int loop = 0; loop < loops; loop++)
+		gem_execbuf(fd, &eb);
+	gem_sync(fd, handle);
+	clock_gettime(CLOCK_MONOTONIC, &t_end);
+
+	return igt_elapsed(&t_start, &t_end);
+}
+
+/**
+ * igt_measure_nop:
+ * @fd: open i915 drm file descriptor
+ * @engine: execbuf engine selection flags
+ * @size: size of the nop batch in bytes
+ * @loops: number of batches to time
+ *
+ * Executes @loops back to back nop batches of @size bytes on @engine, after
+ * one untimed batch.
+ *
+ * Returns:
+ * The average execution time of one batch in microseconds.
+ */
+double igt_measure_nop(int fd, unsigned int engine, unsigned long size,
+		       unsigned int loops)
+{
+	uint32_t handle = nop_batch(fd, size);
+	double t;
+
+	t = time_nops(fd, engine, handle, loops);
+	gem_close(fd, handle);
+
+	return 1e6 * t / loops;
+}
+
+/**
+ * igt_calibrate_nop:
+ * @fd: open i915 drm file descriptor
+ * @engine: execbuf engine selection flags
+ * @usecs: target execution time of a batch
+ * @tolerance_pct: how much two consecutive estimates may differ by
+ *
+ * Finds the size of a nop batch taking @usecs to execute on @engine,
+ * iterating for at least five seconds and until the estimate settles within
+ * @tolerance_pct. This never uses the cache, see igt_calibrate_nop_cached().
+ *
+ * Returns:
+ * The batch size in bytes, a multiple of the page size.
+ */
+unsigned long igt_calibrate_nop(int fd, unsigned int engine,
+				unsigned int usecs, unsigned int tolerance_pct)
+{
+	unsigned long size, last_size;
+	struct timespec t_0, t_end;
+
+	clock_gettime(CLOCK_MONOTONIC, &t_0);
+
+	size = 256 * 1024;
+	do {
+		uint32_t handle = nop_batch(fd, size);
+		double t;
+
+		t = time_nops(fd, engine, handle, CALIBRATION_LOOPS);
+		gem_close(fd, handle);
+
+		last_size = size;
+		size = CALIBRATION_LOOPS * size / t / 1e6 * usecs;
+		size = ALIGN(max(size, 4096ul), 4096);
+
+		clock_gettime(CLOCK_MONOTONIC, &t_end);
+	} while (igt_elapsed(&t_0, &t_end) < CALIBRATION_MIN_TIME ||
+		 labs((long)size - (long)last_size) >
+		 size * tolerance_pct / 100);
+
+	return size;
+}
+
+static char *cache_path(void)
+{
+	const char *env;
+	char *path;
+
+	env = getenv("IGT_CALIBRATION_CACHE");
+	if (env)
+		return *env ? strdup(env) : NULL;
+
+	env = getenv("XDG_CACHE_HOME");
+	if (env && *env) {
+		if (asprintf(&path, "%s/igt-nop-calibration", env) < 0)
+			return NULL;
+		return path;
+	}
+
+	env = getenv("HOME");
+	if (!env || !*env)
+		return NULL;
+
+	if (asprintf(&path, "%s/.cache", env) < 0)
+		return NULL;
+	mkdir(path, 0700);
+	free(path);
+
+	if (asprintf(&path, "%s/.cache/igt-nop-calibration", env) < 0)
+		return NULL;
+	return path;
+}
+
+static int read_cache(const char *path, struct calibration_entry *entries)
+{
+	char line[256];
+	int count = 0;
+	FILE *file;
+
+	file = fopen(path, "r");
+	if (!file)
+		return 0;
+
+	while (count < MAX_ENTRIES && fgets(line, sizeof(line), file)) {
+		struct calibration_entry *e = &entries[count];
+
+		if (line[0] == '#')
+			continue;
+
+		if (sscanf(line, "%x %127s %x %u %u %lu",
+			   &e->devid, e->kernel, &e->build,
+			   &e->engine, &e->usecs, &e->size) == 6)
+			count++;
+	}
+
+	fclose(file);
+	return count;
+}
+
+static void write_cache(const char *path,
+			const struct calibration_entry *entries, int count)
+{
+	char *tmp;
+	FILE *file;
+	int i;
+
+	/* Concurrent runs may race, each one replaces the whole file */
+	if (asprintf(&tmp, "%s.%d", path, getpid()) < 0)
+		return;
+
+	file = fopen(tmp, "w");
+	if (!file) {
+		free(tmp);
+		return;
+	}
+
+	fprintf(file, "# devid kernel build engine usecs bytes\n");
+	for (i = 0; i < count; i++)
+		fprintf(file, "%04x %s %08x %u %u %lu\n",
+			entries[i].devid, entries[i].kernel, entries[i].build,
+			entries[i].engine, entries[i].usecs, entries[i].size);
+
+	if (fclose(file) == 0 && rename(tmp, path) == 0) {
+		free(tmp);
+		return;
+	}
+
+	unlink(tmp);
+	free(tmp);
+}
+
+static uint32_t hash_string(const char *str)
+{
+	uint32_t hash = 2166136261u; /* FNV-1a */
+
+	while (*str) {
+		hash ^= (uint8_t)*str++;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static void calibration_key(int fd, unsigned int engine, unsigned int usecs,
+			    struct calibration_entry *key)
+{
+	struct utsname uts;
+
+	memset(key, 0, sizeof(*key));
+	key->devid = intel_get_drm_devid(fd);
+	key->engine = engine;
+	key->usecs = usecs;
+
+	if (uname(&uts) == 0) {
+		snprintf(key->kernel, sizeof(key->kernel), "%s", uts.release);
+		key->build = hash_string(uts.version);
+	} else {
+		strcpy(key->kernel, "unknown");
+	}
+}
+
+static bool same_key(const struct calibration_entry *a,
+		     const struct calibration_entry *b)
+{
+	return a->devid == b->devid && a->build == b->build &&
+	       a->engine == b->engine && a->usecs == b->usecs &&
+	       strcmp(a->kernel, b->kernel) == 0;
+}
+
+/**
+ * igt_calibrate_nop_cached:
+ * @fd: open i915 drm file descriptor
+ * @engine: execbuf engine selection flags
+ * @usecs: target execution time of a batch
+ * @tolerance_pct: how much two consecutive estimates may differ by
+ * @cached: set to whether a cached result was used, may be NULL
+ *
+ * Like igt_calibrate_nop(), but first looks for a previous result for the
+ * same device, kernel, engine and @usecs in the calibration cache. A cached
+ * size is used if a few batches of it take within @tolerance_pct (at least
+ * 5%) of @usecs, otherwise the calibration is run again and the cache
+ * updated. Fake devices are always calibrated from scratch.
+ *
+ * Returns:
+ * The batch size in bytes, a multiple of the page size.
+ */
+unsigned long igt_calibrate_nop_cached(int fd, unsigned int engine,
+				       unsigned int usecs,
+				       unsigned int tolerance_pct,
+				       bool *cached)
+{
+	struct calibration_entry *entries, key;
+	unsigned int tolerance;
+	unsigned long size;
+	char *path = NULL;
+	int count = 0, i;
+
+	if (cached)
+		*cached = false;
+
+	if (!igt_is_fake_i915(fd))
+		path = cache_path();
+	if (!path)
+		return igt_calibrate_nop(fd, engine, usecs, tolerance_pct);
+
+	entries = calloc(MAX_ENTRIES, sizeof(*entries));
+	if (!entries) {
+		free(path);
+		return igt_calibrate_nop(fd, engine, usecs, tolerance_pct);
+	}
+
+	calibration_key(fd, engine, usecs, &key);
+	count = read_cache(path, entries);
+
+	for (i = 0; i < count; i++)
+		if (same_key(&entries[i], &key))
+			break;
+
+	tolerance = max(tolerance_pct, REVALIDATE_MIN_TOLERANCE);
+	if (i < count) {
+		double t = igt_measure_nop(fd, engine, entries[i].size,
+					   REVALIDATE_LOOPS);
+
+		if (fabs(t - usecs) <= usecs * tolerance / 100.) {
+			size = entries[i].size;
+			if (cached)
+				*cached = true;
+			goto out;
+		}
+	} else if (count == MAX_ENTRIES) {
+		/* Forget the oldest result */
+		memmove(entries, entries + 1, --count * sizeof(*entries));
+		i = count;
+	}
+
+	size = igt_calibrate_nop(fd, engine, usecs, tolerance_pct);
+
+	entries[i] = key;
+	entries[i].size = size;
+	if (i == count)
+		count++;
+	write_cache(path, entries, count);
+
+out:
+	free(entries);
+	free(path);
+	return size;
+}
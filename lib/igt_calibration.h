@@ -0,0 +1,41 @@
+/*
+ * Copyright © 2017 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef IGT_CALIBRATION_H
+#define IGT_CALIBRATION_H
+
+#include <stdbool.h>
+#include <time.h>
+
+double igt_elapsed(const struct timespec *start, const struct timespec *end);
+
+double igt_measure_nop(int fd, unsigned int engine, unsigned long size,
+		       unsigned int loops);
+unsigned long igt_calibrate_nop(int fd, unsigned int engine,
+				unsigned int usecs, unsigned int tolerance_pct);
+unsigned long igt_calibrate_nop_cached(int fd, unsigned int engine,
+				       unsigned int usecs,
+				       unsigned int tolerance_pct,
+				       bool *cached);
+
+#endif /* IGT_CALIBRATION_H */
@@ -49,6 +49,7 @@
 #include <sys/syscall.h>
 #endif
 #include <pthread.h>
+#include <sched.h>
 #include <sys/utsname.h>
 #include <termios.h>
 #include <errno.h>
@@ -265,68 +266,207 @@ static int igt_exitcode = IGT_EXIT_SUCCESS;
 static const char *command_str;
 
 static char* igt_log_domain_filter;
+
+/*
+ * The log buffer keeps the last lines logged at any level, for the dump on
+ * failure. It is a preallocated ring of records claimed with an atomic
+ * sequence number, so logging neither allocates nor takes a global lock.
+ * Records hold the formatted message, the "(program:pid) domain-LEVEL:"
+ * prefix is only added when dumping. Each record has its own lock, held just
+ * to copy the line in or print it out.
+ */
+#define LOG_BUFFER_SIZE 256
+#define LOG_ENTRY_TEXT 448
+
+struct log_entry {
+	unsigned long seq;	/* sequence number + 1, 0 if never written */
+	int lock;
+	pid_t pid;
+	enum igt_log_level level;
+	bool continuation;
+	bool has_domain;
+	char *overflow;		/* text too long for the record */
+	char text[LOG_ENTRY_TEXT];	/* the domain, if any, then the line */
+};
+
 static struct {
-	char *entries[256];
-	uint8_t start, end;
+	struct log_entry entries[LOG_BUFFER_SIZE];
+	unsigned long next;	/* next sequence number */
+	unsigned long start;	/* first sequence number to dump */
 } log_buffer;
-static pthread_mutex_t log_buffer_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *igt_log_level_str[] = {
+	"DEBUG",
+	"INFO",
+	"WARNING",
+	"CRITICAL",
+	"NONE"
+};
 
 const char *igt_test_name(void)
 {
 	return command_str;
 }
 
-static void _igt_log_buffer_append(char *line)
+static const char *log_program_name(void)
+{
+#ifdef __GLIBC__
+	return program_invocation_short_name;
+#else
+	return command_str;
+#endif
+}
+
+static void log_entry_lock(struct log_entry *entry)
 {
-	pthread_mutex_lock(&log_buffer_mutex);
+	while (__sync_lock_test_and_set(&entry->lock, 1))
+		sched_yield();
+}
 
-	free(log_buffer.entries[log_buffer.end]);
-	log_buffer.entries[log_buffer.end] = line;
-	log_buffer.end++;
-	if (log_buffer.end == log_buffer.start)
-		log_buffer.start++;
+static bool log_entry_trylock(struct log_entry *entry)
+{
+	return !__sync_lock_test_and_set(&entry->lock, 1);
+}
 
-	pthread_mutex_unlock(&log_buffer_mutex);
+static void log_entry_unlock(struct log_entry *entry)
+{
+	__sync_lock_release(&entry->lock);
 }
 
-static void _igt_log_buffer_reset(void)
+static const char *log_entry_domain(struct log_entry *entry)
 {
-	pthread_mutex_lock(&log_buffer_mutex);
+	if (!entry->has_domain)
+		return NULL;
+
+	return entry->overflow ?: entry->text;
+}
+
+static const char *log_entry_line(struct log_entry *entry)
+{
+	const char *text = entry->overflow ?: entry->text;
+
+	return entry->has_domain ? text + strlen(text) + 1 : text;
+}
+
+static void log_print(FILE *file, pid_t pid, const char *domain,
+		      enum igt_log_level level, bool continuation,
+		      const char *line)
+{
+	if (continuation)
+		fputs(line, file);
+	else
+		fprintf(file, "(%s:%d) %s%s%s: %s", log_program_name(),
+			pid, domain ?: "", domain ? "-" : "",
+			igt_log_level_str[level], line);
+}
+
+/*
+ * Copy the line into the next record of the ring, overwriting the oldest.
+ * The lock is only held for the copy, so that nothing can block while
+ * holding it.
+ */
+static void _igt_log_buffer_append(const char *domain,
+				   enum igt_log_level level,
+				   bool continuation,
+				   const char *line, size_t len)
+{
+	unsigned long seq = __sync_fetch_and_add(&log_buffer.next, 1);
+	struct log_entry *entry = &log_buffer.entries[seq % LOG_BUFFER_SIZE];
+	size_t domain_len = domain ? strlen(domain) + 1 : 0;
+	char *text = entry->text;
+
+	log_entry_lock(entry);
+
+	free(entry->overflow);
+	entry->overflow = NULL;
+
+	/* rare long lines, and failing that the line without its domain */
+	if (domain_len + len >= sizeof(entry->text)) {
+		entry->overflow = malloc(domain_len + len + 1);
+		if (entry->overflow)
+			text = entry->overflow;
+		else
+			domain_len = 0;
+	}
 
-	log_buffer.start = log_buffer.end = 0;
+	if (domain_len)
+		memcpy(text, domain, domain_len);
+	if (text == entry->text && domain_len + len >= sizeof(entry->text))
+		len = sizeof(entry->text) - 1;
+	memcpy(text + domain_len, line, len);
+	text[domain_len + len] = '\0';
 
-	pthread_mutex_unlock(&log_buffer_mutex);
+	entry->seq = seq + 1;
+	entry->pid = getpid();
+	entry->level = level;
+	entry->continuation = continuation;
+	entry->has_domain = domain_len;
+
+	log_entry_unlock(entry);
+}
+
+static void _igt_log_buffer_reset(void)
+{
+	__atomic_store_n(&log_buffer.start,
+			 __atomic_load_n(&log_buffer.next, __ATOMIC_ACQUIRE),
+			 __ATOMIC_RELEASE);
 }
 
 static void _igt_log_buffer_dump(void)
 {
-	uint8_t i;
+	unsigned long seq, start, end;
 
 	if (in_subtest)
 		fprintf(stderr, "Subtest %s failed.\n", in_subtest);
 	else
 		fprintf(stderr, "Test %s failed.\n", command_str);
 
-	if (log_buffer.start == log_buffer.end) {
+	/* one record short of the ring, as many lines as always dumped */
+	end = __atomic_load_n(&log_buffer.next, __ATOMIC_ACQUIRE);
+	start = __atomic_load_n(&log_buffer.start, __ATOMIC_ACQUIRE);
+	if (end - start >= LOG_BUFFER_SIZE)
+		start = end - (LOG_BUFFER_SIZE - 1);
+
+	if (start == end) {
 		fprintf(stderr, "No log.\n");
 		return;
 	}
 
-	pthread_mutex_lock(&log_buffer_mutex);
 	fprintf(stderr, "**** DEBUG ****\n");
 
-	i = log_buffer.start;
-	do {
-		char *last_line = log_buffer.entries[i];
-		fprintf(stderr, "%s", last_line);
-		i++;
-	} while (i != log_buffer.start && i != log_buffer.end);
+	for (seq = start; seq != end; seq++) {
+		struct log_entry *entry =
+			&log_buffer.entries[seq % LOG_BUFFER_SIZE];
+		struct log_entry copy;
+
+		/*
+		 * Skip busy records rather than wait, the dump may be from a
+		 * signal handler that interrupted their writer. Records are
+		 * copied out to be printed unlocked, and are not dumped again,
+		 * so their long text can be taken over.
+		 */
+		if (!log_entry_trylock(entry))
+			continue;
+		copy = *entry;
+		if (copy.seq == seq + 1) {
+			entry->overflow = NULL;
+			entry->seq = 0;
+		}
+		log_entry_unlock(entry);
+
+		/* and records overwritten since */
+		if (copy.seq != seq + 1)
+			continue;
+
+		log_print(stderr, copy.pid, log_entry_domain(&copy),
+			  copy.level, copy.continuation, log_entry_line(&copy));
+		free(copy.overflow);
+	}
 
 	/* reset the buffer */
-	log_buffer.start = log_buffer.end = 0;
+	__atomic_store_n(&log_buffer.start, end, __ATOMIC_RELEASE);
 
 	fprintf(stderr, "****  END  ****\n");
-	pthread_mutex_unlock(&log_buffer_mutex);
 }
 
 __attribute__((format(printf, 1, 2)))
@@ -1946,45 +2086,37 @@ void igt_log(const char *domain, enum igt_log_level level, const char *format, .
 void igt_vlog(const char *domain, enum igt_log_level level, const char *format, va_list args)
 {
 	FILE *file;
-	char *line, *formatted_line;
-	const char *program_name;
-	const char *igt_log_level_str[] = {
-		"DEBUG",
-		"INFO",
-		"WARNING",
-		"CRITICAL",
-		"NONE"
-	};
-	static bool line_continuation = false;
+	char buf[LOG_ENTRY_TEXT];
+	char *line = buf;
+	bool continuation;
+	va_list copy;
+	int len;
+	/* a line is continued by the next logged from the same thread */
+	static __thread bool line_continuation = false;
 
 	assert(format);
 
-#ifdef __GLIBC__
-	program_name = program_invocation_short_name;
-#else
-	program_name = command_str;
-#endif
-
 	if (list_subtests && level <= IGT_LOG_WARN)
 		return;
 
-	if (vasprintf(&line, format, args) == -1)
-		return;
-
-	if (line_continuation) {
-		formatted_line = strdup(line);
-		if (!formatted_line)
-			goto out;
-	} else if (asprintf(&formatted_line, "(%s:%d) %s%s%s: %s", program_name,
-		     getpid(), (domain) ? domain : "", (domain) ? "-" : "",
-		     igt_log_level_str[level], line) == -1) {
-		goto out;
+	/* format on the stack, only allocating for long lines */
+	va_copy(copy, args);
+	len = vsnprintf(buf, sizeof(buf), format, args);
+	if (len >= (int)sizeof(buf) && vasprintf(&line, format, copy) == -1) {
+		line = buf;
+		len = strlen(buf);
+	}
+	va_end(copy);
+	if (len < 0) {
+		buf[0] = '\0';
+		len = 0;
 	}
 
-	line_continuation = line[strlen(line) - 1] != '\n';
+	continuation = line_continuation;
+	line_continuation = len && line[len - 1] != '\n';
 
 	/* append log buffer */
-	_igt_log_buffer_append(formatted_line);
+	_igt_log_buffer_append(domain, level, continuation, line, len);
 
 	/* check print log level */
 	if (igt_log_level > level)
@@ -2011,13 +2143,13 @@ void igt_vlog(const char *domain, enum igt_log_level level, const char *format,
 	/* prepend all except information messages with process, domain and log
 	 * level information */
 	if (level != IGT_LOG_INFO)
-		fwrite(formatted_line, sizeof(char), strlen(formatted_line),
-		       file);
+		log_print(file, getpid(), domain, level, continuation, line);
 	else
-		fwrite(line, sizeof(char), strlen(line), file);
+		fwrite(line, sizeof(char), len, file);
 
 out:
-	free(line);
+	if (line != buf)
+		free(line);
 }
 
 static const char *timeout_op;
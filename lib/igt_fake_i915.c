@@ -0,0 +1,1140 @@
+/*
+ * Copyright © 2017 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "drmtest.h"
+#include "igt_aux.h"
+#include "igt_fake_i915.h"
+#include "intel_chipset.h"
+#include "ioctl_wrappers.h"
+
+/**
+ * SECTION:igt_fake_i915
+ * @short_description: Userspace stand-in for an i915 device
+ * @title: Fake i915
+ * @include: igt_fake_i915.h
+ *
+ * This library implements enough of the i915 GEM uAPI in userspace to run
+ * benchmarks and the submission paths of tools on machines without an Intel
+ * GPU, e.g. to profile the userspace side of a workload or to develop on a
+ * laptop.
+ *
+ * It is enabled by setting the IGT_FAKE_I915 environment variable to the
+ * simulated execution time of each batch in microseconds, after which
+ * drm_open_driver() and friends return a fake device when asked for
+ * #DRIVER_INTEL. IGT_FAKE_I915_NS_PER_KB adds a cost proportional to the batch
+ * length, so that benchmarks which size their batches by calibration, like
+ * gem_wsim, get the durations they asked for. IGT_FAKE_I915_DEVID selects the
+ * reported PCI id, by default #IGT_FAKE_I915_DEFAULT_DEVID.
+ *
+ * All the objects of a fake device live in a memfd, which is also the file
+ * descriptor handed out, so GTT mmaps through the returned fd work as usual.
+ * Ioctls are routed through #igt_ioctl; calling ioctl() or drmIoctl() directly
+ * on a fake device fails with ENOTTY. igt_while_interruptible() chains to the
+ * fake device, provided it was opened before entering the loop.
+ *
+ * Batches are never executed. Relocations are written into the objects, and
+ * each batch occupies its engine for the configured time, so busy, wait and
+ * set-domain report completion as a real device running nop batches would.
+ * Anything relying on the GPU writing to memory, like seqno or timestamp
+ * stores, does not see those writes. The engine timelines are shared between
+ * all fake devices and with forked children, so clients in separate processes
+ * contend for the same fake engines.
+ */
+
+#define FAKE_SPACE (1ull << 40)
+#define FAKE_GTT_BASE (1ull << 20)
+
+#define LOCAL_I915_PARAM_HAS_EXEC_SOFTPIN 37
+#define LOCAL_I915_PARAM_MMAP_GTT_VERSION 40
+#define LOCAL_I915_PARAM_HAS_EXEC_ASYNC 43
+
+#define LOCAL_EXEC_OBJECT_WRITE (1 << 2)
+#define LOCAL_EXEC_OBJECT_ASYNC (1 << 6)
+#define LOCAL_I915_EXEC_FENCE_IN (1 << 16)
+#define LOCAL_I915_EXEC_FENCE_OUT (1 << 17)
+#define LOCAL_I915_EXEC_BATCH_FIRST (1 << 18)
+
+#define LOCAL_I915_CONTEXT_PARAM_GTT_SIZE 0x3
+#define LOCAL_I915_CONTEXT_PARAM_PRIORITY 0x6
+
+struct local_i915_gem_mmap_v2 {
+	uint32_t handle;
+	uint32_t pad;
+	uint64_t offset;
+	uint64_t size;
+	uint64_t addr_ptr;
+	uint64_t flags;
+};
+
+enum fake_engine {
+	FAKE_RCS = 0,
+	FAKE_VCS1,
+	FAKE_VCS2,
+	FAKE_BCS,
+	FAKE_VECS,
+	FAKE_NUM_ENGINES
+};
+
+/* The engine ids reported by the busy ioctl, i.e. the I915_EXEC_* ring */
+static const uint32_t fake_uabi_id[FAKE_NUM_ENGINES] = {
+	[FAKE_RCS] = I915_EXEC_RENDER,
+	[FAKE_VCS1] = I915_EXEC_BSD,
+	[FAKE_VCS2] = I915_EXEC_BSD,
+	[FAKE_BCS] = I915_EXEC_BLT,
+	[FAKE_VECS] = 4,
+};
+
+/* Lives in MAP_SHARED memory so that forked clients see the same GPU */
+struct fake_gpu {
+	uint64_t engine_busy[FAKE_NUM_ENGINES];
+};
+
+struct fake_bo {
+	uint64_t size;
+	uint64_t offset; /* into the memfd */
+	uint64_t gtt;
+	uint64_t busy_until;
+	uint64_t write_until;
+	uint32_t read_engines;
+	uint32_t write_engine;
+	uint32_t tiling, stride;
+	uint32_t caching;
+	bool write;
+};
+
+struct fake_ctx {
+	bool used;
+	uint64_t param[LOCAL_I915_CONTEXT_PARAM_PRIORITY + 1];
+};
+
+struct fake_i915 {
+	struct fake_i915 *next;
+	int fd;
+	dev_t dev;
+	ino_t ino;
+
+	uint64_t *cursor; /* shared with forked children, like the memfd */
+	unsigned int active; /* ioctls in flight, which may be sleeping */
+
+	struct fake_bo **bo;
+	unsigned int max_bo;
+	uint32_t *free_bo; /* stack of unused slots */
+	unsigned int num_free;
+
+	struct fake_ctx *ctx;
+	unsigned int max_ctx;
+};
+
+static struct {
+	pthread_mutex_t mutex;
+	struct fake_i915 *devices;
+	struct fake_gpu *gpu;
+	uint64_t latency;
+	uint64_t ns_per_kb;
+	uint32_t devid;
+} fake = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static uint64_t fake_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static bool fake_has_llc(void)
+{
+	return intel_gen(fake.devid) >= 6 &&
+	       !IS_VALLEYVIEW(fake.devid) && !IS_CHERRYVIEW(fake.devid) &&
+	       !IS_BROXTON(fake.devid) && !IS_GEMINILAKE(fake.devid);
+}
+
+static uint64_t max_u64(uint64_t a, uint64_t b)
+{
+	return a > b ? a : b;
+}
+
+/*
+ * Drops the device lock while sleeping, so the caller must look up its
+ * objects again afterwards.
+ */
+static void fake_sleep_until(uint64_t t)
+{
+	struct timespec ts = {
+		.tv_sec = t / 1000000000ull,
+		.tv_nsec = t % 1000000000ull,
+	};
+
+	if (t <= fake_now())
+		return;
+
+	pthread_mutex_unlock(&fake.mutex);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+	pthread_mutex_lock(&fake.mutex);
+}
+
+static void fake_free(struct fake_i915 *dev)
+{
+	unsigned int i;
+
+	for (i = 0; i < dev->max_bo; i++)
+		free(dev->bo[i]);
+	free(dev->bo);
+	free(dev->free_bo);
+	free(dev->ctx);
+	munmap(dev->cursor, 4096);
+	free(dev);
+}
+
+static bool fake_open(const struct fake_i915 *dev)
+{
+	struct stat st;
+
+	/* The fd may have been closed and reused behind our back */
+	return dev->fd >= 0 && fstat(dev->fd, &st) == 0 &&
+	       st.st_dev == dev->dev && st.st_ino == dev->ino;
+}
+
+/*
+ * The fd is closed with plain close(), so a device is only found to be gone
+ * on its next lookup, or when another device is opened. It is freed once no
+ * ioctl is still sleeping on it.
+ */
+static void fake_reap(void)
+{
+	struct fake_i915 **p = &fake.devices;
+
+	while (*p) {
+		struct fake_i915 *dev = *p;
+
+		if (!fake_open(dev))
+			dev->fd = -1;
+
+		if (dev->fd < 0 && !dev->active) {
+			*p = dev->next;
+			fake_free(dev);
+		} else {
+			p = &dev->next;
+		}
+	}
+}
+
+static struct fake_i915 *fake_lookup(int fd)
+{
+	struct fake_i915 *dev;
+
+	for (dev = fake.devices; dev; dev = dev->next) {
+		if (dev->fd != fd)
+			continue;
+
+		if (!fake_open(dev)) {
+			fake_reap();
+			return NULL;
+		}
+
+		return dev;
+	}
+
+	return NULL;
+}
+
+static struct fake_bo *lookup_bo(struct fake_i915 *dev, uint32_t handle)
+{
+	if (handle == 0 || handle > dev->max_bo)
+		return NULL;
+
+	return dev->bo[handle - 1];
+}
+
+static struct fake_ctx *lookup_ctx(struct fake_i915 *dev, uint32_t id)
+{
+	if (id >= dev->max_ctx || !dev->ctx[id].used)
+		return NULL;
+
+	return &dev->ctx[id];
+}
+
+static int fake_version(struct fake_i915 *dev, drm_version_t *v)
+{
+	static const char name[] = "i915";
+
+	if (v->name && v->name_len)
+		memcpy(v->name, name, min(v->name_len, strlen(name)));
+	v->name_len = strlen(name);
+	v->date_len = 0;
+	v->desc_len = 0;
+	v->version_major = 1;
+	v->version_minor = 6;
+	v->version_patchlevel = 0;
+
+	return 0;
+}
+
+static int fake_getparam(struct fake_i915 *dev, struct drm_i915_getparam *gp)
+{
+	int value;
+
+	switch (gp->param) {
+	case I915_PARAM_CHIPSET_ID:
+		value = fake.devid;
+		break;
+	case I915_PARAM_HAS_BSD:
+	case I915_PARAM_HAS_BLT:
+	case I915_PARAM_HAS_VEBOX:
+	case I915_PARAM_HAS_BSD2:
+	case I915_PARAM_HAS_WAIT_TIMEOUT:
+	case I915_PARAM_HAS_EXEC_NO_RELOC:
+	case I915_PARAM_HAS_EXEC_HANDLE_LUT:
+	case LOCAL_I915_PARAM_HAS_EXEC_SOFTPIN:
+	case LOCAL_I915_PARAM_HAS_EXEC_ASYNC:
+		value = 1;
+		break;
+	case I915_PARAM_HAS_LLC:
+		value = fake_has_llc();
+		break;
+	case I915_PARAM_HAS_ALIASING_PPGTT:
+		value = 2;
+		break;
+	case I915_PARAM_MMAP_VERSION:
+	case LOCAL_I915_PARAM_MMAP_GTT_VERSION:
+		value = 1;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	*gp->value = value;
+	return 0;
+}
+
+static int fake_gem_create(struct fake_i915 *dev, struct drm_i915_gem_create *arg)
+{
+	struct fake_bo *bo;
+	uint64_t size;
+	unsigned int i;
+
+	if (arg->size == 0)
+		return -EINVAL;
+
+	size = ALIGN(arg->size, 4096);
+	if (size > FAKE_SPACE)
+		return -E2BIG;
+
+	if (!dev->num_free) {
+		unsigned int max = dev->max_bo ? 2 * dev->max_bo : 64;
+		struct fake_bo **tmp;
+		uint32_t *free_bo;
+
+		free_bo = realloc(dev->free_bo, max * sizeof(*free_bo));
+		if (!free_bo)
+			return -ENOMEM;
+		dev->free_bo = free_bo;
+
+		tmp = realloc(dev->bo, max * sizeof(*tmp));
+		if (!tmp)
+			return -ENOMEM;
+
+		memset(tmp + dev->max_bo, 0,
+		       (max - dev->max_bo) * sizeof(*tmp));
+		dev->bo = tmp;
+
+		/* hand out the lowest new slot first */
+		for (i = max; i > dev->max_bo; i--)
+			dev->free_bo[dev->num_free++] = i - 1;
+		dev->max_bo = max;
+	}
+
+	bo = calloc(1, sizeof(*bo));
+	if (!bo)
+		return -ENOMEM;
+
+	i = dev->free_bo[dev->num_free - 1];
+	bo->size = size;
+	bo->offset = __sync_fetch_and_add(dev->cursor, size);
+	if (bo->offset + size > FAKE_SPACE) {
+		free(bo);
+		return -ENOSPC;
+	}
+	bo->gtt = FAKE_GTT_BASE + bo->offset;
+	bo->caching = fake_has_llc();
+
+	dev->bo[i] = bo;
+	dev->num_free--;
+	arg->handle = i + 1;
+	arg->size = size;
+
+	return 0;
+}
+
+static int fake_gem_close(struct fake_i915 *dev, struct drm_gem_close *arg)
+{
+	struct fake_bo *bo = lookup_bo(dev, arg->handle);
+
+	if (!bo)
+		return -EINVAL;
+
+	/* Give the memory back, the range itself is never reused */
+	fallocate(dev->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+		  bo->offset, bo->size);
+
+	dev->bo[arg->handle - 1] = NULL;
+	dev->free_bo[dev->num_free++] = arg->handle - 1;
+	free(bo);
+
+	return 0;
+}
+
+static int fake_gem_pwrite(struct fake_i915 *dev,
+			   struct drm_i915_gem_pwrite *arg)
+{
+	struct fake_bo *bo = lookup_bo(dev, arg->handle);
+
+	if (!bo)
+		return -ENOENT;
+
+	if (arg->offset > bo->size || arg->size > bo->size - arg->offset)
+		return -EINVAL;
+
+	fake_sleep_until(bo->busy_until);
+	if (!(bo = lookup_bo(dev, arg->handle)))
+		return -ENOENT;
+
+	if (pwrite(dev->fd, from_user_pointer(arg->data_ptr), arg->size,
+		   bo->offset + arg->offset) != arg->size)
+		return -EFAULT;
+
+	return 0;
+}
+
+static int fake_gem_pread(struct fake_i915 *dev, struct drm_i915_gem_pread *arg)
+{
+	struct fake_bo *bo = lookup_bo(dev, arg->handle);
+
+	if (!bo)
+		return -ENOENT;
+
+	if (arg->offset > bo->size || arg->size > bo->size - arg->offset)
+		return -EINVAL;
+
+	fake_sleep_until(bo->write_until);
+	if (!(bo = lookup_bo(dev, arg->handle)))
+		return -ENOENT;
+
+	if (pread(dev->fd, from_user_pointer(arg->data_ptr), arg->size,
+		  bo->offset + arg->offset) != arg->size)
+		return -EFAULT;
+
+	return 0;
+}
+
+static int fake_gem_mmap(struct fake_i915 *dev,
+			 struct local_i915_gem_mmap_v2 *arg, size_t len)
+{
+	struct fake_bo *bo = lookup_bo(dev, arg->handle);
+	void *ptr;
+
+	if (!bo)
+		return -ENOENT;
+
+	if (len >= sizeof(*arg) && arg->flags & ~(uint64_t)I915_MMAP_WC)
+		return -EINVAL;
+
+	if (arg->offset > bo->size || arg->size > bo->size - arg->offset)
+		return -EINVAL;
+
+	ptr = mmap(NULL, arg->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   dev->fd, bo->offset + arg->offset);
+	if (ptr == MAP_FAILED)
+		return -errno;
+
+	arg->addr_ptr = to_user_pointer(ptr);
+	return 0;
+}
+
+static int fake_gem_mmap_gtt(struct fake_i915 *dev,
+			     struct drm_i915_gem_mmap_gtt *arg)
+{
+	struct fake_bo *bo = lookup_bo(dev, arg->handle);
+
+	if (!bo)
+		return -ENOENT;
+
+	/* The fd is the backing store, so the fake offset is the real one */
+	arg->offset = bo->offset;
+	return 0;
+}
+
+static int fake_gem_set_domain(struct fake_i915 *dev,
+			       struct drm_i915_gem_set_domain *arg)
+{
+	struct fake_bo *bo = lookup_bo(dev, arg->handle);
+
+	if (!bo)
+		return -ENOENT;
+
+	if (arg->write_domain && arg->write_domain != arg->read_domains)
+		return -EINVAL;
+
+	fake_sleep_until(arg->write_domain ? bo->busy_until : bo->write_until);
+	return 0;
+}
+
+static int fake_gem_busy(struct fake_i915 *dev, struct drm_i915_gem_busy *arg)
+{
+	struct fake_bo *bo = lookup_bo(dev, arg->handle);
+	uint64_t now = fake_now();
+
+	if (!bo)
+		return -ENOENT;
+
+	arg->busy = 0;
+	if (bo->busy_until > now)
+		arg->busy |= bo->read_engines << 16;
+	if (bo->write_until > now)
+		arg->busy |= bo->write_engine;
+
+	return 0;
+}
+
+static int fake_gem_wait(struct fake_i915 *dev, struct drm_i915_gem_wait *arg)
+{
+	struct fake_bo *bo = lookup_bo(dev, arg->bo_handle);
+	uint64_t now = fake_now();
+	uint64_t remaining;
+
+	if (!bo)
+		return -ENOENT;
+
+	if (arg->flags)
+		return -EINVAL;
+
+	remaining = bo->busy_until > now ? bo->busy_until - now : 0;
+	if (arg->timeout_ns >= 0 && remaining > (uint64_t)arg->timeout_ns) {
+		fake_sleep_until(now + arg->timeout_ns);
+		arg->timeout_ns = 0;
+		return -ETIME;
+	}
+
+	fake_sleep_until(now + remaining);
+	if (arg->timeout_ns > 0)
+		arg->timeout_ns -= remaining;
+
+	return 0;
+}
+
+static int fake_gem_caching(struct fake_i915 *dev,
+			    struct drm_i915_gem_caching *arg, bool set)
+{
+	struct fake_bo *bo = lookup_bo(dev, arg->handle);
+
+	if (!bo)
+		return -ENOENT;
+
+	if (set)
+		bo->caching = arg->caching;
+	else
+		arg->caching = bo->caching;
+
+	return 0;
+}
+
+static int fake_gem_set_tiling(struct fake_i915 *dev,
+			       struct drm_i915_gem_set_tiling *arg)
+{
+	struct fake_bo *bo = lookup_bo(dev, arg->handle);
+
+	if (!bo)
+		return -ENOENT;
+
+	if (arg->tiling_mode > I915_TILING_Y)
+		return -EINVAL;
+
+	bo->tiling = arg->tiling_mode;
+	bo->stride = bo->tiling ? arg->stride : 0;
+	arg->stride = bo->stride;
+	arg->swizzle_mode = I915_BIT_6_SWIZZLE_NONE;
+
+	return 0;
+}
+
+static int fake_gem_get_tiling(struct fake_i915 *dev,
+			       struct drm_i915_gem_get_tiling *arg)
+{
+	struct fake_bo *bo = lookup_bo(dev, arg->handle);
+
+	if (!bo)
+		return -ENOENT;
+
+	arg->tiling_mode = bo->tiling;
+	arg->swizzle_mode = I915_BIT_6_SWIZZLE_NONE;
+
+	return 0;
+}
+
+static int fake_gem_madvise(struct fake_i915 *dev,
+			    struct drm_i915_gem_madvise *arg)
+{
+	if (!lookup_bo(dev, arg->handle))
+		return -ENOENT;
+
+	arg->retained = 1;
+	return 0;
+}
+
+static int fake_gem_get_aperture(struct fake_i915 *dev,
+				 struct drm_i915_gem_get_aperture *arg)
+{
+	arg->aper_size = 1ull << 32;
+	arg->aper_available_size = arg->aper_size;
+	return 0;
+}
+
+static int fake_context_create(struct fake_i915 *dev,
+			       struct drm_i915_gem_context_create *arg)
+{
+	unsigned int i;
+
+	for (i = 1; i < dev->max_ctx; i++)
+		if (!dev->ctx[i].used)
+			break;
+
+	if (i >= dev->max_ctx) {
+		unsigned int max = 2 * dev->max_ctx;
+		struct fake_ctx *tmp;
+
+		tmp = realloc(dev->ctx, max * sizeof(*tmp));
+		if (!tmp)
+			return -ENOMEM;
+
+		memset(tmp + dev->max_ctx, 0,
+		       (max - dev->max_ctx) * sizeof(*tmp));
+		dev->ctx = tmp;
+		dev->max_ctx = max;
+	}
+
+	memset(&dev->ctx[i], 0, sizeof(dev->ctx[i]));
+	dev->ctx[i].used = true;
+	dev->ctx[i].param[LOCAL_I915_CONTEXT_PARAM_GTT_SIZE] = 1ull << 48;
+	arg->ctx_id = i;
+
+	return 0;
+}
+
+static int fake_context_destroy(struct fake_i915 *dev,
+				struct drm_i915_gem_context_destroy *arg)
+{
+	if (arg->ctx_id == 0 || !lookup_ctx(dev, arg->ctx_id))
+		return -ENOENT;
+
+	dev->ctx[arg->ctx_id].used = false;
+	return 0;
+}
+
+static int fake_context_param(struct fake_i915 *dev,
+			      struct drm_i915_gem_context_param *arg, bool set)
+{
+	struct fake_ctx *ctx = lookup_ctx(dev, arg->ctx_id);
+
+	if (!ctx)
+		return -ENOENT;
+
+	if (arg->param == 0 || arg->param >= ARRAY_SIZE(ctx->param))
+		return -EINVAL;
+
+	if (!set) {
+		arg->size = 0;
+		arg->value = ctx->param[arg->param];
+		return 0;
+	}
+
+	switch (arg->param) {
+	case LOCAL_I915_CONTEXT_PARAM_GTT_SIZE:
+		return -EINVAL;
+	case LOCAL_I915_CONTEXT_PARAM_PRIORITY:
+		if ((int64_t)arg->value > 1023 || (int64_t)arg->value < -1023)
+			return -EINVAL;
+		break;
+	}
+
+	ctx->param[arg->param] = arg->value;
+	return 0;
+}
+
+static int fake_engine(uint64_t flags)
+{
+	switch (flags & 0x3f) {
+	case I915_EXEC_DEFAULT:
+	case I915_EXEC_RENDER:
+		return FAKE_RCS;
+	case I915_EXEC_BSD:
+		switch (flags & I915_EXEC_BSD_MASK) {
+		case I915_EXEC_BSD_DEFAULT:
+			return fake.gpu->engine_busy[FAKE_VCS2] <
+			       fake.gpu->engine_busy[FAKE_VCS1] ?
+			       FAKE_VCS2 : FAKE_VCS1;
+		case I915_EXEC_BSD_RING1:
+			return FAKE_VCS1;
+		case I915_EXEC_BSD_RING2:
+			return FAKE_VCS2;
+		default:
+			return -EINVAL;
+		}
+	case I915_EXEC_BLT:
+		return FAKE_BCS;
+	case 4: /* I915_EXEC_VEBOX */
+		return FAKE_VECS;
+	default:
+		return -EINVAL;
+	}
+}
+
+static int fake_check_relocs(struct fake_i915 *dev, struct fake_bo *bo,
+			     struct drm_i915_gem_exec_object2 *obj,
+			     const struct drm_i915_gem_execbuffer2 *eb)
+{
+	struct drm_i915_gem_relocation_entry *reloc =
+		from_user_pointer(obj->relocs_ptr);
+	unsigned int len = intel_gen(fake.devid) >= 8 ? 8 : 4;
+	unsigned int n;
+
+	for (n = 0; n < obj->relocation_count; n++) {
+		struct drm_i915_gem_relocation_entry *r = &reloc[n];
+
+		if (eb->flags & I915_EXEC_HANDLE_LUT) {
+			if (r->target_handle >= eb->buffer_count)
+				return -ENOENT;
+		} else if (!lookup_bo(dev, r->target_handle)) {
+			return -ENOENT;
+		}
+
+		if (r->offset & 3 || r->offset > bo->size - len)
+			return -EINVAL;
+	}
+
+	return 0;
+}
+
+/* Only once the whole execbuf has been checked by fake_check_relocs() */
+static int fake_relocate(struct fake_i915 *dev, struct fake_bo *bo,
+			 struct fake_bo **bos,
+			 struct drm_i915_gem_exec_object2 *obj,
+			 uint64_t flags)
+{
+	struct drm_i915_gem_relocation_entry *reloc =
+		from_user_pointer(obj->relocs_ptr);
+	unsigned int len = intel_gen(fake.devid) >= 8 ? 8 : 4;
+	unsigned int n;
+
+	for (n = 0; n < obj->relocation_count; n++) {
+		struct drm_i915_gem_relocation_entry *r = &reloc[n];
+		struct fake_bo *target;
+		uint64_t addr;
+
+		if (flags & I915_EXEC_HANDLE_LUT)
+			target = bos[r->target_handle];
+		else
+			target = lookup_bo(dev, r->target_handle);
+
+		if (r->write_domain)
+			target->write = true;
+
+		if (flags & I915_EXEC_NO_RELOC && r->presumed_offset == target->gtt)
+			continue;
+
+		addr = target->gtt + (int32_t)r->delta;
+		if (pwrite(dev->fd, &addr, len, bo->offset + r->offset) != len)
+			return -EFAULT;
+
+		r->presumed_offset = target->gtt;
+	}
+
+	return 0;
+}
+
+static int cmp_bo(const void *A, const void *B)
+{
+	uintptr_t a = (uintptr_t)*(struct fake_bo * const *)A;
+	uintptr_t b = (uintptr_t)*(struct fake_bo * const *)B;
+
+	return a < b ? -1 : a > b;
+}
+
+static int fake_execbuf(struct fake_i915 *dev,
+			struct drm_i915_gem_execbuffer2 *eb)
+{
+	struct drm_i915_gem_exec_object2 *objects =
+		from_user_pointer(eb->buffers_ptr);
+	unsigned int i, count = eb->buffer_count;
+	struct fake_bo **bos, *batch;
+	uint64_t now, start, end, busy, len;
+	int engine, ret;
+
+	if (count == 0)
+		return -EINVAL;
+
+	if (eb->flags & (LOCAL_I915_EXEC_FENCE_IN | LOCAL_I915_EXEC_FENCE_OUT))
+		return -EINVAL;
+
+	engine = fake_engine(eb->flags);
+	if (engine < 0)
+		return engine;
+
+	if (!lookup_ctx(dev, eb->rsvd1 & 0xffffffff))
+		return -ENOENT;
+
+	/* The objects in order, then sorted to spot duplicates */
+	bos = malloc(2 * count * sizeof(*bos));
+	if (!bos)
+		return -ENOMEM;
+
+	/* Check everything first, so that a failed execbuf changes nothing */
+	ret = -ENOENT;
+	for (i = 0; i < count; i++) {
+		bos[i] = lookup_bo(dev, objects[i].handle);
+		if (!bos[i])
+			goto out;
+	}
+
+	ret = -EINVAL;
+	memcpy(bos + count, bos, count * sizeof(*bos));
+	qsort(bos + count, count, sizeof(*bos), cmp_bo);
+	for (i = 1; i < count; i++)
+		if (bos[count + i] == bos[count + i - 1])
+			goto out;
+
+	for (i = 0; i < count; i++) {
+		if (objects[i].flags & EXEC_OBJECT_PINNED &&
+		    objects[i].offset & 4095) {
+			ret = -EINVAL;
+			goto out;
+		}
+
+		ret = fake_check_relocs(dev, bos[i], &objects[i], eb);
+		if (ret)
+			goto out;
+	}
+
+	for (i = 0; i < count; i++) {
+		struct drm_i915_gem_exec_object2 *obj = &objects[i];
+
+		bos[i]->write = obj->flags & LOCAL_EXEC_OBJECT_WRITE;
+		if (obj->flags & EXEC_OBJECT_PINNED)
+			bos[i]->gtt = obj->offset;
+		obj->offset = bos[i]->gtt;
+	}
+
+	for (i = 0; i < count; i++) {
+		ret = fake_relocate(dev, bos[i], bos, &objects[i], eb->flags);
+		if (ret)
+			goto out;
+	}
+
+	batch = bos[eb->flags & LOCAL_I915_EXEC_BATCH_FIRST ? 0 : count - 1];
+	len = eb->batch_len ?: batch->size;
+
+	/*
+	 * Implicit fencing: wait for the last writer of everything we use and
+	 * for all users of what we write, then queue behind the engine.
+	 */
+	start = now = fake_now();
+	for (i = 0; i < count; i++) {
+		struct fake_bo *bo = bos[i];
+
+		if (objects[i].flags & LOCAL_EXEC_OBJECT_ASYNC)
+			continue;
+
+		start = max_u64(start, bo->write ? bo->busy_until :
+						   bo->write_until);
+	}
+
+	do {
+		busy = fake.gpu->engine_busy[engine];
+		end = max_u64(start, busy) + fake.latency +
+		      len * fake.ns_per_kb / 1024;
+	} while (!__sync_bool_compare_and_swap(&fake.gpu->engine_busy[engine],
+					       busy, end));
+
+	for (i = 0; i < count; i++) {
+		struct fake_bo *bo = bos[i];
+
+		if (bo->busy_until <= now)
+			bo->read_engines = 0;
+		bo->busy_until = max_u64(bo->busy_until, end);
+		bo->read_engines |= 1 << fake_uabi_id[engine];
+		if (bo->write) {
+			bo->write_until = end;
+			bo->write_engine = fake_uabi_id[engine];
+		}
+	}
+
+out:
+	free(bos);
+	return ret;
+}
+
+static int fake_dispatch(struct fake_i915 *dev, unsigned long request,
+			 void *arg)
+{
+	if (_IOC_TYPE(request) != DRM_IOCTL_BASE)
+		return -ENOTTY;
+
+	switch (_IOC_NR(request)) {
+	case _IOC_NR(DRM_IOCTL_VERSION):
+		return fake_version(dev, arg);
+	case _IOC_NR(DRM_IOCTL_GEM_CLOSE):
+		return fake_gem_close(dev, arg);
+
+	case DRM_COMMAND_BASE + DRM_I915_GETPARAM:
+		return fake_getparam(dev, arg);
+	case DRM_COMMAND_BASE + DRM_I915_GEM_CREATE:
+		return fake_gem_create(dev, arg);
+	case DRM_COMMAND_BASE + DRM_I915_GEM_PWRITE:
+		return fake_gem_pwrite(dev, arg);
+	case DRM_COMMAND_BASE + DRM_I915_GEM_PREAD:
+		return fake_gem_pread(dev, arg);
+	case DRM_COMMAND_BASE + DRM_I915_GEM_MMAP:
+		return fake_gem_mmap(dev, arg, _IOC_SIZE(request));
+	case DRM_COMMAND_BASE + DRM_I915_GEM_MMAP_GTT:
+		return fake_gem_mmap_gtt(dev, arg);
+	case DRM_COMMAND_BASE + DRM_I915_GEM_SET_DOMAIN:
+		return fake_gem_set_domain(dev, arg);
+	case DRM_COMMAND_BASE + DRM_I915_GEM_SW_FINISH:
+	case DRM_COMMAND_BASE + DRM_I915_GEM_THROTTLE:
+		return 0;
+	case DRM_COMMAND_BASE + DRM_I915_GEM_BUSY:
+		return fake_gem_busy(dev, arg);
+	case DRM_COMMAND_BASE + DRM_I915_GEM_WAIT:
+		return fake_gem_wait(dev, arg);
+	case DRM_COMMAND_BASE + DRM_I915_GEM_SET_CACHING:
+		return fake_gem_caching(dev, arg, true);
+	case DRM_COMMAND_BASE + DRM_I915_GEM_GET_CACHING:
+		return fake_gem_caching(dev, arg, false);
+	case DRM_COMMAND_BASE + DRM_I915_GEM_SET_TILING:
+		return fake_gem_set_tiling(dev, arg);
+	case DRM_COMMAND_BASE + DRM_I915_GEM_GET_TILING:
+		return fake_gem_get_tiling(dev, arg);
+	case DRM_COMMAND_BASE + DRM_I915_GEM_MADVISE:
+		return fake_gem_madvise(dev, arg);
+	case DRM_COMMAND_BASE + DRM_I915_GEM_GET_APERTURE:
+		return fake_gem_get_aperture(dev, arg);
+	case DRM_COMMAND_BASE + DRM_I915_GEM_EXECBUFFER2:
+		return fake_execbuf(dev, arg);
+	case DRM_COMMAND_BASE + DRM_I915_GEM_CONTEXT_CREATE:
+		return fake_context_create(dev, arg);
+	case DRM_COMMAND_BASE + DRM_I915_GEM_CONTEXT_DESTROY:
+		return fake_context_destroy(dev, arg);
+	case DRM_COMMAND_BASE + DRM_I915_GEM_CONTEXT_GETPARAM:
+		return fake_context_param(dev, arg, false);
+	case DRM_COMMAND_BASE + DRM_I915_GEM_CONTEXT_SETPARAM:
+		return fake_context_param(dev, arg, true);
+	case DRM_COMMAND_BASE + DRM_I915_GEM_USERPTR:
+		return -ENODEV;
+	default:
+		return -EINVAL;
+	}
+}
+
+static int fake_ioctl(int fd, unsigned long request, void *arg)
+{
+	struct fake_i915 *dev;
+	int ret;
+
+	pthread_mutex_lock(&fake.mutex);
+	dev = fake_lookup(fd);
+	if (!dev) {
+		pthread_mutex_unlock(&fake.mutex);
+		return drmIoctl(fd, request, arg);
+	}
+
+	dev->active++;
+	ret = fake_dispatch(dev, request, arg);
+	dev->active--;
+	pthread_mutex_unlock(&fake.mutex);
+
+	if (ret) {
+		errno = -ret;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int fake_memfd(void)
+{
+	char name[] = "/tmp/igt-fake-i915.XXXXXX";
+	int fd;
+
+#ifdef __NR_memfd_create
+	fd = syscall(__NR_memfd_create, "igt-fake-i915", 0);
+	if (fd >= 0)
+		return fd;
+#endif
+
+	fd = mkostemp(name, O_CLOEXEC);
+	if (fd >= 0)
+		unlink(name);
+
+	return fd;
+}
+
+/**
+ * igt_fake_i915_enabled:
+ *
+ * Returns:
+ * True if the IGT_FAKE_I915 environment variable asks for a fake device.
+ */
+bool igt_fake_i915_enabled(void)
+{
+	return getenv("IGT_FAKE_I915") != NULL;
+}
+
+/**
+ * igt_fake_i915_open:
+ *
+ * Creates a new fake i915 device and routes #igt_ioctl through it. Every call
+ * returns a separate device, like opening a new drm file, with its own objects
+ * and contexts. It is freed once its fd has been closed, the next time a fake
+ * device is looked up or opened.
+ *
+ * The batch costs and PCI id are taken from the IGT_FAKE_I915,
+ * IGT_FAKE_I915_NS_PER_KB and IGT_FAKE_I915_DEVID environment variables on the
+ * first call.
+ *
+ * Returns:
+ * The file descriptor of the fake device or -1 on error, with errno set.
+ */
+int igt_fake_i915_open(void)
+{
+	struct fake_i915 *dev;
+	struct stat st;
+	const char *env;
+	int err;
+
+	dev = calloc(1, sizeof(*dev));
+	if (!dev)
+		return -1;
+
+	dev->max_ctx = 16;
+	dev->ctx = calloc(dev->max_ctx, sizeof(*dev->ctx));
+	if (!dev->ctx)
+		goto err_dev;
+	dev->ctx[0].used = true;
+	dev->ctx[0].param[LOCAL_I915_CONTEXT_PARAM_GTT_SIZE] = 1ull << 48;
+
+	dev->cursor = mmap(NULL, 4096, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_ANON, -1, 0);
+	if (dev->cursor == MAP_FAILED)
+		goto err_ctx;
+
+	dev->fd = fake_memfd();
+	if (dev->fd < 0)
+		goto err_cursor;
+
+	if (ftruncate(dev->fd, FAKE_SPACE) || fstat(dev->fd, &st))
+		goto err_fd;
+	dev->dev = st.st_dev;
+	dev->ino = st.st_ino;
+
+	pthread_mutex_lock(&fake.mutex);
+
+	if (!fake.gpu) {
+		fake.gpu = mmap(NULL, sizeof(*fake.gpu),
+				PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_ANON, -1, 0);
+		if (fake.gpu == MAP_FAILED) {
+			fake.gpu = NULL;
+			pthread_mutex_unlock(&fake.mutex);
+			goto err_fd;
+		}
+
+		env = getenv("IGT_FAKE_I915");
+		fake.latency = env ? strtoull(env, NULL, 0) * 1000 : 0;
+
+		env = getenv("IGT_FAKE_I915_NS_PER_KB");
+		fake.ns_per_kb = env ? strtoull(env, NULL, 0) : 0;
+
+		env = getenv("IGT_FAKE_I915_DEVID");
+		fake.devid = env ? strtoul(env, NULL, 0) : 0;
+		if (!intel_gen(fake.devid))
+			fake.devid = IGT_FAKE_I915_DEFAULT_DEVID;
+	}
+
+	fake_reap();
+	dev->next = fake.devices;
+	fake.devices = dev;
+
+	if (igt_ioctl == drmIoctl)
+		igt_ioctl = fake_ioctl;
+
+	pthread_mutex_unlock(&fake.mutex);
+
+	return dev->fd;
+
+err_fd:
+	err = errno;
+	close(dev->fd);
+	errno = err;
+err_cursor:
+	munmap(dev->cursor, 4096);
+err_ctx:
+	free(dev->ctx);
+err_dev:
+	free(dev);
+	return -1;
+}
+
+/**
+ * igt_is_fake_i915:
+ * @fd: file descriptor
+ *
+ * Returns:
+ * True if @fd was returned by igt_fake_i915_open() and is still open.
+ */
+bool igt_is_fake_i915(int fd)
+{
+	bool ret;
+
+	pthread_mutex_lock(&fake.mutex);
+	ret = fake_lookup(fd) != NULL;
+	pthread_mutex_unlock(&fake.mutex);
+
+	return ret;
+}
@@ -61,7 +61,7 @@ static bool has_gpu_reset(int fd)
 		gp.param = 35; /* HAS_GPU_RESET */
 		gp.value = &val;
 
-		if (ioctl(fd, DRM_IOCTL_I915_GETPARAM, &gp))
+		if (igt_ioctl(fd, DRM_IOCTL_I915_GETPARAM, &gp))
 			once = intel_gen(intel_get_drm_devid(fd)) >= 5;
 		else
 			once = val > 0;
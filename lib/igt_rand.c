@@ -11,9 +11,15 @@ hars_petruska_f54_1_random_seed(uint32_t new_state)
 }
 
 uint32_t
-hars_petruska_f54_1_random_unsafe(void)
+hars_petruska_f54_1_random(uint32_t *s)
 {
 #define rol(x,k) ((x << k) | (x >> (32-k)))
-	return state = (state ^ rol (state, 5) ^ rol (state, 24)) + 0x37798849;
+	return *s = (*s ^ rol (*s, 5) ^ rol (*s, 24)) + 0x37798849;
 #undef rol
 }
+
+uint32_t
+hars_petruska_f54_1_random_unsafe(void)
+{
+	return hars_petruska_f54_1_random(&state);
+}
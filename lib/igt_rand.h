@@ -28,6 +28,7 @@
 
 uint32_t hars_petruska_f54_1_random_seed(uint32_t seed);
 uint32_t hars_petruska_f54_1_random_unsafe(void);
+uint32_t hars_petruska_f54_1_random(uint32_t *state);
 
 static inline void hars_petruska_f54_1_random_perturb(uint32_t xor)
 {
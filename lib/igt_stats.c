@@ -31,7 +31,16 @@
 
 #define U64_MAX         ((uint64_t)~0ULL)
 
-#define sorted_value(stats, i) (stats->is_float ? stats->sorted_f[i] : stats->sorted_u64[i])
+/*
+ * The sketch buckets cover [2^(SKETCH_EXP_MIN - 1), 2^SKETCH_EXP_MAX), each
+ * power of two being split into 2^precision linear sub-buckets. Bucket 0
+ * collects everything below that range (including zero and negative values).
+ */
+#define SKETCH_EXP_MIN	(-31)
+#define SKETCH_EXP_MAX	64
+#define SKETCH_N_EXP	(SKETCH_EXP_MAX - SKETCH_EXP_MIN + 1)
+#define sketch_n_buckets(stats) (1 + (SKETCH_N_EXP << stats->sketch_precision))
+
 #define unsorted_value(stats, i) (stats->is_float ? stats->values_f[i] : stats->values_u64[i])
 
 /**
@@ -64,6 +73,13 @@
  *
  *	igt_stats_fini(&stats);
  * ]|
+ *
+ * Storing every sample is not an option for long running measurements. An
+ * #igt_stats_t initialized with igt_stats_init_sketch() instead accumulates
+ * the samples into a fixed size log-linear histogram: memory use is constant
+ * and pushing a value is O(1). The mean and variance are still computed
+ * exactly, the median, quartiles, interquartile mean and trimean become
+ * approximations whose relative error is bounded by the sketch precision.
  */
 
 static unsigned int get_new_capacity(int need)
@@ -83,7 +99,7 @@ static void igt_stats_ensure_capacity(igt_stats_t *stats,
 	unsigned int new_n_values = stats->n_values + n_additional_values;
 	unsigned int new_capacity;
 
-	if (new_n_values <= stats->capacity)
+	if (stats->is_sketch || new_n_values <= stats->capacity)
 		return;
 
 	new_capacity = get_new_capacity(new_n_values);
@@ -92,9 +108,6 @@ static void igt_stats_ensure_capacity(igt_stats_t *stats,
 	igt_assert(stats->values_u64);
 
 	stats->capacity = new_capacity;
-
-	free(stats->sorted_u64);
-	stats->sorted_u64 = NULL;
 }
 
 /**
@@ -137,6 +150,48 @@ void igt_stats_init_with_size(igt_stats_t *stats, unsigned int capacity)
 	stats->range[1] = -HUGE_VAL;
 }
 
+/**
+ * igt_stats_init_sketch:
+ * @stats: An #igt_stats_t instance
+ * @precision: Number of significant bits kept for each value, at most
+ *	       #IGT_STATS_SKETCH_MAX_PRECISION
+ *
+ * Like igt_stats_init() but without storing the individual data samples.
+ * Values are instead counted in a histogram of 2^@precision linear buckets
+ * per power of two, allocated once here (768 bytes per unit of
+ * 2^@precision), so that @stats can absorb any number of samples: the count
+ * of values and the bucket counts are 64 bit.
+ *
+ * The rank of each value is kept exactly, only its magnitude is quantized:
+ * the median, quartiles, interquartile mean and trimean are within a relative
+ * error of 2^-(@precision + 1) of the exact result for values between 2^-32
+ * and 2^64. Smaller values, including zero and negative ones, are all
+ * reported as the smallest pushed value. The minimum, maximum, mean and
+ * variance are exact. #IGT_STATS_SKETCH_DEFAULT_PRECISION gives an error
+ * bound of 0.4%.
+ *
+ * #igt_stats_t.values_u64 and #igt_stats_t.values_f are not available in this
+ * mode.
+ *
+ * igt_stats_fini() must be called once finished with @stats.
+ */
+void igt_stats_init_sketch(igt_stats_t *stats, unsigned int precision)
+{
+	igt_assert(precision <= IGT_STATS_SKETCH_MAX_PRECISION);
+
+	memset(stats, 0, sizeof(*stats));
+
+	stats->is_sketch = true;
+	stats->sketch_precision = precision;
+	stats->sketch = calloc(sketch_n_buckets(stats), sizeof(*stats->sketch));
+	igt_assert(stats->sketch);
+
+	stats->min = U64_MAX;
+	stats->max = 0;
+	stats->range[0] = HUGE_VAL;
+	stats->range[1] = -HUGE_VAL;
+}
+
 /**
  * igt_stats_fini:
  * @stats: An #igt_stats_t instance
@@ -146,9 +201,144 @@ void igt_stats_init_with_size(igt_stats_t *stats, unsigned int capacity)
 void igt_stats_fini(igt_stats_t *stats)
 {
 	free(stats->values_u64);
-	free(stats->sorted_u64);
+	free(stats->sketch);
 }
 
+/**
+ * igt_stats_is_sketch:
+ * @stats: An #igt_stats_t instance
+ *
+ * Returns: #true if @stats was initialized with igt_stats_init_sketch() and
+ * only returns approximate quantiles.
+ */
+bool igt_stats_is_sketch(igt_stats_t *stats)
+{
+	return stats->is_sketch;
+}
+
+static unsigned int sketch_index(igt_stats_t *stats, double value)
+{
+	unsigned int sub, n_sub = 1u << stats->sketch_precision;
+	double mantissa;
+	int exp;
+
+	if (!(value > 0))
+		return 0;
+
+	mantissa = frexp(value, &exp);
+	if (exp < SKETCH_EXP_MIN)
+		return 0;
+	if (exp > SKETCH_EXP_MAX)
+		return sketch_n_buckets(stats) - 1;
+
+	/* mantissa is in [0.5, 1) */
+	sub = (2 * mantissa - 1) * n_sub;
+	if (sub >= n_sub)
+		sub = n_sub - 1;
+
+	return 1 + (exp - SKETCH_EXP_MIN) * n_sub + sub;
+}
+
+/* Representative value of a bucket: its midpoint, clamped to the seen range */
+static double sketch_bucket_value(igt_stats_t *stats, unsigned int idx)
+{
+	unsigned int n_sub = 1u << stats->sketch_precision;
+	double value;
+	int exp;
+
+	if (idx == 0)
+		return stats->range[0];
+
+	idx--;
+	exp = SKETCH_EXP_MIN + idx / n_sub;
+	value = ldexp(.5 + (idx % n_sub + .5) / (2 * n_sub), exp);
+
+	if (value < stats->range[0])
+		value = stats->range[0];
+	if (value > stats->range[1])
+		value = stats->range[1];
+
+	return value;
+}
+
+/*
+ * Combines the mean and sum of squared differences of two sets of values, as
+ * described by Chan et al. in:
+ *
+ * Updating Formulae and a Pairwise Algorithm for Computing Sample Variances,
+ * Technical Report STAN-CS-79-773, Stanford University, 1979.
+ *
+ * Source: https://en.wikipedia.org/wiki/Algorithms_for_calculating_variance
+ */
+static void chan_merge(double *mean, double *m2, double n,
+		       double other_mean, double other_m2, double other_n)
+{
+	double delta = other_mean - *mean;
+
+	if (!other_n)
+		return;
+
+	*mean += delta * other_n / (n + other_n);
+	*m2 += other_m2 + delta * delta * n * other_n / (n + other_n);
+}
+
+static void igt_stats_sketch_push(igt_stats_t *stats, double value)
+{
+	double delta;
+
+	stats->sketch[sketch_index(stats, value)]++;
+	stats->n_values++;
+
+	/* see igt_stats_knuth_mean_variance() */
+	delta = value - stats->mean;
+	stats->mean += delta / stats->n_values;
+	stats->sketch_m2 += delta * (value - stats->mean);
+	stats->mean_variance_valid = false;
+
+	if (value < stats->range[0])
+		stats->range[0] = value;
+	if (value > stats->range[1])
+		stats->range[1] = value;
+}
+
+/* Approximate value of the idx-th (0-based) smallest sample */
+static double igt_stats_sketch_value(igt_stats_t *stats, uint64_t idx)
+{
+	unsigned int i, n = sketch_n_buckets(stats);
+	uint64_t count = 0;
+
+	for (i = 0; i < n; i++) {
+		count += stats->sketch[i];
+		if (count > idx)
+			return sketch_bucket_value(stats, i);
+	}
+
+	return stats->range[1];
+}
+
+/* Approximate sum of the samples ranked first to last (inclusive) */
+static double igt_stats_sketch_sum(igt_stats_t *stats,
+				   uint64_t first, uint64_t last)
+{
+	unsigned int i, n = sketch_n_buckets(stats);
+	uint64_t start = 0;
+	double sum = 0.;
+
+	for (i = 0; i < n && start <= last; i++) {
+		uint64_t end = start + stats->sketch[i];
+		uint64_t lo = start > first ? start : first;
+		uint64_t hi = end < last + 1 ? end : last + 1;
+
+		if (hi > lo)
+			sum += (hi - lo) * sketch_bucket_value(stats, i);
+
+		start = end;
+	}
+
+	return sum;
+}
+
+
 
 /**
  * igt_stats_is_population:
@@ -212,13 +402,18 @@ void igt_stats_push(igt_stats_t *stats, uint64_t value)
 		return;
 	}
 
+	if (stats->is_sketch) {
+		igt_stats_sketch_push(stats, value);
+		goto out;
+	}
+
 	igt_stats_ensure_capacity(stats, 1);
 
 	stats->values_u64[stats->n_values++] = value;
 
 	stats->mean_variance_valid = false;
-	stats->sorted_array_valid = false;
 
+out:
 	if (value < stats->min)
 		stats->min = value;
 	if (value > stats->max)
@@ -235,6 +430,12 @@ void igt_stats_push(igt_stats_t *stats, uint64_t value)
  */
 void igt_stats_push_float(igt_stats_t *stats, double value)
 {
+	if (stats->is_sketch) {
+		stats->is_float = true;
+		igt_stats_sketch_push(stats, value);
+		return;
+	}
+
 	igt_stats_ensure_capacity(stats, 1);
 
 	if (!stats->is_float) {
@@ -249,7 +450,6 @@ void igt_stats_push_float(igt_stats_t *stats, double value)
 	stats->values_f[stats->n_values++] = value;
 
 	stats->mean_variance_valid = false;
-	stats->sorted_array_valid = false;
 
 	if (value < stats->range[0])
 		stats->range[0] = value;
@@ -276,6 +476,59 @@ void igt_stats_push_array(igt_stats_t *stats,
 		igt_stats_push(stats, values[i]);
 }
 
+/**
+ * igt_stats_merge:
+ * @stats: An #igt_stats_t instance
+ * @other: An #igt_stats_t instance to merge into @stats
+ *
+ * Adds all the values of the @other dataset to the @stats dataset, as if they
+ * had been pushed into @stats. This allows, for instance, each thread to
+ * collect values into its own #igt_stats_t without any locking, and combine
+ * them for the final results.
+ *
+ * An approximate @other, see igt_stats_init_sketch(), can only be merged into
+ * an approximate @stats of the same precision. In that case the result is
+ * the same as if all the values had been pushed into a single sketch. @other
+ * is left untouched.
+ */
+void igt_stats_merge(igt_stats_t *stats, igt_stats_t *other)
+{
+	unsigned int i;
+
+	if (other->is_sketch) {
+		igt_assert(stats->is_sketch);
+		igt_assert_eq(stats->sketch_precision, other->sketch_precision);
+
+		for (i = 0; i < sketch_n_buckets(stats); i++)
+			stats->sketch[i] += other->sketch[i];
+
+		chan_merge(&stats->mean, &stats->sketch_m2, stats->n_values,
+			   other->mean, other->sketch_m2, other->n_values);
+		stats->n_values += other->n_values;
+		stats->mean_variance_valid = false;
+
+		stats->is_float |= other->is_float;
+		if (other->min < stats->min)
+			stats->min = other->min;
+		if (other->max > stats->max)
+			stats->max = other->max;
+		if (other->range[0] < stats->range[0])
+			stats->range[0] = other->range[0];
+		if (other->range[1] > stats->range[1])
+			stats->range[1] = other->range[1];
+		return;
+	}
+
+	igt_stats_ensure_capacity(stats, other->n_values);
+
+	for (i = 0; i < other->n_values; i++) {
+		if (other->is_float)
+			igt_stats_push_float(stats, other->values_f[i]);
+		else
+			igt_stats_push(stats, other->values_u64[i]);
+	}
+}
+
 /**
  * igt_stats_get_min:
  * @stats: An #igt_stats_t instance
@@ -338,30 +591,96 @@ static int cmp_f(const void *pa, const void *pb)
 	return 0;
 }
 
-static void igt_stats_ensure_sorted_values(igt_stats_t *stats)
-{
-	if (stats->sorted_array_valid)
-		return;
+/*
+ * Hoare's FIND with a median-of-three pivot, operating on the values array
+ * itself. Only a permutation of the pushed values is performed, no copy is
+ * made. Should the partitioning degenerate, we stop after 2 * log2(n)
+ * rounds and fall back to sorting what is left of the range (introselect).
+ *
+ * On return, a[k] is the value of rank k in [lo, hi] (hi inclusive), with
+ * a[lo..k-1] <= a[k] <= a[k+1..hi]. Already sorted data isn't reordered.
+ */
+#define DEFINE_SELECT(name, type, cmp)					\
+static void name(type *a, long lo, long hi, long k)			\
+{									\
+	unsigned int depth = 2;						\
+	long n;								\
+									\
+	for (n = hi - lo + 1; n > 1; n >>= 1)				\
+		depth += 2;						\
+									\
+	while (hi > lo) {						\
+		long i = lo, j = hi, mid = lo + (hi - lo) / 2;		\
+		type pivot, tmp;					\
+									\
+		if (!depth--) {						\
+			qsort(a + lo, hi - lo + 1, sizeof(*a), cmp);	\
+			return;						\
+		}							\
+									\
+		if (a[mid] < a[lo])					\
+			tmp = a[mid], a[mid] = a[lo], a[lo] = tmp;	\
+		if (a[hi] < a[mid]) {					\
+			tmp = a[mid], a[mid] = a[hi], a[hi] = tmp;	\
+			if (a[mid] < a[lo])				\
+				tmp = a[mid], a[mid] = a[lo], a[lo] = tmp; \
+		}							\
+		pivot = a[mid];						\
+									\
+		do {							\
+			while (a[i] < pivot)				\
+				i++;					\
+			while (pivot < a[j])				\
+				j--;					\
+			if (i <= j) {					\
+				tmp = a[i], a[i] = a[j], a[j] = tmp;	\
+				i++;					\
+				j--;					\
+			}						\
+		} while (i <= j);					\
+									\
+		if (k <= j)						\
+			hi = j;						\
+		else if (k >= i)					\
+			lo = i;						\
+		else							\
+			return;						\
+	}								\
+}
 
-	if (!stats->sorted_u64) {
-		/*
-		 * igt_stats_ensure_capacity() will free ->sorted when the
-		 * capacity increases, which also correspond to an invalidation
-		 * of the sorted array. We'll then reallocate it here on
-		 * demand.
-		 */
-		stats->sorted_u64 = calloc(stats->capacity,
-					   sizeof(*stats->values_u64));
-		igt_assert(stats->sorted_u64);
+DEFINE_SELECT(select_u64, uint64_t, cmp_u64)
+DEFINE_SELECT(select_f, double, cmp_f)
+
+/* Moves the value of rank k in [start, end) to index k and returns it */
+static double igt_stats_select(igt_stats_t *stats,
+			       unsigned int start, unsigned int end,
+			       unsigned int k)
+{
+	if (stats->is_float) {
+		select_f(stats->values_f, start, end - 1, k);
+		return stats->values_f[k];
+	} else {
+		select_u64(stats->values_u64, start, end - 1, k);
+		return stats->values_u64[k];
 	}
+}
+
+static double sorted_value(igt_stats_t *stats, uint64_t i)
+{
+	if (stats->is_sketch)
+		return igt_stats_sketch_value(stats, i);
 
-	memcpy(stats->sorted_u64, stats->values_u64,
-	       sizeof(*stats->values_u64) * stats->n_values);
+	return igt_stats_select(stats, 0, stats->n_values, i);
+}
 
-	qsort(stats->sorted_u64, stats->n_values, sizeof(*stats->values_u64),
-	      stats->is_float ? cmp_f : cmp_u64);
+/* Value of rank i + 1, right after sorted_value(stats, i) */
+static double next_sorted_value(igt_stats_t *stats, uint64_t i)
+{
+	if (stats->is_sketch)
+		return igt_stats_sketch_value(stats, i + 1);
 
-	stats->sorted_array_valid = true;
+	/* the smallest of the values above rank i */
+	return igt_stats_select(stats, i + 1, stats->n_values, i + 1);
 }
 
 /*
@@ -370,15 +689,13 @@ static void igt_stats_ensure_sorted_values(igt_stats_t *stats)
  */
 static double
 igt_stats_get_median_internal(igt_stats_t *stats,
-			      unsigned int start, unsigned int end,
-			      unsigned int *lower_end /* out */,
-			      unsigned int *upper_start /* out */)
+			      uint64_t start, uint64_t end,
+			      uint64_t *lower_end /* out */,
+			      uint64_t *upper_start /* out */)
 {
-	unsigned int mid, n_values = end - start;
+	uint64_t mid, n_values = end - start;
 	double median;
 
-	igt_stats_ensure_sorted_values(stats);
-
 	/* odd number of data points */
 	if (n_values % 2 == 1) {
 		/* median is the value in the middle (actual datum) */
@@ -399,7 +716,8 @@ igt_stats_get_median_internal(igt_stats_t *stats,
 		 * values.
 		 */
 		mid = start + n_values / 2 - 1;
-		median = (sorted_value(stats, mid) + sorted_value(stats, mid+1))/2.;
+		median = sorted_value(stats, mid);
+		median = (median + next_sorted_value(stats, mid))/2.;
 
 		if (lower_end)
 			*lower_end = mid + 1;
@@ -423,7 +741,7 @@ igt_stats_get_median_internal(igt_stats_t *stats,
 void igt_stats_get_quartiles(igt_stats_t *stats,
 			     double *q1, double *q2, double *q3)
 {
-	unsigned int lower_end, upper_start;
+	uint64_t lower_end, upper_start;
 	double ret;
 
 	if (stats->n_values < 3) {
@@ -475,10 +793,50 @@ double igt_stats_get_iqr(igt_stats_t *stats)
  */
 double igt_stats_get_median(igt_stats_t *stats)
 {
+	if (!stats->n_values)
+		return 0.;
+
 	return igt_stats_get_median_internal(stats, 0, stats->n_values,
 					     NULL, NULL);
 }
 
+/**
+ * igt_stats_get_percentile:
+ * @stats: An #igt_stats_t instance
+ * @percentile: The percentile to retrieve, between 0 and 100
+ *
+ * Retrieves the value below which @percentile percent of the @stats dataset
+ * falls, e.g. 50 for the median, 99 or 99.9 for tail latencies. Values in
+ * between two data points are linearly interpolated.
+ *
+ * The exact percentile is found by partially reordering the values pushed
+ * into @stats, in linear time on average. See igt_stats_init_sketch() for the
+ * accuracy of an approximate @stats.
+ */
+double igt_stats_get_percentile(igt_stats_t *stats, double percentile)
+{
+	uint64_t lower;
+	double rank, lo, hi;
+
+	igt_assert(percentile >= 0. && percentile <= 100.);
+
+	if (!stats->n_values)
+		return 0.;
+
+	rank = (stats->n_values - 1) * percentile / 100.;
+	lower = rank;
+	if (lower >= stats->n_values - 1)
+		return sorted_value(stats, stats->n_values - 1);
+
+	lo = sorted_value(stats, lower);
+	if (rank == lower)
+		return lo;
+
+	hi = next_sorted_value(stats, lower);
+
+	return lo + (rank - lower) * (hi - lo);
+}
+
 /*
  * Algorithm popularised by Knuth in:
  *
@@ -495,6 +853,13 @@ static void igt_stats_knuth_mean_variance(igt_stats_t *stats)
 	if (stats->mean_variance_valid)
 		return;
 
+	if (stats->is_sketch) {
+		/* mean and m2 are accumulated as values are pushed */
+		mean = stats->mean;
+		m2 = stats->sketch_m2;
+		goto out;
+	}
+
 	for (i = 0; i < stats->n_values; i++) {
 		double delta = unsorted_value(stats, i) - mean;
 
@@ -502,6 +867,7 @@ static void igt_stats_knuth_mean_variance(igt_stats_t *stats)
 		m2 += delta * (unsorted_value(stats, i) - mean);
 	}
 
+out:
 	stats->mean = mean;
 	if (stats->n_values > 1 && !stats->is_population)
 		stats->variance = m2 / (stats->n_values - 1);
@@ -565,23 +931,41 @@ double igt_stats_get_std_deviation(igt_stats_t *stats)
  */
 double igt_stats_get_iqm(igt_stats_t *stats)
 {
-	unsigned int q1, q3, i;
+	uint64_t q1, q3, i;
 	double mean;
 
-	igt_stats_ensure_sorted_values(stats);
+	if (!stats->n_values)
+		return 0.;
+	if (stats->n_values == 1)
+		return sorted_value(stats, 0);
 
 	q1 = (stats->n_values + 3) / 4;
 	q3 = 3 * stats->n_values / 4;
 
-	mean = 0;
-	for (i = 0; i <= q3 - q1; i++)
-		mean += (sorted_value(stats, q1 + i) - mean) / (i + 1);
+	if (stats->is_sketch) {
+		i = q3 - q1 + 1;
+		mean = igt_stats_sketch_sum(stats, q1, q3) / i;
+	} else {
+		/*
+		 * Partition the values around q1 and q3, [q1, q3] then holds
+		 * the central values, in no particular order.
+		 */
+		igt_stats_select(stats, 0, stats->n_values, q1);
+		if (q3 > q1)
+			igt_stats_select(stats, q1 + 1, stats->n_values, q3);
+
+		mean = 0;
+		for (i = 0; i <= q3 - q1; i++)
+			mean += (unsorted_value(stats, q1 + i) - mean) / (i + 1);
+	}
 
 	if (stats->n_values % 4) {
 		double rem = .5 * (stats->n_values % 4) / 4;
 
 		q1 = (stats->n_values) / 4;
 		q3 = (3 * stats->n_values + 3) / 4;
+		if (q3 >= stats->n_values)
+			q3 = stats->n_values - 1;
 
 		mean += rem * (sorted_value(stats, q1) - mean) / i++;
 		mean += rem * (sorted_value(stats, q3) - mean) / i++;
@@ -660,3 +1044,23 @@ double igt_mean_get_variance(struct igt_mean *m)
 	return m->sq / m->count;
 }
 
+/**
+ * igt_mean_merge:
+ * @m: tracking structure
+ * @other: tracking structure to merge into @m
+ *
+ * Adds the samples tracked in @other to @m. The resulting mean and variance
+ * are those that would have been computed had all the values been added to
+ * @m directly.
+ */
+void igt_mean_merge(struct igt_mean *m, const struct igt_mean *other)
+{
+	chan_merge(&m->mean, &m->sq, m->count,
+		   other->mean, other->sq, other->count);
+	m->count += other->count;
+	if (other->min < m->min)
+		m->min = other->min;
+	if (other->max > m->max)
+		m->max = other->max;
+}
+
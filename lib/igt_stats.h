@@ -35,9 +35,12 @@
  * @is_float: Whether @values_f or @values_u64 is valid
  * @values_f: An array containing pushed float values
  * @n_values: The number of pushed values
+ *
+ * Retrieving a median, quartile or percentile reorders @values_u64 and
+ * @values_f in place, the order in which values were pushed is not preserved.
  */
 typedef struct {
-	unsigned int n_values;
+	uint64_t n_values;
 	unsigned int is_float : 1;
 	union {
 		uint64_t *values_u64;
@@ -48,20 +51,24 @@ typedef struct {
 	unsigned int capacity;
 	unsigned int is_population  : 1;
 	unsigned int mean_variance_valid : 1;
-	unsigned int sorted_array_valid : 1;
+	unsigned int is_sketch : 1;
 
 	uint64_t min, max;
 	double range[2];
 	double mean, variance;
 
-	union {
-		uint64_t *sorted_u64;
-		double *sorted_f;
-	};
+	unsigned int sketch_precision;
+	uint64_t *sketch;
+	double sketch_m2;
 } igt_stats_t;
 
+#define IGT_STATS_SKETCH_DEFAULT_PRECISION 7
+#define IGT_STATS_SKETCH_MAX_PRECISION 12
+
 void igt_stats_init(igt_stats_t *stats);
 void igt_stats_init_with_size(igt_stats_t *stats, unsigned int capacity);
+void igt_stats_init_sketch(igt_stats_t *stats, unsigned int precision);
+bool igt_stats_is_sketch(igt_stats_t *stats);
 void igt_stats_fini(igt_stats_t *stats);
 bool igt_stats_is_population(igt_stats_t *stats);
 void igt_stats_set_population(igt_stats_t *stats, bool full_population);
@@ -69,6 +76,7 @@ void igt_stats_push(igt_stats_t *stats, uint64_t value);
 void igt_stats_push_float(igt_stats_t *stats, double value);
 void igt_stats_push_array(igt_stats_t *stats,
 			  const uint64_t *values, unsigned int n_values);
+void igt_stats_merge(igt_stats_t *stats, igt_stats_t *other);
 uint64_t igt_stats_get_min(igt_stats_t *stats);
 uint64_t igt_stats_get_max(igt_stats_t *stats);
 uint64_t igt_stats_get_range(igt_stats_t *stats);
@@ -79,6 +87,7 @@ double igt_stats_get_iqm(igt_stats_t *stats);
 double igt_stats_get_mean(igt_stats_t *stats);
 double igt_stats_get_trimean(igt_stats_t *stats);
 double igt_stats_get_median(igt_stats_t *stats);
+double igt_stats_get_percentile(igt_stats_t *stats, double percentile);
 double igt_stats_get_variance(igt_stats_t *stats);
 double igt_stats_get_std_deviation(igt_stats_t *stats);
 
@@ -99,5 +108,6 @@ void igt_mean_init(struct igt_mean *m);
 void igt_mean_add(struct igt_mean *m, double v);
 double igt_mean_get(struct igt_mean *m);
 double igt_mean_get_variance(struct igt_mean *m);
+void igt_mean_merge(struct igt_mean *m, const struct igt_mean *other);
 
 #endif /* __IGT_STATS_H__ */
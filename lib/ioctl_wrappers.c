@@ -110,7 +110,7 @@ gem_handle_to_libdrm_bo(drm_intel_bufmgr *bufmgr, int fd, const char *name, uint
 
 	memset(&flink, 0, sizeof(handle));
 	flink.handle = handle;
-	ret = ioctl(fd, DRM_IOCTL_GEM_FLINK, &flink);
+	ret = igt_ioctl(fd, DRM_IOCTL_GEM_FLINK, &flink);
 	igt_assert(ret == 0);
 	errno = 0;
 
@@ -175,7 +175,7 @@ int __gem_set_tiling(int fd, uint32_t handle, uint32_t tiling, uint32_t stride)
 		st.tiling_mode = tiling;
 		st.stride = tiling ? stride : 0;
 
-		ret = ioctl(fd, DRM_IOCTL_I915_GEM_SET_TILING, &st);
+		ret = igt_ioctl(fd, DRM_IOCTL_I915_GEM_SET_TILING, &st);
 	} while (ret == -1 && (errno == EINTR || errno == EAGAIN));
 	if (ret != 0)
 		return -errno;
@@ -261,7 +261,7 @@ uint32_t gem_get_caching(int fd, uint32_t handle)
 
 	memset(&arg, 0, sizeof(arg));
 	arg.handle = handle;
-	ret = ioctl(fd, LOCAL_DRM_IOCTL_I915_GEM_GET_CACHEING, &arg);
+	ret = igt_ioctl(fd, LOCAL_DRM_IOCTL_I915_GEM_GET_CACHEING, &arg);
 	igt_assert(ret == 0);
 	errno = 0;
 
@@ -284,7 +284,7 @@ uint32_t gem_open(int fd, uint32_t name)
 
 	memset(&open_struct, 0, sizeof(open_struct));
 	open_struct.name = name;
-	ret = ioctl(fd, DRM_IOCTL_GEM_OPEN, &open_struct);
+	ret = igt_ioctl(fd, DRM_IOCTL_GEM_OPEN, &open_struct);
 	igt_assert(ret == 0);
 	igt_assert(open_struct.handle != 0);
 	errno = 0;
@@ -310,7 +310,7 @@ uint32_t gem_flink(int fd, uint32_t handle)
 
 	memset(&flink, 0, sizeof(flink));
 	flink.handle = handle;
-	ret = ioctl(fd, DRM_IOCTL_GEM_FLINK, &flink);
+	ret = igt_ioctl(fd, DRM_IOCTL_GEM_FLINK, &flink);
 	igt_assert(ret == 0);
 	errno = 0;
 
@@ -348,7 +348,7 @@ int __gem_write(int fd, uint32_t handle, uint64_t offset, const void *buf, uint6
 	gem_pwrite.data_ptr = to_user_pointer(buf);
 
 	err = 0;
-	if (drmIoctl(fd, DRM_IOCTL_I915_GEM_PWRITE, &gem_pwrite))
+	if (igt_ioctl(fd, DRM_IOCTL_I915_GEM_PWRITE, &gem_pwrite))
 		err = -errno;
 	return err;
 }
@@ -381,7 +381,7 @@ static int __gem_read(int fd, uint32_t handle, uint64_t offset, void *buf, uint6
 	gem_pread.data_ptr = to_user_pointer(buf);
 
 	err = 0;
-	if (drmIoctl(fd, DRM_IOCTL_I915_GEM_PREAD, &gem_pread))
+	if (igt_ioctl(fd, DRM_IOCTL_I915_GEM_PREAD, &gem_pread))
 		err = -errno;
 	return err;
 }
@@ -494,7 +494,7 @@ bool gem_create__has_stolen_support(int fd)
 		gp.value = &val;
 
 		/* Do we have the extended gem_create_ioctl? */
-		ioctl(fd, DRM_IOCTL_I915_GETPARAM, &gp);
+		igt_ioctl(fd, DRM_IOCTL_I915_GETPARAM, &gp);
 		has_stolen_support = val >= 2;
 	}
 
@@ -710,12 +710,12 @@ bool gem_mmap__has_wc(int fd)
 		memset(&gp, 0, sizeof(gp));
 		gp.param = 40; /* MMAP_GTT_VERSION */
 		gp.value = &gtt_version;
-		ioctl(fd, DRM_IOCTL_I915_GETPARAM, &gp);
+		igt_ioctl(fd, DRM_IOCTL_I915_GETPARAM, &gp);
 
 		memset(&gp, 0, sizeof(gp));
 		gp.param = 30; /* MMAP_VERSION */
 		gp.value = &mmap_version;
-		ioctl(fd, DRM_IOCTL_I915_GETPARAM, &gp);
+		igt_ioctl(fd, DRM_IOCTL_I915_GETPARAM, &gp);
 
 		/* Do we have the new mmap_ioctl with DOMAIN_WC? */
 		if (mmap_version >= 1 && gtt_version >= 2) {
@@ -1129,7 +1129,7 @@ int gem_gtt_type(int fd)
 	gp.param = 18; /* HAS_ALIASING_PPGTT */
 	gp.value = &val;
 
-	if (ioctl(fd, DRM_IOCTL_I915_GETPARAM, &gp, sizeof(gp)))
+	if (igt_ioctl(fd, DRM_IOCTL_I915_GETPARAM, &gp))
 		return 0;
 
 	errno = 0;
@@ -1186,7 +1186,7 @@ int gem_available_fences(int fd)
 		gp.value = &num_fences;
 
 		num_fences = 0;
-		ioctl(fd, DRM_IOCTL_I915_GETPARAM, &gp, sizeof(gp));
+		igt_ioctl(fd, DRM_IOCTL_I915_GETPARAM, &gp);
 		errno = 0;
 	}
 
@@ -1205,7 +1205,7 @@ bool gem_has_llc(int fd)
 		gp.value = &has_llc;
 
 		has_llc = 0;
-		ioctl(fd, DRM_IOCTL_I915_GETPARAM, &gp, sizeof(gp));
+		igt_ioctl(fd, DRM_IOCTL_I915_GETPARAM, &gp);
 		errno = 0;
 	}
 
@@ -1385,7 +1385,7 @@ uint64_t gem_aperture_size(int fd)
 
 		memset(&p, 0, sizeof(p));
 		p.param = 0x3;
-		if (ioctl(fd, LOCAL_IOCTL_I915_GEM_CONTEXT_GETPARAM, &p) == 0) {
+		if (igt_ioctl(fd, LOCAL_IOCTL_I915_GEM_CONTEXT_GETPARAM, &p) == 0) {
 			aperture_size = p.value;
 		} else {
 			struct drm_i915_gem_get_aperture aperture;
@@ -1464,7 +1464,7 @@ bool gem_has_softpin(int fd)
 		gp.value = &has_softpin;
 
 		has_softpin = 0;
-		ioctl(fd, DRM_IOCTL_I915_GETPARAM, &gp, sizeof(gp));
+		igt_ioctl(fd, DRM_IOCTL_I915_GETPARAM, &gp);
 		errno = 0;
 	}
 
@@ -1493,7 +1493,7 @@ bool gem_has_exec_fence(int fd)
 		gp.value = &has_exec_fence;
 
 		has_exec_fence = 0;
-		ioctl(fd, DRM_IOCTL_I915_GETPARAM, &gp, sizeof(gp));
+		igt_ioctl(fd, DRM_IOCTL_I915_GETPARAM, &gp);
 		errno = 0;
 	}
 
@@ -1525,7 +1525,7 @@ void igt_require_gem(int fd)
 	igt_require_intel(fd);
 
 	err = 0;
-	if (ioctl(fd, DRM_IOCTL_I915_GEM_THROTTLE))
+	if (igt_ioctl(fd, DRM_IOCTL_I915_GEM_THROTTLE, NULL))
 		err = -errno;
 
 	igt_require_f(err == 0, "Unresponsive i915/GEM device\n");
@@ -0,0 +1,322 @@
+/*
+ * Copyright © 2017 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "igt.h"
+#include "igt_fake_i915.h"
+
+#define LATENCY_US 20000
+
+static uint64_t elapsed_ns(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000000000ull +
+		now.tv_nsec - start->tv_nsec;
+}
+
+static uint32_t submit(int fd, uint32_t ctx, uint32_t target, unsigned ring)
+{
+	struct drm_i915_gem_exec_object2 obj[2];
+	struct drm_i915_gem_relocation_entry reloc;
+	struct drm_i915_gem_execbuffer2 eb;
+	uint32_t bbe = MI_BATCH_BUFFER_END;
+
+	memset(obj, 0, sizeof(obj));
+	obj[0].handle = target;
+	obj[1].handle = gem_create(fd, 4096);
+	gem_write(fd, obj[1].handle, 0, &bbe, sizeof(bbe));
+
+	memset(&reloc, 0, sizeof(reloc));
+	reloc.target_handle = target;
+	reloc.offset = 64;
+	reloc.delta = 0x40;
+	reloc.presumed_offset = -1;
+	reloc.read_domains = I915_GEM_DOMAIN_INSTRUCTION;
+	reloc.write_domain = I915_GEM_DOMAIN_INSTRUCTION;
+	obj[1].relocs_ptr = to_user_pointer(&reloc);
+	obj[1].relocation_count = 1;
+
+	memset(&eb, 0, sizeof(eb));
+	eb.buffers_ptr = to_user_pointer(obj);
+	eb.buffer_count = 2;
+	eb.flags = ring;
+	i915_execbuffer2_set_context_id(eb, ctx);
+	gem_execbuf(fd, &eb);
+
+	igt_assert_eq_u64(reloc.presumed_offset, obj[0].offset);
+	igt_assert_eq_u64(obj[1].offset & 4095, 0);
+
+	return obj[1].handle;
+}
+
+static void test_objects(int fd)
+{
+	uint32_t handle, data[1024], *gtt, *cpu;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(data); i++)
+		data[i] = i;
+
+	handle = gem_create(fd, sizeof(data));
+	gem_write(fd, handle, 0, data, sizeof(data));
+
+	gtt = gem_mmap__gtt(fd, handle, sizeof(data), PROT_READ | PROT_WRITE);
+	cpu = gem_mmap__cpu(fd, handle, 0, sizeof(data), PROT_READ);
+	for (i = 0; i < ARRAY_SIZE(data); i++)
+		igt_assert_eq_u32(gtt[i], i);
+
+	gtt[10] = 0xdeadbeef;
+	igt_assert_eq_u32(cpu[10], 0xdeadbeef);
+
+	memset(data, 0, sizeof(data));
+	gem_read(fd, handle, 0, data, sizeof(data));
+	igt_assert_eq_u32(data[10], 0xdeadbeef);
+	igt_assert_eq_u32(data[11], 11);
+
+	munmap(cpu, sizeof(data));
+	munmap(gtt, sizeof(data));
+	gem_close(fd, handle);
+
+	igt_assert_eq(__gem_write(fd, handle, 0, data, 4), -ENOENT);
+}
+
+static void test_relocations(int fd)
+{
+	uint32_t target = gem_create(fd, 4096);
+	uint32_t batch = submit(fd, 0, target, I915_EXEC_RENDER);
+	uint64_t addr;
+
+	gem_read(fd, batch, 64, &addr, sizeof(addr));
+	gem_sync(fd, batch);
+
+	/* The address has the same size on every gen we default to */
+	igt_assert_neq_u64(addr, 0);
+	igt_assert_eq_u64(addr & 4095, 0x40);
+
+	gem_close(fd, batch);
+	gem_close(fd, target);
+}
+
+static void test_latency(int fd)
+{
+	uint32_t target = gem_create(fd, 4096);
+	uint32_t batch[2];
+	struct timespec start;
+	int64_t timeout;
+	uint64_t t;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	batch[0] = submit(fd, 0, target, I915_EXEC_RENDER);
+	batch[1] = submit(fd, 0, target, I915_EXEC_BLT);
+	igt_assert(gem_bo_busy(fd, target));
+
+	/* Writes to the same object are serialised across engines */
+	timeout = 0;
+	igt_assert_eq(gem_wait(fd, batch[1], &timeout), -ETIME);
+
+	gem_sync(fd, batch[1]);
+	t = elapsed_ns(&start);
+	igt_assert_f(t >= 2 * LATENCY_US * 1000ull,
+		     "completed after %"PRIu64"ns\n", t);
+	igt_assert(!gem_bo_busy(fd, target));
+
+	timeout = 0;
+	igt_assert_eq(gem_wait(fd, target, &timeout), 0);
+
+	gem_close(fd, batch[0]);
+	gem_close(fd, batch[1]);
+	gem_close(fd, target);
+}
+
+static void test_contexts(int fd)
+{
+	struct local_i915_gem_context_param param;
+	uint32_t target = gem_create(fd, 4096);
+	uint32_t ctx = gem_context_create(fd);
+
+	memset(&param, 0, sizeof(param));
+	param.context = ctx;
+	param.param = 0x6; /* priority */
+	param.value = 512;
+	gem_context_set_param(fd, &param);
+
+	param.value = 0;
+	gem_context_get_param(fd, &param);
+	igt_assert_eq_u64(param.value, 512);
+
+	gem_close(fd, submit(fd, ctx, target, I915_EXEC_BSD));
+	gem_context_destroy(fd, ctx);
+	igt_assert_eq(__gem_context_destroy(fd, ctx), -ENOENT);
+
+	gem_close(fd, target);
+}
+
+static void test_invalid_execbuf(int fd)
+{
+	struct drm_i915_gem_exec_object2 obj[2];
+	struct drm_i915_gem_relocation_entry reloc;
+	struct drm_i915_gem_execbuffer2 eb;
+	uint32_t bbe = MI_BATCH_BUFFER_END;
+	uint32_t batch;
+	uint64_t offset;
+
+	batch = gem_create(fd, 4096);
+	gem_write(fd, batch, 0, &bbe, sizeof(bbe));
+
+	memset(obj, 0, sizeof(obj));
+	obj[0].handle = gem_create(fd, 4096);
+	obj[1].handle = batch;
+
+	memset(&eb, 0, sizeof(eb));
+	eb.buffers_ptr = to_user_pointer(obj);
+	eb.buffer_count = 2;
+	gem_execbuf(fd, &eb);
+	gem_sync(fd, batch);
+	offset = obj[0].offset;
+
+	/* Move the target, but fail on the relocation of the later batch */
+	memset(&reloc, 0, sizeof(reloc));
+	reloc.target_handle = obj[0].handle;
+	reloc.offset = 4096;
+	obj[1].relocs_ptr = to_user_pointer(&reloc);
+	obj[1].relocation_count = 1;
+	obj[0].flags = EXEC_OBJECT_PINNED;
+	obj[0].offset = offset + (1 << 20);
+	igt_assert_eq(__gem_execbuf(fd, &eb), -EINVAL);
+	igt_assert(!gem_bo_busy(fd, obj[0].handle));
+
+	obj[1].handle = obj[0].handle;
+	obj[1].relocation_count = 0;
+	igt_assert_eq(__gem_execbuf(fd, &eb), -EINVAL);
+	igt_assert(!gem_bo_busy(fd, obj[0].handle));
+
+	/* Nothing of the failed execbufs stuck */
+	obj[0].flags = 0;
+	obj[1].handle = batch;
+	gem_execbuf(fd, &eb);
+	igt_assert_eq_u64(obj[0].offset, offset);
+
+	gem_close(fd, batch);
+	gem_close(fd, obj[0].handle);
+}
+
+static void test_handles(int fd)
+{
+	uint32_t handle[3], last;
+
+	for (int i = 0; i < 3; i++)
+		handle[i] = gem_create(fd, 4096);
+
+	/* Closed handles are reused, so replays don't grow the table */
+	gem_close(fd, handle[1]);
+	igt_assert_eq_u32(gem_create(fd, 4096), handle[1]);
+
+	last = gem_create(fd, 4096);
+	gem_close(fd, last);
+	for (int i = 0; i < 1000; i++) {
+		uint32_t tmp = gem_create(fd, 4096);
+
+		igt_assert_eq_u32(tmp, last);
+		gem_close(fd, tmp);
+	}
+
+	for (int i = 0; i < 3; i++)
+		gem_close(fd, handle[i]);
+}
+
+static void test_interruptible(int fd)
+{
+	/* The interrupter must chain to the fake device, not bypass it */
+	igt_while_interruptible(true) {
+		uint32_t handle = gem_create(fd, 4096);
+
+		igt_assert(gem_bo_busy(fd, handle) == false);
+		gem_close(fd, handle);
+	}
+}
+
+static void test_close(void)
+{
+	int fd = igt_fake_i915_open();
+
+	igt_assert(igt_is_fake_i915(fd));
+	close(fd);
+	igt_assert(!igt_is_fake_i915(fd));
+
+	/* Either reuses the fd, or frees the device on the way */
+	fd = igt_fake_i915_open();
+	igt_assert(igt_is_fake_i915(fd));
+	close(fd);
+}
+
+igt_main
+{
+	int fd = -1;
+
+	igt_fixture {
+		char latency[16];
+
+		snprintf(latency, sizeof(latency), "%d", LATENCY_US);
+		setenv("IGT_FAKE_I915", latency, 1);
+
+		fd = drm_open_driver(DRIVER_INTEL);
+		igt_assert(igt_is_fake_i915(fd));
+		igt_assert(is_i915_device(fd));
+		igt_assert_eq(intel_get_drm_devid(fd),
+			      IGT_FAKE_I915_DEFAULT_DEVID);
+	}
+
+	igt_subtest("objects")
+		test_objects(fd);
+
+	igt_subtest("relocations")
+		test_relocations(fd);
+
+	igt_subtest("latency")
+		test_latency(fd);
+
+	igt_subtest("contexts")
+		test_contexts(fd);
+
+	igt_subtest("invalid-execbuf")
+		test_invalid_execbuf(fd);
+
+	igt_subtest("handles")
+		test_handles(fd);
+
+	igt_subtest("interruptible")
+		test_interruptible(fd);
+
+	igt_subtest("close")
+		test_close();
+
+	igt_fixture
+		close(fd);
+}
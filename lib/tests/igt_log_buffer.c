@@ -0,0 +1,250 @@
+/*
+ * Copyright © 2017 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Testcase: Test the log dumped on a failure.
+ *
+ * 1. A failing subtest with no log says so.
+ * 2. Only the last 255 lines since the subtest started are dumped, with
+ *    their prefix, continuations and long lines intact.
+ * 3. Lines logged from several threads at once are all dumped whole, in the
+ *    order each thread logged them.
+ */
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "igt_core.h"
+
+/*
+ * We need to hide assert from the cocci igt test refactor spatch.
+ *
+ * IMPORTANT: Test infrastructure tests are the only valid places where using
+ * assert is allowed.
+ */
+#define internal_assert assert
+
+char test[] = "test";
+char *argv_run[] = { test };
+
+#define NUM_THREADS 8
+#define THREAD_LINES 1000
+
+static char long_line[1024];
+
+static const char *program_name(void)
+{
+#ifdef __GLIBC__
+	return program_invocation_short_name;
+#else
+	return test;
+#endif
+}
+
+static void *log_thread(void *arg)
+{
+	int thread = (long)arg;
+	int i;
+
+	for (i = 0; i < THREAD_LINES; i++) {
+		if (i % 100 == 50)
+			igt_debug("thread %d line %d %s\n", thread, i,
+				  long_line);
+		else
+			igt_debug("thread %d line %d\n", thread, i);
+	}
+
+	return NULL;
+}
+
+static void run_test(void)
+{
+	int argc = 1;
+	int i;
+
+	igt_subtest_init(argc, argv_run);
+
+	for (i = 0; i < 10; i++)
+		igt_debug("before subtests %d\n", i);
+
+	igt_subtest("empty")
+		igt_fail(IGT_EXIT_FAILURE);
+
+	igt_subtest("full") {
+		for (i = 0; i < 300; i++)
+			igt_debug("line %d\n", i);
+
+		igt_log("domain", IGT_LOG_DEBUG, "to be ");
+		igt_log("domain", IGT_LOG_DEBUG, "continued\n");
+		igt_debug("%s\n", long_line);
+
+		igt_fail(IGT_EXIT_FAILURE);
+	}
+
+	igt_subtest("threads") {
+		pthread_t threads[NUM_THREADS];
+		long t;
+
+		for (t = 0; t < NUM_THREADS; t++)
+			internal_assert(pthread_create(&threads[t], NULL,
+						       log_thread,
+						       (void *)t) == 0);
+		for (t = 0; t < NUM_THREADS; t++)
+			pthread_join(threads[t], NULL);
+
+		igt_fail(IGT_EXIT_FAILURE);
+	}
+
+	igt_exit();
+}
+
+static char *run_fork(pid_t *child)
+{
+	size_t size = 0;
+	char *log = NULL;
+	FILE *file;
+	int fd[2], status;
+	pid_t pid;
+
+	internal_assert(pipe(fd) == 0);
+
+	switch (pid = fork()) {
+	case -1:
+		internal_assert(0);
+	case 0:
+		close(fd[0]);
+		dup2(fd[1], STDERR_FILENO);
+		run_test();
+	default:
+		close(fd[1]);
+		file = fdopen(fd[0], "r");
+		internal_assert(file);
+		internal_assert(getdelim(&log, &size, '\0', file) > 0);
+		fclose(file);
+
+		while (waitpid(pid, &status, 0) == -1 &&
+		       errno == EINTR)
+			;
+
+		internal_assert(WIFEXITED(status));
+		internal_assert(WEXITSTATUS(status) == IGT_EXIT_FAILURE);
+	}
+
+	*child = pid;
+	return log;
+}
+
+static void check_threads(char *log, pid_t pid)
+{
+	int last[NUM_THREADS];
+	char prefix[64];
+	char *p, *end;
+	int thread, i, n;
+
+	p = strstr(log, "Subtest threads failed.\n**** DEBUG ****\n");
+	internal_assert(p);
+	p = strchr(strchr(p, '\n') + 1, '\n') + 1;
+
+	end = strstr(p, "****  END  ****\n");
+	internal_assert(end);
+	*end = '\0';
+
+	snprintf(prefix, sizeof(prefix), "(%s:%d) DEBUG: thread ",
+		 program_name(), pid);
+
+	for (thread = 0; thread < NUM_THREADS; thread++)
+		last[thread] = -1;
+
+	/* each thread's lines are the last it logged, in order */
+	for (n = 0; *p; n++) {
+		internal_assert(strncmp(p, prefix, strlen(prefix)) == 0);
+		p += strlen(prefix);
+		internal_assert(sscanf(p, "%d line %d", &thread, &i) == 2);
+		internal_assert(thread >= 0 && thread < NUM_THREADS);
+		internal_assert(last[thread] == -1 || i == last[thread] + 1);
+		last[thread] = i;
+
+		p = strchr(p, '\n');
+		internal_assert(p);
+		if (i % 100 == 50)
+			internal_assert(strncmp(p - strlen(long_line), long_line,
+						strlen(long_line)) == 0);
+		p++;
+	}
+	internal_assert(n == 255);
+
+	for (thread = 0; thread < NUM_THREADS; thread++)
+		internal_assert(last[thread] == -1 ||
+				last[thread] == THREAD_LINES - 1);
+}
+
+int main(int argc, char **argv)
+{
+	char expected[2048];
+	char *log, *p, *end;
+	pid_t pid;
+	int i;
+
+	memset(long_line, 'x', sizeof(long_line) - 1);
+
+	log = run_fork(&pid);
+
+	p = strstr(log, "Subtest empty failed.\nNo log.\n");
+	internal_assert(p);
+
+	p = strstr(p, "Subtest full failed.\n**** DEBUG ****\n");
+	internal_assert(p);
+	p = strchr(strchr(p, '\n') + 1, '\n') + 1;
+
+	end = strstr(p, "****  END  ****\n");
+	internal_assert(end);
+	*end = '\0';
+
+	/* 252 numbered lines, then the 3 records logged after them */
+	for (i = 300 - 252; i < 300; i++) {
+		snprintf(expected, sizeof(expected),
+			 "(%s:%d) DEBUG: line %d\n", program_name(), pid, i);
+		internal_assert(strncmp(p, expected, strlen(expected)) == 0);
+		p += strlen(expected);
+	}
+
+	snprintf(expected, sizeof(expected),
+		 "(%s:%d) domain-DEBUG: to be continued\n"
+		 "(%s:%d) DEBUG: %s\n",
+		 program_name(), pid, program_name(), pid, long_line);
+	internal_assert(strcmp(p, expected) == 0);
+
+	check_threads(end + 1, pid);
+
+	free(log);
+
+	return 0;
+}
@@ -23,6 +23,7 @@
  */
 
 #include "igt_core.h"
+#include "igt_rand.h"
 #include "igt_stats.h"
 
 #define ARRAY_SIZE(arr) (sizeof(arr)/sizeof(arr[0]))
@@ -213,13 +214,13 @@ static void test_reallocation(void)
 
 	for (i = 0; i < 101; i++) {
 		igt_stats_push(&stats, i);
-		/* also triggers ->sorted reallocations */
+		/* selections in between pushes */
 		if (i > 10)
 			igt_stats_get_median(&stats);
 	}
 	igt_assert(!stats.is_float);
 
-	igt_assert_eq(stats.n_values, 101);
+	igt_assert_eq_u64(stats.n_values, 101);
 	for (i = 0; i < 101; i++)
 		igt_assert_eq(stats.values_u64[i], i);
 	igt_assert_eq_double(igt_stats_get_mean(&stats), 50.0);
@@ -228,6 +229,291 @@ static void test_reallocation(void)
 	igt_stats_fini(&stats);
 }
 
+static int cmp_u64(const void *pa, const void *pb)
+{
+	const uint64_t *a = pa, *b = pb;
+
+	return *a < *b ? -1 : *a > *b;
+}
+
+/* Percentile interpolated between closest ranks, as a reference */
+static double reference_percentile(const uint64_t *sorted, unsigned int n,
+				   double percentile)
+{
+	double rank = (n - 1) * percentile / 100.;
+	unsigned int lower = rank;
+
+	if (lower >= n - 1)
+		return sorted[n - 1];
+
+	return sorted[lower] + (rank - lower) * (double)(sorted[lower + 1] - sorted[lower]);
+}
+
+static void test_percentile(void)
+{
+	static const double percentiles[] =
+		{ 0, 1, 10, 25, 50, 75, 90, 99, 99.9, 100 };
+	static const unsigned int counts[] = { 1, 2, 3, 10, 1001, 100000 };
+	unsigned int c, p, i, pattern;
+
+	hars_petruska_f54_1_random_seed(0);
+
+	for (pattern = 0; pattern < 4; pattern++) {
+		for (c = 0; c < ARRAY_SIZE(counts); c++) {
+			unsigned int n = counts[c];
+			uint64_t *values = malloc(n * sizeof(*values));
+			igt_stats_t stats;
+
+			igt_assert(values);
+			for (i = 0; i < n; i++) {
+				switch (pattern) {
+				case 0: /* random */
+					values[i] = hars_petruska_f54_1_random_unsafe();
+					break;
+				case 1: /* many duplicates */
+					values[i] = hars_petruska_f54_1_random_unsafe() % 7;
+					break;
+				case 2: /* ascending */
+					values[i] = i;
+					break;
+				case 3: /* descending */
+					values[i] = n - i;
+					break;
+				}
+			}
+
+			igt_stats_init_with_size(&stats, n);
+			igt_stats_push_array(&stats, values, n);
+			qsort(values, n, sizeof(*values), cmp_u64);
+
+			for (p = 0; p < ARRAY_SIZE(percentiles); p++)
+				igt_assert_eq_double(igt_stats_get_percentile(&stats, percentiles[p]),
+						     reference_percentile(values, n, percentiles[p]));
+
+			igt_assert_eq_double(igt_stats_get_median(&stats),
+					     reference_percentile(values, n, 50));
+
+			/* the values are only permuted */
+			qsort(stats.values_u64, n, sizeof(*values), cmp_u64);
+			igt_assert(memcmp(stats.values_u64, values,
+					  n * sizeof(*values)) == 0);
+
+			igt_stats_fini(&stats);
+			free(values);
+		}
+	}
+}
+
+static void assert_within(double approx, double exact, double bound)
+{
+	igt_assert_f(fabs(approx - exact) <= bound * fabs(exact),
+		     "%f not within %f of %f\n", approx, bound, exact);
+}
+
+static void compare_sketch(igt_stats_t *exact, igt_stats_t *sketch,
+			   unsigned int precision)
+{
+	double bound = ldexp(1., -(precision + 1));
+	double eq1, eq2, eq3, sq1, sq2, sq3;
+
+	igt_assert_eq_u64(sketch->n_values, exact->n_values);
+
+	/*
+	 * The moments are tracked exactly, the same way as over the exact
+	 * values in the order they were pushed, before selecting any
+	 * quantile reorders them.
+	 */
+	igt_assert_eq_double(igt_stats_get_mean(sketch),
+			     igt_stats_get_mean(exact));
+	igt_assert_eq_double(igt_stats_get_variance(sketch),
+			     igt_stats_get_variance(exact));
+
+	igt_stats_get_quartiles(exact, &eq1, &eq2, &eq3);
+	igt_stats_get_quartiles(sketch, &sq1, &sq2, &sq3);
+	assert_within(sq1, eq1, bound);
+	assert_within(sq2, eq2, bound);
+	assert_within(sq3, eq3, bound);
+
+	assert_within(igt_stats_get_median(sketch),
+		      igt_stats_get_median(exact), bound);
+	assert_within(igt_stats_get_iqm(sketch),
+		      igt_stats_get_iqm(exact), bound);
+	assert_within(igt_stats_get_trimean(sketch),
+		      igt_stats_get_trimean(exact), bound);
+}
+
+static void test_sketch(void)
+{
+	static const unsigned int precisions[] = { 1, 4, 7, 10 };
+	static const unsigned int counts[] = { 4, 5, 6, 7, 101, 10000 };
+	unsigned int p, c, i;
+
+	hars_petruska_f54_1_random_seed(0);
+
+	for (p = 0; p < ARRAY_SIZE(precisions); p++) {
+		for (c = 0; c < ARRAY_SIZE(counts); c++) {
+			igt_stats_t exact, sketch;
+
+			/* integers spread over many orders of magnitude */
+			igt_stats_init(&exact);
+			igt_stats_init_sketch(&sketch, precisions[p]);
+			for (i = 0; i < counts[c]; i++) {
+				uint64_t v = hars_petruska_f54_1_random_unsafe();
+
+				v >>= v & 31;
+				igt_stats_push(&exact, v);
+				igt_stats_push(&sketch, v);
+			}
+			compare_sketch(&exact, &sketch, precisions[p]);
+			igt_assert_eq_u64(igt_stats_get_min(&sketch),
+					  igt_stats_get_min(&exact));
+			igt_assert_eq_u64(igt_stats_get_max(&sketch),
+					  igt_stats_get_max(&exact));
+			igt_stats_fini(&exact);
+			igt_stats_fini(&sketch);
+
+			/* small floating point values */
+			igt_stats_init(&exact);
+			igt_stats_init_sketch(&sketch, precisions[p]);
+			for (i = 0; i < counts[c]; i++) {
+				double v = hars_petruska_f54_1_random_unsafe();
+
+				v = 1e-6 * (1 + v / UINT32_MAX);
+				igt_stats_push_float(&exact, v);
+				igt_stats_push_float(&sketch, v);
+			}
+			compare_sketch(&exact, &sketch, precisions[p]);
+			igt_stats_fini(&exact);
+			igt_stats_fini(&sketch);
+		}
+	}
+}
+
+static void test_sketch_constant_memory(void)
+{
+	igt_stats_t stats;
+	unsigned int i;
+
+	igt_stats_init_sketch(&stats, IGT_STATS_SKETCH_DEFAULT_PRECISION);
+	igt_assert(igt_stats_is_sketch(&stats));
+
+	for (i = 0; i < 1000000; i++)
+		igt_stats_push(&stats, i % 1000);
+
+	igt_assert(stats.values_u64 == NULL);
+	igt_assert_eq_u64(stats.n_values, 1000000);
+	igt_assert_eq(igt_stats_get_min(&stats), 0);
+	igt_assert_eq(igt_stats_get_max(&stats), 999);
+	assert_within(igt_stats_get_median(&stats), 499.5,
+		      ldexp(1., -(IGT_STATS_SKETCH_DEFAULT_PRECISION + 1)));
+
+	igt_stats_fini(&stats);
+}
+
+static void test_sketch_large_count(void)
+{
+	igt_stats_t stats;
+	unsigned int i;
+
+	igt_stats_init_sketch(&stats, IGT_STATS_SKETCH_DEFAULT_PRECISION);
+	for (i = 1; i <= 4; i++)
+		igt_stats_push(&stats, i);
+
+	/* 2^31 copies of each value, past where a 32 bit count wraps */
+	for (i = 0; i < 31; i++)
+		igt_stats_merge(&stats, &stats);
+
+	igt_assert_eq_u64(stats.n_values, 1ull << 33);
+	assert_within(igt_stats_get_median(&stats), 2.5,
+		      ldexp(1., -(IGT_STATS_SKETCH_DEFAULT_PRECISION + 1)));
+	igt_assert_eq_double(igt_stats_get_mean(&stats), 2.5);
+
+	igt_stats_fini(&stats);
+}
+
+static void test_merge(void)
+{
+	static const unsigned int chunks[] = { 0, 1, 7, 100, 1000, 3 };
+	igt_stats_t whole, merged, whole_sketch, merged_sketch;
+	struct igt_mean whole_mean, merged_mean;
+	unsigned int c, i;
+
+	hars_petruska_f54_1_random_seed(0);
+
+	igt_stats_init(&whole);
+	igt_stats_init(&merged);
+	igt_stats_init_sketch(&whole_sketch, 5);
+	igt_stats_init_sketch(&merged_sketch, 5);
+	igt_mean_init(&whole_mean);
+	igt_mean_init(&merged_mean);
+
+	for (c = 0; c < ARRAY_SIZE(chunks); c++) {
+		igt_stats_t part, part_sketch;
+		struct igt_mean part_mean;
+
+		igt_stats_init(&part);
+		igt_stats_init_sketch(&part_sketch, 5);
+		igt_mean_init(&part_mean);
+
+		for (i = 0; i < chunks[c]; i++) {
+			/* give each chunk a different distribution */
+			uint64_t v = hars_petruska_f54_1_random_unsafe() % 1000;
+
+			v += 1000 * c;
+			igt_stats_push(&whole, v);
+			igt_stats_push(&part, v);
+			igt_stats_push(&whole_sketch, v);
+			igt_stats_push(&part_sketch, v);
+			igt_mean_add(&whole_mean, v);
+			igt_mean_add(&part_mean, v);
+		}
+
+		igt_stats_merge(&merged, &part);
+		igt_stats_merge(&merged_sketch, &part_sketch);
+		igt_mean_merge(&merged_mean, &part_mean);
+
+		igt_stats_fini(&part);
+		igt_stats_fini(&part_sketch);
+	}
+
+	igt_assert_eq_u64(merged.n_values, whole.n_values);
+	igt_assert_eq(igt_stats_get_min(&merged), igt_stats_get_min(&whole));
+	igt_assert_eq(igt_stats_get_max(&merged), igt_stats_get_max(&whole));
+	igt_assert_eq_double(igt_stats_get_median(&merged),
+			     igt_stats_get_median(&whole));
+	igt_assert_eq_double(igt_stats_get_percentile(&merged, 99),
+			     igt_stats_get_percentile(&whole, 99));
+	assert_within(igt_stats_get_variance(&merged),
+		      igt_stats_get_variance(&whole), 1e-9);
+
+	/* merging sketches is exact with respect to a single sketch */
+	igt_assert_eq_u64(merged_sketch.n_values, whole_sketch.n_values);
+	igt_assert_eq(igt_stats_get_min(&merged_sketch),
+		      igt_stats_get_min(&whole_sketch));
+	igt_assert_eq(igt_stats_get_max(&merged_sketch),
+		      igt_stats_get_max(&whole_sketch));
+	igt_assert_eq_double(igt_stats_get_median(&merged_sketch),
+			     igt_stats_get_median(&whole_sketch));
+	igt_assert_eq_double(igt_stats_get_iqm(&merged_sketch),
+			     igt_stats_get_iqm(&whole_sketch));
+	assert_within(igt_stats_get_mean(&merged_sketch),
+		      igt_stats_get_mean(&whole), 1e-9);
+	assert_within(igt_stats_get_variance(&merged_sketch),
+		      igt_stats_get_variance(&whole), 1e-9);
+
+	assert_within(igt_mean_get(&merged_mean),
+		      igt_mean_get(&whole_mean), 1e-9);
+	assert_within(igt_mean_get_variance(&merged_mean),
+		      igt_mean_get_variance(&whole_mean), 1e-9);
+	igt_assert_eq_double(merged_mean.min, whole_mean.min);
+	igt_assert_eq_double(merged_mean.max, whole_mean.max);
+
+	igt_stats_fini(&whole);
+	igt_stats_fini(&merged);
+	igt_stats_fini(&whole_sketch);
+	igt_stats_fini(&merged_sketch);
+}
+
 igt_simple_main
 {
 	test_init_zero();
@@ -240,4 +526,9 @@ igt_simple_main
 	test_invalidate_mean();
 	test_std_deviation();
 	test_reallocation();
+	test_percentile();
+	test_sketch();
+	test_sketch_constant_memory();
+	test_sketch_large_count();
+	test_merge();
 }
@@ -24,80 +24,519 @@
 
 /* Simple tool to print statistics on incoming line buffers intervals */
 
-#define _ISOC99_SOURCE
+#define _GNU_SOURCE
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
 #include <unistd.h>
+#include <math.h>
 
 #include "igt_stats.h"
 
-static void statify(FILE *file, const char *name)
-{
+#define ARRAY_SIZE(arr) (sizeof(arr)/sizeof(arr[0]))
+
+#define BUFFER_SIZE (4 << 20)
+
+/* log2 histogram buckets, bucket e holds values in [2^(e-1), 2^e) */
+#define HIST_MIN_EXP (-64)
+#define HIST_MAX_EXP 64
+#define HIST_BUCKETS (HIST_MAX_EXP - HIST_MIN_EXP + 1)
+
+enum format {
+	FORMAT_TEXT,
+	FORMAT_CSV,
+	FORMAT_JSON,
+};
+
+static struct {
+	bool summary;
+	bool histogram;
+	bool approximate;
+	enum format format;
+} options;
+
+static const double percentiles[] = { 50, 90, 99, 99.9 };
+static const char *percentile_names[] = { "median", "p90", "p99", "p99.9" };
+
+struct summary {
 	igt_stats_t stats;
-	char *line = NULL;
-	size_t line_len = 0;
-
-	igt_stats_init(&stats);
-	while (getline(&line, &line_len, file) != -1) {
-		char *end, *start = line;
-		union {
-			unsigned long long u64;
-			double fp;
-		} u;
-		int is_float;
-
-		is_float = 0;
-		u.u64 = strtoull(start, &end, 0);
-		if (*end == '.') {
-			u.fp = strtod(start, &end);
-			is_float = 1;
+	double min, max;
+	uint64_t negative; /* values <= 0, outside of the histogram */
+	uint64_t hist[HIST_BUCKETS];
+};
+
+static void push(struct summary *s, double value, bool is_float,
+		 unsigned long long u64)
+{
+	if (is_float)
+		igt_stats_push_float(&s->stats, value);
+	else
+		igt_stats_push(&s->stats, u64);
+
+	if (value < s->min)
+		s->min = value;
+	if (value > s->max)
+		s->max = value;
+
+	if (options.histogram) {
+		int exp;
+
+		if (value <= 0) {
+			s->negative++;
+			return;
 		}
-		while (start != end) {
-			if (is_float)
-				igt_stats_push_float(&stats, u.fp);
-			else
-				igt_stats_push(&stats, u.u64);
 
-			is_float = 0;
-			u.u64 = strtoull(start = end, &end, 0);
-			if (*end == '.') {
-				u.fp = strtod(start, &end);
-				is_float = 1;
+		frexp(value, &exp);
+		if (exp < HIST_MIN_EXP)
+			exp = HIST_MIN_EXP;
+		if (exp > HIST_MAX_EXP)
+			exp = HIST_MAX_EXP;
+		s->hist[exp - HIST_MIN_EXP]++;
+	}
+}
+
+/*
+ * Parses all the numbers at the start of each line, stopping at the first
+ * thing that isn't one, just like strtoull()/strtod() would. @end must point
+ * at the end of a complete line, so that the C library parsers don't run off
+ * the buffer. Plain decimal integers, by far the most common input, are
+ * handled inline.
+ */
+static void parse_lines(struct summary *s, char *buf, char *end)
+{
+	char *p = buf;
+
+	while (p < end) {
+		unsigned long long u64;
+		char *start, *next;
+		unsigned int digits;
+
+		while (*p == ' ' || *p == '\t' || *p == '\r' ||
+		       *p == '\v' || *p == '\f')
+			p++;
+
+		if (*p == '\n') {
+			p++;
+			continue;
+		}
+
+		start = p;
+		u64 = 0;
+		for (digits = 0; *p >= '0' && *p <= '9'; digits++)
+			u64 = 10 * u64 + (*p++ - '0');
+
+		if (digits && digits < 20 && *p != '.' &&
+		    !(digits > 1 && *start == '0') &&
+		    !(*start == '0' && (*p == 'x' || *p == 'X'))) {
+			push(s, u64, false, u64);
+			continue;
+		}
+
+		/* Fallback to the C library for everything else */
+		p = start;
+		u64 = strtoull(p, &next, 0);
+		if (*next == '.') {
+			double fp = strtod(p, &next);
+
+			if (next != p) {
+				push(s, fp, true, 0);
+				p = next;
+				continue;
 			}
 		}
+		if (next != p) {
+			push(s, u64, false, u64);
+			p = next;
+			continue;
+		}
+
+		/* Not a number, skip to the next line */
+		next = memchr(p, '\n', end - p);
+		p = next ? next + 1 : end;
 	}
-	free(line);
+}
+
+static int read_values(struct summary *s, int fd)
+{
+	size_t size = BUFFER_SIZE, len = 0;
+	char *buf;
+
+	buf = malloc(size + 1);
+	if (!buf)
+		return -ENOMEM;
+
+	for (;;) {
+		ssize_t ret;
+		char *eol;
+
+		if (len == size) {
+			/* A single line doesn't fit, grow the buffer */
+			char *tmp = realloc(buf, 2 * size + 1);
+
+			if (!tmp) {
+				free(buf);
+				return -ENOMEM;
+			}
+			buf = tmp;
+			size *= 2;
+		}
+
+		ret = read(fd, buf + len, size - len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			free(buf);
+			return -errno;
+		}
+
+		if (ret == 0) {
+			/* Parse what's left, terminated like a last line */
+			buf[len] = '\0';
+			parse_lines(s, buf, buf + len);
+			break;
+		}
+		len += ret;
 
-	if (name)
-		printf("%s: ", name);
+		/* Only parse complete lines, keep the rest for later */
+		eol = memrchr(buf, '\n', len);
+		if (!eol)
+			continue;
 
-	printf("%f\n", igt_stats_get_trimean(&stats));
+		eol++;
+		parse_lines(s, buf, eol);
+		len -= eol - buf;
+		memmove(buf, eol, len);
+	}
 
-	igt_stats_fini(&stats);
+	free(buf);
+	return 0;
 }
 
-int main(int argc, char **argv)
+static void print_json_string(const char *str)
+{
+	putchar('"');
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			printf("\\%c", *str);
+		else if ((unsigned char)*str < 0x20)
+			printf("\\u%04x", *str);
+		else
+			putchar(*str);
+	}
+	putchar('"');
+}
+
+/* Without values there's nothing but the count to report */
+static void print_empty_summary(const char *name)
+{
+	unsigned int i;
+
+	switch (options.format) {
+	case FORMAT_TEXT:
+		if (name)
+			printf("%s:\n", name);
+		printf("count: 0\n");
+		break;
+
+	case FORMAT_CSV:
+		printf("%s,0,,,,", name ?: "-");
+		for (i = 0; i < ARRAY_SIZE(percentiles); i++)
+			printf(",");
+		printf("\n");
+		break;
+
+	case FORMAT_JSON:
+		printf("\"count\": 0, \"min\": null, \"max\": null, "
+		       "\"mean\": null, \"stddev\": null");
+		for (i = 0; i < ARRAY_SIZE(percentiles); i++)
+			printf(", \"%s\": null", percentile_names[i]);
+		break;
+	}
+}
+
+static void print_summary(struct summary *s, const char *name)
+{
+	igt_stats_t *stats = &s->stats;
+	double values[ARRAY_SIZE(percentiles)];
+	double mean, stddev;
+	unsigned int i;
+
+	if (!stats->n_values) {
+		print_empty_summary(name);
+		return;
+	}
+
+	mean = igt_stats_get_mean(stats);
+	stddev = igt_stats_get_std_deviation(stats);
+	for (i = 0; i < ARRAY_SIZE(percentiles); i++)
+		values[i] = igt_stats_get_percentile(stats, percentiles[i]);
+
+	switch (options.format) {
+	case FORMAT_TEXT:
+		if (name)
+			printf("%s:\n", name);
+		printf("count: %"PRIu64"\n", stats->n_values);
+		printf("min: %f\n", s->min);
+		printf("max: %f\n", s->max);
+		printf("mean: %f\n", mean);
+		printf("stddev: %f\n", stddev);
+		for (i = 0; i < ARRAY_SIZE(percentiles); i++)
+			printf("%s: %f\n", percentile_names[i], values[i]);
+		break;
+
+	case FORMAT_CSV:
+		printf("%s,%"PRIu64",%f,%f,%f,%f", name ?: "-", stats->n_values,
+		       s->min, s->max, mean, stddev);
+		for (i = 0; i < ARRAY_SIZE(percentiles); i++)
+			printf(",%f", values[i]);
+		printf("\n");
+		break;
+
+	case FORMAT_JSON:
+		printf("\"count\": %"PRIu64", \"min\": %f, \"max\": %f, "
+		       "\"mean\": %f, \"stddev\": %f",
+		       stats->n_values, s->min, s->max, mean, stddev);
+		for (i = 0; i < ARRAY_SIZE(percentiles); i++)
+			printf(", \"%s\": %f", percentile_names[i], values[i]);
+		break;
+	}
+}
+
+static void print_histogram(struct summary *s, const char *name)
+{
+	int first = HIST_BUCKETS, last = -1, i;
+	bool comma = false;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		if (!s->hist[i])
+			continue;
+		if (i < first)
+			first = i;
+		last = i;
+	}
+
+	if (options.format == FORMAT_JSON)
+		printf("\"histogram\": [");
+	else if (options.format == FORMAT_TEXT && name)
+		printf("%s:\n", name);
+
+	if (s->negative) {
+		switch (options.format) {
+		case FORMAT_TEXT:
+			printf("%14s .. %-14g %12"PRIu64"\n",
+			       "-inf", 0., s->negative);
+			break;
+		case FORMAT_CSV:
+			printf("%s,-inf,0,%"PRIu64"\n",
+			       name ?: "-", s->negative);
+			break;
+		case FORMAT_JSON:
+			printf("{\"lower\": null, \"upper\": 0, "
+			       "\"count\": %"PRIu64"}", s->negative);
+			comma = true;
+			break;
+		}
+	}
+
+	for (i = first; i <= last; i++) {
+		double lower = ldexp(1., i + HIST_MIN_EXP - 1);
+		double upper = ldexp(1., i + HIST_MIN_EXP);
+
+		switch (options.format) {
+		case FORMAT_TEXT:
+			printf("%14g .. %-14g %12"PRIu64"\n",
+			       lower, upper, s->hist[i]);
+			break;
+		case FORMAT_CSV:
+			printf("%s,%g,%g,%"PRIu64"\n",
+			       name ?: "-", lower, upper, s->hist[i]);
+			break;
+		case FORMAT_JSON:
+			printf("%s{\"lower\": %g, \"upper\": %g, "
+			       "\"count\": %"PRIu64"}",
+			       comma ? ", " : "", lower, upper, s->hist[i]);
+			comma = true;
+			break;
+		}
+	}
+
+	if (options.format == FORMAT_JSON)
+		printf("]");
+}
+
+static void statify(int fd, const char *name)
 {
-	if (argc == 1) {
-		statify(stdin, NULL);
+	struct summary *s;
+	int ret;
+
+	s = calloc(1, sizeof(*s));
+	if (!s) {
+		perror(name ?: "stdin");
+		return;
+	}
+
+	if (options.approximate)
+		igt_stats_init_sketch(&s->stats,
+				      IGT_STATS_SKETCH_DEFAULT_PRECISION);
+	else
+		igt_stats_init(&s->stats);
+	s->min = HUGE_VAL;
+	s->max = -HUGE_VAL;
+
+	ret = read_values(s, fd);
+	if (ret) {
+		errno = -ret;
+		perror(name ?: "stdin");
+		goto out;
+	}
+
+	if (!options.summary && !options.histogram) {
+		/* The original terse output, kept for existing scripts */
+		if (options.format == FORMAT_JSON) {
+			printf("{");
+			if (name) {
+				printf("\"name\": ");
+				print_json_string(name);
+				printf(", ");
+			}
+			printf("\"trimean\": %f}\n",
+			       igt_stats_get_trimean(&s->stats));
+		} else if (options.format == FORMAT_CSV) {
+			printf("%s,%f\n", name ?: "-",
+			       igt_stats_get_trimean(&s->stats));
+		} else {
+			if (name)
+				printf("%s: ", name);
+			printf("%f\n", igt_stats_get_trimean(&s->stats));
+		}
+		goto out;
+	}
+
+	if (options.format == FORMAT_JSON) {
+		/* One object per input, as a stream of JSON lines */
+		printf("{");
+		if (name) {
+			printf("\"name\": ");
+			print_json_string(name);
+			printf(", ");
+		}
+		if (options.summary)
+			print_summary(s, name);
+		if (options.summary && options.histogram)
+			printf(", ");
+		if (options.histogram)
+			print_histogram(s, name);
+		printf("}\n");
 	} else {
-		int i;
+		if (options.summary)
+			print_summary(s, name);
+		if (options.histogram)
+			print_histogram(s, name);
+	}
+
+out:
+	igt_stats_fini(&s->stats);
+	free(s);
+}
+
+static void __attribute__((noreturn)) usage(const char *name, int status)
+{
+	fprintf(status ? stderr : stdout,
+		"Usage: %s [OPTIONS] [FILE...]\n"
+		"Reads numbers, one or more per line, from FILEs or stdin and\n"
+		"prints their trimean, or:\n"
+		"  -s, --summary        count, min, max, mean, stddev, median,\n"
+		"                       p90, p99 and p99.9\n"
+		"  -H, --histogram      a histogram with power of 2 buckets\n"
+		"  -a, --approximate    use constant memory, quantiles are then\n"
+		"                       accurate to 0.4%%\n"
+		"  -f, --format=FORMAT  output as text (default), csv or json,\n"
+		"                       csv taking only one of -s and -H\n"
+		"  -h, --help           this help\n",
+		name);
+	exit(status);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{ "summary", no_argument, NULL, 's' },
+		{ "histogram", no_argument, NULL, 'H' },
+		{ "approximate", no_argument, NULL, 'a' },
+		{ "format", required_argument, NULL, 'f' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	unsigned int i;
+	int c;
+
+	while ((c = getopt_long(argc, argv, "sHaf:h", long_options, NULL)) != -1) {
+		switch (c) {
+		case 's':
+			options.summary = true;
+			break;
+		case 'H':
+			options.histogram = true;
+			break;
+		case 'a':
+			options.approximate = true;
+			break;
+		case 'f':
+			if (strcmp(optarg, "text") == 0)
+				options.format = FORMAT_TEXT;
+			else if (strcmp(optarg, "csv") == 0)
+				options.format = FORMAT_CSV;
+			else if (strcmp(optarg, "json") == 0)
+				options.format = FORMAT_JSON;
+			else
+				usage(argv[0], EXIT_FAILURE);
+			break;
+		case 'h':
+			usage(argv[0], EXIT_SUCCESS);
+		default:
+			usage(argv[0], EXIT_FAILURE);
+		}
+	}
+
+	/* The two tables have different columns */
+	if (options.format == FORMAT_CSV &&
+	    options.summary && options.histogram) {
+		fprintf(stderr,
+			"%s: csv output takes either --summary or --histogram\n",
+			argv[0]);
+		return EXIT_FAILURE;
+	}
 
-		for (i = 1; i < argc; i++) {
-			FILE *file;
+	if (options.format == FORMAT_CSV && options.summary) {
+		printf("name,count,min,max,mean,stddev");
+		for (i = 0; i < ARRAY_SIZE(percentiles); i++)
+			printf(",%s", percentile_names[i]);
+		printf("\n");
+	} else if (options.format == FORMAT_CSV && options.histogram) {
+		printf("name,lower,upper,count\n");
+	}
+
+	if (optind == argc) {
+		statify(STDIN_FILENO, NULL);
+	} else {
+		for (c = optind; c < argc; c++) {
+			int fd;
 
-			file = fopen(argv[i], "r");
-			if (file == NULL) {
-				perror(argv[i]);
+			fd = open(argv[c], O_RDONLY);
+			if (fd < 0) {
+				perror(argv[c]);
 				continue;
 			}
 
-			statify(file, argv[i]);
-			fclose(file);
+			statify(fd, argv[c]);
+			close(fd);
 		}
 	}
 
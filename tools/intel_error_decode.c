@@ -44,8 +44,11 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <errno.h>
 #include <sys/stat.h>
 #include <err.h>
@@ -59,10 +62,13 @@
 #include "intel_reg.h"
 #include "drmtest.h"
 
+/* The register decoders print into the text of the chunk being read */
+static FILE *out;
+
 static uint32_t
 print_head(unsigned int reg)
 {
-	printf("    head = 0x%08x, wraps = %d\n", reg & (0x7ffff<<2), reg >> 21);
+	fprintf(out, "    head = 0x%08x, wraps = %d\n", reg & (0x7ffff<<2), reg >> 21);
 	return reg & (0x7ffff<<2);
 }
 
@@ -73,10 +79,10 @@ print_ctl(unsigned int reg)
 
 #define BIT_STR(reg, x, on, off) ((1 << (x)) & reg) ? on : off
 
-	printf("    len=%d%s%s%s\n", ring_length,
-	       BIT_STR(reg, 0, ", enabled", ", disabled"),
-	       BIT_STR(reg, 10, ", semaphore wait ", ""),
-	       BIT_STR(reg, 11, ", rb wait ", "")
+	fprintf(out, "    len=%d%s%s%s\n", ring_length,
+		     BIT_STR(reg, 0, ", enabled", ", disabled"),
+		     BIT_STR(reg, 10, ", semaphore wait ", ""),
+		     BIT_STR(reg, 11, ", rb wait ", "")
 		);
 #undef BIT_STR
 	return ring_length;
@@ -86,9 +92,9 @@ static void
 print_acthd(unsigned int reg, unsigned int ring_length)
 {
 	if ((reg & (0x7ffff << 2)) < ring_length)
-		printf("    at ring: 0x%08x\n", reg & (0x7ffff << 2));
+		fprintf(out, "    at ring: 0x%08x\n", reg & (0x7ffff << 2));
 	else
-		printf("    at batch: 0x%08x\n", reg);
+		fprintf(out, "    at batch: 0x%08x\n", reg);
 }
 
 static void
@@ -115,7 +121,7 @@ print_instdone(uint32_t devid, unsigned int instdone, unsigned int instdone1)
 		}
 
 		if (busy)
-			printf("    busy: %s\n", instdone_bits[i].name);
+			fprintf(out, "    busy: %s\n", instdone_bits[i].name);
 	}
 }
 
@@ -141,7 +147,7 @@ print_i830_pgtbl_err(unsigned int reg)
 	}
 
 	if (str)
-		printf("    source = %s\n", str);
+		fprintf(out, "    source = %s\n", str);
 
 	switch(reg & 0x7) {
 	case 0x0: str  = "Invalid GTT"; break;
@@ -153,85 +159,85 @@ print_i830_pgtbl_err(unsigned int reg)
 	case 0x6: str = "Invalid Tiling"; break;
 	case 0x7: str = "Host to CAM"; break;
 	}
-	printf("    error = %s\n", str);
+	fprintf(out, "    error = %s\n", str);
 }
 
 static void
 print_i915_pgtbl_err(unsigned int reg)
 {
 	if (reg & (1 << 29))
-		printf("    Cursor A: Invalid GTT PTE\n");
+		fprintf(out, "    Cursor A: Invalid GTT PTE\n");
 	if (reg & (1 << 28))
-		printf("    Cursor B: Invalid GTT PTE\n");
+		fprintf(out, "    Cursor B: Invalid GTT PTE\n");
 	if (reg & (1 << 27))
-		printf("    MT: Invalid tiling\n");
+		fprintf(out, "    MT: Invalid tiling\n");
 	if (reg & (1 << 26))
-		printf("    MT: Invalid GTT PTE\n");
+		fprintf(out, "    MT: Invalid GTT PTE\n");
 	if (reg & (1 << 25))
-		printf("    LC: Invalid tiling\n");
+		fprintf(out, "    LC: Invalid tiling\n");
 	if (reg & (1 << 24))
-		printf("    LC: Invalid GTT PTE\n");
+		fprintf(out, "    LC: Invalid GTT PTE\n");
 	if (reg & (1 << 23))
-		printf("    BIN VertexData: Invalid GTT PTE\n");
+		fprintf(out, "    BIN VertexData: Invalid GTT PTE\n");
 	if (reg & (1 << 22))
-		printf("    BIN Instruction: Invalid GTT PTE\n");
+		fprintf(out, "    BIN Instruction: Invalid GTT PTE\n");
 	if (reg & (1 << 21))
-		printf("    CS VertexData: Invalid GTT PTE\n");
+		fprintf(out, "    CS VertexData: Invalid GTT PTE\n");
 	if (reg & (1 << 20))
-		printf("    CS Instruction: Invalid GTT PTE\n");
+		fprintf(out, "    CS Instruction: Invalid GTT PTE\n");
 	if (reg & (1 << 19))
-		printf("    CS: Invalid GTT\n");
+		fprintf(out, "    CS: Invalid GTT\n");
 	if (reg & (1 << 18))
-		printf("    Overlay: Invalid tiling\n");
+		fprintf(out, "    Overlay: Invalid tiling\n");
 	if (reg & (1 << 16))
-		printf("    Overlay: Invalid GTT PTE\n");
+		fprintf(out, "    Overlay: Invalid GTT PTE\n");
 	if (reg & (1 << 14))
-		printf("    Display C: Invalid tiling\n");
+		fprintf(out, "    Display C: Invalid tiling\n");
 	if (reg & (1 << 12))
-		printf("    Display C: Invalid GTT PTE\n");
+		fprintf(out, "    Display C: Invalid GTT PTE\n");
 	if (reg & (1 << 10))
-		printf("    Display B: Invalid tiling\n");
+		fprintf(out, "    Display B: Invalid tiling\n");
 	if (reg & (1 << 8))
-		printf("    Display B: Invalid GTT PTE\n");
+		fprintf(out, "    Display B: Invalid GTT PTE\n");
 	if (reg & (1 << 6))
-		printf("    Display A: Invalid tiling\n");
+		fprintf(out, "    Display A: Invalid tiling\n");
 	if (reg & (1 << 4))
-		printf("    Display A: Invalid GTT PTE\n");
+		fprintf(out, "    Display A: Invalid GTT PTE\n");
 	if (reg & (1 << 1))
-		printf("    Host Invalid PTE data\n");
+		fprintf(out, "    Host Invalid PTE data\n");
 	if (reg & (1 << 0))
-		printf("    Host Invalid GTT PTE\n");
+		fprintf(out, "    Host Invalid GTT PTE\n");
 }
 
 static void
 print_i965_pgtbl_err(unsigned int reg)
 {
 	if (reg & (1 << 26))
-		printf("    Invalid Sampler Cache GTT entry\n");
+		fprintf(out, "    Invalid Sampler Cache GTT entry\n");
 	if (reg & (1 << 24))
-		printf("    Invalid Render Cache GTT entry\n");
+		fprintf(out, "    Invalid Render Cache GTT entry\n");
 	if (reg & (1 << 23))
-		printf("    Invalid Instruction/State Cache GTT entry\n");
+		fprintf(out, "    Invalid Instruction/State Cache GTT entry\n");
 	if (reg & (1 << 22))
-		printf("    There is no ROC, this cannot occur!\n");
+		fprintf(out, "    There is no ROC, this cannot occur!\n");
 	if (reg & (1 << 21))
-		printf("    Invalid GTT entry during Vertex Fetch\n");
+		fprintf(out, "    Invalid GTT entry during Vertex Fetch\n");
 	if (reg & (1 << 20))
-		printf("    Invalid GTT entry during Command Fetch\n");
+		fprintf(out, "    Invalid GTT entry during Command Fetch\n");
 	if (reg & (1 << 19))
-		printf("    Invalid GTT entry during CS\n");
+		fprintf(out, "    Invalid GTT entry during CS\n");
 	if (reg & (1 << 18))
-		printf("    Invalid GTT entry during Cursor Fetch\n");
+		fprintf(out, "    Invalid GTT entry during Cursor Fetch\n");
 	if (reg & (1 << 17))
-		printf("    Invalid GTT entry during Overlay Fetch\n");
+		fprintf(out, "    Invalid GTT entry during Overlay Fetch\n");
 	if (reg & (1 << 8))
-		printf("    Invalid GTT entry during Display B Fetch\n");
+		fprintf(out, "    Invalid GTT entry during Display B Fetch\n");
 	if (reg & (1 << 4))
-		printf("    Invalid GTT entry during Display A Fetch\n");
+		fprintf(out, "    Invalid GTT entry during Display A Fetch\n");
 	if (reg & (1 << 1))
-		printf("    Valid PTE references illegal memory\n");
+		fprintf(out, "    Valid PTE references illegal memory\n");
 	if (reg & (1 << 0))
-		printf("    Invalid GTT entry during fetch for host\n");
+		fprintf(out, "    Invalid GTT entry during fetch for host\n");
 }
 
 static void
@@ -249,45 +255,45 @@ print_pgtbl_err(unsigned int reg, unsigned int devid)
 static void print_ivb_error(unsigned int reg, unsigned int devid)
 {
 	if (reg & (1 << 0))
-		printf("    TLB page fault error (GTT entry not valid)\n");
+		fprintf(out, "    TLB page fault error (GTT entry not valid)\n");
 	if (reg & (1 << 1))
-		printf("    Invalid physical address in RSTRM interface (PAVP)\n");
+		fprintf(out, "    Invalid physical address in RSTRM interface (PAVP)\n");
 	if (reg & (1 << 2))
-		printf("    Invalid page directory entry error\n");
+		fprintf(out, "    Invalid page directory entry error\n");
 	if (reg & (1 << 3))
-		printf("    Invalid physical address in ROSTRM interface (PAVP)\n");
+		fprintf(out, "    Invalid physical address in ROSTRM interface (PAVP)\n");
 	if (reg & (1 << 4))
-		printf("    TLB page VTD translation generated an error\n");
+		fprintf(out, "    TLB page VTD translation generated an error\n");
 	if (reg & (1 << 5))
-		printf("    Invalid physical address in WRITE interface (PAVP)\n");
+		fprintf(out, "    Invalid physical address in WRITE interface (PAVP)\n");
 	if (reg & (1 << 6))
-		printf("    Page directory VTD translation generated error\n");
+		fprintf(out, "    Page directory VTD translation generated error\n");
 	if (reg & (1 << 8))
-		printf("    Cacheline containing a PD was marked as invalid\n");
+		fprintf(out, "    Cacheline containing a PD was marked as invalid\n");
 	if (IS_HASWELL(devid) && (reg >> 10) & 0x1f)
-		printf("    %d pending page faults\n", (reg >> 10) & 0x1f);
+		fprintf(out, "    %d pending page faults\n", (reg >> 10) & 0x1f);
 }
 
 static void print_snb_error(unsigned int reg)
 {
 	if (reg & (1 << 0))
-		printf("    TLB page fault error (GTT entry not valid)\n");
+		fprintf(out, "    TLB page fault error (GTT entry not valid)\n");
 	if (reg & (1 << 1))
-		printf("    Context page GTT translation generated a fault (GTT entry not valid)\n");
+		fprintf(out, "    Context page GTT translation generated a fault (GTT entry not valid)\n");
 	if (reg & (1 << 2))
-		printf("    Invalid page directory entry error\n");
+		fprintf(out, "    Invalid page directory entry error\n");
 	if (reg & (1 << 3))
-		printf("    HWS page GTT translation generated a page fault (GTT entry not valid)\n");
+		fprintf(out, "    HWS page GTT translation generated a page fault (GTT entry not valid)\n");
 	if (reg & (1 << 4))
-		printf("    TLB page VTD translation generated an error\n");
+		fprintf(out, "    TLB page VTD translation generated an error\n");
 	if (reg & (1 << 5))
-		printf("    Context page VTD translation generated an error\n");
+		fprintf(out, "    Context page VTD translation generated an error\n");
 	if (reg & (1 << 6))
-		printf("    Page directory VTD translation generated error\n");
+		fprintf(out, "    Page directory VTD translation generated error\n");
 	if (reg & (1 << 7))
-		printf("    HWS page VTD translation generated an error\n");
+		fprintf(out, "    HWS page VTD translation generated an error\n");
 	if (reg & (1 << 8))
-		printf("    Cacheline containing a PD was marked as invalid\n");
+		fprintf(out, "    Cacheline containing a PD was marked as invalid\n");
 }
 
 static void print_bdw_error(unsigned int reg, unsigned int devid)
@@ -295,17 +301,17 @@ static void print_bdw_error(unsigned int reg, unsigned int devid)
 	print_ivb_error(reg, devid);
 
 	if (reg & (1 << 10))
-		printf("    Non WB memory type for Advanced Context\n");
+		fprintf(out, "    Non WB memory type for Advanced Context\n");
 	if (reg & (1 << 11))
-		printf("    PASID not enabled\n");
+		fprintf(out, "    PASID not enabled\n");
 	if (reg & (1 << 12))
-		printf("    PASID boundary violation\n");
+		fprintf(out, "    PASID boundary violation\n");
 	if (reg & (1 << 13))
-		printf("    PASID not valid\n");
+		fprintf(out, "    PASID not valid\n");
 	if (reg & (1 << 14))
-		printf("    PASID was zero for untranslated request\n");
+		fprintf(out, "    PASID was zero for untranslated request\n");
 	if (reg & (1 << 15))
-		printf("    Context was not marked as present when doing DMA\n");
+		fprintf(out, "    Context was not marked as present when doing DMA\n");
 }
 
 static void
@@ -321,7 +327,7 @@ print_error(unsigned int reg, unsigned int devid)
 static void
 print_snb_fence(unsigned int devid, uint64_t fence)
 {
-	printf("    %svalid, %c-tiled, pitch: %i, start: 0x%08x, size: %u\n",
+	fprintf(out, "    %svalid, %c-tiled, pitch: %i, start: 0x%08x, size: %u\n",
 			fence & 1 ? "" : "in",
 			fence & (1<<1) ? 'y' : 'x',
 			(int)(((fence>>32)&0xfff)+1)*128,
@@ -332,7 +338,7 @@ print_snb_fence(unsigned int devid, uint64_t fence)
 static void
 print_i965_fence(unsigned int devid, uint64_t fence)
 {
-	printf("    %svalid, %c-tiled, pitch: %i, start: 0x%08x, size: %u\n",
+	fprintf(out, "    %svalid, %c-tiled, pitch: %i, start: 0x%08x, size: %u\n",
 			fence & 1 ? "" : "in",
 			fence & (1<<1) ? 'y' : 'x',
 			(int)(((fence>>2)&0x1ff)+1)*128,
@@ -349,7 +355,7 @@ print_i915_fence(unsigned int devid, uint64_t fence)
 	else
 		tile_width = 512;
 
-	printf("    %svalid, %c-tiled, pitch: %i, start: 0x%08x, size: %i\n",
+	fprintf(out, "    %svalid, %c-tiled, pitch: %i, start: 0x%08x, size: %i\n",
 			fence & 1 ? "" : "in",
 			fence & (1<<12) ? 'y' : 'x',
 			(1<<((fence>>4)&0xf))*tile_width,
@@ -360,7 +366,7 @@ print_i915_fence(unsigned int devid, uint64_t fence)
 static void
 print_i830_fence(unsigned int devid, uint64_t fence)
 {
-	printf("    %svalid, %c-tiled, pitch: %i, start: 0x%08x, size: %i\n",
+	fprintf(out, "    %svalid, %c-tiled, pitch: %i, start: 0x%08x, size: %i\n",
 			fence & 1 ? "" : "in",
 			fence & (1<<12) ? 'y' : 'x',
 			(1<<((fence>>4)&0xf))*128,
@@ -402,22 +408,22 @@ print_fault_reg(unsigned devid, uint32_t reg)
 		return;
 
 	if (reg & (1 << 0))
-		printf("    Valid\n");
+		fprintf(out, "    Valid\n");
 	else
 		return;
 
 	if (intel_gen(devid) < 8)
-		printf("    %s Fault (%s)\n", gen7_types[reg >> 1 & 0x3],
-		       reg & (1 << 11) ? "GGTT" : "PPGTT");
+		fprintf(out, "    %s Fault (%s)\n", gen7_types[reg >> 1 & 0x3],
+			     reg & (1 << 11) ? "GGTT" : "PPGTT");
 	else
-		printf("    Invalid %s Fault\n", gen8_types[reg >> 1 & 0x3]);
+		fprintf(out, "    Invalid %s Fault\n", gen8_types[reg >> 1 & 0x3]);
 
 	if (intel_gen(devid) < 8)
-		printf("    Address 0x%08x\n", reg & ~((1 << 12)-1));
+		fprintf(out, "    Address 0x%08x\n", reg & ~((1 << 12)-1));
 	else
-		printf("    Engine %s\n", engine[reg >> 12 & 0x7]);
+		fprintf(out, "    Engine %s\n", engine[reg >> 12 & 0x7]);
 
-	printf("    Source ID %d\n", reg >> 3 & 0xff);
+	fprintf(out, "    Source ID %d\n", reg >> 3 & 0xff);
 }
 
 static void
@@ -429,48 +435,110 @@ print_fault_data(unsigned devid, uint32_t data1, uint32_t data0)
 		return;
 
 	address = ((uint64_t)(data0) << 12) | ((uint64_t)data1 & 0xf) << 44;
-	printf("    Address 0x%016" PRIx64 " %s\n", address,
-	       data1 & (1 << 4) ? "GGTT" : "PPGTT");
+	fprintf(out, "    Address 0x%016" PRIx64 " %s\n", address,
+		     data1 & (1 << 4) ? "GGTT" : "PPGTT");
 }
 
 #define MAX_RINGS 10 /* I really hope this never... */
 
-static void decode(struct drm_intel_decode *ctx,
-		   const char *buffer_name,
-		   const char *ring_name,
-		   uint64_t gtt_offset,
-		   uint32_t head_offset,
-		   uint32_t *data, int *count,
-		   int decode)
+static struct {
+	unsigned int threads;
+	const char *rings;	/* comma separated prefixes, or all */
+	const char *buffers;	/* comma separated names, or all */
+	bool disasm;
+	bool json;
+} options = {
+	.disasm = true,
+};
+
+static void print_buffer(FILE *f,
+			 const char *buffer_name,
+			 const char *ring_name,
+			 uint64_t gtt_offset,
+			 uint32_t head_offset)
 {
-	if (!*count)
-		return;
-
-	printf("%s (%s) at 0x%08x_%08x", buffer_name, ring_name,
-	       (unsigned)(gtt_offset >> 32),
-	       (unsigned)(gtt_offset & 0xffffffff));
+	fprintf(f, "%s (%s) at 0x%08x_%08x", buffer_name, ring_name,
+		(unsigned)(gtt_offset >> 32),
+		(unsigned)(gtt_offset & 0xffffffff));
 	if (head_offset != -1)
-		printf("; HEAD points to: 0x%08x_%08x",
-		       (unsigned)((head_offset + gtt_offset) >> 32),
-		       (unsigned)((head_offset + gtt_offset) & 0xffffffff));
-	printf("\n");
+		fprintf(f, "; HEAD points to: 0x%08x_%08x",
+			(unsigned)((head_offset + gtt_offset) >> 32),
+			(unsigned)((head_offset + gtt_offset) & 0xffffffff));
+	fprintf(f, "\n");
+}
 
-	if (decode) {
+static void decode(FILE *f,
+		   struct drm_intel_decode *ctx,
+		   uint64_t gtt_offset,
+		   uint32_t *data, int count)
+{
+	if (ctx) {
 		drm_intel_decode_set_batch_pointer(ctx, data, gtt_offset,
-						   *count);
+						   count);
 		drm_intel_decode(ctx);
 	} else {
-		for (int i = 0; i + 4 < *count; i += 4)
-			printf("[%04x] %08x %08x %08x %08x\n",
-			       4*i, data[i], data[i+1], data[i+2], data[i+3]);
+		for (int i = 0; i + 4 < count; i += 4)
+			fprintf(f, "[%04x] %08x %08x %08x %08x\n",
+				4*i, data[i], data[i+1], data[i+2], data[i+3]);
+	}
+}
+
+static void json_string(FILE *f, const char *s, size_t len)
+{
+	fputc('"', f);
+	for (; len--; s++) {
+		switch (*s) {
+		case '"':
+		case '\\':
+			fprintf(f, "\\%c", *s);
+			break;
+		case '\n':
+			fputs("\\n", f);
+			break;
+		case '\t':
+			fputs("\\t", f);
+			break;
+		default:
+			if ((unsigned char)*s < 0x20)
+				fprintf(f, "\\u%04x", *s);
+			else
+				fputc(*s, f);
+		}
+	}
+	fputc('"', f);
+}
+
+/* An array of the lines of text, optionally without leading blanks. */
+static void json_lines(FILE *f, const char *text, size_t len, bool trim)
+{
+	const char *end = text + len;
+	bool first = true;
+
+	fputc('[', f);
+	while (text < end) {
+		const char *eol = memchr(text, '\n', end - text) ?: end;
+		const char *s = text;
+
+		if (trim)
+			while (s < eol && (*s == ' ' || *s == '\t'))
+				s++;
+
+		if (s < eol) {
+			if (!first)
+				fputs(", ", f);
+			json_string(f, s, eol - s);
+			first = false;
+		}
+
+		text = eol + 1;
 	}
-	*count = 0;
+	fputc(']', f);
 }
 
 static int zlib_inflate(uint32_t **ptr, int len)
 {
 	struct z_stream_s zstream;
-	void *out;
+	void *buf;
 
 	memset(&zstream, 0, sizeof(zstream));
 
@@ -480,8 +548,9 @@ static int zlib_inflate(uint32_t **ptr, int len)
 	if (inflateInit(&zstream) != Z_OK)
 		return 0;
 
-	out = malloc(128*4096); /* approximate obj size */
-	zstream.next_out = out;
+	/* approximate obj size, but never less than we tell zlib we have */
+	buf = malloc(40*len > 128*4096 ? 40*len : 128*4096);
+	zstream.next_out = buf;
 	zstream.avail_out = 40*len;
 
 	do {
@@ -498,28 +567,28 @@ static int zlib_inflate(uint32_t **ptr, int len)
 		if (zstream.avail_out)
 			break;
 
-		out = realloc(out, 2*zstream.total_out);
-		if (out == NULL) {
+		buf = realloc(buf, 2*zstream.total_out);
+		if (buf == NULL) {
 			inflateEnd(&zstream);
 			return 0;
 		}
 
-		zstream.next_out = (unsigned char *)out + zstream.total_out;
+		zstream.next_out = (unsigned char *)buf + zstream.total_out;
 		zstream.avail_out = zstream.total_out;
 	} while (1);
 end:
 	inflateEnd(&zstream);
 	free(*ptr);
-	*ptr = out;
+	*ptr = buf;
 	return zstream.total_out / 4;
 }
 
-static int ascii85_decode(const char *in, uint32_t **out, bool inflate)
+static int ascii85_decode(const char *in, uint32_t **data, bool inflate)
 {
 	int len = 0, size = 1024;
 
-	*out = realloc(*out, sizeof(uint32_t)*size);
-	if (*out == NULL)
+	*data = realloc(*data, sizeof(uint32_t)*size);
+	if (*data == NULL)
 		return 0;
 
 	while (*in >= '!' && *in <= 'z') {
@@ -527,8 +596,8 @@ static int ascii85_decode(const char *in, uint32_t **out, bool inflate)
 
 		if (len == size) {
 			size *= 2;
-			*out = realloc(*out, sizeof(uint32_t)*size);
-			if (*out == NULL)
+			*data = realloc(*data, sizeof(uint32_t)*size);
+			if (*data == NULL)
 				return 0;
 		}
 
@@ -542,20 +611,525 @@ static int ascii85_decode(const char *in, uint32_t **out, bool inflate)
 			v += in[4] - 33;
 			in += 5;
 		}
-		(*out)[len++] = v;
+		(*data)[len++] = v;
 	}
 
 	if (!inflate)
 		return len;
 
-	return zlib_inflate(out, len);
+	return zlib_inflate(data, len);
+}
+
+/*
+ * The error state is decoded as a pipeline. read_data_file() splits it into
+ * chunks in file order: the text it prints for the registers as it reads
+ * them, and the buffers, which are left to a pool of workers to ascii85
+ * decode, inflate and disassemble. A writer prints the chunks in order as
+ * they complete. libdrm's decoder keeps state in globals, so the workers take
+ * turns in file order for the disassembly itself, and the output is the same
+ * as if everything was done in sequence.
+ */
+struct chunk {
+	struct chunk *next;		/* in file order */
+	struct chunk *next_work;	/* buffers waiting for a worker */
+
+	char *text;			/* output, valid once done */
+	size_t len;
+	bool done;
+	bool failed;
+
+	/* buffer contents, either ascii85 or already read as dwords */
+	char *line;
+	bool inflate;
+	uint32_t *data;
+	int count;
+
+	struct buffer_info {
+		const char *name;
+		char *ring_name;
+		uint64_t gtt_offset;
+		uint32_t head_offset;
+		uint32_t devid;
+		uint32_t acthd;
+		bool has_acthd;
+		int do_decode;
+	} info;
+	bool disasm;
+	unsigned long ticket;		/* turn to disassemble */
+};
+
+static struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct chunk *head, **tail;
+	struct chunk *work, **work_tail;
+	unsigned int inflight, max_inflight;
+	unsigned long ticket, next_ticket;
+	bool eof;
+} pipeline = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.tail = &pipeline.head,
+	.work_tail = &pipeline.work,
+};
+
+static struct chunk *text_chunk;
+
+static struct chunk *chunk_alloc(void)
+{
+	struct chunk *c = calloc(1, sizeof(*c));
+
+	if (!c) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+
+	return c;
+}
+
+static void chunk_free(struct chunk *c)
+{
+	free(c->text);
+	free(c->line);
+	free(c->data);
+	free(c->info.ring_name);
+	free(c);
+}
+
+/* Append c to the output, waiting while too much of it is pending. */
+static void chunk_queue(struct chunk *c, bool work)
+{
+	pthread_mutex_lock(&pipeline.mutex);
+	while (pipeline.inflight >= pipeline.max_inflight)
+		pthread_cond_wait(&pipeline.cond, &pipeline.mutex);
+
+	pipeline.inflight++;
+	*pipeline.tail = c;
+	pipeline.tail = &c->next;
+
+	if (work) {
+		*pipeline.work_tail = c;
+		pipeline.work_tail = &c->next_work;
+	}
+
+	pthread_cond_broadcast(&pipeline.cond);
+	pthread_mutex_unlock(&pipeline.mutex);
+}
+
+static void chunk_done(struct chunk *c)
+{
+	pthread_mutex_lock(&pipeline.mutex);
+	c->done = true;
+	pthread_cond_broadcast(&pipeline.cond);
+	pthread_mutex_unlock(&pipeline.mutex);
+}
+
+static void text_begin(void)
+{
+	text_chunk = chunk_alloc();
+	out = open_memstream(&text_chunk->text, &text_chunk->len);
+	if (!out) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+
+	chunk_queue(text_chunk, false);
+}
+
+static void text_end(void)
+{
+	fclose(out);
+	out = NULL;
+
+	chunk_done(text_chunk);
+	text_chunk = NULL;
+}
+
+/* A comma separated list of names, or of their prefixes. */
+static bool name_selected(const char *list, const char *name, bool prefix)
+{
+	if (!list)
+		return true;
+
+	if (!name)
+		name = "";
+
+	for (;;) {
+		size_t len = strcspn(list, ",");
+
+		if (len && strncasecmp(list, name, len) == 0 &&
+		    (prefix || name[len] == '\0'))
+			return true;
+
+		if (!list[len])
+			return false;
+
+		list += len + 1;
+	}
+}
+
+static void disasm_wait(unsigned long ticket)
+{
+	pthread_mutex_lock(&pipeline.mutex);
+	while (pipeline.ticket != ticket)
+		pthread_cond_wait(&pipeline.cond, &pipeline.mutex);
+	pthread_mutex_unlock(&pipeline.mutex);
+}
+
+static void disasm_next(void)
+{
+	pthread_mutex_lock(&pipeline.mutex);
+	pipeline.ticket++;
+	pthread_cond_broadcast(&pipeline.cond);
+	pthread_mutex_unlock(&pipeline.mutex);
+}
+
+static void json_buffer(FILE *f, const struct chunk *c)
+{
+	const char *ring = c->info.ring_name ?: "";
+
+	fprintf(f, "{\"type\": \"buffer\", \"ring\": ");
+	json_string(f, ring, strlen(ring));
+	fprintf(f, ", \"name\": ");
+	json_string(f, c->info.name, strlen(c->info.name));
+	fprintf(f, ", \"gtt_offset\": %" PRIu64 ", \"size\": %u",
+		c->info.gtt_offset, 4 * c->count);
+	if (c->info.head_offset != -1)
+		fprintf(f, ", \"head_offset\": %u", c->info.head_offset);
+}
+
+static void decode_chunk(struct chunk *c)
+{
+	struct drm_intel_decode *ctx = NULL;
+	char *decoded = NULL;
+	size_t decoded_len = 0;
+	FILE *f, *contents;
+
+	/* JSON always has the size of the buffer */
+	if (c->line && (options.disasm || options.json)) {
+		c->count = ascii85_decode(c->line + 1, &c->data, c->inflate);
+		if (c->count == 0)
+			c->failed = true;
+	}
+	free(c->line);
+	c->line = NULL;
+
+	f = open_memstream(&c->text, &c->len);
+	contents = f;
+	if (options.json && options.disasm)
+		contents = open_memstream(&decoded, &decoded_len);
+	if (!f || !contents) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+
+	if (c->disasm)
+		disasm_wait(c->ticket);
+
+	if (!c->failed) {
+		if (c->disasm) {
+			ctx = drm_intel_decode_context_alloc(c->info.devid);
+			drm_intel_decode_set_output_file(ctx, contents);
+			if (c->info.has_acthd)
+				drm_intel_decode_set_head_tail(ctx,
+							       c->info.acthd,
+							       0xffffffff);
+		}
+
+		if (options.json)
+			json_buffer(f, c);
+		else
+			print_buffer(f, c->info.name, c->info.ring_name,
+				     c->info.gtt_offset, c->info.head_offset);
+
+		if (options.disasm)
+			decode(contents, ctx, c->info.gtt_offset,
+			       c->data, c->count);
+
+		if (ctx)
+			drm_intel_decode_context_free(ctx);
+	}
+
+	if (c->disasm)
+		disasm_next();
+
+	if (contents != f) {
+		fclose(contents);
+		if (!c->failed) {
+			fprintf(f, ", \"decoded\": ");
+			json_lines(f, decoded, decoded_len, false);
+		}
+		free(decoded);
+	}
+
+	if (options.json && !c->failed)
+		fprintf(f, "}");
+
+	fclose(f);
+
+	free(c->data);
+	c->data = NULL;
+}
+
+static void *worker(void *arg)
+{
+	for (;;) {
+		struct chunk *c;
+
+		pthread_mutex_lock(&pipeline.mutex);
+		while (!pipeline.work && !pipeline.eof)
+			pthread_cond_wait(&pipeline.cond, &pipeline.mutex);
+
+		c = pipeline.work;
+		if (c) {
+			pipeline.work = c->next_work;
+			if (!pipeline.work)
+				pipeline.work_tail = &pipeline.work;
+		}
+		pthread_mutex_unlock(&pipeline.mutex);
+
+		if (!c)
+			break;
+
+		decode_chunk(c);
+		chunk_done(c);
+	}
+
+	return NULL;
+}
+
+static void *writer(void *arg)
+{
+	for (;;) {
+		struct chunk *c;
+
+		pthread_mutex_lock(&pipeline.mutex);
+		while (!(pipeline.head && pipeline.head->done) &&
+		       !(pipeline.eof && !pipeline.head))
+			pthread_cond_wait(&pipeline.cond, &pipeline.mutex);
+
+		c = pipeline.head;
+		if (c) {
+			pipeline.head = c->next;
+			if (!pipeline.head)
+				pipeline.tail = &pipeline.head;
+		}
+		pthread_mutex_unlock(&pipeline.mutex);
+
+		if (!c)
+			break;
+
+		if (c->failed) {
+			fflush(stdout);
+			fprintf(stderr, "ASCII85 decode failed.\n");
+			exit(1);
+		}
+
+		fwrite(c->text, 1, c->len, stdout);
+		chunk_free(c);
+
+		pthread_mutex_lock(&pipeline.mutex);
+		pipeline.inflight--;
+		pthread_cond_broadcast(&pipeline.cond);
+		pthread_mutex_unlock(&pipeline.mutex);
+	}
+
+	fflush(stdout);
+
+	return NULL;
+}
+
+/*
+ * With --json the error state is written as one JSON object, with the lines
+ * as an array of records in file order. Lines of the form "NAME: VALUE" are
+ * fields, the fields indented under "RING command stream:" are gathered into
+ * that ring's record, and buffers are records of their own. Whatever the
+ * register decoders print for a line goes along with it, so the document
+ * carries the same information as the text output, and it is streamed out
+ * like that.
+ */
+static struct {
+	bool first;		/* no record written yet */
+	bool ring;		/* inside a ring's record */
+	bool ring_first;	/* no field in the ring's record yet */
+} json = {
+	.first = true,
+};
+
+static void json_record(void)
+{
+	fprintf(out, "%s", json.first ? "\n  " : ",\n  ");
+	json.first = false;
+}
+
+static void json_ring_end(void)
+{
+	if (!json.ring)
+		return;
+
+	fprintf(out, "]}");
+	json.ring = false;
+}
+
+/* Numbers in hex with 0x, or in decimal, else the text. */
+static void json_value(const char *value, size_t len)
+{
+	unsigned long long v = 0;
+	const char *end;
+	char *endp;
+
+	end = value;
+	while (end < value + len && *end != ' ' && *end != '\t')
+		end++;
+
+	errno = 0;
+	if (!strncasecmp(value, "0x", 2) && end > value + 2)
+		v = strtoull(value + 2, &endp, 16);
+	else if (*value >= '0' && *value <= '9')
+		v = strtoull(value, &endp, 10);
+	else
+		endp = NULL;
+
+	if (endp == end && !errno) {
+		fprintf(out, "\"value\": %llu", v);
+		if (end < value + len) {
+			fprintf(out, ", \"text\": ");
+			json_string(out, value, len);
+		}
+	} else {
+		fprintf(out, "\"value\": ");
+		json_string(out, value, len);
+	}
+}
+
+static void json_line(const char *line,
+		      const char *decoded, size_t decoded_len)
+{
+	size_t len = strcspn(line, "\n");
+	const char *name, *sep, *value;
+	size_t name_len;
+	bool indented;
+	unsigned int index;
+	unsigned long long fence;
+
+	while (len && (line[len - 1] == ' ' || line[len - 1] == '\r'))
+		len--;
+	if (!len)
+		return;
+
+	indented = line[0] == ' ' || line[0] == '\t';
+	if (!indented)
+		json_ring_end();
+
+	name = line;
+	while (*name == ' ' || *name == '\t')
+		name++;
+
+	if (!indented && len > 16 &&
+	    !strncmp(line + len - 16, " command stream:", 16)) {
+		json_record();
+		fprintf(out, "{\"type\": \"ring\", \"name\": ");
+		json_string(out, line, len - 16);
+		fprintf(out, ", \"registers\": [");
+		json.ring = true;
+		json.ring_first = true;
+		return;
+	}
+
+	if (json.ring) {
+		fprintf(out, "%s", json.ring_first ? "\n    " : ",\n    ");
+		json.ring_first = false;
+	} else {
+		json_record();
+	}
+
+	if (sscanf(line, "  fence[%u] = %Lx", &index, &fence) == 2) {
+		fprintf(out, "{\"type\": \"fence\", \"index\": %u, "
+			"\"value\": %llu", index, fence);
+	} else if ((sep = memchr(name, ':', line + len - name)) &&
+		   sep > name) {
+		name_len = sep - name;
+		value = sep + 1;
+		while (value < line + len && (*value == ' ' || *value == '\t'))
+			value++;
+
+		fprintf(out, "{%s\"name\": ",
+			json.ring ? "" : "\"type\": \"field\", ");
+		json_string(out, name, name_len);
+		fprintf(out, ", ");
+		json_value(value, line + len - value);
+	} else {
+		fprintf(out, "{%s\"text\": ",
+			json.ring ? "" : "\"type\": \"text\", ");
+		json_string(out, name, line + len - name);
+	}
+
+	if (decoded_len) {
+		fprintf(out, ", \"decode\": ");
+		json_lines(out, decoded, decoded_len, true);
+	}
+	fprintf(out, "}");
+}
+
+/*
+ * Pass the buffer on to the workers: the ascii85 in *line, or else the dwords
+ * read so far, if any.
+ */
+static void queue_buffer(const struct buffer_info *b, char **line,
+			 uint32_t **data, int *data_size, int *count)
+{
+	struct chunk *c;
+
+	if (!line && !*count)
+		return;
+
+	if (!name_selected(options.rings, b->ring_name, true) ||
+	    !name_selected(options.buffers, b->name, false)) {
+		if (!line)
+			*count = 0;
+		return;
+	}
+
+	c = chunk_alloc();
+	if (line) {
+		c->line = *line;
+		c->inflate = c->line[0] == ':';
+		*line = NULL;
+	} else {
+		c->data = *data;
+		c->count = *count;
+		*data = NULL;
+		*data_size = 0;
+		*count = 0;
+	}
+
+	if (options.json) {
+		json_ring_end();
+		json_record();
+	}
+
+	c->info = *b;
+	if (b->ring_name)
+		c->info.ring_name = strdup(b->ring_name);
+	c->disasm = b->do_decode && options.disasm;
+	if (c->disasm)
+		c->ticket = pipeline.next_ticket++;
+
+	text_end();
+	chunk_queue(c, true);
+	text_begin();
 }
 
 static void
 read_data_file(FILE *file)
 {
-	struct drm_intel_decode *decode_ctx = NULL;
-	uint32_t devid = PCI_CHIP_I855_GM;
+	pthread_t *threads;
+	struct buffer_info info = {
+		.name = "batch buffer",
+		.head_offset = -1,
+		.devid = PCI_CHIP_I855_GM,
+		.do_decode = 1,
+	};
 	uint32_t *data = NULL;
 	uint32_t head[MAX_RINGS];
 	int head_idx = 0;
@@ -565,25 +1139,30 @@ read_data_file(FILE *file)
 	char *line = NULL;
 	size_t line_size;
 	uint32_t offset, value, ring_length = 0;
-	uint64_t gtt_offset = 0;
-	uint32_t head_offset = -1;
-	const char *buffer_name = "batch buffer";
-	char *ring_name = NULL;
-	int do_decode = 1;
+	unsigned int i;
+
+	threads = calloc(options.threads + 1, sizeof(*threads));
+	if (!threads) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+
+	/* Enough to keep the workers busy while the writer catches up */
+	pipeline.max_inflight = 4 * options.threads + 2;
+
+	pthread_create(&threads[0], NULL, writer, NULL);
+	for (i = 1; i <= options.threads; i++)
+		pthread_create(&threads[i], NULL, worker, NULL);
+
+	text_begin();
+	if (options.json)
+		fprintf(out, "{\"records\": [");
 
 	while (getline(&line, &line_size, file) > 0) {
 		char *dashes;
 
 		if (line[0] == ':' || line[0] == '~') {
-			count = ascii85_decode(line+1, &data, line[0] == ':');
-			if (count == 0) {
-				fprintf(stderr, "ASCII85 decode failed.\n");
-				exit(1);
-			}
-			decode(decode_ctx,
-			       buffer_name, ring_name,
-			       gtt_offset, head_offset,
-			       data, &count, do_decode);
+			queue_buffer(&info, &line, NULL, NULL, NULL);
 			continue;
 		}
 
@@ -611,15 +1190,12 @@ read_data_file(FILE *file)
 			strncpy(new_ring_name, line, dashes - line);
 			new_ring_name[dashes - line - 1] = '\0';
 
-			decode(decode_ctx,
-			       buffer_name, ring_name,
-			       gtt_offset, head_offset,
-			       data, &count, do_decode);
-			gtt_offset = 0;
-			head_offset = -1;
+			queue_buffer(&info, NULL, &data, &data_size, &count);
+			info.gtt_offset = 0;
+			info.head_offset = -1;
 
-			free(ring_name);
-			ring_name = new_ring_name;
+			free(info.ring_name);
+			info.ring_name = new_ring_name;
 
 			dashes += 4;
 			for (b = buffers; b->match; b++) {
@@ -636,17 +1212,17 @@ read_data_file(FILE *file)
 				matched = sscanf(dashes, "= 0x%08x %08x\n",
 						 &hi, &lo);
 				if (matched > 0) {
-					gtt_offset = hi;
+					info.gtt_offset = hi;
 					if (matched == 2) {
-						gtt_offset <<= 32;
-						gtt_offset |= lo;
+						info.gtt_offset <<= 32;
+						info.gtt_offset |= lo;
 					}
 				}
 
-				do_decode = b->do_decode;
-				buffer_name = b->name;
-				if (b == buffers)
-					head_offset = head[head_idx++];
+				info.do_decode = b->do_decode;
+				info.name = b->name;
+				if (b == buffers && head_idx < num_rings)
+					info.head_offset = head[head_idx++];
 				break;
 			}
 
@@ -656,14 +1232,24 @@ read_data_file(FILE *file)
 		matched = sscanf(line, "%08x : %08x", &offset, &value);
 		if (matched != 2) {
 			unsigned int reg, reg2;
+			FILE *text = NULL;
+			char *decoded;
+			size_t len;
 
 			/* display reg section is after the ringbuffers, don't mix them */
-			decode(decode_ctx,
-			       buffer_name, ring_name,
-			       gtt_offset, head_offset,
-			       data, &count, do_decode);
+			queue_buffer(&info, NULL, &data, &data_size, &count);
+
+			/* Gather what is printed for the line to turn into JSON */
+			if (options.json) {
+				text = out;
+				out = open_memstream(&decoded, &len);
+				if (!out) {
+					fprintf(stderr, "Out of memory.\n");
+					exit(1);
+				}
+			}
 
-			printf("%s", line);
+			fprintf(out, "%s", line);
 
 			matched = sscanf(line, "PCI ID: 0x%04x\n", &reg);
 			if (matched == 0)
@@ -674,11 +1260,11 @@ read_data_file(FILE *file)
 					matched = sscanf(pci_id_start, "PCI ID: 0x%04x\n", &reg);
 			}
 			if (matched == 1) {
-				devid = reg;
-				printf("Detected GEN%i chipset\n",
-						intel_gen(devid));
+				info.devid = reg;
+				fprintf(out, "Detected GEN%i chipset\n",
+					intel_gen(info.devid));
 
-				decode_ctx = drm_intel_decode_context_alloc(devid);
+				info.has_acthd = false;
 			}
 
 			matched = sscanf(line, "  CTL: 0x%08x\n", &reg);
@@ -687,42 +1273,53 @@ read_data_file(FILE *file)
 
 			matched = sscanf(line, "  HEAD: 0x%08x\n", &reg);
 			if (matched == 1) {
-				head[num_rings++] = print_head(reg);
+				reg = print_head(reg);
+				if (num_rings < MAX_RINGS)
+					head[num_rings++] = reg;
 			}
 
 			matched = sscanf(line, "  ACTHD: 0x%08x\n", &reg);
 			if (matched == 1) {
 				print_acthd(reg, ring_length);
-				drm_intel_decode_set_head_tail(decode_ctx, reg, 0xffffffff);
+				info.acthd = reg;
+				info.has_acthd = true;
 			}
 
 			matched = sscanf(line, "  PGTBL_ER: 0x%08x\n", &reg);
 			if (matched == 1 && reg)
-				print_pgtbl_err(reg, devid);
+				print_pgtbl_err(reg, info.devid);
 
 			matched = sscanf(line, "  ERROR: 0x%08x\n", &reg);
 			if (matched == 1 && reg)
-				print_error(reg, devid);
+				print_error(reg, info.devid);
 
 			matched = sscanf(line, "  INSTDONE: 0x%08x\n", &reg);
 			if (matched == 1)
-				print_instdone(devid, reg, -1);
+				print_instdone(info.devid, reg, -1);
 
 			matched = sscanf(line, "  INSTDONE1: 0x%08x\n", &reg);
 			if (matched == 1)
-				print_instdone(devid, -1, reg);
+				print_instdone(info.devid, -1, reg);
 
 			matched = sscanf(line, "  fence[%i] = %Lx\n", &reg, &fence);
 			if (matched == 2)
-				print_fence(devid, fence);
+				print_fence(info.devid, fence);
 
 			matched = sscanf(line, "  FAULT_REG: 0x%08x\n", &reg);
 			if (matched == 1 && reg)
-				print_fault_reg(devid, reg);
+				print_fault_reg(info.devid, reg);
 
 			matched = sscanf(line, "  FAULT_TLB_DATA: 0x%08x 0x%08x\n", &reg, &reg2);
 			if (matched == 2)
-				print_fault_data(devid, reg, reg2);
+				print_fault_data(info.devid, reg, reg2);
+
+			if (options.json) {
+				fclose(out);
+				out = text;
+				json_line(line, decoded + strlen(line),
+					  len - strlen(line));
+				free(decoded);
+			}
 
 			continue;
 		}
@@ -741,14 +1338,26 @@ read_data_file(FILE *file)
 		data[count-1] = value;
 	}
 
-	decode(decode_ctx,
-	       buffer_name, ring_name,
-	       gtt_offset, head_offset,
-	       data, &count, do_decode);
+	queue_buffer(&info, NULL, &data, &data_size, &count);
+
+	if (options.json) {
+		json_ring_end();
+		fprintf(out, "\n]}\n");
+	}
+	text_end();
+
+	pthread_mutex_lock(&pipeline.mutex);
+	pipeline.eof = true;
+	pthread_cond_broadcast(&pipeline.cond);
+	pthread_mutex_unlock(&pipeline.mutex);
+
+	for (i = 0; i <= options.threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
 
 	free(data);
 	free(line);
-	free(ring_name);
+	free(info.ring_name);
 }
 
 static void setup_pager(void)
@@ -775,35 +1384,97 @@ static void setup_pager(void)
 	}
 }
 
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+			"intel_gpu_decode: Parse an Intel GPU i915_error_state\n"
+			"Usage:\n"
+			"\t%s [<options>] [<file>]\n"
+			"\n"
+			"With no arguments, debugfs-dri-directory is probed for in "
+			"/debug and \n"
+			"/sys/kernel/debug.  Otherwise, it may be "
+			"specified.  If a file is given,\n"
+			"it is parsed as an GPU dump in the format of "
+			"/debug/dri/0/i915_error_state.\n"
+			"\n"
+			"Options:\n"
+			"\t-j, --threads=N\t\tdecode buffers using N threads\n"
+			"\t-r, --ring=NAME[,...]\tonly show buffers of rings whose "
+			"names start with NAME\n"
+			"\t-b, --buffer=NAME[,...]\tonly show buffers of these kinds, "
+			"e.g. batch,ring\n"
+			"\t-n, --no-disasm\t\tonly show where the buffers are, "
+			"not their contents\n"
+			"\t-J, --json\t\twrite a JSON document instead of text\n",
+			prog);
+}
+
 int
 main(int argc, char *argv[])
 {
+	static const struct option long_options[] = {
+		{ "threads", required_argument, NULL, 'j' },
+		{ "ring", required_argument, NULL, 'r' },
+		{ "buffer", required_argument, NULL, 'b' },
+		{ "no-disasm", no_argument, NULL, 'n' },
+		{ "json", no_argument, NULL, 'J' },
+		{ "help", no_argument, NULL, 'h' },
+		{ }
+	};
 	FILE *file;
 	const char *path;
 	char *filename = NULL;
 	struct stat st;
-	int error;
-
-	if (argc > 2) {
-		fprintf(stderr,
-				"intel_gpu_decode: Parse an Intel GPU i915_error_state\n"
-				"Usage:\n"
-				"\t%s [<file>]\n"
-				"\n"
-				"With no arguments, debugfs-dri-directory is probed for in "
-				"/debug and \n"
-				"/sys/kernel/debug.  Otherwise, it may be "
-				"specified.  If a file is given,\n"
-				"it is parsed as an GPU dump in the format of "
-				"/debug/dri/0/i915_error_state.\n",
-				argv[0]);
+	int error, threads, c;
+
+	while ((c = getopt_long(argc, argv, "j:r:b:nJh",
+				long_options, NULL)) != -1) {
+		switch (c) {
+		case 'j':
+			threads = atoi(optarg);
+			if (threads <= 0) {
+				usage(argv[0]);
+				return 1;
+			}
+			options.threads = threads;
+			break;
+		case 'r':
+			options.rings = optarg;
+			break;
+		case 'b':
+			options.buffers = optarg;
+			break;
+		case 'n':
+			options.disasm = false;
+			break;
+		case 'J':
+			options.json = true;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (argc - optind > 1) {
+		usage(argv[0]);
 		return 1;
 	}
 
-	if (isatty(1))
+	if (!options.threads) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		options.threads = cpus > 0 ? cpus : 1;
+	}
+
+	if (isatty(1) && !options.json)
 		setup_pager();
 
-	if (argc == 1) {
+	if (optind == argc) {
 		if (isatty(0)) {
 			path = "/sys/class/drm/card0/error";
 			error = stat(path, &st);
@@ -826,7 +1497,7 @@ main(int argc, char *argv[])
 			exit(0);
 		}
 	} else {
-		path = argv[1];
+		path = argv[optind];
 		error = stat(path, &st);
 		if (error != 0) {
 			fprintf(stderr, "Error opening %s: %s\n",
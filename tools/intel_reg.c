@@ -21,15 +21,22 @@
  * SOFTWARE.
  */
 
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <inttypes.h>
 #include <limits.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "igt.h"
@@ -54,6 +61,12 @@ static inline int _not_supported(void)
 
 #endif /* HAVE_SYS_IO_H */
 
+enum format {
+	FORMAT_TEXT,
+	FORMAT_CSV,
+	FORMAT_RAW,
+};
+
 struct config {
 	struct pci_device *pci_dev;
 	char *mmiofile;
@@ -72,10 +85,19 @@ struct config {
 	/* spread out bits for convenience */
 	bool binary;
 
+	/* read and sample: output format */
+	enum format format;
+
+	/* sample: period in microseconds and number of samples, 0 for no limit */
+	uint32_t interval;
+	uint64_t samples;
+
 	/* register spec */
 	char *specfile;
 	struct reg *regs;
 	ssize_t regcount;
+	struct reg_index *index;
+	struct reg_db *db;
 
 	int verbosity;
 };
@@ -84,28 +106,22 @@ struct config {
 static int set_reg_by_addr(struct config *config, struct reg *reg,
 			   uint32_t addr)
 {
-	int i;
+	const struct reg *r;
 
 	reg->addr = addr;
 	if (reg->name)
 		free(reg->name);
 	reg->name = NULL;
 
-	for (i = 0; i < config->regcount; i++) {
-		struct reg *r = &config->regs[i];
-
-		if (reg->port_desc.port != r->port_desc.port)
-			continue;
-
-		/* ->mmio_offset should be 0 for non-MMIO ports. */
-		if (addr + reg->mmio_offset == r->addr + r->mmio_offset) {
-			/* Always output the "normalized" offset+addr. */
-			reg->mmio_offset = r->mmio_offset;
-			reg->addr = r->addr;
+	/* ->mmio_offset should be 0 for non-MMIO ports. */
+	r = intel_reg_index_find_addr(config->index, reg->port_desc.port,
+				      addr + reg->mmio_offset);
+	if (r) {
+		/* Always output the "normalized" offset+addr. */
+		reg->mmio_offset = r->mmio_offset;
+		reg->addr = r->addr;
 
-			reg->name = r->name ? strdup(r->name) : NULL;
-			break;
-		}
+		reg->name = r->name ? strdup(r->name) : NULL;
 	}
 
 	return 0;
@@ -115,32 +131,22 @@ static int set_reg_by_addr(struct config *config, struct reg *reg,
 static int set_reg_by_name(struct config *config, struct reg *reg,
 			   const char *name)
 {
-	int i;
+	const struct reg *r;
 
 	reg->name = strdup(name);
 	reg->addr = 0;
 
-	for (i = 0; i < config->regcount; i++) {
-		struct reg *r = &config->regs[i];
-
-		if (reg->port_desc.port != r->port_desc.port)
-			continue;
-
-		if (!r->name)
-			continue;
-
-		if (strcasecmp(name, r->name) == 0) {
-			reg->addr = r->addr;
+	r = intel_reg_index_find_name(config->index, reg->port_desc.port, name);
+	if (!r)
+		return -1;
 
-			/* Also get MMIO offset if not already specified. */
-			if (!reg->mmio_offset && r->mmio_offset)
-				reg->mmio_offset = r->mmio_offset;
+	reg->addr = r->addr;
 
-			return 0;
-		}
-	}
+	/* Also get MMIO offset if not already specified. */
+	if (!reg->mmio_offset && r->mmio_offset)
+		reg->mmio_offset = r->mmio_offset;
 
-	return -1;
+	return 0;
 }
 
 static void to_binary(char *buf, size_t buflen, uint32_t val)
@@ -237,22 +243,14 @@ static void dump_decode(struct config *config, struct reg *reg, uint32_t val)
 	}
 }
 
-static int read_register(struct config *config, struct reg *reg, uint32_t *valp)
+/* Whether the register's port can be read on this device at all */
+static int check_register_port(struct config *config, struct reg *reg)
 {
-	uint32_t val = 0;
-
 	switch (reg->port_desc.port) {
 	case PORT_MMIO:
-		val = INREG(reg->mmio_offset + reg->addr);
-		break;
 	case PORT_PORTIO_VGA:
-		iopl(3);
-		val = inb(reg->addr);
-		iopl(0);
-		break;
 	case PORT_MMIO_VGA:
-		val = INREG8(reg->addr);
-		break;
+		return 0;
 	case PORT_BUNIT:
 	case PORT_PUNIT:
 	case PORT_NC:
@@ -268,13 +266,41 @@ static int read_register(struct config *config, struct reg *reg, uint32_t *valp)
 				reg->port_desc.name);
 			return -1;
 		}
-		val = intel_iosf_sb_read(reg->port_desc.port, reg->addr);
-		break;
+		return 0;
 	default:
 		fprintf(stderr, "port %d not supported\n", reg->port_desc.port);
 		return -1;
 	}
+}
+
+/* Read a register that passed check_register_port() */
+static uint32_t __read_register(struct reg *reg)
+{
+	uint32_t val;
+
+	switch (reg->port_desc.port) {
+	case PORT_MMIO:
+		return INREG(reg->mmio_offset + reg->addr);
+	case PORT_PORTIO_VGA:
+		iopl(3);
+		val = inb(reg->addr);
+		iopl(0);
+		return val;
+	case PORT_MMIO_VGA:
+		return INREG8(reg->addr);
+	default:
+		return intel_iosf_sb_read(reg->port_desc.port, reg->addr);
+	}
+}
+
+static int read_register(struct config *config, struct reg *reg, uint32_t *valp)
+{
+	uint32_t val;
+
+	if (check_register_port(config, reg))
+		return -1;
 
+	val = __read_register(reg);
 	if (valp)
 		*valp = val;
 
@@ -398,7 +424,127 @@ static int parse_reg(struct config *config, struct reg *reg, const char *s)
 	return ret;
 }
 
-/* XXX: add support for register ranges, maybe REGISTER..REGISTER */
+/* Far more than any sensible range, and still a reasonable allocation */
+#define MAX_RANGE_REGS (1 << 20)
+
+/*
+ * Parse REGISTER, or REGISTER..REGISTER for all the registers in between, into
+ * an array of registers to read. Return the number of registers, or -1.
+ */
+static int parse_reg_range(struct config *config, const char *s,
+			   struct reg **regsp)
+{
+	struct reg *regs, reg, last;
+	const char *dots;
+	uint32_t end;
+	uint64_t n;
+	int i;
+
+	dots = strstr(s, "..");
+	if (dots) {
+		char *first = strndup(s, dots - s);
+		int ret;
+
+		ret = parse_reg(config, &reg, first);
+		free(first);
+		if (ret)
+			return -1;
+
+		if (parse_reg(config, &last, dots + 2)) {
+			free(reg.name);
+			return -1;
+		}
+		free(last.name);
+
+		end = last.mmio_offset + last.addr;
+		if (last.port_desc.port != reg.port_desc.port ||
+		    end < reg.mmio_offset + reg.addr) {
+			fprintf(stderr, "invalid register range '%s'\n", s);
+			free(reg.name);
+			return -1;
+		}
+
+		n = (uint64_t)(end - reg.mmio_offset - reg.addr) /
+			reg.port_desc.stride + 1;
+	} else {
+		if (parse_reg(config, &reg, s))
+			return -1;
+
+		n = config->count;
+	}
+
+	if (n > MAX_RANGE_REGS) {
+		fprintf(stderr, "too many registers in '%s' (max %d)\n",
+			s, MAX_RANGE_REGS);
+		free(reg.name);
+		return -1;
+	}
+
+	regs = calloc(n, sizeof(*regs));
+	if (!regs) {
+		fprintf(stderr, "Error: %s\n", strerror(ENOMEM));
+		free(reg.name);
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		regs[i] = reg;
+		regs[i].name = reg.name ? strdup(reg.name) : NULL;
+
+		/* Update addr and name. */
+		set_reg_by_addr(config, &reg, reg.addr + reg.port_desc.stride);
+	}
+	free(reg.name);
+
+	*regsp = regs;
+
+	return n;
+}
+
+static void free_regs(struct reg *regs, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		free(regs[i].name);
+	free(regs);
+}
+
+/*
+ * Read registers whose port and address are already resolved, back to back,
+ * so that the values are as close to a single point in time as possible.
+ * Return the number of registers that could not be read.
+ */
+static int read_registers(struct config *config, struct reg *regs,
+			  uint32_t *vals, bool *valid, int n)
+{
+	int i, failed = 0;
+
+	for (i = 0; i < n; i++) {
+		valid[i] = read_register(config, &regs[i], &vals[i]) == 0;
+		if (!valid[i])
+			failed++;
+	}
+
+	return failed;
+}
+
+static void csv_address(FILE *f, const struct reg *reg)
+{
+	if (reg->port_desc.port == PORT_MMIO)
+		fprintf(f, "0x%08x", reg->mmio_offset + reg->addr);
+	else
+		fprintf(f, "%s:0x%08x", reg->port_desc.name, reg->addr);
+}
+
+static void csv_name(FILE *f, const struct reg *reg)
+{
+	if (reg->name)
+		fprintf(f, "%s", reg->name);
+	else
+		csv_address(f, reg);
+}
+
 static int intel_reg_read(struct config *config, int argc, char *argv[])
 {
 	int i, j;
@@ -413,18 +559,55 @@ static int intel_reg_read(struct config *config, int argc, char *argv[])
 	else
 		intel_register_access_init(config->pci_dev, 0, config->drm_fd);
 
+	if (config->format == FORMAT_CSV)
+		printf("register,address,value\n");
+
 	for (i = 1; i < argc; i++) {
-		struct reg reg;
+		struct reg *regs;
+		uint32_t *vals;
+		bool *valid;
+		int n;
 
-		if (parse_reg(config, &reg, argv[i]))
+		n = parse_reg_range(config, argv[i], &regs);
+		if (n < 0)
+			continue;
+
+		vals = calloc(n, sizeof(*vals));
+		valid = calloc(n, sizeof(*valid));
+		if (!vals || !valid) {
+			fprintf(stderr, "Error: %s\n", strerror(ENOMEM));
+			free(valid);
+			free(vals);
+			free_regs(regs, n);
 			continue;
+		}
 
-		for (j = 0; j < config->count; j++) {
-			dump_register(config, &reg);
-			/* Update addr and name. */
-			set_reg_by_addr(config, &reg,
-					reg.addr + reg.port_desc.stride);
+		/* Read them all before spending any time on the output. */
+		read_registers(config, regs, vals, valid, n);
+
+		for (j = 0; j < n; j++) {
+			if (!valid[j])
+				continue;
+
+			switch (config->format) {
+			case FORMAT_TEXT:
+				dump_decode(config, &regs[j], vals[j]);
+				break;
+			case FORMAT_CSV:
+				csv_name(stdout, &regs[j]);
+				putchar(',');
+				csv_address(stdout, &regs[j]);
+				printf(",0x%08x\n", vals[j]);
+				break;
+			case FORMAT_RAW:
+				fwrite(&vals[j], sizeof(vals[j]), 1, stdout);
+				break;
+			}
 		}
+
+		free(valid);
+		free(vals);
+		free_regs(regs, n);
 	}
 
 	intel_register_access_fini();
@@ -432,6 +615,269 @@ static int intel_reg_read(struct config *config, int argc, char *argv[])
 	return EXIT_SUCCESS;
 }
 
+/*
+ * Samples are written to a preallocated single producer, single consumer ring
+ * by the sampling thread and drained to the output by the main thread, so the
+ * sampling period is never held up by the output. Each slot is a timestamp
+ * followed by one value per register.
+ */
+struct sample_ring {
+	struct config *config;
+	struct reg *regs;
+	int nregs;
+
+	uint64_t *slots;
+	unsigned int slot_size;		/* in uint64_t */
+	unsigned int capacity;		/* in slots, power of two */
+	unsigned int head;		/* written by the sampler */
+	unsigned int tail;		/* written by the writer */
+
+	uint64_t interval_ns;
+	uint64_t samples;
+	uint64_t dropped;
+	uint64_t missed;
+	bool done;
+};
+
+static volatile sig_atomic_t sample_stop;
+
+static void sample_signal(int sig)
+{
+	sample_stop = 1;
+}
+
+static uint64_t timespec_ns(const struct timespec *ts)
+{
+	return ts->tv_sec * 1000000000ull + ts->tv_nsec;
+}
+
+static void *sample_thread(void *arg)
+{
+	struct sample_ring *ring = arg;
+	struct timespec next, now;
+	uint64_t start, i;
+	uint32_t *vals;
+
+	vals = calloc(ring->nregs, sizeof(*vals));
+	if (!vals)
+		goto out;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	start = timespec_ns(&next);
+
+	for (i = 0; !ring->samples || i < ring->samples; i++) {
+		unsigned int head = ring->head;
+		unsigned int tail = __atomic_load_n(&ring->tail,
+						    __ATOMIC_ACQUIRE);
+		uint64_t *slot;
+		int j;
+
+		if (sample_stop)
+			break;
+
+		/* All checked to be readable, so nothing to report here. */
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		for (j = 0; j < ring->nregs; j++)
+			vals[j] = __read_register(&ring->regs[j]);
+
+		if (head - tail == ring->capacity) {
+			ring->dropped++;
+		} else {
+			slot = &ring->slots[(head & (ring->capacity - 1)) *
+					    ring->slot_size];
+			slot[0] = timespec_ns(&now) - start;
+			for (j = 0; j < ring->nregs; j++)
+				slot[1 + j] = vals[j];
+
+			/* Publish the slot contents with the new head. */
+			__atomic_store_n(&ring->head, head + 1,
+					 __ATOMIC_RELEASE);
+		}
+
+		if (!ring->interval_ns)
+			continue;
+
+		next.tv_nsec += ring->interval_ns % 1000000000;
+		next.tv_sec += ring->interval_ns / 1000000000 +
+			next.tv_nsec / 1000000000;
+		next.tv_nsec %= 1000000000;
+
+		/* Skip periods we are already late for instead of bursting. */
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		while (timespec_ns(&next) <= timespec_ns(&now)) {
+			ring->missed++;
+			next.tv_nsec += ring->interval_ns % 1000000000;
+			next.tv_sec += ring->interval_ns / 1000000000 +
+				next.tv_nsec / 1000000000;
+			next.tv_nsec %= 1000000000;
+		}
+
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+				       &next, NULL) == EINTR && !sample_stop)
+			;
+	}
+
+out:
+	free(vals);
+
+	__atomic_store_n(&ring->done, true, __ATOMIC_RELEASE);
+
+	return NULL;
+}
+
+static void sample_output(struct sample_ring *ring, const uint64_t *slot)
+{
+	int j;
+
+	if (ring->config->format == FORMAT_RAW) {
+		uint32_t vals[ring->nregs];
+
+		for (j = 0; j < ring->nregs; j++)
+			vals[j] = slot[1 + j];
+
+		fwrite(&slot[0], sizeof(slot[0]), 1, stdout);
+		fwrite(vals, sizeof(vals[0]), ring->nregs, stdout);
+		return;
+	}
+
+	printf("%"PRIu64, slot[0]);
+	for (j = 0; j < ring->nregs; j++)
+		printf(",0x%08"PRIx32, (uint32_t)slot[1 + j]);
+	putchar('\n');
+}
+
+/*
+ * Drain the ring. Return the number of samples written, or -1 once the sampler
+ * is done and everything has been written.
+ */
+static int sample_drain(struct sample_ring *ring)
+{
+	unsigned int head, tail = ring->tail;
+	bool done = __atomic_load_n(&ring->done, __ATOMIC_ACQUIRE);
+	int n = 0;
+
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+	for (; tail != head; tail++, n++)
+		sample_output(ring, &ring->slots[(tail & (ring->capacity - 1)) *
+						 ring->slot_size]);
+
+	/* Finish reading the slots before handing them back to the sampler. */
+	__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+	return done && !n ? -1 : n;
+}
+
+static int intel_reg_sample(struct config *config, int argc, char *argv[])
+{
+	struct sample_ring ring = {
+		.config = config,
+		.interval_ns = config->interval * 1000ull,
+		.samples = config->samples,
+	};
+	struct sigaction sa = { .sa_handler = sample_signal };
+	pthread_t thread;
+	uint64_t per_sec;
+	int i, j, n, ret = EXIT_FAILURE;
+
+	if (argc == 1) {
+		fprintf(stderr, "sample: no registers specified\n");
+		return EXIT_FAILURE;
+	}
+
+	if (config->mmiofile)
+		intel_mmio_use_dump_file(config->mmiofile);
+	else
+		intel_register_access_init(config->pci_dev, 0, config->drm_fd);
+
+	/* Resolve everything up front, the sampler only does register reads. */
+	for (i = 1; i < argc; i++) {
+		struct reg *regs, *tmp;
+
+		n = parse_reg_range(config, argv[i], &regs);
+		if (n < 0)
+			goto out;
+
+		tmp = realloc(ring.regs, (ring.nregs + n) * sizeof(*tmp));
+		if (!tmp) {
+			free_regs(regs, n);
+			goto out;
+		}
+
+		ring.regs = tmp;
+		memcpy(&ring.regs[ring.nregs], regs, n * sizeof(*regs));
+		ring.nregs += n;
+		free(regs);
+	}
+
+	/* A register that can't be read would only ever sample as garbage. */
+	for (j = 0; j < ring.nregs; j++) {
+		if (check_register_port(config, &ring.regs[j])) {
+			fprintf(stderr, "sample: cannot read ");
+			csv_name(stderr, &ring.regs[j]);
+			fputc('\n', stderr);
+			goto out;
+		}
+	}
+
+	/* Buffer about a second of samples, the writer drains much faster. */
+	per_sec = ring.interval_ns ? 1000000000ull / ring.interval_ns : 1000000;
+	ring.capacity = 1024;
+	while (ring.capacity < per_sec && ring.capacity < 1 << 20)
+		ring.capacity <<= 1;
+
+	ring.slot_size = 1 + ring.nregs;
+	ring.slots = malloc((size_t)ring.capacity * ring.slot_size *
+			    sizeof(*ring.slots));
+	if (!ring.slots) {
+		fprintf(stderr, "Error: %s\n", strerror(ENOMEM));
+		goto out;
+	}
+
+	/* Fault the ring in now rather than from the sampler. */
+	memset(ring.slots, 0,
+	       (size_t)ring.capacity * ring.slot_size * sizeof(*ring.slots));
+
+	if (config->format != FORMAT_RAW) {
+		printf("time_ns");
+		for (j = 0; j < ring.nregs; j++) {
+			putchar(',');
+			csv_name(stdout, &ring.regs[j]);
+		}
+		putchar('\n');
+	}
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	if (pthread_create(&thread, NULL, sample_thread, &ring)) {
+		fprintf(stderr, "Error: failed to start sampling\n");
+		goto out;
+	}
+
+	while ((n = sample_drain(&ring)) >= 0) {
+		if (!n)
+			usleep(5000);
+	}
+
+	pthread_join(thread, NULL);
+	fflush(stdout);
+
+	if (ring.dropped || ring.missed)
+		fprintf(stderr, "sample: %"PRIu64" samples dropped, "
+			"%"PRIu64" periods missed\n", ring.dropped, ring.missed);
+
+	ret = EXIT_SUCCESS;
+
+out:
+	free(ring.slots);
+	free_regs(ring.regs, ring.nregs);
+
+	intel_register_access_fini();
+
+	return ret;
+}
+
 static int intel_reg_write(struct config *config, int argc, char *argv[])
 {
 	int i;
@@ -518,7 +964,161 @@ static int intel_reg_snapshot(struct config *config, int argc, char *argv[])
 	return EXIT_SUCCESS;
 }
 
-/* XXX: add support for reading and re-decoding a previously done dump */
+struct snapshot {
+	const char *filename;
+	const void *data;
+	size_t size;
+};
+
+static int snapshot_open(struct snapshot *snap, const char *filename)
+{
+	struct stat st;
+	int fd;
+
+	snap->filename = filename;
+	snap->data = NULL;
+	snap->size = 0;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st)) {
+		fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	if (st.st_size < sizeof(uint32_t)) {
+		fprintf(stderr, "%s: not an MMIO snapshot\n", filename);
+		close(fd);
+		return -1;
+	}
+
+	snap->data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (snap->data == MAP_FAILED) {
+		fprintf(stderr, "%s: mmap: %s\n", filename, strerror(errno));
+		snap->data = NULL;
+		return -1;
+	}
+	snap->size = st.st_size;
+
+	/* Registers are visited in spec order, not in file order. */
+	madvise((void *)snap->data, snap->size, MADV_WILLNEED);
+
+	return 0;
+}
+
+static void snapshot_close(struct snapshot *snap)
+{
+	if (snap->data)
+		munmap((void *)snap->data, snap->size);
+	snap->data = NULL;
+}
+
+/* Only MMIO registers are in the snapshot, sideband is never captured. */
+static int snapshot_read(const struct snapshot *snap, const struct reg *reg,
+			 uint32_t *valp)
+{
+	size_t offset;
+
+	if (reg->port_desc.port != PORT_MMIO)
+		return -1;
+
+	offset = (size_t)reg->mmio_offset + reg->addr;
+	if (offset > snap->size - sizeof(*valp))
+		return -1;
+
+	memcpy(valp, (const char *)snap->data + offset, sizeof(*valp));
+
+	return 0;
+}
+
+static int intel_reg_snapshot_decode(struct config *config,
+				     int argc, char *argv[])
+{
+	struct snapshot snap;
+	int i, j, ret = EXIT_SUCCESS;
+
+	if (argc == 1) {
+		fprintf(stderr, "snapshot-decode: no snapshots specified\n");
+		return EXIT_FAILURE;
+	}
+
+	for (i = 1; i < argc; i++) {
+		if (snapshot_open(&snap, argv[i])) {
+			ret = EXIT_FAILURE;
+			continue;
+		}
+
+		if (argc > 2)
+			printf("%s%s:\n", i > 1 ? "\n" : "", snap.filename);
+
+		for (j = 0; j < config->regcount; j++) {
+			struct reg *reg = &config->regs[j];
+			uint32_t val;
+
+			if (snapshot_read(&snap, reg, &val) == 0)
+				dump_decode(config, reg, val);
+		}
+
+		snapshot_close(&snap);
+	}
+
+	return ret;
+}
+
+static int intel_reg_snapshot_diff(struct config *config,
+				   int argc, char *argv[])
+{
+	struct snapshot base, snap;
+	int i, j, ret = EXIT_SUCCESS;
+
+	if (argc < 3) {
+		fprintf(stderr, "snapshot-diff: need at least two snapshots\n");
+		return EXIT_FAILURE;
+	}
+
+	if (snapshot_open(&base, argv[1]))
+		return EXIT_FAILURE;
+
+	for (i = 2; i < argc; i++) {
+		if (snapshot_open(&snap, argv[i])) {
+			ret = EXIT_FAILURE;
+			continue;
+		}
+
+		printf("%s--- %s\n+++ %s\n", i > 2 ? "\n" : "",
+		       base.filename, snap.filename);
+
+		/* A register past the end of one snapshot only gets one side */
+		for (j = 0; j < config->regcount; j++) {
+			struct reg *reg = &config->regs[j];
+			uint32_t old, new;
+			bool has_old, has_new;
+
+			has_old = snapshot_read(&base, reg, &old) == 0;
+			has_new = snapshot_read(&snap, reg, &new) == 0;
+			if (has_old == has_new && (!has_old || old == new))
+				continue;
+
+			if (has_old) {
+				printf("-");
+				dump_decode(config, reg, old);
+			}
+			if (has_new) {
+				printf("+");
+				dump_decode(config, reg, new);
+			}
+		}
+
+		snapshot_close(&snap);
+	}
+
+	snapshot_close(&base);
+
+	return ret;
+}
+
 static int intel_reg_decode(struct config *config, int argc, char *argv[])
 {
 	int i;
@@ -572,15 +1172,23 @@ struct command {
 	const char *description;
 	const char *synopsis;
 	int (*function)(struct config *config, int argc, char *argv[]);
+	/* no register access, works with just --devid on any machine */
+	bool offline;
 };
 
 static const struct command commands[] = {
 	{
 		.name = "read",
 		.function = intel_reg_read,
-		.synopsis = "[--count=N] REGISTER [...]",
+		.synopsis = "[--count=N] REGISTER[..REGISTER] [...]",
 		.description = "read and decode specified register(s)",
 	},
+	{
+		.name = "sample",
+		.function = intel_reg_sample,
+		.synopsis = "[--interval=USECS] [--samples=N] REGISTER[..REGISTER] [...]",
+		.description = "sample specified register(s) periodically",
+	},
 	{
 		.name = "write",
 		.function = intel_reg_write,
@@ -597,12 +1205,27 @@ static const struct command commands[] = {
 		.function = intel_reg_decode,
 		.synopsis = "REGISTER VALUE [REGISTER VALUE ...]",
 		.description = "decode value(s) for specified register(s)",
+		.offline = true,
 	},
 	{
 		.name = "snapshot",
 		.function = intel_reg_snapshot,
 		.description = "create a snapshot of the MMIO bar to stdout",
 	},
+	{
+		.name = "snapshot-decode",
+		.function = intel_reg_snapshot_decode,
+		.synopsis = "FILE [...]",
+		.description = "decode all known registers in MMIO snapshot(s)",
+		.offline = true,
+	},
+	{
+		.name = "snapshot-diff",
+		.function = intel_reg_snapshot_diff,
+		.synopsis = "BASE FILE [...]",
+		.description = "show registers that differ from BASE snapshot",
+		.offline = true,
+	},
 	{
 		.name = "list",
 		.function = intel_reg_list,
@@ -623,14 +1246,15 @@ static int intel_reg_help(struct config *config, int argc, char *argv[])
 	printf("Usage: intel_reg [OPTION ...] COMMAND\n\n");
 	printf("COMMAND is one of:\n");
 	for (i = 0; i < ARRAY_SIZE(commands); i++) {
-		printf("  %-14s%s\n", commands[i].name,
+		printf("  %-16s%s\n", commands[i].name,
 		       commands[i].synopsis ?: "");
-		printf("  %-14s%s\n", "", commands[i].description);
+		printf("  %-16s%s\n", "", commands[i].description);
 	}
 
 	printf("\n");
 	printf("REGISTER is defined as:\n");
         printf("  [(PORTNAME|PORTNUM|MMIO-OFFSET):](REGNAME|REGADDR)\n");
+	printf("REGISTER..REGISTER is the range of registers between the two.\n");
 
 	printf("\n");
 	printf("PORTNAME is one of:\n");
@@ -641,9 +1265,12 @@ static int intel_reg_help(struct config *config, int argc, char *argv[])
 	printf("OPTIONS common to most COMMANDS:\n");
 	printf(" --spec=PATH    Read register spec from directory or file\n");
 	printf(" --mmio=FILE    Use an MMIO snapshot\n");
-	printf(" --devid=DEVID  Specify PCI device ID for --mmio=FILE\n");
+	printf(" --devid=DEVID  Specify PCI device ID for --mmio=FILE and snapshots\n");
 	printf(" --all          Decode registers for all known platforms\n");
 	printf(" --binary       Binary dump registers\n");
+	printf(" --format=FMT   Output text, csv or raw 32-bit values (read, sample)\n");
+	printf(" --interval=US  Sampling period in microseconds, 0 for no delay\n");
+	printf(" --samples=N    Number of samples to take, 0 until interrupted\n");
 	printf(" --verbose      Increase verbosity\n");
 	printf(" --quiet        Reduce verbosity\n");
 
@@ -662,6 +1289,39 @@ static const char *get_codename(uint32_t devid)
 	return intel_get_device_info(devid)->codename;
 }
 
+/*
+ * Get the name of the i'th spec file candidate for devid, in order of
+ * preference. Return false when there are no more.
+ */
+static bool get_reg_spec_name(char *buf, size_t buflen, uint32_t devid, int i)
+{
+	const char *codename;
+
+	switch (i) {
+	case 0:
+		/* First, try file named after devid, e.g. "0412" for Haswell GT2. */
+		snprintf(buf, buflen, "%04x", devid);
+		return true;
+	case 1:
+		/*
+		 * Second, for gen5+, try file named after codename, e.g.
+		 * "haswell" for Haswell.
+		 */
+		codename = get_codename(devid);
+		snprintf(buf, buflen, "%s", codename ?: "");
+		return true;
+	case 2:
+		/*
+		 * Third, try file named after gen, e.g. "gen7" for Haswell
+		 * (which is technically 7.5 but this is how it works).
+		 */
+		snprintf(buf, buflen, "gen%d", intel_gen(devid));
+		return true;
+	default:
+		return false;
+	}
+}
+
 /*
  * Get register definitions filename for devid in dir. Return 0 if found,
  * negative error code otherwise.
@@ -669,33 +1329,92 @@ static const char *get_codename(uint32_t devid)
 static int get_reg_spec_file(char *buf, size_t buflen, const char *dir,
 			     uint32_t devid)
 {
-	const char *codename;
+	char name[NAME_MAX];
+	int i;
 
-	/* First, try file named after devid, e.g. "0412" for Haswell GT2. */
-	snprintf(buf, buflen, "%s/%04x", dir, devid);
-	if (!access(buf, F_OK))
-		return 0;
+	for (i = 0; get_reg_spec_name(name, sizeof(name), devid, i); i++) {
+		if (!*name)
+			continue;
 
-	/*
-	 * Second, for gen5+, try file named after codename, e.g. "haswell" for
-         * Haswell.
-	 */
-	codename = get_codename(devid);
-	if (codename) {
-		snprintf(buf, buflen, "%s/%s", dir, codename);
+		snprintf(buf, buflen, "%s/%s", dir, name);
 		if (!access(buf, F_OK))
 			return 0;
 	}
 
-	/*
-	 * Third, try file named after gen, e.g. "gen7" for Haswell (which is
-	 * technically 7.5 but this is how it works).
-	 */
-	snprintf(buf, buflen, "%s/gen%d", dir, intel_gen(devid));
-	if (!access(buf, F_OK))
+	return -ENOENT;
+}
+
+/*
+ * Read register spec and index for devid from the precompiled database at
+ * path. Return the number of registers, 0 if path is not a database, or
+ * negative error code.
+ */
+static int read_reg_db(struct config *config, const char *path)
+{
+	char name[NAME_MAX];
+	ssize_t r = -ENOENT;
+	int i;
+
+	config->db = intel_reg_db_open(path);
+	if (!config->db)
 		return 0;
 
-	return -ENOENT;
+	for (i = 0; get_reg_spec_name(name, sizeof(name), config->devid, i); i++) {
+		if (!*name)
+			continue;
+
+		r = intel_reg_db_spec(config->db, name,
+				      &config->regs, &config->index);
+		if (r != -ENOENT)
+			break;
+	}
+
+	if (r <= 0) {
+		intel_reg_db_close(config->db);
+		config->db = NULL;
+		return r ?: -ENOENT;
+	}
+
+	config->regcount = r;
+
+	return r;
+}
+
+/*
+ * Whether any file in the spec directory dir was modified after the
+ * database at path, which would then no longer match the text spec files.
+ */
+static bool reg_db_stale(const char *dir, const char *path)
+{
+	char buf[PATH_MAX];
+	struct stat db, st;
+	struct dirent *de;
+	bool stale = false;
+	DIR *d;
+
+	if (stat(path, &db))
+		return false;
+
+	d = opendir(dir);
+	if (!d)
+		return false;
+
+	while (!stale && (de = readdir(d))) {
+		if (de->d_name[0] == '.')
+			continue;
+
+		snprintf(buf, sizeof(buf), "%s/%s", dir, de->d_name);
+		if (stat(buf, &st) || !S_ISREG(st.st_mode))
+			continue;
+
+		stale = st.st_mtim.tv_sec > db.st_mtim.tv_sec ||
+			(st.st_mtim.tv_sec == db.st_mtim.tv_sec &&
+			 st.st_mtim.tv_nsec > db.st_mtim.tv_nsec);
+	}
+
+	closedir(d);
+
+	return stale;
 }
 
 /*
@@ -724,6 +1443,13 @@ static int read_reg_spec(struct config *config)
 	}
 
 	if (S_ISDIR(st.st_mode)) {
+		snprintf(buf, sizeof(buf), "%s/registers.db", path);
+		if (reg_db_stale(path, buf))
+			fprintf(stderr, "Warning: '%s' is older than the spec "
+				"files. Using the spec files.\n", buf);
+		else if (read_reg_db(config, buf) > 0)
+			return config->regcount;
+
 		r = get_reg_spec_file(buf, sizeof(buf), path, config->devid);
 		if (r) {
 			fprintf(stderr, "Warning: register spec not found in "
@@ -731,6 +1457,15 @@ static int read_reg_spec(struct config *config)
 			goto builtin;
 		}
 		path = buf;
+	} else {
+		r = read_reg_db(config, path);
+		if (r > 0)
+			return config->regcount;
+		if (r < 0) {
+			fprintf(stderr, "Warning: register spec not found in "
+				"'%s'. Using builtin register spec.\n", path);
+			goto builtin;
+		}
 	}
 
 	config->regcount = intel_reg_spec_file(&config->regs, path);
@@ -762,6 +1497,9 @@ enum opt {
 	OPT_VERBOSE,
 	OPT_QUIET,
 	OPT_HELP,
+	OPT_FORMAT,
+	OPT_INTERVAL,
+	OPT_SAMPLES,
 };
 
 int main(int argc, char *argv[])
@@ -772,6 +1510,7 @@ int main(int argc, char *argv[])
 	const struct command *command = NULL;
 	struct config config = {
 		.count = 1,
+		.interval = 1000,
 	};
 	bool help = false;
 
@@ -791,6 +1530,11 @@ int main(int argc, char *argv[])
 		/* options specific to read, dump and decode */
 		{ "all",	no_argument,		NULL,	OPT_ALL },
 		{ "binary",	no_argument,		NULL,	OPT_BINARY },
+		/* options specific to read and sample */
+		{ "format",	required_argument,	NULL,	OPT_FORMAT },
+		/* options specific to sample */
+		{ "interval",	required_argument,	NULL,	OPT_INTERVAL },
+		{ "samples",	required_argument,	NULL,	OPT_SAMPLES },
 		{ 0 }
 	};
 
@@ -837,6 +1581,32 @@ int main(int argc, char *argv[])
 		case OPT_BINARY:
 			config.binary = true;
 			break;
+		case OPT_FORMAT:
+			if (strcmp(optarg, "text") == 0) {
+				config.format = FORMAT_TEXT;
+			} else if (strcmp(optarg, "csv") == 0) {
+				config.format = FORMAT_CSV;
+			} else if (strcmp(optarg, "raw") == 0) {
+				config.format = FORMAT_RAW;
+			} else {
+				fprintf(stderr, "invalid format '%s'\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_INTERVAL:
+			config.interval = strtoul(optarg, &endp, 10);
+			if (*endp) {
+				fprintf(stderr, "invalid interval '%s'\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_SAMPLES:
+			config.samples = strtoull(optarg, &endp, 10);
+			if (*endp) {
+				fprintf(stderr, "invalid samples '%s'\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
 		case OPT_VERBOSE:
 			config.verbosity++;
 			break;
@@ -864,13 +1634,25 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	for (i = 0; i < ARRAY_SIZE(commands); i++) {
+		if (strcmp(argv[0], commands[i].name) == 0) {
+			command = &commands[i];
+			break;
+		}
+	}
+
+	if (!command) {
+		fprintf(stderr, "'%s' is not an intel-reg command\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	config.drm_fd = -1;
 	if (config.mmiofile) {
 		if (!config.devid) {
 			fprintf(stderr, "--mmio requires --devid\n");
 			return EXIT_FAILURE;
 		}
-	} else {
-		/* XXX: devid without --mmio could be useful for decode. */
+	} else if (!command->offline || !config.devid) {
 		if (config.devid) {
 			fprintf(stderr, "--devid without --mmio\n");
 			return EXIT_FAILURE;
@@ -880,26 +1662,25 @@ int main(int argc, char *argv[])
 	}
 
 	/* Just to make sure we open the right debugfs files */
-	config.drm_fd = __drm_open_driver(DRIVER_INTEL);
+	if (!command->offline || config.pci_dev)
+		config.drm_fd = __drm_open_driver(DRIVER_INTEL);
 
 	if (read_reg_spec(&config) < 0) {
 		return EXIT_FAILURE;
 	}
 
-	for (i = 0; i < ARRAY_SIZE(commands); i++) {
-		if (strcmp(argv[0], commands[i].name) == 0) {
-			command = &commands[i];
-			break;
-		}
-	}
-
-	if (!command) {
-		fprintf(stderr, "'%s' is not an intel-reg command\n", argv[0]);
+	if (!config.index)
+		config.index = intel_reg_index_create(config.regs,
+						      config.regcount);
+	if (!config.index) {
+		fprintf(stderr, "Error: %s\n", strerror(ENOMEM));
 		return EXIT_FAILURE;
 	}
 
 	ret = command->function(&config, argc, argv);
 
+	intel_reg_index_free(config.index);
+	intel_reg_db_close(config.db);
 	free(config.mmiofile);
 
 	return ret;
@@ -0,0 +1,102 @@
+/*
+ * Copyright © 2017 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Compile intel_reg spec files into the database intel_reg loads from the
+ * spec directory instead of parsing the text files. Each spec file becomes a
+ * platform named after the file, e.g. "skylake" for registers/skylake.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "intel_reg_spec.h"
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s -o DATABASE SPECFILE [...]\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *output = NULL;
+	const char **platforms;
+	struct reg **regs;
+	ssize_t *nregs;
+	int i, n, c, ret;
+
+	while ((c = getopt(argc, argv, "o:h")) != -1) {
+		switch (c) {
+		case 'o':
+			output = optarg;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	n = argc - optind;
+	if (!output || n <= 0) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	platforms = calloc(n, sizeof(*platforms));
+	regs = calloc(n, sizeof(*regs));
+	nregs = calloc(n, sizeof(*nregs));
+	if (!platforms || !regs || !nregs) {
+		fprintf(stderr, "Error: out of memory\n");
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < n; i++) {
+		const char *file = argv[optind + i];
+		const char *p = strrchr(file, '/');
+
+		platforms[i] = p ? p + 1 : file;
+		nregs[i] = intel_reg_spec_file(&regs[i], file);
+		if (nregs[i] <= 0) {
+			fprintf(stderr, "Error: no registers in '%s'\n", file);
+			return EXIT_FAILURE;
+		}
+	}
+
+	ret = intel_reg_db_write(output, platforms, regs, nregs, n);
+	if (ret)
+		unlink(output);
+
+	for (i = 0; i < n; i++)
+		intel_reg_spec_free(regs[i], nregs[i]);
+	free(nregs);
+	free(regs);
+	free(platforms);
+
+	return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
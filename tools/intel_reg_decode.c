@@ -2673,6 +2673,93 @@ static struct {
 };
 #undef DECLARE_REGS
 
+/*
+ * The known_registers entries applicable to one devid (or all of them for
+ * devid 0), sorted by address and then by their position in known_registers,
+ * which is the order decodes are tried and printed in.
+ */
+struct decode_entry {
+	const struct reg_debug *r;
+	const char *description;
+	int order;
+};
+
+static struct {
+	bool valid;
+	uint32_t devid;
+	struct decode_entry *entries;
+	int count;
+} decode_index;
+
+static int cmp_decode_entry(const void *_a, const void *_b)
+{
+	const struct decode_entry *a = _a, *b = _b;
+
+	if (a->r->reg != b->r->reg)
+		return (uint32_t)a->r->reg < (uint32_t)b->r->reg ? -1 : 1;
+
+	return a->order - b->order;
+}
+
+static int build_decode_index(uint32_t devid)
+{
+	struct decode_entry *entries;
+	int i, j, count = 0;
+
+	for (i = 0; i < ARRAY_SIZE(known_registers); i++)
+		count += known_registers[i].count;
+
+	entries = calloc(count, sizeof(*entries));
+	if (!entries)
+		return -1;
+
+	count = 0;
+	for (i = 0; i < ARRAY_SIZE(known_registers); i++) {
+		if (devid && known_registers[i].match &&
+		    !known_registers[i].match(devid, 0))
+			continue;
+
+		for (j = 0; j < known_registers[i].count; j++) {
+			entries[count].r = &known_registers[i].regs[j];
+			entries[count].description =
+				known_registers[i].description;
+			entries[count].order = count;
+			count++;
+		}
+	}
+
+	qsort(entries, count, sizeof(*entries), cmp_decode_entry);
+
+	free(decode_index.entries);
+	decode_index.entries = entries;
+	decode_index.count = count;
+	decode_index.devid = devid;
+	decode_index.valid = true;
+
+	return 0;
+}
+
+/* The first entry for addr, or NULL. */
+static const struct decode_entry *find_decode_entry(uint32_t addr)
+{
+	int lo = 0, hi = decode_index.count;
+
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+
+		if ((uint32_t)decode_index.entries[mid].r->reg < addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo == decode_index.count ||
+	    (uint32_t)decode_index.entries[lo].r->reg != addr)
+		return NULL;
+
+	return &decode_index.entries[lo];
+}
+
 /*
  * Decode register value into buffer for devid.
  *
@@ -2682,48 +2769,46 @@ static struct {
 int intel_reg_spec_decode(char *buf, size_t bufsize, const struct reg *reg,
 			  uint32_t val, uint32_t devid)
 {
+	const struct decode_entry *e, *end;
 	char tmp[1024];
-	int i, j;
 
 	if (!bufsize)
 		return -1;
 
 	*buf = 0;
 
-	for (i = 0; i < ARRAY_SIZE(known_registers); i++) {
-		const struct reg_debug *regs = known_registers[i].regs;
+	if (!decode_index.valid || decode_index.devid != devid) {
+		if (build_decode_index(devid))
+			return -1;
+	}
 
-		if (devid) {
-			if (known_registers[i].match &&
-			    !known_registers[i].match(devid, 0))
-				continue;
-		}
+	e = find_decode_entry(reg->addr);
+	if (!e)
+		return 0;
 
-		for (j = 0; j < known_registers[i].count; j++) {
-			const struct reg_debug *r = &regs[j];
-			if (reg->addr != r->reg)
-				continue;
+	end = decode_index.entries + decode_index.count;
+	for (; e < end && (uint32_t)e->r->reg == reg->addr; e++) {
+		const struct reg_debug *r = e->r;
 
-			if (r->debug_output) {
-				if (r->debug_output(tmp, sizeof(tmp), r->reg,
-						    val, devid) == 0)
-					continue;
-			} else if (devid) {
-				return 0;
-			} else {
+		if (r->debug_output) {
+			if (r->debug_output(tmp, sizeof(tmp), r->reg,
+					    val, devid) == 0)
 				continue;
-			}
-
-			if (devid) {
-				strncpy(buf, tmp, bufsize);
-				return 0;
-			}
+		} else if (devid) {
+			return 0;
+		} else {
+			continue;
+		}
 
-			strncat(buf, known_registers[i].description, bufsize);
-			strncat(buf, "\t", bufsize);
-			strncat(buf, tmp, bufsize);
-			strncat(buf, "\n", bufsize);
+		if (devid) {
+			strncpy(buf, tmp, bufsize);
+			return 0;
 		}
+
+		strncat(buf, e->description, bufsize);
+		strncat(buf, "\t", bufsize);
+		strncat(buf, tmp, bufsize);
+		strncat(buf, "\n", bufsize);
 	}
 
 	return 0;
@@ -23,12 +23,16 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <regex.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "intel_reg_spec.h"
 
@@ -235,9 +239,9 @@ static int parse_line(struct reg *reg, const char *line)
 			reg->name = p;
 		} else if (i == 2) {
 			reg->addr = strtoul(p, &e, 16);
-			free(p);
 			if (*e)
 				ret = -1;
+			free(p);
 		} else if (i == 3) {
 			ret = parse_port_desc(reg, p);
 			free(p);
@@ -344,6 +348,626 @@ void intel_reg_spec_free(struct reg *regs, size_t n)
 	free(regs);
 }
 
+/*
+ * Sorted views of a register array for lookups by address and by name. Both
+ * keep the array order among equal keys, so lookups return the same register
+ * as a linear scan from the start would.
+ */
+struct reg_index_entry {
+	const struct reg *reg;
+	size_t order;
+	uint32_t addr; /* addr + mmio_offset */
+};
+
+struct reg_index {
+	struct reg_index_entry *by_addr;
+	size_t naddr;
+	struct reg_index_entry *by_name;
+	size_t nname;
+};
+
+static int cmp_order(const struct reg_index_entry *a,
+		     const struct reg_index_entry *b)
+{
+	return (a->order > b->order) - (a->order < b->order);
+}
+
+static int cmp_addr(const void *_a, const void *_b)
+{
+	const struct reg_index_entry *a = _a, *b = _b;
+
+	if (a->reg->port_desc.port != b->reg->port_desc.port)
+		return a->reg->port_desc.port < b->reg->port_desc.port ? -1 : 1;
+
+	if (a->addr != b->addr)
+		return a->addr < b->addr ? -1 : 1;
+
+	return cmp_order(a, b);
+}
+
+static int cmp_name(const void *_a, const void *_b)
+{
+	const struct reg_index_entry *a = _a, *b = _b;
+	int ret;
+
+	if (a->reg->port_desc.port != b->reg->port_desc.port)
+		return a->reg->port_desc.port < b->reg->port_desc.port ? -1 : 1;
+
+	ret = strcasecmp(a->reg->name, b->reg->name);
+	if (ret)
+		return ret;
+
+	return cmp_order(a, b);
+}
+
+/*
+ * Build lookup indices for regs, which must outlive the index.
+ */
+struct reg_index *intel_reg_index_create(const struct reg *regs, size_t n)
+{
+	struct reg_index *index;
+	size_t i;
+
+	index = calloc(1, sizeof(*index));
+	if (!index)
+		return NULL;
+
+	index->by_addr = calloc(n + 1, sizeof(*index->by_addr));
+	index->by_name = calloc(n + 1, sizeof(*index->by_name));
+	if (!index->by_addr || !index->by_name) {
+		intel_reg_index_free(index);
+		return NULL;
+	}
+
+	for (i = 0; i < n; i++) {
+		struct reg_index_entry e = {
+			.reg = &regs[i],
+			.order = i,
+			.addr = regs[i].addr + regs[i].mmio_offset,
+		};
+
+		index->by_addr[index->naddr++] = e;
+		if (regs[i].name)
+			index->by_name[index->nname++] = e;
+	}
+
+	qsort(index->by_addr, index->naddr, sizeof(*index->by_addr), cmp_addr);
+	qsort(index->by_name, index->nname, sizeof(*index->by_name), cmp_name);
+
+	return index;
+}
+
+/* First entry not ordered before key, ignoring the array order. */
+static const struct reg_index_entry *
+lower_bound(const struct reg_index_entry *base, size_t n,
+	    const struct reg_index_entry *key,
+	    int (*cmp)(const void *, const void *))
+{
+	size_t lo = 0, hi = n;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (cmp(&base[mid], key) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo < n ? &base[lo] : NULL;
+}
+
+/*
+ * Find the first register on port at addr, which includes the mmio_offset.
+ */
+const struct reg *intel_reg_index_find_addr(const struct reg_index *index,
+					    enum port_addr port, uint32_t addr)
+{
+	struct reg key_reg = { .port_desc.port = port };
+	struct reg_index_entry key = { .reg = &key_reg, .addr = addr };
+	const struct reg_index_entry *e;
+
+	e = lower_bound(index->by_addr, index->naddr, &key, cmp_addr);
+	if (!e || e->reg->port_desc.port != port || e->addr != addr)
+		return NULL;
+
+	return e->reg;
+}
+
+/*
+ * Find the first register on port called name, ignoring case.
+ */
+const struct reg *intel_reg_index_find_name(const struct reg_index *index,
+					    enum port_addr port,
+					    const char *name)
+{
+	struct reg key_reg = { .port_desc.port = port, .name = (char *)name };
+	struct reg_index_entry key = { .reg = &key_reg };
+	const struct reg_index_entry *e;
+
+	e = lower_bound(index->by_name, index->nname, &key, cmp_name);
+	if (!e || e->reg->port_desc.port != port ||
+	    strcasecmp(e->reg->name, name))
+		return NULL;
+
+	return e->reg;
+}
+
+void intel_reg_index_free(struct reg_index *index)
+{
+	if (!index)
+		return;
+
+	free(index->by_addr);
+	free(index->by_name);
+	free(index);
+}
+
+/*
+ * Precompiled register spec database, written by intel_reg_compile at build
+ * time. It holds the parsed spec of several platforms, each with the
+ * registers in spec file order and their lookup indices already sorted, so
+ * loading it is a matter of mmapping the file. All offsets are in bytes from
+ * the start of the file, names are offsets into the string table, and
+ * everything is in host byte order; a database from a host of the other
+ * endianness is rejected through byteorder.
+ */
+#define REG_DB_MAGIC		"IGTREGDB"
+#define REG_DB_VERSION		1
+#define REG_DB_BYTEORDER	0x01020304
+#define REG_DB_NO_NAME		UINT32_MAX
+
+struct reg_db_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byteorder;
+	uint32_t nplatforms;
+	uint32_t platforms;	/* struct reg_db_platform[nplatforms] */
+	uint32_t strtab;
+	uint32_t strtab_size;
+};
+
+struct reg_db_platform {
+	uint32_t name;
+	uint32_t nregs;
+	uint32_t regs;		/* struct reg_db_reg[nregs] */
+	uint32_t by_addr;	/* uint32_t[nregs], see struct reg_index */
+	uint32_t nnamed;
+	uint32_t by_name;	/* uint32_t[nnamed] */
+};
+
+struct reg_db_reg {
+	uint32_t name;
+	int32_t port;
+	uint32_t mmio_offset;
+	uint32_t addr;
+};
+
+struct reg_db {
+	const void *data;
+	size_t size;
+};
+
+static const struct port_desc *port_desc_by_port(enum port_addr port)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(port_descs); i++)
+		if (port_descs[i].port == port)
+			return &port_descs[i];
+
+	return NULL;
+}
+
+struct db_strtab {
+	char *data;
+	size_t size, alloc;
+	uint32_t *hash;	/* open addressing, offset + 1, 0 for empty */
+	size_t nhash, count;
+};
+
+static uint32_t str_hash(const char *s)
+{
+	uint32_t h = 2166136261u;
+
+	while (*s)
+		h = (h ^ (unsigned char)*s++) * 16777619u;
+
+	return h;
+}
+
+static int strtab_grow_hash(struct db_strtab *t)
+{
+	size_t nhash = t->nhash ? 2 * t->nhash : 1024;
+	uint32_t *hash;
+	size_t i;
+
+	hash = calloc(nhash, sizeof(*hash));
+	if (!hash)
+		return -1;
+
+	for (i = 0; i < t->nhash; i++) {
+		size_t j;
+
+		if (!t->hash[i])
+			continue;
+
+		j = str_hash(t->data + t->hash[i] - 1) & (nhash - 1);
+		while (hash[j])
+			j = (j + 1) & (nhash - 1);
+		hash[j] = t->hash[i];
+	}
+
+	free(t->hash);
+	t->hash = hash;
+	t->nhash = nhash;
+
+	return 0;
+}
+
+/* Add s to the string table once, however many registers share the name. */
+static int64_t strtab_add(struct db_strtab *t, const char *s)
+{
+	size_t len = strlen(s) + 1;
+	size_t j;
+
+	if (2 * (t->count + 1) > t->nhash && strtab_grow_hash(t))
+		return -1;
+
+	j = str_hash(s) & (t->nhash - 1);
+	while (t->hash[j]) {
+		if (strcmp(t->data + t->hash[j] - 1, s) == 0)
+			return t->hash[j] - 1;
+		j = (j + 1) & (t->nhash - 1);
+	}
+
+	if (t->size + len > t->alloc) {
+		size_t alloc = t->alloc ? 2 * t->alloc : 4096;
+		char *data;
+
+		while (alloc < t->size + len)
+			alloc *= 2;
+
+		data = realloc(t->data, alloc);
+		if (!data)
+			return -1;
+
+		t->data = data;
+		t->alloc = alloc;
+	}
+
+	if (t->size + len >= REG_DB_NO_NAME)
+		return -1;
+
+	memcpy(t->data + t->size, s, len);
+	t->hash[j] = t->size + 1;
+	t->count++;
+	t->size += len;
+
+	return t->hash[j] - 1;
+}
+
+static uint32_t db_align(uint32_t offset)
+{
+	return (offset + 7) & ~7u;
+}
+
+static int db_fill_platform(struct reg_db_platform *p, void *data,
+			    const struct reg *regs, size_t n,
+			    struct db_strtab *strtab)
+{
+	struct reg_db_reg *r = (struct reg_db_reg *)((char *)data + p->regs);
+	uint32_t *by_addr = (uint32_t *)((char *)data + p->by_addr);
+	uint32_t *by_name = (uint32_t *)((char *)data + p->by_name);
+	struct reg_index *index;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		int64_t name = -1;
+
+		if (regs[i].name) {
+			name = strtab_add(strtab, regs[i].name);
+			if (name < 0)
+				return -1;
+		}
+
+		r[i].name = regs[i].name ? name : REG_DB_NO_NAME;
+		r[i].port = regs[i].port_desc.port;
+		r[i].mmio_offset = regs[i].mmio_offset;
+		r[i].addr = regs[i].addr;
+	}
+
+	index = intel_reg_index_create(regs, n);
+	if (!index)
+		return -1;
+
+	for (i = 0; i < index->naddr; i++)
+		by_addr[i] = index->by_addr[i].reg - regs;
+	for (i = 0; i < index->nname; i++)
+		by_name[i] = index->by_name[i].reg - regs;
+	p->nnamed = index->nname;
+
+	intel_reg_index_free(index);
+
+	return 0;
+}
+
+/*
+ * Write the register specs of nplatforms platforms to a database file.
+ */
+int intel_reg_db_write(const char *filename, const char * const *platforms,
+		       struct reg * const *regs, const ssize_t *nregs,
+		       int nplatforms)
+{
+	struct reg_db_header *header;
+	struct reg_db_platform *p;
+	struct db_strtab strtab = {};
+	uint32_t size;
+	void *data;
+	FILE *file;
+	int i, ret = -1;
+
+	size = db_align(sizeof(*header));
+	size = db_align(size + nplatforms * sizeof(*p));
+	for (i = 0; i < nplatforms; i++) {
+		size = db_align(size + nregs[i] * sizeof(struct reg_db_reg));
+		size = db_align(size + 2 * nregs[i] * sizeof(uint32_t));
+	}
+
+	data = calloc(1, size);
+	if (!data)
+		return -1;
+
+	header = data;
+	memcpy(header->magic, REG_DB_MAGIC, sizeof(header->magic));
+	header->version = REG_DB_VERSION;
+	header->byteorder = REG_DB_BYTEORDER;
+	header->nplatforms = nplatforms;
+	header->platforms = db_align(sizeof(*header));
+
+	p = (struct reg_db_platform *)((char *)data + header->platforms);
+	size = db_align(header->platforms + nplatforms * sizeof(*p));
+	for (i = 0; i < nplatforms; i++) {
+		int64_t name = strtab_add(&strtab, platforms[i]);
+
+		if (name < 0)
+			goto out;
+
+		p[i].name = name;
+		p[i].nregs = nregs[i];
+		p[i].regs = size;
+		size = db_align(size + nregs[i] * sizeof(struct reg_db_reg));
+		p[i].by_addr = size;
+		p[i].by_name = size + nregs[i] * sizeof(uint32_t);
+		size = db_align(size + 2 * nregs[i] * sizeof(uint32_t));
+
+		if (db_fill_platform(&p[i], data, regs[i], nregs[i], &strtab))
+			goto out;
+	}
+	header->strtab = size;
+	header->strtab_size = strtab.size;
+
+	file = fopen(filename, "w");
+	if (!file) {
+		fprintf(stderr, "Error: fopen '%s': %s\n",
+			filename, strerror(errno));
+		goto out;
+	}
+
+	if (fwrite(data, size, 1, file) == 1 &&
+	    fwrite(strtab.data, strtab.size, 1, file) == 1)
+		ret = 0;
+	if (fclose(file))
+		ret = -1;
+	if (ret)
+		fprintf(stderr, "Error: writing '%s' failed\n", filename);
+
+out:
+	free(strtab.hash);
+	free(strtab.data);
+	free(data);
+
+	return ret;
+}
+
+static bool db_range_ok(const struct reg_db *db, uint32_t offset,
+			uint32_t count, size_t size)
+{
+	return offset % sizeof(uint32_t) == 0 &&
+		offset <= db->size && count <= (db->size - offset) / size;
+}
+
+/*
+ * Map a register spec database. Return NULL if filename is not one, or was
+ * written on a different kind of host.
+ */
+struct reg_db *intel_reg_db_open(const char *filename)
+{
+	const struct reg_db_header *header;
+	struct reg_db *db;
+	struct stat st;
+	void *data;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) || st.st_size < sizeof(*header)) {
+		close(fd);
+		return NULL;
+	}
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return NULL;
+
+	header = data;
+	if (memcmp(header->magic, REG_DB_MAGIC, sizeof(header->magic)) ||
+	    header->version != REG_DB_VERSION ||
+	    header->byteorder != REG_DB_BYTEORDER)
+		goto err;
+
+	db = malloc(sizeof(*db));
+	if (!db)
+		goto err;
+
+	db->data = data;
+	db->size = st.st_size;
+
+	/* The string table must be the NUL terminated tail of the file. */
+	if (!db_range_ok(db, header->platforms, header->nplatforms,
+			 sizeof(struct reg_db_platform)) ||
+	    !header->strtab_size ||
+	    header->strtab > db->size ||
+	    header->strtab_size != db->size - header->strtab ||
+	    ((const char *)data)[db->size - 1]) {
+		free(db);
+		goto err;
+	}
+
+	return db;
+
+err:
+	munmap(data, st.st_size);
+
+	return NULL;
+}
+
+static const char *db_string(const struct reg_db *db, uint32_t offset)
+{
+	const struct reg_db_header *header = db->data;
+
+	if (offset >= header->strtab_size)
+		return NULL;
+
+	return (const char *)db->data + header->strtab + offset;
+}
+
+static bool db_platform_ok(const struct reg_db *db,
+			   const struct reg_db_platform *p)
+{
+	const struct reg_db_reg *r;
+	const uint32_t *idx;
+	uint32_t i;
+
+	if (!db_range_ok(db, p->regs, p->nregs, sizeof(*r)) ||
+	    !db_range_ok(db, p->by_addr, p->nregs, sizeof(*idx)) ||
+	    !db_range_ok(db, p->by_name, p->nnamed, sizeof(*idx)) ||
+	    p->nnamed > p->nregs)
+		return false;
+
+	r = (const struct reg_db_reg *)((const char *)db->data + p->regs);
+	for (i = 0; i < p->nregs; i++) {
+		if (r[i].name != REG_DB_NO_NAME && !db_string(db, r[i].name))
+			return false;
+		if (!port_desc_by_port(r[i].port))
+			return false;
+	}
+
+	idx = (const uint32_t *)((const char *)db->data + p->by_addr);
+	for (i = 0; i < p->nregs; i++)
+		if (idx[i] >= p->nregs)
+			return false;
+
+	idx = (const uint32_t *)((const char *)db->data + p->by_name);
+	for (i = 0; i < p->nnamed; i++)
+		if (idx[i] >= p->nregs || r[idx[i]].name == REG_DB_NO_NAME)
+			return false;
+
+	return true;
+}
+
+/*
+ * Get register definitions and their index for platform from the database.
+ * The register names point into the database, so regs must be released with
+ * free() rather than intel_reg_spec_free(), and db must outlive them. Return
+ * -ENOENT if the database does not have platform.
+ */
+ssize_t intel_reg_db_spec(const struct reg_db *db, const char *platform,
+			  struct reg **regs, struct reg_index **index)
+{
+	const struct reg_db_header *header = db->data;
+	const struct reg_db_platform *p = NULL;
+	const struct reg_db_reg *r;
+	const uint32_t *idx;
+	struct reg_index *ri;
+	struct reg *rs;
+	uint32_t i;
+
+	for (i = 0; i < header->nplatforms; i++) {
+		const struct reg_db_platform *q =
+			(const struct reg_db_platform *)
+			((const char *)db->data + header->platforms) + i;
+		const char *name = db_string(db, q->name);
+
+		if (name && strcmp(name, platform) == 0) {
+			p = q;
+			break;
+		}
+	}
+
+	if (!p)
+		return -ENOENT;
+
+	if (!db_platform_ok(db, p))
+		return -EINVAL;
+
+	rs = calloc(p->nregs + 1, sizeof(*rs));
+	ri = calloc(1, sizeof(*ri));
+	if (ri) {
+		ri->by_addr = calloc(p->nregs + 1, sizeof(*ri->by_addr));
+		ri->by_name = calloc(p->nnamed + 1, sizeof(*ri->by_name));
+	}
+	if (!rs || !ri || !ri->by_addr || !ri->by_name) {
+		intel_reg_index_free(ri);
+		free(rs);
+		return -ENOMEM;
+	}
+
+	r = (const struct reg_db_reg *)((const char *)db->data + p->regs);
+	for (i = 0; i < p->nregs; i++) {
+		rs[i].port_desc = *port_desc_by_port(r[i].port);
+		rs[i].mmio_offset = r[i].mmio_offset;
+		rs[i].addr = r[i].addr;
+		if (r[i].name != REG_DB_NO_NAME)
+			rs[i].name = (char *)db_string(db, r[i].name);
+	}
+
+	idx = (const uint32_t *)((const char *)db->data + p->by_addr);
+	for (i = 0; i < p->nregs; i++) {
+		struct reg_index_entry *e = &ri->by_addr[ri->naddr++];
+
+		e->reg = &rs[idx[i]];
+		e->order = idx[i];
+		e->addr = e->reg->addr + e->reg->mmio_offset;
+	}
+
+	idx = (const uint32_t *)((const char *)db->data + p->by_name);
+	for (i = 0; i < p->nnamed; i++) {
+		struct reg_index_entry *e = &ri->by_name[ri->nname++];
+
+		e->reg = &rs[idx[i]];
+		e->order = idx[i];
+		e->addr = e->reg->addr + e->reg->mmio_offset;
+	}
+
+	*regs = rs;
+	*index = ri;
+
+	return p->nregs;
+}
+
+void intel_reg_db_close(struct reg_db *db)
+{
+	if (!db)
+		return;
+
+	munmap((void *)db->data, db->size);
+	free(db);
+}
+
 void intel_reg_spec_print_ports(void)
 {
 	int i;
@@ -67,10 +67,27 @@ static inline void *recalloc(void *ptr, size_t nmemb, size_t size)
 	return realloc(ptr, nmemb * size);
 }
 
+struct reg_index;
+struct reg_db;
+
 int parse_port_desc(struct reg *reg, const char *s);
 ssize_t intel_reg_spec_builtin(struct reg **regs, uint32_t devid);
 ssize_t intel_reg_spec_file(struct reg **regs, const char *filename);
 void intel_reg_spec_free(struct reg *regs, size_t n);
+struct reg_index *intel_reg_index_create(const struct reg *regs, size_t n);
+const struct reg *intel_reg_index_find_addr(const struct reg_index *index,
+					    enum port_addr port, uint32_t addr);
+const struct reg *intel_reg_index_find_name(const struct reg_index *index,
+					    enum port_addr port,
+					    const char *name);
+void intel_reg_index_free(struct reg_index *index);
+int intel_reg_db_write(const char *filename, const char * const *platforms,
+		       struct reg * const *regs, const ssize_t *nregs,
+		       int nplatforms);
+struct reg_db *intel_reg_db_open(const char *filename);
+ssize_t intel_reg_db_spec(const struct reg_db *db, const char *platform,
+			  struct reg **regs, struct reg_index **index);
+void intel_reg_db_close(struct reg_db *db);
 int intel_reg_spec_decode(char *buf, size_t bufsize, const struct reg *reg,
 			  uint32_t val, uint32_t devid);
 void intel_reg_spec_print_ports(void);
@@ -0,0 +1,155 @@
+/*
+ * Copyright © 2017 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Decode and diff synthetic MMIO snapshots with intel_reg, which needs no
+ * GPU given --devid, against a small register spec of our own.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "igt.h"
+
+static const char spec[] =
+	"('TEST_A', '0x00000000', '')\n"
+	"('TEST_B', '0x00000004', '')\n"
+	"('TEST_C', '0x00000010', '')\n";
+
+/* TEST_C lies past the end of the old snapshot */
+static const uint32_t old_regs[] = { 0x11111111, 0x22222222 };
+static const uint32_t new_regs[] = { 0x11111111, 0x33333333, 0, 0, 0x44444444 };
+
+static char spec_path[64], old_path[64], new_path[64];
+
+static void write_file(char *path, const void *data, size_t len)
+{
+	FILE *f;
+	int fd;
+
+	strcpy(path, "/tmp/intel_reg.XXXXXX");
+	fd = mkstemp(path);
+	igt_assert_lte(0, fd);
+	f = fdopen(fd, "w");
+	igt_assert(f);
+
+	fwrite(data, len, 1, f);
+	fclose(f);
+}
+
+/* Run intel_reg with the spec, and return what it printed */
+static char *run(const char *args)
+{
+	char *out = igt_capture_output("./intel_reg --devid=0x0412 --spec=%s %s",
+				       spec_path, args);
+
+	igt_assert_f(out, "intel_reg %s failed\n", args);
+	return out;
+}
+
+/* The line intel_reg prints for an MMIO register without decode */
+static const char *reg_line(const char *prefix, const char *name,
+			    uint32_t addr, uint32_t val)
+{
+	static char buf[256];
+
+	snprintf(buf, sizeof(buf), "%s%35s (0x%08x): 0x%08x\n",
+		 prefix, name, addr, val);
+	return buf;
+}
+
+static int count(const char *out, const char *str)
+{
+	int n = 0;
+
+	while ((out = strstr(out, str))) {
+		out += strlen(str);
+		n++;
+	}
+
+	return n;
+}
+
+static void test_decode(void)
+{
+	char args[256];
+	char *out;
+
+	snprintf(args, sizeof(args), "snapshot-decode %s", old_path);
+	out = run(args);
+
+	igt_assert(strstr(out, reg_line("", "TEST_A", 0x0, 0x11111111)));
+	igt_assert(strstr(out, reg_line("", "TEST_B", 0x4, 0x22222222)));
+	igt_assert(!strstr(out, "TEST_C"));
+
+	free(out);
+}
+
+static void test_diff(void)
+{
+	char args[256];
+	char *out;
+
+	snprintf(args, sizeof(args), "snapshot-diff %s %s",
+		 old_path, new_path);
+	out = run(args);
+
+	igt_assert(!strstr(out, "TEST_A"));
+	igt_assert(strstr(out, reg_line("-", "TEST_B", 0x4, 0x22222222)));
+	igt_assert(strstr(out, reg_line("+", "TEST_B", 0x4, 0x33333333)));
+	igt_assert(strstr(out, reg_line("+", "TEST_C", 0x10, 0x44444444)));
+	igt_assert_eq(count(out, "TEST_C"), 1);
+	free(out);
+
+	/* and the other way around */
+	snprintf(args, sizeof(args), "snapshot-diff %s %s",
+		 new_path, old_path);
+	out = run(args);
+
+	igt_assert(strstr(out, reg_line("-", "TEST_C", 0x10, 0x44444444)));
+	igt_assert_eq(count(out, "TEST_C"), 1);
+	free(out);
+}
+
+igt_main
+{
+	igt_fixture {
+		write_file(spec_path, spec, strlen(spec));
+		write_file(old_path, old_regs, sizeof(old_regs));
+		write_file(new_path, new_regs, sizeof(new_regs));
+	}
+
+	igt_subtest("snapshot-decode")
+		test_decode();
+
+	igt_subtest("snapshot-diff")
+		test_diff();
+
+	igt_fixture {
+		unlink(spec_path);
+		unlink(old_path);
+		unlink(new_path);
+	}
+}